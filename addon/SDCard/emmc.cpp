@@ -46,6 +46,7 @@
 	#include <circle/machineinfo.h>
 	#include <circle/memio.h>
 	#include <circle/sched/scheduler.h>
+	#include <circle/devicetreeblob.h>
 #else
 	#include "mmc.h"
 	#include "mmcerror.h"
@@ -86,6 +87,10 @@
 // Requires 150 mA power so disabled on the RPi for now
 #define SDXC_MAXIMUM_PERFORMANCE
 
+#ifdef USE_SDHOST
+	#undef EMMC_USE_ADMA		// not available with the SDHOST driver
+#endif
+
 #ifndef USE_SDHOST
 
 // Enable card interrupts
@@ -95,12 +100,32 @@
 // Required for QEMU
 #define EMMC_ALLOW_OLD_SDHCI
 
+// Define EMMC_USE_ADMA to transfer the data with the ADMA2 engine of the
+// controller (HCSS 1.13), if it is supported and the buffer is suitable,
+// otherwise the CPU transfers it. This is experimental and disabled by default.
+// It has not been validated with QEMU (raspi3b, NO_SDHOST) or on hardware yet.
+//#define EMMC_USE_ADMA
+
+// Wait for the completion of an ADMA2 transfer with the IRQ. The EMMC2
+// controller of the Raspberry Pi 4 shares its IRQ line with the Arasan
+// controller, which is used by the WLAN driver, so that the interrupt status
+// is polled there by default. Define EMMC_ADMA_IRQ, if WLAN is not used.
+#if defined (EMMC_USE_ADMA) && RASPPI != 4 && !defined (EMMC_ADMA_IRQ)
+	#define EMMC_ADMA_IRQ
+#endif
+
 #if RASPPI != 4
 	#define EMMC_BASE	ARM_EMMC_BASE
 #else
 	#define EMMC_BASE	ARM_EMMC2_BASE
 #endif
 
+#if RASPPI <= 4
+	#define EMMC_IRQ	ARM_IRQ_ARASANSDIO
+#else
+	#define EMMC_IRQ	ARM_IRQ_SDIO1
+#endif
+
 #define EMMC_ARG2		(EMMC_BASE + 0x00)
 #define EMMC_BLKSIZECNT		(EMMC_BASE + 0x04)
 #define EMMC_ARG1		(EMMC_BASE + 0x08)
@@ -120,6 +145,8 @@
 #define EMMC_CAPABILITIES_0	(EMMC_BASE + 0x40)
 #define EMMC_CAPABILITIES_1	(EMMC_BASE + 0x44)
 #define EMMC_FORCE_IRPT		(EMMC_BASE + 0x50)
+#define EMMC_ADMA_ERR_STAT	(EMMC_BASE + 0x54)
+#define EMMC_ADMA_SYS_ADDR	(EMMC_BASE + 0x58)
 #define EMMC_BOOT_TIMEOUT	(EMMC_BASE + 0x70)
 #define EMMC_DBG_SEL		(EMMC_BASE + 0x74)
 #define EMMC_EXRDFIFO_CFG	(EMMC_BASE + 0x80)
@@ -191,6 +218,30 @@
 #define SD_CARD_INSERTION       (1 << 6)
 #define SD_CARD_REMOVAL         (1 << 7)
 #define SD_CARD_INTERRUPT       (1 << 8)
+#define SD_ERROR_INTERRUPT      (1 << 15)
+
+// Host Control 1 register (in CONTROL0)
+#define SD_DMA_SELECT_MASK	(3 << 3)
+#define SD_DMA_SELECT_ADMA2	(2 << 3)	// 32-bit address
+
+// CAPABILITIES_0 register
+#define SD_CAPS_ADMA2		(1 << 19)
+
+struct TADMA2Descriptor		// HCSS 1.13.4, 32-bit address
+{
+	u16	Attributes;
+#define ADMA2_VALID		(1 << 0)
+#define ADMA2_END		(1 << 1)
+#define ADMA2_INT		(1 << 2)
+#define ADMA2_ACT_TRAN		(2 << 4)
+	u16	Length;			// in bytes
+	u32	Address;		// must be 32-bit aligned
+}
+PACKED;
+
+#define ADMA2_MAX_LENGTH	0x8000		// per descriptor
+#define ADMA2_DESCRIPTORS	128
+#define ADMA2_MAX_TRANSFER	(ADMA2_MAX_LENGTH * ADMA2_DESCRIPTORS)	// 4 MByte per command
 
 #endif
 
@@ -481,6 +532,7 @@ CEMMCDevice::CEMMCDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer, CA
 	m_pTimer (pTimer),
 	m_pActLED (pActLED),
 	m_ullOffset (0),
+	m_RequestQueue (TransferHandler, this),
 	m_pPartitionManager (0),
 #ifdef USE_SDHOST
 	m_Host (pInterruptSystem, pTimer),
@@ -489,6 +541,15 @@ CEMMCDevice::CEMMCDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer, CA
 #endif
 	m_capacity ((u64) -1),
 	m_pSCR (0)
+#ifndef USE_SDHOST
+	,
+	m_adma_supported (FALSE),
+	m_use_adma (FALSE),
+	m_pADMATable (0),
+	m_adma_table_bus (0),
+	m_adma_irq_connected (FALSE),
+	m_adma_irpts (0)
+#endif
 {
 	assert (m_pInterruptSystem != 0);
 	assert (m_pTimer != 0);
@@ -520,8 +581,22 @@ CEMMCDevice::CEMMCDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer, CA
 
 CEMMCDevice::~CEMMCDevice (void)
 {
+	m_RequestQueue.Flush ();
+
 #ifdef USE_SDHOST
 	m_Host.Reset ();
+#else
+	if (m_adma_irq_connected)
+	{
+		write32 (EMMC_IRPT_EN, 0);
+
+		assert (m_pInterruptSystem != 0);
+		m_pInterruptSystem->DisconnectIRQ (EMMC_IRQ);
+		m_adma_irq_connected = FALSE;
+	}
+
+	delete [] m_pADMATable;
+	m_pADMATable = 0;
 #endif
 
 	delete m_pSCR;
@@ -585,48 +660,58 @@ boolean CEMMCDevice::Initialize (void)
 
 int CEMMCDevice::Read (void *pBuffer, size_t nCount)
 {
-	if (m_ullOffset % SD_BLOCK_SIZE != 0)
-	{
-		return -1;
-	}
-	u32 nBlock = m_ullOffset / SD_BLOCK_SIZE;
-
-	if (m_pActLED != 0)
-	{
-		m_pActLED->On ();
-	}
+	m_RequestQueue.Flush ();
 
-	PeripheralEntry ();
+	return Transfer (FALSE, pBuffer, nCount, m_ullOffset);
+}
 
-	if (DoRead ((u8 *) pBuffer, nCount, nBlock) != (int) nCount)
-	{
-		PeripheralExit ();
+int CEMMCDevice::Write (const void *pBuffer, size_t nCount)
+{
+	m_RequestQueue.Flush ();
 
-		if (m_pActLED != 0)
-		{
-			m_pActLED->Off ();
-		}
+	return Transfer (TRUE, (void *) pBuffer, nCount, m_ullOffset);
+}
 
-		return -1;
-	}
+u64 CEMMCDevice::Seek (u64 ullOffset)
+{
+	m_ullOffset = ullOffset;
+	
+	return m_ullOffset;
+}
 
-	PeripheralExit ();
+u64 CEMMCDevice::GetSize (void) const
+{
+	return m_capacity;
+}
 
-	if (m_pActLED != 0)
+boolean CEMMCDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullOffset = pRequest->GetDeviceOffset ();
+	if (   ullOffset % SD_BLOCK_SIZE != 0
+	    || pRequest->GetCount () % SD_BLOCK_SIZE != 0
+	    || ullOffset + pRequest->GetCount () > m_capacity)
 	{
-		m_pActLED->Off ();
+		return FALSE;
 	}
 
-	return nCount;
+	m_RequestQueue.Submit (pRequest);
+
+	return TRUE;
 }
 
-int CEMMCDevice::Write (const void *pBuffer, size_t nCount)
+boolean CEMMCDevice::FlushRequests (void)
+{
+	return m_RequestQueue.Flush ();
+}
+
+int CEMMCDevice::Transfer (boolean bWrite, void *pBuffer, size_t nCount, u64 ullOffset)
 {
-	if (m_ullOffset % SD_BLOCK_SIZE != 0)
+	if (ullOffset % SD_BLOCK_SIZE != 0)
 	{
 		return -1;
 	}
-	u32 nBlock = m_ullOffset / SD_BLOCK_SIZE;
+	u32 nBlock = ullOffset / SD_BLOCK_SIZE;
 
 	if (m_pActLED != 0)
 	{
@@ -635,17 +720,8 @@ int CEMMCDevice::Write (const void *pBuffer, size_t nCount)
 
 	PeripheralEntry ();
 
-	if (DoWrite ((u8 *) pBuffer, nCount, nBlock) != (int) nCount)
-	{
-		PeripheralExit ();
-
-		if (m_pActLED != 0)
-		{
-			m_pActLED->Off ();
-		}
-
-		return -1;
-	}
+	int nResult = bWrite ? DoWrite ((u8 *) pBuffer, nCount, nBlock)
+			     : DoRead ((u8 *) pBuffer, nCount, nBlock);
 
 	PeripheralExit ();
 
@@ -654,19 +730,21 @@ int CEMMCDevice::Write (const void *pBuffer, size_t nCount)
 		m_pActLED->Off ();
 	}
 
+	if (nResult != (int) nCount)
+	{
+		return -1;
+	}
+
 	return nCount;
 }
 
-u64 CEMMCDevice::Seek (u64 ullOffset)
+int CEMMCDevice::TransferHandler (boolean bWrite, void *pBuffer, size_t nCount,
+				  u64 ullOffset, void *pParam)
 {
-	m_ullOffset = ullOffset;
-	
-	return m_ullOffset;
-}
+	CEMMCDevice *pThis = (CEMMCDevice *) pParam;
+	assert (pThis != 0);
 
-u64 CEMMCDevice::GetSize (void) const
-{
-	return m_capacity;
+	return pThis->Transfer (bWrite, pBuffer, nCount, ullOffset);
 }
 
 #ifndef USE_SDHOST
@@ -923,6 +1001,16 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 	u32 blksizecnt = m_block_size | (m_blocks_to_transfer << 16);
 	write32 (EMMC_BLKSIZECNT, blksizecnt);
 
+#ifdef EMMC_USE_ADMA
+	// The descriptor table has been set up by DoDataCommand()
+	boolean use_adma = m_use_adma && (cmd_reg & SD_CMD_ISDATA);
+	if (use_adma)
+	{
+		write32 (EMMC_ADMA_SYS_ADDR, m_adma_table_bus);
+		cmd_reg |= SD_CMD_DMA;
+	}
+#endif
+
 	// Set argument 1 reg
 	write32 (EMMC_ARG1, argument);
 
@@ -968,6 +1056,21 @@ void CEMMCDevice::IssueCommandInt (u32 cmd_reg, u32 argument, int timeout)
 		break;
 	}
 
+#ifdef EMMC_USE_ADMA
+	if (use_adma)
+	{
+		// The data is transferred by the controller, we only wait for transfer complete
+		if (WaitADMAComplete (timeout) < 0)
+		{
+			return;
+		}
+
+		m_last_cmd_success = 1;
+
+		return;
+	}
+#endif
+
 	// If with data, wait for the appropriate interrupt
 	if (cmd_reg & SD_CMD_ISDATA)
 	{
@@ -2227,6 +2330,17 @@ int CEMMCDevice::CardReset (void)
 #ifndef USE_SDHOST
 	// Reset interrupt register
 	write32 (EMMC_INTERRUPT, 0xffffffff);
+
+#ifdef EMMC_USE_ADMA
+	if (m_adma_supported)
+	{
+		// The controller reset has cleared the DMA select field
+		u32 host_control = read32 (EMMC_CONTROL0);
+		host_control &= ~SD_DMA_SELECT_MASK;
+		host_control |= SD_DMA_SELECT_ADMA2;
+		write32 (EMMC_CONTROL0, host_control);
+	}
+#endif
 #endif
 
 	return 0;
@@ -2269,6 +2383,10 @@ int CEMMCDevice::CardInit (void)
 #endif
 	}
 
+#ifdef EMMC_USE_ADMA
+	InitADMA ();
+#endif
+
 #endif	// #ifndef USE_SDHOST
 
 	// The SEND_SCR command may fail with a DATA_TIMEOUT on the Raspberry Pi 4
@@ -2386,6 +2504,81 @@ int CEMMCDevice::EnsureDataMode (void)
 }
 
 int CEMMCDevice::DoDataCommand (int is_write, u8 *buf, size_t buf_size, u32 block_no)
+{
+#ifdef EMMC_USE_ADMA
+	if (   m_adma_supported
+	    && buf_size >= m_block_size
+	    && buf_size % m_block_size == 0)
+	{
+		// Transfers, which exceed the descriptor table, are split up
+		while (buf_size > 0)
+		{
+			size_t chunk_size = buf_size;
+			if (chunk_size > ADMA2_MAX_TRANSFER)
+			{
+				chunk_size = ADMA2_MAX_TRANSFER;
+			}
+
+			// Falls back to PIO, if the buffer cannot be used for DMA
+			m_use_adma = SetupADMA (buf, chunk_size, is_write);
+
+			int ret = DoDataCommandInt (is_write, buf, chunk_size, block_no);
+
+			if (m_use_adma && !is_write)
+			{
+				// Drop cache lines, which may have been fetched during the transfer
+				CleanAndInvalidateDataCacheRange ((uintptr) buf, chunk_size);
+			}
+
+			m_use_adma = FALSE;
+
+			if (ret < 0)
+			{
+				return ret;
+			}
+
+			buf += chunk_size;
+			buf_size -= chunk_size;
+			block_no += chunk_size / m_block_size;
+		}
+
+		return 0;
+	}
+#endif
+
+#ifdef USE_SDHOST
+	// The SDHOST driver limits the size of a single request
+	size_t max_size = m_Host.GetMMCHost ()->max_req_size;
+	if (   buf_size > max_size
+	    && buf_size % m_block_size == 0)
+	{
+		while (buf_size > 0)
+		{
+			size_t chunk_size = buf_size;
+			if (chunk_size > max_size)
+			{
+				chunk_size = max_size;
+			}
+
+			int ret = DoDataCommandInt (is_write, buf, chunk_size, block_no);
+			if (ret < 0)
+			{
+				return ret;
+			}
+
+			buf += chunk_size;
+			buf_size -= chunk_size;
+			block_no += chunk_size / m_block_size;
+		}
+
+		return 0;
+	}
+#endif
+
+	return DoDataCommandInt (is_write, buf, buf_size, block_no);
+}
+
+int CEMMCDevice::DoDataCommandInt (int is_write, u8 *buf, size_t buf_size, u32 block_no)
 {
 	// PLSS table 4.20 - SDSC cards use byte addresses rather than block addresses
 	if (!m_card_supports_sdhc)
@@ -2519,6 +2712,225 @@ int CEMMCDevice::DoWrite (u8 *buf, size_t buf_size, u32 block_no)
 
 #ifndef USE_SDHOST
 
+#ifdef EMMC_USE_ADMA
+
+// Converts an ARM address range to a 32-bit bus address of the controller
+static boolean GetBusAddress (const TMemoryWindow &rWindow, uintptr nAddress, size_t nSize,
+			      u32 *pBusAddress)
+{
+	if (   nAddress < rWindow.CPUAddress
+	    || nAddress + nSize > rWindow.CPUAddress + rWindow.Size)
+	{
+		return FALSE;
+	}
+
+	u64 nBusAddress = nAddress - rWindow.CPUAddress + rWindow.BusAddress;
+	if (nBusAddress + nSize > 0x100000000ULL)
+	{
+		return FALSE;
+	}
+
+	assert (pBusAddress != 0);
+	*pBusAddress = (u32) nBusAddress;
+
+	return TRUE;
+}
+
+void CEMMCDevice::InitADMA (void)
+{
+	if (!(read32 (EMMC_CAPABILITIES_0) & SD_CAPS_ADMA2))
+	{
+		LogWrite (LogNotice, "ADMA2 is not supported");
+
+		return;
+	}
+
+	// Get the window of ARM memory, which can be accessed by the controller
+#if RASPPI <= 3
+	m_DMAWindow.CPUAddress = 0;
+	m_DMAWindow.BusAddress = GPU_MEM_BASE;
+	m_DMAWindow.Size = 0x40000000;
+#elif RASPPI == 4
+	// 1 GByte at bus address 0xC0000000 on the BCM2711B0, the firmware
+	// updates the dma-ranges of the emmc2bus for later SoC steppings
+	m_DMAWindow.CPUAddress = 0;
+	m_DMAWindow.BusAddress = 0xC0000000;
+	m_DMAWindow.Size = 0x40000000;
+
+	const CDeviceTreeBlob *pDTB = CMachineInfo::Get ()->GetDTB ();
+	if (pDTB != 0)
+	{
+		const TDeviceTreeNode *pBus = pDTB->FindNode ("/emmc2bus");
+		if (pBus != 0)
+		{
+			const TDeviceTreeProperty *pDMA = pDTB->FindProperty (pBus, "dma-ranges");
+			if (   pDMA != 0
+			    && pDTB->GetPropertyValueLength (pDMA) == sizeof (u32)*5)
+			{
+				m_DMAWindow.BusAddress = (u64) pDTB->GetPropertyValueWord (pDMA, 0) << 32
+							 | pDTB->GetPropertyValueWord (pDMA, 1);
+				m_DMAWindow.CPUAddress = (u64) pDTB->GetPropertyValueWord (pDMA, 2) << 32
+							 | pDTB->GetPropertyValueWord (pDMA, 3);
+				m_DMAWindow.Size = pDTB->GetPropertyValueWord (pDMA, 4);
+			}
+		}
+	}
+#else
+	m_DMAWindow.CPUAddress = 0;
+	m_DMAWindow.BusAddress = 0;
+	m_DMAWindow.Size = 0x100000000ULL;
+#endif
+
+	// Heap blocks are cache-line aligned
+	assert (m_pADMATable == 0);
+	m_pADMATable = new TADMA2Descriptor[ADMA2_DESCRIPTORS];
+	if (   m_pADMATable == 0
+	    || !GetBusAddress (m_DMAWindow, (uintptr) m_pADMATable,
+			       sizeof (TADMA2Descriptor) * ADMA2_DESCRIPTORS, &m_adma_table_bus))
+	{
+		LogWrite (LogWarning, "Cannot allocate ADMA2 descriptor table");
+
+		delete [] m_pADMATable;
+		m_pADMATable = 0;
+
+		return;
+	}
+
+#ifdef EMMC_ADMA_IRQ
+	assert (m_pInterruptSystem != 0);
+	m_pInterruptSystem->ConnectIRQ (EMMC_IRQ, ADMAInterruptStub, this);
+	m_adma_irq_connected = TRUE;
+#endif
+
+	m_adma_supported = TRUE;
+
+#ifdef EMMC_DEBUG
+	LogWrite (LogDebug, "Using ADMA2");
+#endif
+}
+
+boolean CEMMCDevice::SetupADMA (const void *buf, size_t buf_size, int is_write)
+{
+	assert (m_pADMATable != 0);
+	assert (buf_size > 0);
+	assert (buf_size <= ADMA2_MAX_TRANSFER);
+
+	// The data address must be 32-bit aligned. A buffer, which is read into, must
+	// occupy whole cache lines, because other data in these lines would be lost,
+	// when the cache is invalidated.
+	uintptr nAddress = (uintptr) buf;
+	u32 nBusAddress;
+	if (   (nAddress & 3)
+	    || (!is_write && !IS_CACHE_ALIGNED (buf, buf_size))
+	    || !GetBusAddress (m_DMAWindow, nAddress, buf_size, &nBusAddress))
+	{
+		return FALSE;
+	}
+
+	CleanAndInvalidateDataCacheRange (nAddress, buf_size);
+
+	unsigned i = 0;
+	while (buf_size > 0)
+	{
+		assert (i < ADMA2_DESCRIPTORS);
+		size_t nLength = buf_size < ADMA2_MAX_LENGTH ? buf_size : ADMA2_MAX_LENGTH;
+
+		m_pADMATable[i].Attributes = ADMA2_VALID | ADMA2_ACT_TRAN;
+		m_pADMATable[i].Length = (u16) nLength;
+		m_pADMATable[i].Address = nBusAddress;
+
+		nBusAddress += nLength;
+		buf_size -= nLength;
+		i++;
+	}
+
+	assert (i > 0);
+	m_pADMATable[i-1].Attributes |= ADMA2_END;
+
+	CleanAndInvalidateDataCacheRange ((uintptr) m_pADMATable, sizeof (TADMA2Descriptor) * i);
+
+	return TRUE;
+}
+
+int CEMMCDevice::WaitADMAComplete (unsigned usec)
+{
+	u32 irpts;
+
+#ifdef EMMC_ADMA_IRQ
+	// The interrupt handler disables the interrupt signal again
+	m_adma_irpts = 0;
+	write32 (EMMC_IRPT_EN, SD_TRANSFER_COMPLETE | 0xffff0000);
+
+	assert (m_pTimer != 0);
+	unsigned nStartTicks = m_pTimer->GetClockTicks ();
+	unsigned nTimeoutTicks = usec * (CLOCKHZ / 1000000);
+
+	while (m_adma_irpts == 0)
+	{
+		if (m_pTimer->GetClockTicks () - nStartTicks >= nTimeoutTicks)
+		{
+			write32 (EMMC_IRPT_EN, 0);
+
+			break;
+		}
+
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+	}
+
+	irpts = m_adma_irpts;
+#else
+	TimeoutWait (EMMC_INTERRUPT, SD_TRANSFER_COMPLETE | SD_ERROR_INTERRUPT, 1, usec);
+	irpts = read32 (EMMC_INTERRUPT);
+#endif
+
+	write32 (EMMC_INTERRUPT, 0xffff0000 | SD_TRANSFER_COMPLETE | SD_DMA_INTERRUPT);
+
+	// Transfer complete overrides data timeout: HCSS 2.2.17
+	if (   ((irpts & 0xffff0002) != 2)
+	    && ((irpts & 0xffff0002) != 0x100002))
+	{
+#ifdef EMMC_DEBUG
+		LogWrite (LogWarning, "Error occured during ADMA2 transfer (intr %08x, adma %x)",
+			  irpts, read32 (EMMC_ADMA_ERR_STAT));
+#endif
+		m_last_error = irpts & 0xffff0000;
+		m_last_interrupt = irpts;
+
+		// The DMA engine has stopped and must be reset
+		ResetDat ();
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void CEMMCDevice::ADMAInterruptHandler (void)
+{
+	u32 irpts = read32 (EMMC_INTERRUPT);
+	if (!(irpts & (SD_TRANSFER_COMPLETE | SD_ERROR_INTERRUPT)))
+	{
+		return;
+	}
+
+	// The status is cleared by the waiting task
+	write32 (EMMC_IRPT_EN, 0);
+
+	m_adma_irpts = irpts;
+}
+
+void CEMMCDevice::ADMAInterruptStub (void *pParam)
+{
+	CEMMCDevice *pThis = (CEMMCDevice *) pParam;
+	assert (pThis != 0);
+
+	pThis->ADMAInterruptHandler ();
+}
+
+#endif
+
 int CEMMCDevice::TimeoutWait (unsigned long reg, unsigned mask, int value, unsigned usec)
 {
 	assert (m_pTimer != 0);
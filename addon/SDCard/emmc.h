@@ -30,18 +30,22 @@
 #define _SDCard_emmc_h
 
 #include <circle/device.h>
+#include <circle/blockrequestqueue.h>
 #include <circle/interrupt.h>
 #include <circle/timer.h>
 #include <circle/actled.h>
 #include <circle/gpiopin.h>
 #include <circle/fs/partitionmanager.h>
 #include <circle/logger.h>
+#include <circle/machineinfo.h>
 #include <circle/types.h>
 #include <circle/sysconfig.h>
 #ifdef USE_SDHOST
 	#include <SDCard/sdhost.h>
 #endif
 
+struct TADMA2Descriptor;
+
 struct TSCR			// SD configuration register
 {
 	u32	scr[2];
@@ -66,9 +70,16 @@ public:
 
 	u64 GetSize (void) const;
 
+	boolean SubmitRequest (CBlockRequest *pRequest);
+	boolean FlushRequests (void);
+
 	const u32 *GetID (void);
 
 private:
+	int Transfer (boolean bWrite, void *pBuffer, size_t nCount, u64 ullOffset);
+	static int TransferHandler (boolean bWrite, void *pBuffer, size_t nCount,
+				    u64 ullOffset, void *pParam);
+
 #ifndef USE_SDHOST
 	int PowerOn (void);
 	void PowerOff (void);
@@ -79,6 +90,12 @@ private:
 
 	int ResetCmd (void);
 	int ResetDat (void);
+
+	void InitADMA (void);
+	boolean SetupADMA (const void *buf, size_t buf_size, int is_write);
+	int WaitADMAComplete (unsigned usec);
+	void ADMAInterruptHandler (void);
+	static void ADMAInterruptStub (void *pParam);
 #endif
 
 	void IssueCommandInt (u32 cmd_reg, u32 argument, int timeout);
@@ -97,6 +114,7 @@ private:
 
 	int EnsureDataMode (void);
 	int DoDataCommand (int is_write, u8 *buf, size_t buf_size, u32 block_no);
+	int DoDataCommandInt (int is_write, u8 *buf, size_t buf_size, u32 block_no);
 	int DoRead (u8 *buf, size_t buf_size, u32 block_no);
 	int DoWrite (u8 *buf, size_t buf_size, u32 block_no);
 
@@ -122,6 +140,8 @@ private:
 
 	u64 m_ullOffset;
 
+	CBlockRequestQueue m_RequestQueue;
+
 	CPartitionManager *m_pPartitionManager;
 
 #ifdef USE_SDHOST
@@ -165,6 +185,14 @@ private:
 #ifndef USE_SDHOST
 	int m_card_removal;
 	u32 m_base_clock;
+
+	boolean m_adma_supported;
+	boolean m_use_adma;		// for the next data command
+	TADMA2Descriptor *m_pADMATable;
+	u32 m_adma_table_bus;		// bus address of m_pADMATable
+	TMemoryWindow m_DMAWindow;	// memory, which can be accessed by the controller
+	boolean m_adma_irq_connected;
+	volatile u32 m_adma_irpts;	// set by the interrupt handler
 #endif
 
 	static const char *sd_versions[];
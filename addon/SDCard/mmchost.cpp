@@ -23,6 +23,7 @@
 #include "mmchost.h"
 #include "mmcerror.h"
 #include <circle/synchronize.h>
+#include <circle/sched/scheduler.h>
 #include <circle/util.h>
 #include <assert.h>
 
@@ -109,11 +110,16 @@ void CMMCHost::RequestSync (mmc_request *pRequest)
 
 	Request (pRequest);
 
-	do
+	// Data transfers are completed from interrupt context
+	DataMemBarrier ();
+	while (!pRequest->done)
 	{
+#ifdef NO_BUSY_WAIT
+		CScheduler::Get ()->Yield ();
+#endif
+
 		DataMemBarrier ();
 	}
-	while (!pRequest->done);
 }
 
 int CMMCHost::PrepareRequest (mmc_request *pRequest)
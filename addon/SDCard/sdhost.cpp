@@ -45,12 +45,20 @@
 
 #define SDHOST_DEBUG		0
 
+// Define SDHOST_USE_DMA to drive multi-block data transfers by the platform DMA
+// controller, which is paced by the SDHOST DREQ, so that the CPU does not need to
+// poll the FIFO. Otherwise PIO is used for all transfers. This is experimental
+// and has not been validated with test/storage yet.
+//#define SDHOST_USE_DMA
+
 #define FIFO_READ_THRESHOLD     4
 #define FIFO_WRITE_THRESHOLD    4
 #define ALLOW_CMD23_READ        0
 #define ALLOW_CMD23_WRITE       0
 #define SDDATA_FIFO_PIO_BURST   8
 #define CMD_DALLY_US            1
+#define PIO_LIMIT		1	/* Use PIO for up to this number of blocks */
+#define DMA_TIMEOUT_MS		1000
 
 #define DRIVER_NAME "sdhost-bcm2835"
 
@@ -179,7 +187,8 @@ static const char From[] = "sdhost";
 
 CSDHOSTDevice::CSDHOSTDevice (CInterruptSystem *pInterruptSystem, CTimer *pTimer)
 :	m_pInterruptSystem (pInterruptSystem),
-	m_pTimer (pTimer)
+	m_pTimer (pTimer),
+	m_pDMAChannel (0)
 {
 	for (unsigned i = 0; i <= 5; i++)
 	{
@@ -200,6 +209,9 @@ CSDHOSTDevice::~CSDHOSTDevice (void)
 
 	PeripheralExit ();
 
+	delete m_pDMAChannel;
+	m_pDMAChannel = 0;
+
 	m_pTimer = 0;
 	m_pInterruptSystem = 0;
 }
@@ -579,12 +591,18 @@ void CSDHOSTDevice::transfer_pio (void)
 {
 	BUG_ON(!host->data);
 
-	boolean is_read = (host->data->flags & MMC_DATA_READ) != 0;
-	if (is_read)
+	if (host->data->flags & MMC_DATA_READ)
 		read_block_pio();
 	else
 		write_block_pio();
 
+	check_transfer_status();
+}
+
+void CSDHOSTDevice::check_transfer_status (void)
+{
+	boolean is_read = (host->data->flags & MMC_DATA_READ) != 0;
+
 	u32 sdhsts = read(SDHSTS);
 	if (sdhsts & (SDHSTS_CRC16_ERROR |
 		      SDHSTS_CRC7_ERROR |
@@ -604,11 +622,169 @@ void CSDHOSTDevice::transfer_pio (void)
 	}
 }
 
+void CSDHOSTDevice::prepare_dma (mmc_data *data)
+{
+	BUG_ON(host->use_dma);
+
+	size_t len = data->blksz * data->blocks;
+	u8 *buf = (u8 *) data->sg;
+
+	/* The DMA controller transfers words. A buffer, which is read
+	   into, must not share cache lines with other data, because
+	   they are invalidated after the transfer. */
+	if (((uintptr) buf & 3) ||
+	    ((data->flags & MMC_DATA_READ) && !IS_CACHE_ALIGNED(buf, len)))
+		return;
+
+	if (data->flags & MMC_DATA_READ) {
+		/* The block doesn't manage the FIFO DREQs properly for
+		 * multi-block transfers, so don't attempt to DMA the final
+		 * few words. They are drained by PIO, when the DMA
+		 * transfer has completed.
+		 */
+		size_t drain = min((FIFO_READ_THRESHOLD - 1) * 4, len);
+		if (drain >= len)
+			return;
+		len -= drain;
+
+		host->drain_buf = (u32 *)(buf + len);
+		host->drain_words = drain/4;
+
+		m_pDMAChannel->SetupIORead(buf, ARM_SDHOST_BASE + SDDATA, len,
+					   DREQSourceSDHOST);
+	} else {
+		host->drain_buf = 0;
+		host->drain_words = 0;
+
+		m_pDMAChannel->SetupIOWrite(ARM_SDHOST_BASE + SDDATA, buf, len,
+					    DREQSourceSDHOST);
+	}
+
+	host->use_dma = 1;
+}
+
+void CSDHOSTDevice::start_dma (void)
+{
+	BUG_ON(!host->use_dma);
+
+	m_pDMAChannel->SetCompletionRoutine(dma_complete_stub, this);
+	m_pDMAChannel->Start();
+
+	BUG_ON(host->dma_timer);
+	host->dma_timer = m_pTimer->StartKernelTimer(MSEC2HZ(DMA_TIMEOUT_MS),
+						     dma_timeout_stub, this);
+}
+
+void CSDHOSTDevice::stop_dma (void)
+{
+	if (host->dma_timer) {
+		m_pTimer->CancelKernelTimer(host->dma_timer);
+		host->dma_timer = 0;
+	}
+
+	if (host->use_dma) {
+		m_pDMAChannel->Cancel();
+		host->use_dma = 0;
+	}
+}
+
+void CSDHOSTDevice::dma_complete (boolean status)
+{
+	m_SpinLock.Acquire ();
+
+	/* The transfer may have been cancelled in the meantime */
+	if (!host->data || !host->use_dma) {
+		m_SpinLock.Release ();
+		return;
+	}
+
+	if (host->dma_timer) {
+		m_pTimer->CancelKernelTimer(host->dma_timer);
+		host->dma_timer = 0;
+	}
+
+	host->use_dma = 0;
+
+	if (!status) {
+		pr_err("%s: DMA transfer failed", mmc_hostname(host->mmc));
+		host->data->error = -EILSEQ;
+	}
+
+	/* Drain the FIFO */
+	unsigned start = m_pTimer->GetClockTicks();
+	while (host->drain_words && !host->data->error) {
+		u32 edm = read(SDEDM);
+		if ((edm >> 4) & 0x1f) {
+			*(host->drain_buf++) = read(SDDATA);
+			host->drain_words--;
+		} else if (m_pTimer->GetClockTicks() - start > host->pio_timeout) {
+			pr_err("%s: FIFO drain timeout - EDM %x",
+			       mmc_hostname(host->mmc), edm);
+			host->data->error = -ETIMEDOUT;
+		}
+	}
+
+	if (!host->data->error)
+		check_transfer_status();
+
+	finish_data();
+
+	mmiowb();
+
+	m_SpinLock.Release ();
+}
+
+void CSDHOSTDevice::dma_complete_stub (unsigned channel, unsigned buffer, boolean status,
+				       void *param)
+{
+	CSDHOSTDevice *pThis = (CSDHOSTDevice *) param;
+	assert (pThis != 0);
+
+	pThis->dma_complete (status);
+}
+
+void CSDHOSTDevice::dma_timeout (void)
+{
+	m_SpinLock.Acquire ();
+
+	host->dma_timer = 0;
+
+	if (host->mrq && host->data && host->use_dma) {
+		pr_err("%s: timeout waiting for DMA transfer",
+		       mmc_hostname(host->mmc));
+		dumpregs();
+
+		stop_dma();
+
+		host->data->error = -ETIMEDOUT;
+		finish_data();
+	}
+
+	mmiowb();
+
+	m_SpinLock.Release ();
+}
+
+void CSDHOSTDevice::dma_timeout_stub (TKernelTimerHandle timer, void *param, void *context)
+{
+	CSDHOSTDevice *pThis = (CSDHOSTDevice *) param;
+	assert (pThis != 0);
+
+	PeripheralEntry ();
+
+	pThis->dma_timeout ();
+
+	PeripheralExit ();
+}
+
 void CSDHOSTDevice::set_transfer_irqs (void)
 {
 	u32 all_irqs = SDHCFG_DATA_IRPT_EN | SDHCFG_BLOCK_IRPT_EN | SDHCFG_BUSY_IRPT_EN;
 
-	host->hcfg = (host->hcfg & ~all_irqs) | SDHCFG_DATA_IRPT_EN | SDHCFG_BUSY_IRPT_EN;
+	if (host->use_dma)
+		host->hcfg = (host->hcfg & ~all_irqs) | SDHCFG_BUSY_IRPT_EN;
+	else
+		host->hcfg = (host->hcfg & ~all_irqs) | SDHCFG_DATA_IRPT_EN | SDHCFG_BUSY_IRPT_EN;
 
 	write(host->hcfg, SDHCFG);
 }
@@ -982,7 +1158,9 @@ void CSDHOSTDevice::finish_command (void)
 		/* Finished CMD23, now send actual command. */
 		host->cmd = 0;
 		if (send_command(host->mrq->cmd)) {
-			/* PIO starts after irq */
+			if (host->data && host->use_dma)
+				/* DMA transfer starts now, PIO starts after irq */
+				start_dma();
 
 			if (!host->use_busy)
 				finish_command();
@@ -1341,6 +1519,10 @@ void CSDHOSTDevice::request (mmc_host *mmc, mmc_request *mrq)
 		return;
 	}
 
+	if (host->have_dma && mrq->data &&
+	    (mrq->data->blocks > host->pio_limit))
+		prepare_dma(mrq->data);
+
 	host->use_sbc = !!mrq->sbc &&
 		(host->mrq->data->flags & USE_CMD23_FLAGS);
 	if (host->use_sbc) {
@@ -1349,7 +1531,9 @@ void CSDHOSTDevice::request (mmc_host *mmc, mmc_request *mrq)
 				finish_command();
 		}
 	} else if (send_command(mrq->cmd)) {
-		/* PIO starts after irq */
+		if (host->data && host->use_dma)
+			/* DMA transfer starts now, PIO starts after irq */
+			start_dma();
 
 		if (!host->use_busy)
 			finish_command();
@@ -1403,6 +1587,9 @@ void CSDHOSTDevice::tasklet_finish (void)
 
 // 	del_timer(&host->timer);
 
+	/* Abort the DMA transfer, if the request has failed early */
+	stop_dma();
+
 	mmc_request *mrq = host->mrq;
 
 	/* Drop the overclock after any data corruption, or after any
@@ -1484,11 +1671,29 @@ int CSDHOSTDevice::add_host (void)
 
 	init(0);
 
+#ifdef SDHOST_USE_DMA
+	// CDMAChannel cannot report a failed allocation, so check for a free channel before
+	unsigned nDMAChannel = CMachineInfo::Get ()->AllocateDMAChannel (DMA_CHANNEL_NORMAL);
+	if (nDMAChannel != DMA_CHANNEL_NONE)
+	{
+		CMachineInfo::Get ()->FreeDMAChannel (nDMAChannel);
+
+		m_pDMAChannel = new CDMAChannel (nDMAChannel, m_pInterruptSystem);
+		assert (m_pDMAChannel != 0);
+		host->have_dma = 1;
+	}
+	else
+	{
+		pr_warn("%s: no DMA channel available", mmc_hostname(mmc));
+	}
+#endif
+
 	m_pInterruptSystem->ConnectIRQ (host->irq, irq_stub, this);
 
 	mmiowb();
 
-	pr_info("%s: %s loaded", mmc_hostname(mmc), DRIVER_NAME);
+	pr_info("%s: %s loaded - DMA %s", mmc_hostname(mmc), DRIVER_NAME,
+		host->have_dma ? "on" : "off");
 
 	return 0;
 
@@ -1512,6 +1717,7 @@ int CSDHOSTDevice::probe (void)
 	host->mmc = mmc;
 	host->pio_timeout = 500*CLOCKHZ/1000;
 	host->max_delay = 1; /* Warn if over 1ms */
+	host->pio_limit = PIO_LIMIT;
 
 	/* Read any custom properties */
 	host->delay_after_stop = 0;
@@ -34,6 +34,7 @@
 #include <SDCard/mmc.h>
 #include <circle/interrupt.h>
 #include <circle/timer.h>
+#include <circle/dmachannel.h>
 #include <circle/gpiopin.h>
 #include <circle/spinlock.h>
 #include <circle/bcm2835.h>
@@ -59,6 +60,10 @@ struct bcm2835_host
 	sg_mapping_iter		sg_miter;	/* SG state for PIO */
 	unsigned		blocks;		/* remaining PIO blocks */
 
+	u32			*drain_buf;	/* Read words, which are not moved by DMA */
+	unsigned		drain_words;
+	TKernelTimerHandle	dma_timer;	/* Timeout for DMA transfer */
+
 	int			irq;		/* Device IRQ */
 
 	u32			cmd_quick_poll_retries;
@@ -77,6 +82,9 @@ struct bcm2835_host
 
 	unsigned		use_sbc:1;		/* Send CMD23 */
 
+	unsigned		have_dma:1;		/* DMA channel is available */
+	unsigned		use_dma:1;		/* Current transfer uses DMA */
+
 	unsigned		debug:1;		/* Enable debug output */
 	unsigned		firmware_sets_cdiv:1;	/* Let the firmware manage the clock */
 	unsigned		reset_clock:1;		/* Reset the clock fore the next request */
@@ -88,6 +96,7 @@ struct bcm2835_host
 	u32			user_overclock_50; /* User's preferred frequency to use when 50MHz is requested (in MHz) */
 	u32			overclock_50;	/* frequency to use when 50MHz is requested (in MHz) */
 	u32			overclock;	/* Current frequency if overclocked, else zero */
+	u32			pio_limit;	/* Maximum block count for PIO transfers */
 
 // 	u32			sectors;	/* Cached card size in sectors */
 };
@@ -116,6 +125,14 @@ private:
 	void read_block_pio (void);
 	void write_block_pio (void);
 	void transfer_pio (void);
+	void check_transfer_status (void);
+	void prepare_dma (mmc_data *data);
+	void start_dma (void);
+	void stop_dma (void);
+	void dma_complete (boolean status);
+	static void dma_complete_stub (unsigned channel, unsigned buffer, boolean status, void *param);
+	void dma_timeout (void);
+	static void dma_timeout_stub (TKernelTimerHandle timer, void *param, void *context);
 	void set_transfer_irqs (void);
 	void prepare_data (mmc_command *cmd);
 	boolean send_command (mmc_command *cmd);
@@ -151,6 +168,8 @@ private:
 	CInterruptSystem *m_pInterruptSystem;
 	CTimer		 *m_pTimer;
 
+	CDMAChannel *m_pDMAChannel;
+
 	CGPIOPin m_GPIO34_39[6];	// WiFi
 	CGPIOPin m_GPIO48_53[6];	// SD card
 
@@ -0,0 +1,452 @@
+//
+// httpfileserver.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <httpfileserver/httpfileserver.h>
+#include <circle/logger.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#if HTTP_FILE_BLOCK_SIZE % FF_MAX_SS != 0
+	#error HTTP_FILE_BLOCK_SIZE must be a multiple of FF_MAX_SS!
+#endif
+
+LOGMODULE ("httpfile");
+
+static const struct
+{
+	const char *pExtension;
+	const char *pContentType;
+}
+s_ContentTypes[] =
+{
+	{"html",	"text/html; charset=iso-8859-1"},
+	{"htm",		"text/html; charset=iso-8859-1"},
+	{"css",		"text/css"},
+	{"js",		"text/javascript"},
+	{"json",	"application/json"},
+	{"txt",		"text/plain; charset=iso-8859-1"},
+	{"log",		"text/plain; charset=iso-8859-1"},
+	{"xml",		"text/xml"},
+	{"png",		"image/png"},
+	{"jpg",		"image/jpeg"},
+	{"jpeg",	"image/jpeg"},
+	{"gif",		"image/gif"},
+	{"svg",		"image/svg+xml"},
+	{"ico",		"image/x-icon"},
+	{"pdf",		"application/pdf"},
+	{"wasm",	"application/wasm"}
+};
+
+CHTTPFileServer::CHTTPFileServer (CNetSubSystem *pNetSubSystem, FATFS *pFileSystem,
+				  const char *pPath, u16 nPort, CSocket *pSocket)
+:	CHTTPDaemon (pNetSubSystem, pSocket, 0, nPort),
+	m_pFileSystem (pFileSystem),
+	m_Path (pPath),
+	m_nPort (nPort),
+	m_pBuffer (0)
+{
+	assert (m_pFileSystem != 0);
+	assert (m_Path.GetLength () > 0);
+	assert (((const char *) m_Path)[m_Path.GetLength ()-1] == '/');
+
+	if (pSocket != 0)
+	{
+		m_pBuffer = new u8[HTTP_FILE_BLOCK_SIZE];
+		assert (m_pBuffer != 0);
+	}
+}
+
+CHTTPFileServer::~CHTTPFileServer (void)
+{
+	delete [] m_pBuffer;
+	m_pBuffer = 0;
+
+	m_pFileSystem = 0;
+}
+
+CHTTPDaemon *CHTTPFileServer::CreateWorker (CNetSubSystem *pNetSubSystem, CSocket *pSocket)
+{
+	return new CHTTPFileServer (pNetSubSystem, m_pFileSystem, m_Path, m_nPort, pSocket);
+}
+
+THTTPStatus CHTTPFileServer::StreamContent (const char *pPath, const char *pParams,
+					    const char *pFormData)
+{
+	CString FileName;
+	if (!MapPath (pPath, &FileName))
+	{
+		return HTTPNotFound;
+	}
+
+	const char *pContentType = GetContentType (FileName);
+
+	// prefer the precompressed variant, if the client accepts it
+	FILINFO FileInfo;
+	boolean bGzip = FALSE;
+	const char *pAcceptEncoding = GetRequestHeader ("Accept-Encoding");
+	if (   pAcceptEncoding != 0
+	    && strstr (pAcceptEncoding, "gzip") != 0)
+	{
+		CString GzipFileName (FileName);
+		GzipFileName.Append (".gz");
+
+		if (   f_stat (GzipFileName, &FileInfo) == FR_OK
+		    && !(FileInfo.fattrib & AM_DIR))
+		{
+			FileName = GzipFileName;
+			bGzip = TRUE;
+		}
+	}
+
+	if (   !bGzip
+	    && (   f_stat (FileName, &FileInfo) != FR_OK
+		|| (FileInfo.fattrib & AM_DIR)))
+	{
+		return HTTPNotFound;
+	}
+
+	u32 nFileSize = FileInfo.fsize;
+
+	// the entity tag changes, when the file is modified
+	CString ETag;
+	ETag.Format ("\"%x-%x%s\"", nFileSize, (unsigned) FileInfo.fdate << 16 | FileInfo.ftime,
+		     bGzip ? "-gz" : "");
+
+	CString Header;
+	Header.Format ("ETag: %s\r\n"
+		       "Accept-Ranges: bytes\r\n"
+		       "Vary: Accept-Encoding\r\n"
+		       "%s", (const char *) ETag, bGzip ? "Content-Encoding: gzip\r\n" : "");
+
+	const char *pIfNoneMatch = GetRequestHeader ("If-None-Match");
+	if (   pIfNoneMatch != 0
+	    && (   strcmp (pIfNoneMatch, "*") == 0
+		|| strstr (pIfNoneMatch, ETag) != 0))
+	{
+		BeginResponse (HTTPNotModified, 0, pContentType, Header);
+
+		return HTTPOK;
+	}
+
+	// a range is ignored, if the client has another version of the file
+	THTTPStatus Status = HTTPOK;
+	u32 nStart = 0;
+	u32 nLength = nFileSize;
+	const char *pRange = GetRequestHeader ("Range");
+	const char *pIfRange = GetRequestHeader ("If-Range");
+	if (   pRange != 0
+	    && (   pIfRange == 0
+		|| strcmp (pIfRange, ETag) == 0))
+	{
+		u32 nEnd;
+		int nResult = ParseRange (pRange, nFileSize, &nStart, &nEnd);
+		if (nResult < 0)
+		{
+			CString ContentRange;
+			ContentRange.Format ("Content-Range: bytes */%u\r\n", nFileSize);
+			Header.Append (ContentRange);
+
+			BeginResponse (HTTPRangeNotSatisfiable, 0, pContentType, Header);
+
+			return HTTPOK;
+		}
+		else if (nResult > 0)
+		{
+			assert (nStart <= nEnd);
+			assert (nEnd < nFileSize);
+			nLength = nEnd - nStart + 1;
+
+			CString ContentRange;
+			ContentRange.Format ("Content-Range: bytes %u-%u/%u\r\n",
+					     nStart, nEnd, nFileSize);
+			Header.Append (ContentRange);
+
+			Status = HTTPPartialContent;
+		}
+		else
+		{
+			nStart = 0;
+		}
+	}
+
+	if (f_open (&m_File, FileName, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return HTTPNotFound;
+	}
+
+	if (   nStart > 0
+	    && f_lseek (&m_File, nStart) != FR_OK)
+	{
+		f_close (&m_File);
+
+		return HTTPInternalServerError;
+	}
+
+	if (   !BeginResponse (Status, nLength, pContentType, Header)
+	    || GetRequestMethod () == HTTPRequestMethodHead)
+	{
+		f_close (&m_File);
+
+		return HTTPOK;
+	}
+
+	// Reading whole blocks at block aligned file positions lets FatFs transfer
+	// the sectors directly into our buffer, which is passed to the socket then.
+	assert (m_pBuffer != 0);
+	while (nLength > 0)
+	{
+		unsigned nBlockSize = HTTP_FILE_BLOCK_SIZE - nStart % HTTP_FILE_BLOCK_SIZE;
+		if (nBlockSize > nLength)
+		{
+			nBlockSize = nLength;
+		}
+
+		unsigned nBytesRead;
+		if (   f_read (&m_File, m_pBuffer, nBlockSize, &nBytesRead) != FR_OK
+		    || nBytesRead != nBlockSize)
+		{
+			LOGERR ("Cannot read: %s", (const char *) FileName);
+
+			f_close (&m_File);
+
+			return HTTPInternalServerError;		// response is incomplete
+		}
+
+		if (!SendContent (m_pBuffer, nBlockSize))
+		{
+			break;
+		}
+
+		nStart += nBlockSize;
+		nLength -= nBlockSize;
+	}
+
+	f_close (&m_File);
+
+	return HTTPOK;
+}
+
+boolean CHTTPFileServer::MapPath (const char *pPath, CString *pFileName) const
+{
+	assert (pPath != 0);
+	if (*pPath++ != '/')
+	{
+		return FALSE;
+	}
+
+	char Buffer[HTTP_MAX_PATH+1];
+	unsigned nLength = 0;
+	while (*pPath != '\0')
+	{
+		char chChar = *pPath++;
+
+		// decode "%XX"
+		if (chChar == '%')
+		{
+			unsigned nValue = 0;
+			for (unsigned i = 0; i < 2; i++)
+			{
+				char chDigit = *pPath++;
+				if ('0' <= chDigit && chDigit <= '9')
+				{
+					nValue = nValue << 4 | (chDigit - '0');
+				}
+				else if ('A' <= (chDigit & ~0x20) && (chDigit & ~0x20) <= 'F')
+				{
+					nValue = nValue << 4 | ((chDigit & ~0x20) - 'A' + 10);
+				}
+				else
+				{
+					return FALSE;
+				}
+			}
+
+			chChar = (char) nValue;
+			if (chChar == '\0')
+			{
+				return FALSE;
+			}
+		}
+
+		if (chChar == '\\')
+		{
+			return FALSE;
+		}
+
+		assert (nLength < sizeof Buffer-1);
+		Buffer[nLength++] = chChar;
+	}
+
+	Buffer[nLength] = '\0';
+
+	// do not leave the served directory
+	if (strstr (Buffer, "..") != 0)
+	{
+		return FALSE;
+	}
+
+	assert (pFileName != 0);
+	*pFileName = m_Path;
+	pFileName->Append (Buffer);
+
+	if (   nLength == 0
+	    || Buffer[nLength-1] == '/')
+	{
+		pFileName->Append ("index.html");
+	}
+
+	return TRUE;
+}
+
+int CHTTPFileServer::ParseRange (const char *pRange, u32 nFileSize, u32 *pStart, u32 *pEnd)
+{
+	// "bytes=first-last", "bytes=first-" or "bytes=-suffixlength" supported
+	assert (pRange != 0);
+	if (strncmp (pRange, "bytes=", 6) != 0)
+	{
+		return 0;
+	}
+	pRange += 6;
+
+	if (strchr (pRange, ',') != 0)
+	{
+		return 0;			// multiple ranges are not supported
+	}
+
+	assert (pStart != 0);
+	assert (pEnd != 0);
+	if (*pRange == '-')
+	{
+		pRange++;
+
+		u32 nSuffixLength;
+		if (   !ParseNumber (&pRange, &nSuffixLength)
+		    || *pRange != '\0')
+		{
+			return 0;
+		}
+
+		if (   nSuffixLength == 0
+		    || nFileSize == 0)
+		{
+			return -1;
+		}
+
+		if (nSuffixLength > nFileSize)
+		{
+			nSuffixLength = nFileSize;
+		}
+
+		*pStart = nFileSize - nSuffixLength;
+		*pEnd = nFileSize - 1;
+
+		return 1;
+	}
+
+	if (   !ParseNumber (&pRange, pStart)
+	    || *pRange++ != '-')
+	{
+		return 0;
+	}
+
+	if (*pRange == '\0')
+	{
+		*pEnd = nFileSize - 1;
+	}
+	else if (   !ParseNumber (&pRange, pEnd)
+		 || *pRange != '\0'
+		 || *pEnd < *pStart)
+	{
+		return 0;
+	}
+
+	if (*pStart >= nFileSize)
+	{
+		return -1;
+	}
+
+	if (*pEnd >= nFileSize)
+	{
+		*pEnd = nFileSize - 1;
+	}
+
+	return 1;
+}
+
+boolean CHTTPFileServer::ParseNumber (const char **ppString, u32 *pValue)
+{
+	assert (ppString != 0);
+	const char *p = *ppString;
+	assert (p != 0);
+
+	u32 nValue = 0;
+	while ('0' <= *p && *p <= '9')
+	{
+		if (nValue > 429496728U)		// prevent wrapping
+		{
+			return FALSE;
+		}
+
+		nValue = nValue * 10 + (*p++ - '0');
+	}
+
+	if (p == *ppString)
+	{
+		return FALSE;
+	}
+
+	*ppString = p;
+
+	assert (pValue != 0);
+	*pValue = nValue;
+
+	return TRUE;
+}
+
+const char *CHTTPFileServer::GetContentType (const char *pFileName)
+{
+	// find the extension of the last path component
+	assert (pFileName != 0);
+	const char *pExtension = 0;
+	for (const char *p = pFileName; *p != '\0'; p++)
+	{
+		if (*p == '.')
+		{
+			pExtension = p+1;
+		}
+		else if (*p == '/')
+		{
+			pExtension = 0;
+		}
+	}
+
+	if (pExtension != 0)
+	{
+
+		for (unsigned i = 0; i < sizeof s_ContentTypes / sizeof s_ContentTypes[0]; i++)
+		{
+			if (strcasecmp (pExtension, s_ContentTypes[i].pExtension) == 0)
+			{
+				return s_ContentTypes[i].pContentType;
+			}
+		}
+	}
+
+	return "application/octet-stream";
+}
@@ -0,0 +1,71 @@
+//
+// httpfileserver.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _httpfileserver_httpfileserver_h
+#define _httpfileserver_httpfileserver_h
+
+#include <circle/net/httpdaemon.h>
+#include <circle/net/netsubsystem.h>
+#include <circle/net/socket.h>
+#include <fatfs/ff.h>
+#include <circle/string.h>
+#include <circle/types.h>
+
+#define HTTP_FILE_BLOCK_SIZE	8192		// bytes read from disk at once, multiple of FF_MAX_SS
+
+class CHTTPFileServer : public CHTTPDaemon	/// Serves static files from a FatFs volume
+{
+public:
+	/// \param pNetSubSystem Pointer to the network subsystem
+	/// \param pFileSystem	 Pointer to the mounted FatFs volume
+	/// \param pPath	 Directory to be served (must have trailing '/')
+	/// \param nPort	 TCP port number to listen on
+	/// \param pSocket	 0 for the listener instance (used by CreateWorker())
+	CHTTPFileServer (CNetSubSystem *pNetSubSystem, FATFS *pFileSystem,
+			 const char *pPath = "SD:/", u16 nPort = HTTP_PORT, CSocket *pSocket = 0);
+	~CHTTPFileServer (void);
+
+	CHTTPDaemon *CreateWorker (CNetSubSystem *pNetSubSystem, CSocket *pSocket);
+
+	/// \brief Sends the requested file in blocks of HTTP_FILE_BLOCK_SIZE
+	/// \note Supports single byte ranges ("Range", "If-Range"), entity tags ("ETag",\n
+	///	  "If-None-Match") and precompressed variants (file.gz for file), which are\n
+	///	  sent, if the client accepts gzip encoding.
+	THTTPStatus StreamContent (const char *pPath, const char *pParams, const char *pFormData);
+
+private:
+	// returns FALSE if the path is invalid or leaves the served directory
+	boolean MapPath (const char *pPath, CString *pFileName) const;
+
+	// returns: 1: range valid, 0: ignore range, -1: range not satisfiable
+	static int ParseRange (const char *pRange, u32 nFileSize, u32 *pStart, u32 *pEnd);
+	static boolean ParseNumber (const char **ppString, u32 *pValue);
+
+	static const char *GetContentType (const char *pFileName);
+
+private:
+	FATFS *m_pFileSystem;
+	CString m_Path;
+	u16 m_nPort;
+
+	FIL m_File;
+	u8 *m_pBuffer;			// of worker
+};
+
+#endif
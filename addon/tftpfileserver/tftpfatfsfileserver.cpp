@@ -129,3 +129,10 @@ int CTFTPFatFsFileServer::FileWrite (const void *pBuffer, unsigned nCount)
 
 	return nBytesWritten;
 }
+
+int CTFTPFatFsFileServer::FileSize (void)
+{
+	assert (m_bFileOpen);
+
+	return (int) f_size (&m_File);
+}
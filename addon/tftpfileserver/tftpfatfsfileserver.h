@@ -38,6 +38,7 @@ public:
 	boolean FileClose (void);
 	int FileRead (void *pBuffer, unsigned nCount);
 	int FileWrite (const void *pBuffer, unsigned nCount);
+	int FileSize (void);
 
 private:
 	FATFS *m_pFileSystem;
@@ -85,6 +85,7 @@
 #define ARM_IRQ_PCIE_EXT_HOST_INTA GIC_SPI (219)
 #define ARM_IRQ_PCIE_HOST_INTA	GIC_SPI (229)
 #define ARM_IRQ_PCIE_HOST_MSI	GIC_SPI (234)
+#define ARM_IRQ_SDIO1		GIC_SPI (273)
 #define ARM_IRQ_SDIO2		GIC_SPI (274)
 
 #define IRQ_LINES		512
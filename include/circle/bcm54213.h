@@ -38,6 +38,7 @@ struct TGEnetCB				// buffer control block
 {
 	uintptr		bd_addr;	// address of HW buffer descriptor
 	u8		*buffer;	// pointer to frame buffer (DMA address)
+	CNetBuffer	*netbuf;	// net buffer, which contains the Rx buffer
 };
 
 struct TGEnetTxRing			// ring of Tx buffers
@@ -87,6 +88,9 @@ public:
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+	// returns the net buffer, which has been used as DMA buffer (no copy)
+	CNetBuffer *ReceiveNetBuffer (void);
+
 	// returns TRUE if PHY link is up
 	boolean IsLinkUp (void);
 
@@ -95,11 +99,21 @@ public:
 	// update device settings according to PHY status
 	boolean UpdatePHY (void);
 
+	// signals RX and TX completion interrupts to the event handler
+	boolean IsEventDriven (void)	{ return TRUE; }
+
+	// inserts TCP/UDP checksums on TX and sums up frames on RX
+	unsigned GetChecksumOffload (void) const
+	{
+		return NET_CHECKSUM_OFFLOAD_TX | NET_CHECKSUM_OFFLOAD_RX;
+	}
+
 private:
 	// UMAC
 	void reset_umac(void);
 	void umac_reset2(void);
 	void init_umac(void);
+	void init_csum(void);
 	void umac_enable_set(u32 mask, bool enable);
 
 	// interrupt disable/enable
@@ -140,8 +154,8 @@ private:
 	int init_rx_ring(unsigned index, unsigned size, unsigned start_ptr, unsigned end_ptr);
 	int alloc_rx_buffers(TGEnetRxRing *ring);
 	void free_rx_buffers(void);
-	u8 *rx_refill(TGEnetCB *cb);
-	u8 *free_rx_cb(TGEnetCB *cb);
+	CNetBuffer *rx_refill(TGEnetCB *cb);
+	CNetBuffer *free_rx_cb(TGEnetCB *cb);
 
 	// Helpers
 	void dmadesc_set(uintptr d, u8 *addr, u32 value);
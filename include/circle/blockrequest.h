@@ -0,0 +1,119 @@
+//
+// blockrequest.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_blockrequest_h
+#define _circle_blockrequest_h
+
+#include <circle/types.h>
+#include <assert.h>
+
+class CBlockRequest;
+
+/// \brief Called, when a block I/O request has been processed
+/// \param pRequest Pointer to the completed request
+/// \param pParam   User parameter
+typedef void TBlockRequestCompletionRoutine (CBlockRequest *pRequest, void *pParam);
+
+/// \brief Asynchronous read or write request to a block device
+/// \details A request is handed over to CDevice::SubmitRequest() and must remain valid,\n
+///	     until its completion routine has been called. Offset and length are given\n
+///	     in bytes, like with the synchronous Seek(), Read() and Write(), and must be\n
+///	     multiples of the block size of the device.
+class CBlockRequest
+{
+public:
+	/// \param bWrite   TRUE for a write request
+	/// \param pBuffer  Buffer with the data to be written or for the read data
+	/// \param nCount   Number of bytes to be transferred
+	/// \param ullOffset Byte offset from start of the device
+	CBlockRequest (boolean bWrite, void *pBuffer, size_t nCount, u64 ullOffset)
+	:	m_bWrite (bWrite),
+		m_pBuffer (pBuffer),
+		m_nCount (nCount),
+		m_ullOffset (ullOffset),
+		m_ullBaseOffset (0),
+		m_pCompletionRoutine (0),
+		m_pCompletionParam (0),
+		m_nResult (-1),
+		m_bComplete (FALSE),
+		m_pNext (0)
+	{
+		assert (pBuffer != 0);
+		assert (nCount > 0);
+	}
+
+	~CBlockRequest (void) {}
+
+	/// \param pRoutine Routine to be called on completion (at TASK_LEVEL)
+	/// \param pParam   User parameter handed over to the routine
+	void SetCompletionRoutine (TBlockRequestCompletionRoutine *pRoutine, void *pParam = 0)
+	{
+		m_pCompletionRoutine = pRoutine;
+		m_pCompletionParam = pParam;
+	}
+
+	boolean IsWrite (void) const		{ return m_bWrite; }
+	void *GetBuffer (void) const		{ return m_pBuffer; }
+	size_t GetCount (void) const		{ return m_nCount; }
+	u64 GetOffset (void) const		{ return m_ullOffset; }
+
+	/// \return Byte offset from start of the underlying physical device
+	u64 GetDeviceOffset (void) const	{ return m_ullBaseOffset + m_ullOffset; }
+	/// \brief Add the start of a partition to the device offset
+	/// \note Called by layered devices (e.g. CPartition) before passing the request on
+	void AddBaseOffset (u64 ullOffset)	{ m_ullBaseOffset += ullOffset; }
+
+	/// \return Has the request been processed?
+	boolean IsComplete (void) const		{ return m_bComplete; }
+	/// \return Number of transferred bytes or < 0 on failure (valid, when complete)
+	int GetResult (void) const		{ return m_nResult; }
+
+	/// \brief Set the result and call the completion routine
+	/// \note Called by the block device driver
+	void Complete (int nResult)
+	{
+		assert (!m_bComplete);
+		m_nResult = nResult;
+		m_bComplete = TRUE;
+
+		if (m_pCompletionRoutine != 0)
+		{
+			(*m_pCompletionRoutine) (this, m_pCompletionParam);
+		}
+	}
+
+private:
+	boolean m_bWrite;
+	void *m_pBuffer;
+	size_t m_nCount;
+	u64 m_ullOffset;
+	u64 m_ullBaseOffset;
+
+	TBlockRequestCompletionRoutine *m_pCompletionRoutine;
+	void *m_pCompletionParam;
+
+	int m_nResult;
+	volatile boolean m_bComplete;
+
+	CBlockRequest *m_pNext;			// in request queue
+
+	friend class CBlockRequestQueue;
+};
+
+#endif
@@ -0,0 +1,112 @@
+//
+// blockrequestqueue.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_blockrequestqueue_h
+#define _circle_blockrequestqueue_h
+
+#include <circle/blockrequest.h>
+#include <circle/types.h>
+
+#define BLOCK_REQUEST_SIZE		512		// transfer unit of the devices
+
+#ifndef BLOCK_REQUEST_MAX_MERGE
+#define BLOCK_REQUEST_MAX_MERGE		0x10000		// max. bytes per merged transfer
+#endif
+
+#ifndef BLOCK_REQUEST_MAX_QUEUED
+#define BLOCK_REQUEST_MAX_QUEUED	32		// queue is flushed, when reached
+#endif
+
+/// \brief Synchronous transfer function of a block device driver
+/// \param bWrite    TRUE for a write transfer
+/// \param pBuffer   Data buffer
+/// \param nCount    Number of bytes to be transferred
+/// \param ullOffset Byte offset from start of the device
+/// \param pParam    User parameter
+/// \return Number of transferred bytes or < 0 on failure
+typedef int TBlockTransferHandler (boolean bWrite, void *pBuffer, size_t nCount,
+				   u64 ullOffset, void *pParam);
+
+/// \brief Request queue, which is used by block device drivers to implement\n
+///	   CDevice::SubmitRequest() and CDevice::FlushRequests()
+/// \details Submitted requests are collected and are started together, when the queue\n
+///	     is flushed or has become full. Reads are served before writes. Both are\n
+///	     sorted by offset (elevator), and requests to adjacent blocks are merged into\n
+///	     a single device transfer. A write, which overlaps a queued request, or a read,\n
+///	     which overlaps a queued write, flushes the queue before it is added, so that\n
+///	     the queue never changes the result of a sequence of requests.
+/// \note Must be used at TASK_LEVEL only. Completion routines are called from\n
+///	  Submit() or Flush(). They may submit further requests (e.g. for read-ahead),\n
+///	  which are processed by the running Flush(), but must not issue synchronous\n
+///	  transfers to the same device.
+class CBlockRequestQueue
+{
+public:
+	/// \param pHandler Synchronous transfer function of the driver
+	/// \param pParam   User parameter handed over to the transfer function
+	CBlockRequestQueue (TBlockTransferHandler *pHandler, void *pParam);
+
+	~CBlockRequestQueue (void);
+
+	/// \brief Add a request to the queue
+	/// \param pRequest Request to be added
+	void Submit (CBlockRequest *pRequest);
+
+	/// \brief Start all queued requests and wait for their completion
+	/// \return Have all requests been successful?
+	boolean Flush (void);
+
+	/// \brief Complete all queued requests with an error, without starting them
+	/// \note To be called, when the device has been removed
+	void Cancel (void);
+
+	/// \return Are requests queued?
+	boolean IsEmpty (void) const
+	{
+		return m_pReadList == 0 && m_pWriteList == 0 && m_pDeferredList == 0;
+	}
+
+private:
+	void Enqueue (CBlockRequest *pRequest);
+
+	boolean Overlaps (const CBlockRequest *pRequest) const;
+	static boolean Overlaps (const CBlockRequest *pList, const CBlockRequest *pRequest);
+
+	static void Insert (CBlockRequest **ppList, CBlockRequest *pRequest);
+
+	boolean ProcessList (CBlockRequest *pList);
+	// returns first request after the merged run
+	CBlockRequest *ProcessRun (CBlockRequest *pFirst, boolean *pOK);
+
+private:
+	TBlockTransferHandler *m_pHandler;
+	void *m_pParam;
+
+	CBlockRequest *m_pReadList;		// sorted by device offset
+	CBlockRequest *m_pWriteList;
+	unsigned m_nQueued;
+
+	boolean m_bFlushing;
+	CBlockRequest *m_pDeferredList;		// submitted while flushing, in order
+	CBlockRequest *m_pDeferredTail;
+
+	u8 *m_pMergeBuffer;			// for requests with non-contiguous buffers
+};
+
+#endif
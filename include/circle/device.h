@@ -24,6 +24,7 @@
 #include <circle/types.h>
 
 class CDevice;
+class CBlockRequest;
 
 typedef void TDeviceRemovedHandler (CDevice *pDevice, void *pContext);
 
@@ -52,6 +53,22 @@ public:
 	/// \note Supported by block devices only
 	virtual u64 GetSize (void) const;
 
+	/// \brief Submit an asynchronous block I/O request
+	/// \param pRequest Request, which must remain valid until it has been completed
+	/// \return Has the request been accepted? (its completion routine will be called)
+	/// \note Supported by block devices only. The request may be completed in this call.\n
+	///	  Otherwise it is started, when FlushRequests() is called or the queue of the\n
+	///	  device has become full. The default implementation processes the request\n
+	///	  synchronously using Seek() and Read() or Write().
+	/// \note Must be called at TASK_LEVEL.
+	virtual boolean SubmitRequest (CBlockRequest *pRequest);
+
+	/// \brief Start all submitted block I/O requests and wait for their completion
+	/// \return Have all requests been successful?
+	/// \note Supported by block devices only. Synchronous Read() and Write() calls\n
+	///	  flush the request queue of the device implicitly.
+	virtual boolean FlushRequests (void);
+
 	/// \param ulCmd The IOCtl command to invoke
 	/// \param pData Depends on command, used to return command specific data
 	/// \return Zero on success, or error code on failure
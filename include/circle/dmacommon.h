@@ -41,6 +41,7 @@ enum TDREQ
 #endif
 	DREQSourceEMMC	 = 11,
 	DREQSourceUARTTX = 12,
+	DREQSourceSDHOST = 13,
 	DREQSourceUARTRX = 14,
 #if RASPPI <= 3
 	DREQSourceHDMI	 = 17
@@ -36,9 +36,12 @@ public:
 	void SetClusterEntry (unsigned nCluster, unsigned nEntry);
 
 	unsigned AllocateCluster (void);			// returns 0 on failure
+	boolean AllocateClusterAt (unsigned nCluster);		// allocate this cluster, if it is free
 	void FreeClusterChain (unsigned nFirstCluster);
 
 private:
+	boolean Allocate (unsigned nCluster);
+
 	TFATBuffer *GetSector (unsigned nCluster, unsigned *pSectorOffset, unsigned nFAT);
 
 	unsigned GetEntry (TFATBuffer *pBuffer, unsigned nSectorOffset);
@@ -2,7 +2,7 @@
 // fatcache.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -22,25 +22,67 @@
 
 #include <circle/fs/fat/fatfsdef.h>
 #include <circle/device.h>
+#include <circle/blockrequest.h>
 #include <circle/genericlock.h>
 #include <circle/synchronize.h>
+#include <circle/types.h>
+
+#define FAT_CACHE_MAX_EXTENT	64		/* sectors, limited by the bit masks */
+#define FAT_CACHE_MIN_EXTENTS	(FAT_FILES + FAT_CACHE_READ_AHEAD + 16)	/* each file may pin one */
+#define FAT_CACHE_RECENT_KEYS	4		/* history for sequential access detection */
+
+struct TFATCacheExtent;
 
 struct TFATBuffer
 {
 	unsigned	 nMagic;
-	TFATBuffer	*pNext;
-	TFATBuffer	*pPrev;
 	unsigned	 nSector;
 	unsigned	 nUseCount;
-	int		 bDirty;
+	TFATCacheExtent	*pExtent;		/* extent, which holds this sector */
+
+	unsigned char	*Data;			/* FAT_SECTOR_SIZE bytes */
+};
+
+/*
+ * An extent holds a number of consecutive sectors, usually one cluster,
+ * which is read from or written to disk with a single request.
+ */
+struct TFATCacheExtent
+{
+	unsigned	 nMagic;
+	unsigned	 nKey;			/* extent number on disk */
+	TFATCacheExtent	*pNext;			/* in queue or free list */
+	TFATCacheExtent	*pPrev;
+	TFATCacheExtent	*pHashNext;		/* in hash chain */
+	unsigned	 nQueue;		/* queue, the extent is linked into */
+	unsigned	 nUseCount;		/* sum of the use counts of its sectors */
+	u64		 ullValid;		/* sector bit masks */
+	u64		 ullDirty;
+	boolean		 bReadAhead;		/* loaded by read-ahead, not used yet */
+
+	TFATBuffer	*pBuffers;
+	unsigned char	*pData;
+};
 
-	DMA_BUFFER (unsigned char, Data, FAT_SECTOR_SIZE);
+struct TFATCacheQueue
+{
+	TFATCacheExtent	*pFirst;
+	TFATCacheExtent	*pLast;
+	unsigned	 nCount;
 };
 
-struct TFATBufferList
+struct TFATCacheStatistics
 {
-	TFATBuffer *pFirst;
-	TFATBuffer *pLast;
+	unsigned	nHits;			/* sector requests served from the cache */
+	unsigned	nMisses;		/* sector requests, which needed a disk read */
+	unsigned	nReadAheadExtents;	/* extents loaded by read-ahead */
+	unsigned	nReadAheadHits;		/* of them, which have been used later */
+	unsigned	nReadRequests;		/* disk requests issued by the cache */
+	unsigned	nSectorsRead;
+	unsigned	nWriteRequests;
+	unsigned	nSectorsWritten;
+	unsigned	nDirectRequests;	/* transfers, which bypassed the cache */
+	unsigned	nDirectSectors;
 };
 
 class CFATCache
@@ -53,10 +95,25 @@ public:
 	 * Open buffer cache
 	 *
 	 * Params:  pPartition		Partition to be used
+	 *	    nCacheSize		Size of the cached data in bytes
 	 * Returns: Nonzero on success
 	 */
-	int Open (CDevice *pPartition);
-	
+	int Open (CDevice *pPartition, unsigned nCacheSize = FAT_CACHE_SIZE);
+
+	/*
+	 * Set geometry of the file system (called after the boot sector has been read)
+	 *
+	 * Params:  nSectorsPerCluster	Size of a cluster
+	 *	    nFirstDataSector	Sector number of cluster 2
+	 * Returns: none
+	 *
+	 * Extents are set to the cluster size (max. FAT_CACHE_MAX_EXTENT sectors) and
+	 * aligned to cluster boundaries then. Smaller extents are used, if the cache
+	 * would hold less than FAT_CACHE_MIN_EXTENTS extents otherwise. The cache is
+	 * flushed and emptied before.
+	 */
+	void SetClusterGeometry (unsigned nSectorsPerCluster, unsigned nFirstDataSector);
+
 	/*
 	 * Close buffer cache
 	 *
@@ -100,17 +157,104 @@ public:
 	 */
 	void MarkDirty (TFATBuffer *pBuffer);
 
+	/*
+	 * Read consecutive sectors directly into a buffer, bypassing the cache
+	 *
+	 * Params:  nSector	First sector number
+	 *	    nCount	Number of sectors
+	 *	    pBuffer	Buffer to copy data to
+	 * Returns: Nonzero on success
+	 *
+	 * Dirty sectors in the range are written back before.
+	 */
+	int ReadDirect (unsigned nSector, unsigned nCount, void *pBuffer);
+
+	/*
+	 * Write consecutive sectors directly from a buffer, bypassing the cache
+	 *
+	 * Params:  nSector	First sector number
+	 *	    nCount	Number of sectors
+	 *	    pBuffer	Buffer to copy data from
+	 * Returns: Nonzero on success
+	 *
+	 * Sectors, which are held in the cache, are updated after a successful write.
+	 */
+	int WriteDirect (unsigned nSector, unsigned nCount, const void *pBuffer);
+
+	/*
+	 * Get cache statistics
+	 *
+	 * Params:  pStatistics	Pointer to structure to be filled
+	 * Returns: none
+	 */
+	void GetStatistics (TFATCacheStatistics *pStatistics);
+
 private:
-	void MoveBufferFirst (TFATBuffer *pBuffer);
-	void MoveBufferLast (TFATBuffer *pBuffer);
+	boolean Setup (unsigned nExtentSectors, unsigned nExtentOffset);
+	void Cleanup (void);
+
+	unsigned GetKey (unsigned nSector) const;
+	unsigned GetIndex (unsigned nSector) const;
+	void GetRange (unsigned nKey, unsigned *pFrom, unsigned *pTo) const;
+	boolean IsDirty (unsigned nSector, unsigned nCount) const;
+	unsigned GetSectorNumber (unsigned nKey, unsigned nIndex) const;
+
+	TFATCacheExtent *Lookup (unsigned nKey) const;
+	TFATCacheExtent *Allocate (unsigned nKey, boolean bFrequent);
+	TFATCacheExtent *FindVictim (void);
+	boolean Evict (TFATCacheExtent *pExtent);
+	void Touch (TFATCacheExtent *pExtent);
+	boolean IsSequential (unsigned nKey);
+
+	boolean ReadExtent (TFATCacheExtent *pExtent, unsigned nIndex);
+	boolean ReadSectors (TFATCacheExtent *pExtent, unsigned nFrom, unsigned nTo);
+	void ReadAhead (TFATCacheExtent *pDemand, unsigned nFromKey, unsigned nToKey);
+	boolean WriteBack (void);
+	static void WriteCompletionRoutine (CBlockRequest *pRequest, void *pParam);
+
+	void HashInsert (TFATCacheExtent *pExtent);
+	void HashRemove (TFATCacheExtent *pExtent);
+	void QueueInsertFirst (unsigned nQueue, TFATCacheExtent *pExtent);
+	void QueueRemove (TFATCacheExtent *pExtent);
+	boolean GhostRemove (unsigned nKey);
+	void GhostInsert (unsigned nKey);
 
 	void Fault (unsigned nCode);
 
 private:
 	CDevice		*m_pPartition;
-	TFATBufferList	 m_BufferList;
+	unsigned	 m_nDeviceSectors;
+
+	unsigned	 m_nSectors;		/* cache size in sectors */
+	unsigned char	*m_pData;
+	TFATBuffer	*m_pBuffers;
+
+	unsigned	 m_nExtentSectors;
+	unsigned	 m_nExtentOffset;	/* aligns extents to cluster boundaries */
+	unsigned	 m_nExtents;
+	TFATCacheExtent	*m_pExtents;
+	TFATCacheExtent	*m_pFreeList;
+
+	unsigned	 m_nHashShift;
+	TFATCacheExtent	**m_ppHash;
+
+	/* 2Q replacement: A1in (FIFO), Am (LRU) and A1out (ghost keys) */
+	TFATCacheQueue	 m_Queue[2];
+	unsigned	 m_nInMax;
+	unsigned	*m_pGhostKeys;
+	unsigned	 m_nGhostMax;
+	unsigned	 m_nGhostCount;
+	unsigned	 m_nGhostNext;
+
+	/* sequential access detection */
+	unsigned	 m_RecentKeys[FAT_CACHE_RECENT_KEYS];
+	unsigned	 m_nRecentNext;
+	unsigned	 m_nReadAheadEnd;	/* first key, which has not been read ahead */
+
+	boolean		 m_bWriteError;
+	TFATCacheStatistics m_Statistics;
 
-	CGenericLock m_BufferListLock;
+	CGenericLock m_CacheLock;
 	CGenericLock m_DiskLock;
 };
 
@@ -74,6 +74,14 @@ public:
 	 */
 	void Synchronize (void);
 
+	/*
+	 * Get buffer cache statistics
+	 *
+	 * Params:  pStatistics	Pointer to structure to be filled
+	 * Returns: none
+	 */
+	void GetCacheStatistics (TFATCacheStatistics *pStatistics);
+
 	/*
 	* Find first directory entry
 	*
@@ -154,6 +162,10 @@ public:
 	*/
 	int FileDelete (const char *pTitle);
 
+private:
+	unsigned GetClusterRun (TFile *pFile, unsigned nClusterOffset, unsigned nMaxSectors,
+				boolean bWrite);
+
 private:
 	CFATCache	m_Cache;
 	CFATInfo	m_FATInfo;
@@ -9,7 +9,18 @@
 
 #define FAT_SECTOR_SIZE		512
 
-#define FAT_BUFFERS		100
+#ifndef FAT_CACHE_SIZE
+#define FAT_CACHE_SIZE		0x20000		// bytes, size of the buffer cache (HEAP_DMA30)
+#endif
+
+#ifndef FAT_CACHE_READ_AHEAD
+#define FAT_CACHE_READ_AHEAD	4		// extents, 0 disables read-ahead
+#endif
+
+#ifndef FAT_DIRECT_TRANSFER_MAX
+#define FAT_DIRECT_TRANSFER_MAX	0x100000	// bytes, max. size of a read/write bypassing the cache
+#endif
+
 #define FAT_FILES		40
 
 #define FAT_MAX_FILESIZE	0xFFFFFFFF
@@ -35,6 +35,11 @@ public:
 
 	u64 Seek (u64 ullOffset);
 
+	u64 GetSize (void) const;
+
+	boolean SubmitRequest (CBlockRequest *pRequest);
+	boolean FlushRequests (void);
+
 private:
 	CDevice *m_pDevice;
 	unsigned m_nFirstSector;
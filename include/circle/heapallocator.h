@@ -35,6 +35,11 @@ ASSERT_STATIC (DATA_CACHE_LINE_LENGTH_MAX >= 16);
 #define HEAP_ALIGN_MASK		(HEAP_BLOCK_ALIGN-1)
 
 #define HEAP_BLOCK_MAX_BUCKETS	20
+#define HEAP_BUCKET_GRANULE	64		// all bucket sizes must be a multiple of this
+
+#if defined (ARM_ALLOW_MULTI_CORE) && HEAP_CORE_CACHE_BLOCKS > 0
+	#define HEAP_CORE_CACHE
+#endif
 
 struct THeapBlockHeader
 {
@@ -60,6 +65,19 @@ struct THeapBlockBucket
 	THeapBlockHeader	*pFreeList;
 };
 
+#ifdef HEAP_CORE_CACHE
+
+ASSERT_STATIC (HEAP_CORE_CACHE_BLOCKS >= 2);
+
+struct THeapCoreCache		// free blocks cached by one core
+{
+	THeapBlockHeader	*pFreeList[HEAP_BLOCK_MAX_BUCKETS];
+	unsigned		 nCount[HEAP_BLOCK_MAX_BUCKETS];
+}
+ALIGN (DATA_CACHE_LINE_LENGTH_MAX);
+
+#endif
+
 class CHeapAllocator	/// Allocates blocks from a flat memory region
 {
 public:
@@ -87,15 +105,28 @@ public:
 	/// \param pBlock Memory block to be reallocated
 	/// \param nSize  New block size
 	/// \return Pointer to new block (block contents has been copied, if the block has moved)
+	/// \note Blocks, which are bigger than the largest bucket size, are grown in place,\n
+	///	  if the following memory space is free.
 	void *ReAllocate (void *pBlock, size_t nSize);
 
 	/// \param pBlock Memory block to be freed
-	/// \note Memory space of blocks, which are bigger than the largest bucket size,\n
-	///	  cannot be returned to a free list and is lost.
+	/// \note Blocks, which are bigger than the largest bucket size, are returned to an\n
+	///	  address ordered free list and merged with adjacent free blocks.
 	void Free (void *pBlock);
 
-#ifdef HEAP_DEBUG
+	/// \brief Log statistics of the large blocks (and of the buckets with HEAP_DEBUG)
 	void DumpStatus (void);
+
+private:
+	// must be called with spin lock acquired
+	THeapBlockHeader *AllocateLarge (size_t nSize);
+	void FreeLarge (THeapBlockHeader *pBlockHeader);
+
+	boolean GrowLarge (THeapBlockHeader *pBlockHeader, size_t nSize);
+
+#ifdef HEAP_CORE_CACHE
+	void *AllocateCached (unsigned nBucket);
+	void FreeCached (THeapBlockHeader *pBlockHeader, unsigned nBucket);
 #endif
 
 private:
@@ -106,7 +137,14 @@ private:
 	THeapBlockBucket m_Bucket[HEAP_BLOCK_MAX_BUCKETS+1];
 	CSpinLock	 m_SpinLock;
 
-	static u32 s_nBucketSize[];
+	THeapBlockHeader *m_pLargeFreeList;	// ordered by address
+	unsigned	 m_nLargeBlocksUsed;
+	size_t		 m_nLargeBytesUsed;
+
+#ifdef HEAP_CORE_CACHE
+	unsigned	 m_nCoreCacheBuckets;	// buckets 0..m_nCoreCacheBuckets-1 are cached
+	THeapCoreCache	 m_CoreCache[CORES];
+#endif
 };
 
 #endif
@@ -35,6 +35,9 @@ public:
 	// pBuffer must have size FRAME_BUFFER_SIZE
 	boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength);
 
+	// returns the frame with the checksum state from the RX descriptor
+	CNetBuffer *ReceiveNetBuffer (void);
+
 	// returns TRUE if PHY link is up
 	boolean IsLinkUp (void);
 
@@ -43,6 +46,15 @@ public:
 	// update device settings according to PHY status
 	boolean UpdatePHY (void);
 
+	// signals RX and TX completion interrupts to the event handler
+	boolean IsEventDriven (void)	{ return TRUE; }
+
+	// generates IP/TCP/UDP checksums on TX and verifies them on RX
+	unsigned GetChecksumOffload (void) const
+	{
+		return NET_CHECKSUM_OFFLOAD_TX | NET_CHECKSUM_OFFLOAD_RX;
+	}
+
 private:
 	struct TDMADescriptor
 	{
@@ -52,6 +64,8 @@ private:
 		u32	unused;
 	};
 
+	boolean rx_frame (void *pBuffer, unsigned *pResultLength, u32 *pctrl);
+
 	int eth_alloc (void);
 	int macb_initialize (void);
 	void macb_halt (void);
@@ -76,6 +90,9 @@ private:
 
 	static unsigned mii_nway_result (unsigned negotiated);
 
+	void InterruptHandler (void);
+	static void InterruptStub (void *pParam);
+
 private:
 	CMACAddress m_MACAddress;
 
@@ -105,6 +122,8 @@ private:
 	int m_old_duplex;
 
 	CGPIOPin m_PHYResetPin;
+
+	boolean m_bInterruptConnected;
 };
 
 #endif
@@ -154,12 +154,10 @@ public:
 
 	static void DumpStatus (void)
 	{
-#ifdef HEAP_DEBUG
 		s_pThis->m_HeapLow.DumpStatus ();
 #if RASPPI >= 4
 		s_pThis->m_HeapHigh.DumpStatus ();
 #endif
-#endif
 
 #ifdef PAGE_DEBUG
 		s_pThis->m_Pager.DumpStatus ();
@@ -21,6 +21,7 @@
 #define _circle_net_checksumcalculator_h
 
 #include <circle/net/ipaddress.h>
+#include <circle/netbuffer.h>
 #include <circle/macros.h>
 #include <circle/types.h>
 
@@ -48,13 +49,34 @@ public:
 	
 	u16 Calculate (const void *pBuffer, unsigned nLength);
 
+	// returns the (not complemented) sum over the pseudo header,
+	// which is set as checksum, when it is inserted by the net device
+	u16 CalculatePseudoHeader (unsigned nLength);
+
+	// verifies the checksum of a received packet, uses the checksum offload
+	// result from pNetBuffer, if given and the packet is its whole data
+	boolean IsValid (const void *pPacket, unsigned nLength, const CNetBuffer *pNetBuffer = 0);
+
+	// copies nDataLength bytes from pData behind the header at pPacket and returns
+	// the checksum over the pseudo header, the header and the data, so that the data
+	// is read only once (the checksum field in the header must be 0 before)
+	u16 CopyAndCalculate (void *pPacket, unsigned nHeaderLength,
+			      const void *pData, unsigned nDataLength);
+
 	static u16 SimpleCalculate (const void *pBuffer, unsigned nLength);
 
-private:
+	// the following methods return a partial (not folded) sum and are public for
+	// benchmarking, CalculateChunk() and CopyAndCalculateChunk() use NEON, if available
 	static u32 CalculateChunk (const void *pBuffer, unsigned nLength, u32 nChecksum);
+	static u32 CalculateChunkScalar (const void *pBuffer, unsigned nLength, u32 nChecksum);
+	static u32 CopyAndCalculateChunk (void *pDest, const void *pSource, unsigned nLength,
+					  u32 nChecksum);
 
 	static u16 FoldResult (u32 nChecksum);
-	
+
+	// returns TRUE, if the checksum is calculated using NEON instructions
+	static boolean IsNEONSupported (void);
+
 private:
 	TPseudoHeader m_Header;
 	boolean m_bDestAddressSet;
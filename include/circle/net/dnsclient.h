@@ -22,23 +22,74 @@
 
 #include <circle/net/netsubsystem.h>
 #include <circle/net/ipaddress.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/types.h>
 
+#define DNS_CACHE_SIZE		16		// number of cached host names
+#define DNS_MAX_HOSTNAME_SIZE	256
+
+struct TDNSCacheStatistics
+{
+	unsigned nHits;			// resolved from cache
+	unsigned nNegativeHits;		// failure returned from cache
+	unsigned nMisses;		// query sent to the DNS server
+	unsigned nCoalesced;		// waited for a query of another task
+};
+
 class CDNSClient
 {
 public:
 	CDNSClient (CNetSubSystem *pNetSubSystem);
 	~CDNSClient (void);
 
+	// results are cached for the TTL of the DNS record,
+	// failures are cached for a short time (negative caching)
 	boolean Resolve (const char *pHostname, CIPAddress *pIPAddress);
 
+	// resolve in advance, if pHostname is not cached or its entry will expire soon,
+	// to be called from a background task, so that Resolve() hits the cache later
+	boolean Prefetch (const char *pHostname);
+
+	static void GetCacheStatistics (TDNSCacheStatistics *pStatistics);
+	static void FlushCache (void);
+
 private:
+	boolean Lookup (const char *pHostname, CIPAddress *pIPAddress, boolean bPrefetch);
+
+	// returns: 1 on success, 0 if the name does not exist, -1 on other error
+	int Query (const char *pHostname, u8 *pIPAddress, unsigned *pTTL);
+
 	boolean ConvertIPString (const char *pIPString, CIPAddress *pIPAddress);
 
 private:
 	CNetSubSystem *m_pNetSubSystem;
 
 	static u16 s_nXID;		// transaction ID
+
+	enum TCacheState
+	{
+		CacheStateFree,
+		CacheStatePending,	// query is running
+		CacheStateValid,
+		CacheStateNegative,
+		CacheStateUnknown
+	};
+
+	struct TCacheEntry
+	{
+		TCacheState State;
+		char	    Hostname[DNS_MAX_HOSTNAME_SIZE];
+		u8	    IPAddress[IP_ADDRESS_SIZE];
+		unsigned    nExpireTicks;
+		unsigned    nTTLTicks;
+		unsigned    nLastUsedTicks;
+		boolean	    bRefreshing;	// prefetch query is running, entry remains usable
+	};
+
+	// shared by all instances, accessed from tasks on core 0 only
+	static TCacheEntry s_Cache[DNS_CACHE_SIZE];
+	static CSynchronizationEvent s_QueryDoneEvent;
+	static TDNSCacheStatistics s_Statistics;
 };
 
 #endif
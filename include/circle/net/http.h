@@ -30,6 +30,7 @@
 #define HTTP_MAX_PARAMS		(HTTP_MAX_URI-HTTP_MAX_PATH-1)
 #define HTTP_MAX_FORM_DATA	2048
 #define HTTP_MAX_MULTIPART_BOUNDARY 100
+#define HTTP_MAX_REQUEST_HEADER	2048		// header fields kept for GetRequestHeader()
 
 enum THTTPRequestMethod
 {
@@ -42,11 +43,14 @@ enum THTTPRequestMethod
 enum THTTPStatus
 {
 	HTTPOK			  = 200,
+	HTTPPartialContent	  = 206,
+	HTTPNotModified		  = 304,
 	HTTPBadRequest		  = 400,
 	HTTPNotFound		  = 404,
 	HTTPRequestTimeout	  = 408,
 	HTTPRequestEntityTooLarge = 413,
 	HTTPRequestURITooLong	  = 414,
+	HTTPRangeNotSatisfiable	  = 416,
 	HTTPInternalServerError	  = 500,
 	HTTPMethodNotImplemented  = 501,
 	HTTPVersionNotSupported	  = 505,
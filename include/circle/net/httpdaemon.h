@@ -21,12 +21,17 @@
 #define _circle_net_httpdaemon_h
 
 #include <circle/sched/task.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/net/netsubsystem.h>
 #include <circle/net/http.h>
 #include <circle/net/socket.h>
 #include <circle/net/ipaddress.h>
 #include <circle/types.h>
 
+#define HTTPD_CONTENT_LENGTH_UNKNOWN	((unsigned) -1)	// send with chunked transfer encoding
+
+#define HTTPD_MAX_PENDING		10		// accepted connections waiting for a worker
+
 class CHTTPDaemon : public CTask
 {
 public:
@@ -40,6 +45,7 @@ public:
 	void Run (void);
 
 	// creates an instance of your derived webserver class
+	// workers are kept in a pool and process further connections after the first one
 	virtual CHTTPDaemon *CreateWorker (CNetSubSystem *pNetSubSystem, CSocket *pSocket) = 0;
 
 	// define this to provide your content
@@ -48,7 +54,15 @@ public:
 					const char  *pFormData, // form data from POST ("" for none)
 				        u8	    *pBuffer,	// copy your content here
 				        unsigned    *pLength,	// in: buffer size, out: content length
-				        const char **ppContentType) = 0; // set this if not "text/html"
+				        const char **ppContentType); // set this if not "text/html"
+
+	// or define this to send your content in pieces, without a content buffer
+	// call BeginResponse() once and SendContent() as often as needed from here
+	// return a status other than HTTPOK before BeginResponse() to send an error page
+	// the default implementation sends the content from GetContent()
+	virtual THTTPStatus StreamContent (const char *pPath,		// path of the file to be sent
+					   const char *pParams,		// parameters to GET ("" for none)
+					   const char *pFormData);	// form data from POST ("" for none)
 
 	// overwrite this to implement your own access logging
 	virtual void WriteAccessLog (const CIPAddress	&rRemoteIP,
@@ -64,14 +78,38 @@ protected:
 				      const u8	 **ppData,	// returns pointer to part data
 				      unsigned	  *pLength);	// returns part data length
 
+	// sends the response header, to be called from StreamContent() only
+	boolean BeginResponse (THTTPStatus  Status,
+			       unsigned	    nContentLength,	// or HTTPD_CONTENT_LENGTH_UNKNOWN
+			       const char  *pContentType = "text/html",
+			       const char  *pExtraHeader = 0);	// "Field: value\r\n" lines or 0
+
+	// sends a piece of content after BeginResponse(), returns FALSE on error
+	// the data is ignored on HEAD requests
+	boolean SendContent (const void *pData, unsigned nLength);
+
+	THTTPRequestMethod GetRequestMethod (void) const;
+
+	// returns the value of a field from the request header (0 if not present)
+	// field names are compared case-insensitive, fields beyond HTTP_MAX_REQUEST_HEADER are lost
+	const char *GetRequestHeader (const char *pName) const;
+
 private:
-	void Listener (void);			// accepts incoming connections and creates worker task
-	void Worker (void);			// processes a connection
+	void Listener (void);			// accepts incoming connections and assigns them to workers
+	void Worker (void);			// processes connections
+
+	boolean ProcessRequest (void);		// returns TRUE if the connection can be kept
 
 	THTTPStatus ParseRequest (void);
 	THTTPStatus ParseMethod (char *pLine);
 	THTTPStatus ParseHeaderField (char *pLine);
 
+	int ReceiveData (boolean bIdle);	// returns number of bytes, 0 on timeout, < 0 on error
+	boolean WriteData (const void *pData, unsigned nLength);
+	boolean FlushData (void);
+
+	static const char *GetStatusMessage (THTTPStatus Status);
+
 	void *Search (const void *pBuffer, unsigned nBufLen,
 		      const void *pNeedle, unsigned nNeedleLen);
 
@@ -84,6 +122,25 @@ private:
 	
 	u8 *m_pContentBuffer;
 
+	// worker pool (valid in the listener instance)
+	CSocket *m_pPendingSocket[HTTPD_MAX_PENDING];
+	unsigned m_nPendingIn;
+	unsigned m_nPendingOut;
+	unsigned m_nPendingCount;
+	CSynchronizationEvent m_PendingEvent;		// set when a connection has been queued
+	unsigned m_nWorkers;
+	unsigned m_nIdleWorkers;
+
+	CHTTPDaemon *m_pListener;			// valid in worker instances
+
+	// connection state
+	u8 m_RxBuffer[FRAME_BUFFER_SIZE];		// may hold following (pipelined) requests
+	unsigned m_nRxOffset;
+	unsigned m_nRxLength;
+
+	u8 m_TxBuffer[FRAME_BUFFER_SIZE];		// collects small pieces of the response
+	unsigned m_nTxLength;
+
 	// from request
 	THTTPRequestMethod m_RequestMethod;
 
@@ -91,6 +148,9 @@ private:
 	char m_RequestPath[HTTP_MAX_PATH+1];		// the path without parameters
 	char m_RequestParams[HTTP_MAX_PARAMS+1];	// the parameters from URI
 
+	char m_RequestHeader[HTTP_MAX_REQUEST_HEADER+1]; // "Field: value\0" strings, ends with "\0"
+	unsigned m_nRequestHeaderLength;
+
 	boolean m_bRequestFormDataAvailable;		// form data is available
 	unsigned m_nRequestContentLength;		// length of form data from POST request
 	char m_RequestFormData[HTTP_MAX_FORM_DATA+1];	// form data from POST request
@@ -101,7 +161,15 @@ private:
 	char *m_pMultipartBuffer;			// pointer to allocated multipart buffer
 	char *m_pMultipartPointer;			// pointer into allocated multipart buffer
 
-	static unsigned s_nInstanceCount;
+	boolean m_bKeepAlive;				// client did not request "Connection: close"
+
+	// response state
+	boolean m_bResponseStarted;
+	THTTPStatus m_ResponseStatus;
+	boolean m_bChunked;
+	unsigned m_nResponseLength;			// announced Content-Length
+	unsigned m_nContentSent;
+	boolean m_bSendError;
 };
 
 #endif
@@ -10,4 +10,10 @@
 
 #define MSG_DONTWAIT	0x40
 
+// events for CSocketSet
+#define POLLIN		0x01		// data can be received or connection can be accepted
+#define POLLOUT		0x04		// data can be sent without blocking
+#define POLLERR		0x08		// error occurred
+#define POLLHUP		0x10		// connection has been closed
+
 #endif
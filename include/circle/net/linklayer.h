@@ -56,10 +56,15 @@ public:
 
 	boolean Send (const CIPAddress &rReceiver, const void *pIPPacket, unsigned nLength);
 
-	// pBuffer must have size FRAME_BUFFER_SIZE
-	boolean Receive (void *pBuffer, unsigned *pResultLength);
+	// returns 0 if no IP packet is available, reference is passed to the caller
+	CNetBuffer *Receive (void);
+
+	// returns NET_CHECKSUM_OFFLOAD_* flags of the net device
+	unsigned GetChecksumOffload (void) const;
 
 public:
+	// with NET_CHECKSUM_OFFLOAD_TX the checksum of TCP/UDP over IPv4 frames
+	// is inserted by the net device (see: CNetDevice::GetChecksumOffload())
 	boolean SendRaw (const void *pFrame, unsigned nLength);
 
 	// pBuffer must have size FRAME_BUFFER_SIZE
@@ -25,6 +25,10 @@
 #include <circle/net/ipaddress.h>
 #include <circle/net/icmphandler.h>
 #include <circle/net/checksumcalculator.h>
+#include <circle/net/tcpstatistics.h>
+#include <circle/net/socketmsg.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 class CNetConnection
@@ -61,10 +65,40 @@ public:
 			    const CIPAddress &rForeignIP, u16 nForeignPort) = 0;
 	virtual int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort) = 0;
 
+	// scatter-gather variants, TCP receives as many bytes as available then
+	virtual int SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
+	{
+		return -1;
+	}
+	virtual int ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
+	{
+		return -1;
+	}
+
+	// returns: number of datagrams sent or received, < 0 on error (UDP only)
+	virtual int SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags)	{ return -1; }
+	virtual int ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags) { return -1; }
+
 	virtual int SetOptionBroadcast (boolean bAllowed) = 0;
+	virtual int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize) = 0;
+
+	// TCP only, pAlgorithm must have been returned by CTCPCongestionControl::FindAlgorithm()
+	virtual int SetOptionCongestionControl (const char *pAlgorithm)	{ return -1; }
+
+	// returns: 0 on success, -1 if not supported
+	virtual int GetStatistics (TTCPStatistics *pStatistics)	{ return -1; }
 
 	virtual boolean IsConnected (void) const = 0;
 	virtual boolean IsTerminated (void) const = 0;
+
+	// returns: mask of POLL* flags (see circle/net/in.h) for the current state
+	virtual unsigned GetPollEvents (void) const	{ return 0; }
+	// pEvent will be set on any change, which may affect GetPollEvents() (0 to remove)
+	void SetPollEvent (CSynchronizationEvent *pEvent);
+
+	// returns: TRUE if packets from any foreign host/port may be accepted,
+	//	    the connection is found by the own port only then
+	virtual boolean IsWildcard (void) const = 0;
 	
 	virtual void Process (void) = 0;
 
@@ -72,12 +106,32 @@ public:
 	virtual int PacketReceived (const void *pPacket, unsigned nLength,
 				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol) = 0;
 
+	// same as above, but the payload can be queued by reference (AddRef()) without copy
+	virtual int PacketReceived (CNetBuffer *pBuffer,
+				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol)
+	{
+		return PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
+				       rSenderIP, rReceiverIP, nProtocol);
+	}
+
 	// returns: 0: not to me, 1: notification consumed
 	virtual int NotificationReceived (TICMPNotificationType Type,
 					  CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
 					  u16 nSendPort, u16 nReceivePort,
 					  int nProtocol) = 0;
 
+protected:
+	// request a call of Process() from the net task, can be called at IRQ_LEVEL
+	void RequestProcess (void);
+
+	// wake the task waiting in CSocketSet::Wait(), if any, can be called at IRQ_LEVEL
+	void SignalPollEvent (void);
+
+private:
+	void MarkPending (void);
+	static CNetConnection *TakePendingList (void);		// and clear it
+	CNetConnection *ClearPending (void);			// returns next in taken list
+
 protected:
 	CNetConfig    *m_pNetConfig;
 	CNetworkLayer *m_pNetworkLayer;
@@ -88,6 +142,24 @@ protected:
 	int m_nProtocol;
 
 	CChecksumCalculator m_Checksum;
+
+private:
+	CSynchronizationEvent * volatile m_pPollEvent;
+
+	// managed by CTransportLayer
+	boolean m_bHashed;
+	boolean m_bWildcardHashed;		// in the table of wildcard connections
+	unsigned m_nHashBucket;
+	CNetConnection *m_pNextHashed;		// in the same hash bucket
+
+	boolean m_bPending;			// in list of connections with pending work
+	CNetConnection *m_pNextPending;
+
+	static CNetConnection *s_pFirstPending;
+	static CNetConnection *s_pLastPending;
+	static CSpinLock s_PendingSpinLock;
+
+	friend class CTransportLayer;
 };
 
 #endif
@@ -35,16 +35,31 @@ public:
 
 	boolean Initialize (boolean bWaitForActivate);
 
-	void Process (void);
+	// returns TRUE if frames have been received
+	boolean Process (void);
 
 	// returns 0, if net device is not available yet
 	const CMACAddress *GetMACAddress (void) const;
 
 	void Send (const void *pBuffer, unsigned nLength);
-	boolean Receive (void *pBuffer, unsigned *pResultLength);
+
+	// returns number of received frames (0 if nothing has been received),
+	// up to nMaxCount references are passed to the caller
+	unsigned Receive (CNetBuffer **ppBuffer, unsigned nMaxCount);
 
 	boolean IsRunning (void) const;			// is net device available?
 
+	// does the net device signal received and sent frames?
+	boolean IsEventDriven (void) const;
+
+	// returns NET_CHECKSUM_OFFLOAD_* flags (0 if net device is not available yet)
+	unsigned GetChecksumOffload (void) const;
+
+private:
+	void AttachDevice (void);
+
+	static void DeviceEventHandler (void *pParam);
+
 private:
 	TNetDeviceType m_DeviceType;
 	CNetConfig *m_pNetConfig;
@@ -2,7 +2,7 @@
 // netqueue.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -20,30 +20,60 @@
 #ifndef _circle_net_netqueue_h
 #define _circle_net_netqueue_h
 
+#include <circle/netbuffer.h>
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#define NET_QUEUE_SIZE		256		// default number of entries, power of 2
+#define NET_QUEUE_BATCH_SIZE	16		// useful number of entries per batch
+
 struct TNetQueueEntry;
 
+// Bounded ring of net buffers with preallocated entries. Dequeue() is lock-free
+// and may be called from several tasks. Enqueue() is lock-free for a single
+// producer. Queues with more than one producer must be created with
+// bMultiProducer set, which serializes the producers with a spin lock.
 class CNetQueue
 {
 public:
-	CNetQueue (void);
+	CNetQueue (unsigned nSize = NET_QUEUE_SIZE, boolean bMultiProducer = FALSE);
 	~CNetQueue (void);
 
 	boolean IsEmpty (void) const;
 	
 	void Flush (void);
 	
-	void Enqueue (const void *pBuffer, unsigned nLength, void *pParam = 0);
+	// copies the data into a net buffer, returns FALSE if the queue is full
+	boolean Enqueue (const void *pBuffer, unsigned nLength, void *pParam = 0);
 
-	// returns length (0 if queue is empty)
+	// returns length (0 if queue is empty), copies the data out of the net buffer
 	unsigned Dequeue (void *pBuffer, void **ppParam = 0);
 
+	// takes over the reference to pBuffer, which is released if the queue is full
+	// (returns FALSE then, pParam has to be freed by the caller)
+	boolean Enqueue (CNetBuffer *pBuffer, void *pParam = 0);
+
+	// returns 0 if queue is empty, reference is passed to the caller
+	CNetBuffer *Dequeue (void **ppParam = 0);
+
+	// batch operations are for queues, which are used without pParam
+
+	// enqueues up to nCount buffers and returns their number,
+	// takes over the references of the enqueued buffers only
+	unsigned EnqueueBatch (CNetBuffer *const *ppBuffer, unsigned nCount);
+
+	// dequeues up to nMaxCount buffers and returns their number,
+	// references are passed to the caller
+	unsigned DequeueBatch (CNetBuffer **ppBuffer, unsigned nMaxCount);
+
 private:
-	volatile TNetQueueEntry *m_pFirst;
-	volatile TNetQueueEntry *m_pLast;
+	TNetQueueEntry *m_pEntry;
+	unsigned m_nSizeMask;
+
+	volatile int m_nIn;		// free running indices
+	volatile int m_nOut;
 
+	boolean m_bMultiProducer;
 	CSpinLock m_SpinLock;
 };
 
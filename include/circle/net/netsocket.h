@@ -21,6 +21,7 @@
 #define _circle_net_netsocket_h
 
 #include <circle/net/ipaddress.h>
+#include <circle/net/tcpstatistics.h>
 #include <circle/types.h>
 
 class CNetSubSystem;
@@ -104,6 +105,26 @@ public:
 	/// \return Status (0 success, < 0 on error)
 	virtual int SetOptionBroadcast (boolean bAllowed) { return -1; }
 
+	/// \brief Set the size of the receive and send buffer of a TCP connection (ignored on UDP socket)
+	/// \param nRxBufferSize Receive buffer size in bytes (0 to keep the current size)
+	/// \param nTxBufferSize Send buffer size in bytes (0 to keep the current size)
+	/// \return Status (0 success, < 0 on error)
+	/// \note The receive buffer size determines the advertised TCP window. Call this after\n
+	///	  Connect() or Listen(). Sizes are limited to an implementation defined range.
+	virtual int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize) { return -1; }
+
+	/// \brief Select the congestion control algorithm of a TCP connection (ignored on UDP socket)
+	/// \param pAlgorithm Name of the algorithm ("cubic" or "newreno")
+	/// \return Status (0 success, < 0 on error or if the algorithm is unknown)
+	/// \note Call this after Connect() or Listen(). The default algorithm is set with\n
+	///	  TCP_CONGESTION_CONTROL in include/circle/sysconfig.h.
+	virtual int SetOptionCongestionControl (const char *pAlgorithm) { return -1; }
+
+	/// \brief Get counters and state of a connected TCP socket for monitoring
+	/// \param pStatistics Pointer to structure to be filled
+	/// \return Status (0 success, < 0 on error or if not connected)
+	virtual int GetStatistics (TTCPStatistics *pStatistics) { return -1; }
+
 	/// \brief Get IP address of connected remote host
 	/// \return Pointer to IP address (four bytes, 0-pointer if not connected)
 	virtual const u8 *GetForeignIP (void) const = 0;
@@ -25,6 +25,7 @@
 #include <circle/net/linklayer.h>
 #include <circle/net/networklayer.h>
 #include <circle/net/transportlayer.h>
+#include <circle/sched/synchronizationevent.h>
 #include <circle/string.h>
 #include <circle/types.h>
 
@@ -45,7 +46,12 @@ public:
 	
 	boolean Initialize (boolean bWaitForActivate = TRUE);
 
-	void Process (void);
+	// returns TRUE if frames have been received
+	boolean Process (void);
+
+	// wakes the net task, if there is new work to be processed
+	// can be called from interrupt context
+	void SignalEvent (void);
 
 	CNetConfig *GetConfig (void);
 	CNetDeviceLayer *GetNetDeviceLayer (void);
@@ -59,6 +65,11 @@ public:
 
 	static CNetSubSystem *Get (void);
 
+private:
+	// blocks until SignalEvent() has been called, if the net device supports it
+	void WaitForWork (void);
+	friend class CNetTask;
+
 private:
 	CString		m_Hostname;
 
@@ -71,6 +82,8 @@ private:
 	boolean		m_bUseDHCP;
 	CDHCPClient    *m_pDHCPClient;
 
+	CSynchronizationEvent m_Event;
+
 	static CNetSubSystem *s_pThis;
 };
 
@@ -41,8 +41,9 @@ struct TIPHeader
 	u16	nIdentification;
 #define IP_IDENTIFICATION_DEFAULT	0
 	u16	nFlagsFragmentOffset;
-#define IP_FRAGMENT_OFFSET(field)	((field) & 0x1F00)
+#define IP_FRAGMENT_OFFSET(field)	((field) & 0x1FFF)	// in host byte order, 8 byte units
 	#define IP_FRAGMENT_OFFSET_FIRST	0
+	#define IP_FRAGMENT_UNIT		8
 #define IP_FLAGS_DF			(1 << 6)	// valid without BE()
 #define IP_FLAGS_MF			(1 << 5)
 	u8	nTTL;
@@ -57,6 +58,14 @@ struct TIPHeader
 }
 PACKED;
 
+#define IP_MTU				1500
+#define IP_MAX_DATAGRAM_SIZE		65535
+#define IP_MAX_PAYLOAD_SIZE		(IP_MAX_DATAGRAM_SIZE - sizeof (TIPHeader))
+
+#ifndef IP_REASSEMBLY_SLOTS
+#define IP_REASSEMBLY_SLOTS		4	// datagrams reassembled in parallel
+#endif
+
 struct TNetworkPrivateData
 {
 	u8	nProtocol;
@@ -64,6 +73,15 @@ struct TNetworkPrivateData
 	u8	DestinationAddress[IP_ADDRESS_SIZE];
 };
 
+struct TIPFragmentStatistics
+{
+	unsigned nFragmentsReceived;
+	unsigned nDatagramsReassembled;
+	unsigned nReassemblyTimeouts;		// incomplete datagrams discarded after timeout
+	unsigned nReassemblyFailures;		// invalid fragments or no resources
+	unsigned nFragmentsSent;
+};
+
 class CNetworkLayer
 {
 public:
@@ -74,11 +92,11 @@ public:
 
 	void Process (void);
 
+	// packets larger than IP_MTU are fragmented, nLength can be up to IP_MAX_PAYLOAD_SIZE
 	boolean Send (const CIPAddress &rReceiver, const void *pPacket, unsigned nLength, int nProtocol);
 
-	// pBuffer must have size FRAME_BUFFER_SIZE
-	boolean Receive (void *pBuffer, unsigned *pResultLength,
-			 CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol);
+	// returns 0 if no packet is available, reference is passed to the caller
+	CNetBuffer *Receive (CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol);
 
 	boolean ReceiveNotification (TICMPNotificationType *pType,
 				     CIPAddress *pSender, CIPAddress *pReceiver,
@@ -90,6 +108,25 @@ public:
 	boolean ReceiveICMP (void *pBuffer, unsigned *pResultLength,
 			     CIPAddress *pSender, CIPAddress *pReceiver);
 
+	void GetFragmentStatistics (TIPFragmentStatistics *pStatistics) const;
+
+	// returns TRUE if the TCP/UDP checksum of a packet of nLength bytes to rReceiver
+	// is inserted by the net device, the checksum field has to be set to the sum
+	// over the pseudo header then (see: CChecksumCalculator::CalculatePseudoHeader())
+	boolean IsChecksumOffload (const CIPAddress &rReceiver, unsigned nLength) const;
+
+private:
+	// nFlagsFragmentOffset and nIdentification in network byte order
+	boolean SendPacket (const CIPAddress &rReceiver, const void *pPacket, unsigned nLength,
+			    int nProtocol, u16 nFlagsFragmentOffset, u16 nIdentification);
+
+	// takes the reference to the fragment, returns the complete payload or 0
+	CNetBuffer *Reassemble (const TIPHeader *pHeader, CNetBuffer *pFragment);
+	void ExpireReassembly (void);
+
+	struct TReassemblySlot;
+	void FreeReassemblySlot (TReassemblySlot *pSlot);
+
 private:
 	void AddRoute (const u8 *pDestIP, const u8 *pGatewayIP);
 	const u8 *GetGateway (const u8 *pDestIP) const;
@@ -111,6 +148,27 @@ private:
 	CNetQueue *m_pICMPRxQueue2;
 
 	CRouteCache m_RouteCache;
+
+	u16 m_nIdentification;
+
+	struct TReassemblySlot
+	{
+		boolean	    bInUse;
+		u8	    SourceAddress[IP_ADDRESS_SIZE];
+		u8	    DestinationAddress[IP_ADDRESS_SIZE];
+		u16	    nIdentification;
+		u8	    nProtocol;
+		unsigned    nStartTicks;
+		CNetBuffer *pBuffer;			// payload is assembled here
+		unsigned    nTotalLength;		// 0 until the last fragment is received
+		unsigned    nReceivedUnits;		// number of bits set in UnitMap
+#define IP_MAX_FRAGMENT_UNITS	((IP_MAX_PAYLOAD_SIZE + IP_FRAGMENT_UNIT-1) / IP_FRAGMENT_UNIT)
+		u32	    UnitMap[(IP_MAX_FRAGMENT_UNITS + 31) / 32];
+	};
+
+	TReassemblySlot m_Reassembly[IP_REASSEMBLY_SLOTS];
+
+	TIPFragmentStatistics m_FragmentStatistics;
 };
 
 #endif
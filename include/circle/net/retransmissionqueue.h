@@ -2,7 +2,7 @@
 // retransmissionqueue.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -28,6 +28,9 @@ public:
 	CRetransmissionQueue (unsigned nSize);
 	~CRetransmissionQueue (void);
 
+	unsigned GetSize (void) const;
+	void SetSize (unsigned nSize);		// queue must be empty, data is discarded
+
 	boolean IsEmpty (void) const;
 	
 	unsigned GetFreeSpace (void) const;
@@ -35,11 +38,17 @@ public:
 
 	unsigned GetBytesAvailable (void) const;
 	void Read (void *pBuffer, unsigned nLength);
+	// read already sent data at offset from the oldest unacknowledged byte
+	void Read (unsigned nOffset, void *pBuffer, unsigned nLength) const;
+	void Skip (unsigned nBytes);		// mark data as sent without reading it
 	void Advance (unsigned nBytes);
 	void Reset (void);
 
 	void Flush (void);
 
+private:
+	void Copy (unsigned nFrom, void *pBuffer, unsigned nLength) const;
+
 private:
 	unsigned m_nSize;
 
@@ -2,7 +2,7 @@
 // retranstimeoutcalc.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -36,6 +36,8 @@ public:
 
 	void SegmentSent (u32 nSequenceNumber, u32 nLength = 1);
 	void SegmentAcknowledged (u32 nAcknowledgmentNumber);		// called for valid ACKs only
+	// same as above, with RTT sample taken from the Timestamps option (RFC 7323)
+	void SegmentAcknowledged (u32 nAcknowledgmentNumber, unsigned nRTT);
 
 	void RetransmissionTimerExpired (void);
 
@@ -24,6 +24,7 @@
 #include <circle/net/ipaddress.h>
 #include <circle/net/netconfig.h>
 #include <circle/net/transportlayer.h>
+#include <circle/net/socketmsg.h>
 #include <circle/types.h>
 
 #define SOCKET_MAX_LISTEN_BACKLOG	32
@@ -67,12 +68,15 @@ public:
 	/// \param nLength Length of the message
 	/// \param nFlags  MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
 	/// \return Length of the sent message (< 0 on error)
+	/// \note On UDP socket datagrams up to IP_MAX_PAYLOAD_SIZE-8 bytes are allowed,\n
+	///	  which are fragmented by IP, if they do not fit into one frame.
 	int Send (const void *pBuffer, unsigned nLength, int nFlags);
 
 	/// \brief Receive a message from a remote host
 	/// \param pBuffer Pointer to the message buffer
 	/// \param nLength Size of the message buffer in bytes\n
-	/// Should be at least FRAME_BUFFER_SIZE, otherwise data may get lost
+	/// Should be at least FRAME_BUFFER_SIZE, otherwise data may get lost\n
+	/// (on UDP socket the size of the largest expected datagram)
 	/// \param nFlags MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
 	/// \return Length of received message (0 with MSG_DONTWAIT if no message available, < 0 on error)
 	int Receive (void *pBuffer, unsigned nLength, int nFlags);
@@ -98,12 +102,75 @@ public:
 	int ReceiveFrom (void *pBuffer, unsigned nLength, int nFlags,
 			 CIPAddress *pForeignIP, u16 *pForeignPort);
 
+	/// \brief Send a message, which is gathered from multiple buffers
+	/// \param pIOVec	Array of buffer descriptors
+	/// \param nIOVecCount	Number of entries in pIOVec
+	/// \param nFlags	MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
+	/// \return Length of the sent message (< 0 on error)
+	/// \note On UDP socket the message is sent as one datagram.
+	int SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+
+	/// \brief Receive a message, which is scattered to multiple buffers
+	/// \param pIOVec	Array of buffer descriptors (can be of any size)
+	/// \param nIOVecCount	Number of entries in pIOVec
+	/// \param nFlags	MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
+	/// \return Number of received bytes (0 with MSG_DONTWAIT if no data available, < 0 on error)
+	/// \note On TCP socket as many bytes are returned as available, up to the total size\n
+	///	  of the buffers. Remaining data is returned with the next call. On UDP socket\n
+	///	  one datagram is returned, which is truncated, if it does not fit.
+	int ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+
+	/// \brief Send multiple datagrams (UDP only)
+	/// \param pMessage	Array of datagram descriptors (nSize is not used)
+	/// \param nCount	Number of entries in pMessage
+	/// \param nFlags	MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
+	/// \return Number of sent datagrams (< 0 on error)
+	/// \note ForeignIP and nForeignPort are ignored on a connected socket.
+	int SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags);
+
+	/// \brief Receive multiple datagrams (UDP only)
+	/// \param pMessage	Array of datagram descriptors, nLength, ForeignIP and nForeignPort\n
+	///			will be returned for each received datagram
+	/// \param nCount	Number of entries in pMessage
+	/// \param nFlags	MSG_DONTWAIT (non-blocking operation) or 0 (blocking operation)
+	/// \return Number of received datagrams (0 with MSG_DONTWAIT if none available, < 0 on error)
+	/// \note Blocks until the first datagram is available only, and returns all queued\n
+	///	  datagrams up to nCount then. Datagrams are truncated to nSize.
+	int ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags);
+
 	/// \brief Call this with bAllowed == TRUE after Bind() or Connect() to be able\n
 	/// to send and receive broadcast messages (ignored on TCP socket)
 	/// \param bAllowed Sending and receiving broadcast messages allowed on this socket? (default FALSE)
 	/// \return Status (0 success, < 0 on error)
 	int SetOptionBroadcast (boolean bAllowed);
 
+	/// \brief Set the size of the receive and send buffer of a TCP connection (ignored on UDP socket)
+	/// \param nRxBufferSize Receive buffer size in bytes (0 to keep the current size)
+	/// \param nTxBufferSize Send buffer size in bytes (0 to keep the current size)
+	/// \return Status (0 success, < 0 on error)
+	/// \note The receive buffer size determines the advertised TCP window. Call this after\n
+	///	  Connect() or Listen(). Accepted connections inherit the sizes of the listening\n
+	///	  socket. Sizes are limited to an implementation defined range.
+	int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize);
+
+	/// \brief Select the congestion control algorithm of a TCP connection (ignored on UDP socket)
+	/// \param pAlgorithm Name of the algorithm ("cubic" or "newreno")
+	/// \return Status (0 success, < 0 on error or if the algorithm is unknown)
+	/// \note Call this after Connect() or Listen(). Accepted connections inherit the\n
+	///	  algorithm of the listening socket.
+	int SetOptionCongestionControl (const char *pAlgorithm);
+
+	/// \brief Get counters and state of a connected TCP socket for monitoring
+	/// \param pStatistics Pointer to structure to be filled
+	/// \return Status (0 success, < 0 on error or if not connected)
+	int GetStatistics (TTCPStatistics *pStatistics);
+
+	/// \brief Get the readiness of the socket for CSocketSet
+	/// \param pEvent Event to be set on any change of the readiness (0 to remove it)
+	/// \return Mask of POLLIN, POLLOUT, POLLERR and POLLHUP (include circle/net/in.h)
+	/// \note Only one event can be registered with a socket at a time.
+	unsigned Poll (CSynchronizationEvent *pEvent);
+
 	/// \brief Get IP address of connected remote host
 	/// \return Pointer to IP address (four bytes, 0-pointer if not connected)
 	const u8 *GetForeignIP (void) const;
@@ -121,6 +188,10 @@ private:
 
 	unsigned m_nBackLog;
 	int m_hListenConnection[SOCKET_MAX_LISTEN_BACKLOG];
+
+	unsigned m_nRxBufferSize;		// 0 for default
+	unsigned m_nTxBufferSize;
+	const char *m_pCongestionControl;	// 0 for default
 };
 
 #endif
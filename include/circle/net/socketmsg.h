@@ -0,0 +1,43 @@
+//
+// socketmsg.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_socketmsg_h
+#define _circle_net_socketmsg_h
+
+#include <circle/net/ipaddress.h>
+#include <circle/types.h>
+
+/// \brief Buffer descriptor for scatter-gather operations (like struct iovec)
+struct TSocketIOVec
+{
+	void	 *pBuffer;
+	unsigned  nLength;
+};
+
+/// \brief Datagram descriptor for batch operations (UDP only)
+struct TSocketMessage
+{
+	void	   *pBuffer;
+	unsigned    nSize;		///< Size of the buffer (receive only)
+	unsigned    nLength;		///< Length of the datagram (input on send, output on receive)
+	CIPAddress  ForeignIP;		///< Destination (send, ignored if connected) or sender (receive)
+	u16	    nForeignPort;
+};
+
+#endif
@@ -0,0 +1,85 @@
+//
+// socketset.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_socketset_h
+#define _circle_net_socketset_h
+
+#include <circle/net/socket.h>
+#include <circle/net/in.h>
+#include <circle/sched/synchronizationevent.h>
+#include <circle/types.h>
+
+/// \brief Waits for any of multiple sockets to become ready (like poll())
+/// \details This allows one task to serve many clients. The task is blocked, until\n
+///	     a socket in the set can receive data or has a pending connection to be\n
+///	     accepted (POLLIN), can send data without blocking (POLLOUT), has an error\n
+///	     (POLLERR) or has been closed (POLLHUP).
+/// \note A socket can be member of one set only and must be removed from the set,\n
+///	  before it is deleted.
+class CSocketSet
+{
+public:
+	/// \param nMaxSockets Maximum number of sockets in the set
+	CSocketSet (unsigned nMaxSockets);
+
+	~CSocketSet (void);
+
+	/// \brief Add a socket to the set, or modify the events of a socket in the set
+	/// \param pSocket Pointer to the socket
+	/// \param nEvents POLLIN and/or POLLOUT (POLLERR and POLLHUP are always reported)
+	/// \return Operation successful? (FALSE, if the set is full)
+	boolean Add (CSocket *pSocket, unsigned nEvents = POLLIN);
+
+	/// \brief Remove a socket from the set
+	/// \param pSocket Pointer to the socket
+	void Remove (CSocket *pSocket);
+
+	/// \return Number of sockets in the set
+	unsigned GetCount (void) const;
+
+	/// \brief Wait until at least one socket in the set is ready
+	/// \param nTimeoutMs Timeout in milliseconds (0 to poll, < 0 to wait infinitely)
+	/// \return Number of ready sockets (0 on timeout)
+	int Wait (int nTimeoutMs = -1);
+
+	/// \brief Get a ready socket after Wait()
+	/// \param nIndex Index of the ready socket (0 .. return value of Wait()-1)
+	/// \param pEvents Events, which occurred on the socket, will be returned here (may be 0)
+	/// \return Pointer to the socket
+	/// \note The result of Wait() remains valid, when sockets are added or removed.
+	CSocket *GetReady (unsigned nIndex, unsigned *pEvents = 0) const;
+
+private:
+	unsigned m_nMaxSockets;
+	unsigned m_nSockets;
+
+	struct TEntry
+	{
+		CSocket	*pSocket;
+		unsigned nEvents;
+	};
+
+	TEntry *m_pEntry;			// requested events
+	TEntry *m_pReady;			// returned events
+	unsigned m_nReady;
+
+	CSynchronizationEvent m_Event;
+};
+
+#endif
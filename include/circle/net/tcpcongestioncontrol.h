@@ -0,0 +1,102 @@
+//
+// tcpcongestioncontrol.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpcongestioncontrol_h
+#define _circle_net_tcpcongestioncontrol_h
+
+#include <circle/sysconfig.h>
+#include <circle/types.h>
+
+#define TCP_SSTHRESH_INFINITE	0xFFFFFFFFU	///< initial slow start threshold
+
+/// \brief Base class of TCP congestion control algorithms
+/// \details The loss recovery (fast retransmit, fast recovery with NewReno partial ACK\n
+///	     handling, RFC 5681 and RFC 6582) is common to all algorithms and implemented\n
+///	     here. Derived classes define the window growth on new ACKs and the window\n
+///	     reduction on loss. All window sizes are given in bytes.
+class CTCPCongestionControl
+{
+public:
+	CTCPCongestionControl (void);
+	virtual ~CTCPCongestionControl (void);
+
+	/// \return Name of the algorithm
+	virtual const char *GetName (void) const = 0;
+
+	/// \brief Set the initial window (RFC 5681 section 3.1)
+	/// \param nMSS Send maximum segment size of the connection
+	/// \note Called, when the connection has been established
+	virtual void Initialize (unsigned nMSS);
+
+	/// \brief Continue with the window of another algorithm, which has been used before
+	/// \param pPrevious Pointer to the previously used algorithm
+	void Inherit (const CTCPCongestionControl *pPrevious);
+
+	/// \brief New data has been acknowledged outside of fast recovery
+	/// \param nBytesAcked Number of newly acknowledged bytes
+	/// \param nFlightSize Number of outstanding bytes before this ACK
+	virtual void DataAcknowledged (unsigned nBytesAcked, unsigned nFlightSize) = 0;
+
+	/// \brief Three duplicate ACKs have been received, fast recovery begins
+	/// \param nFlightSize Number of outstanding bytes
+	void EnterRecovery (unsigned nFlightSize);
+	/// \brief A further duplicate ACK has been received in fast recovery
+	void DuplicateAck (void);
+	/// \brief Only a part of the data, sent before fast recovery began, has been acknowledged
+	/// \param nBytesAcked Number of newly acknowledged bytes
+	void PartialAck (unsigned nBytesAcked);
+	/// \brief All data, sent before fast recovery began, has been acknowledged
+	/// \param nFlightSize Number of outstanding bytes after this ACK
+	void ExitRecovery (unsigned nFlightSize);
+
+	/// \brief The retransmission timer has expired
+	/// \param nFlightSize Number of outstanding bytes
+	void RetransmissionTimeout (unsigned nFlightSize);
+
+	/// \return Congestion window (cwnd)
+	unsigned GetWindow (void) const		{ return m_nCongestionWindow; }
+	/// \return Slow start threshold (ssthresh)
+	unsigned GetSlowStartThreshold (void) const { return m_nSlowStartThreshold; }
+
+	/// \brief Create an instance of a congestion control algorithm
+	/// \param pName Name of the algorithm ("newreno" or "cubic")
+	/// \return Pointer to the new object, 0 if the name is unknown
+	static CTCPCongestionControl *Create (const char *pName = TCP_CONGESTION_CONTROL);
+
+	/// \param pName Name of an algorithm
+	/// \return Constant name string of the algorithm, 0 if the name is unknown
+	/// \note The returned pointer remains valid and can be compared with other ones.
+	static const char *FindAlgorithm (const char *pName);
+
+protected:
+	/// \brief Loss has been detected, update the algorithm state
+	/// \param nFlightSize Number of outstanding bytes
+	/// \return New slow start threshold
+	virtual unsigned LossDetected (unsigned nFlightSize) = 0;
+
+	/// \brief Increase the window in slow start (RFC 3465 with L = 2*SMSS)
+	void SlowStart (unsigned nBytesAcked);
+
+protected:
+	unsigned m_nMSS;
+	unsigned m_nCongestionWindow;
+	unsigned m_nSlowStartThreshold;
+};
+
+#endif
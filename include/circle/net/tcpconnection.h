@@ -2,7 +2,7 @@
 // tcpconnection.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2024  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -27,6 +27,7 @@
 #include <circle/net/netqueue.h>
 #include <circle/net/retransmissionqueue.h>
 #include <circle/net/retranstimeoutcalc.h>
+#include <circle/net/tcpcongestioncontrol.h>
 #include <circle/sched/synchronizationevent.h>
 #include <circle/timer.h>
 #include <circle/spinlock.h>
@@ -55,7 +56,11 @@ enum TTCPTimer
 	TCPTimerUnknown
 };
 
+#define TCP_MAX_OUT_OF_ORDER_SEGMENTS	64	// segments held back until the gap is filled
+#define TCP_SACK_SCOREBOARD_SIZE	8	// ranges reported by the receiver as SACKed
+
 struct TTCPHeader;
+struct TTCPOptions;
 
 class CTCPConnection : public CNetConnection
 {
@@ -83,16 +88,28 @@ public:
 		    const CIPAddress &rForeignIP, u16 nForeignPort);
 	int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort);
 
+	int SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+	int ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+
 	int SetOptionBroadcast (boolean bAllowed);
+	int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize);
+	int SetOptionCongestionControl (const char *pAlgorithm);
+
+	int GetStatistics (TTCPStatistics *pStatistics);
 
 	boolean IsConnected (void) const;
 	boolean IsTerminated (void) const;
+	boolean IsWildcard (void) const;
+
+	unsigned GetPollEvents (void) const;
 	
 	void Process (void);
 	
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
 	int PacketReceived (const void *pPacket, unsigned nLength,
 			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
+	int PacketReceived (CNetBuffer *pBuffer,
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
 
 	// returns: 0: not to me, 1: notification consumed
 	int NotificationReceived (TICMPNotificationType Type,
@@ -104,9 +121,30 @@ private:
 	boolean SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber = 0,
 			     const void *pData = 0, unsigned nDataLength = 0);
 
-	void ScanOptions (TTCPHeader *pHeader);
+	void ScanOptions (TTCPHeader *pHeader, TTCPOptions *pOptions);
+	void NegotiateOptions (const TTCPOptions *pOptions);	// on received SYN
+
+	boolean UpdateReceiveWindow (void);			// TRUE if right edge moved
+
+	boolean QueueReceivedData (const u8 *pData, unsigned nLength);	// FALSE if queue is full
+	boolean QueueReceivedBuffer (CNetBuffer *pBuffer);		// releases pBuffer on failure
+	// returns number of bytes copied from m_pRxPartial and m_RxQueue
+	unsigned DequeueReceivedData (const TSocketIOVec *pIOVec, unsigned nIOVecCount);
+	boolean QueueOutOfOrderData (u32 nSequenceNumber, const u8 *pData, unsigned nLength);
+	void DequeueOutOfOrderData (void);			// move segments following m_nRCV_NXT
+	void FlushOutOfOrderData (void);
+	unsigned GetSACKBlocks (u32 *pLeft, u32 *pRight, unsigned nMaxBlocks) const;
+
+	void UpdateScoreboard (const TTCPOptions *pOptions);	// after m_nSND_UNA has been updated
+
+	unsigned GetSendMSS (void) const;			// payload size of a data segment
+	void StartCongestionControl (void);			// on entering TCPStateEstablished
+	void RetransmitFirstSegment (void);			// fast retransmit at m_nSND_UNA
 	
 	u32 CalculateISN (void);
+
+	void SetEvent (void);			// set m_Event and signal the poll event
+	void SetTxEvent (void);			// set m_TxEvent and signal the poll event
 	
 	void StartTimer (unsigned nTimer, unsigned nHZ);
 	void StopTimer (unsigned nTimer);
@@ -127,8 +165,23 @@ private:
 
 	CNetQueue m_TxQueue;
 	CNetQueue m_RxQueue;
+	volatile int m_nRxQueueBytes;		// data bytes in m_RxQueue
+	volatile unsigned m_nRxBufferSize;	// determines the receive window
+	volatile boolean m_bWindowUpdate;	// user has read data, window may be opened
+	CNetBuffer *m_pRxBuffer;		// holds the currently received segment
+	CNetBuffer *m_pRxPartial;		// segment, which has been read partially
+
+	struct TOutOfOrderSegment		// sorted by sequence number
+	{
+		u32	    nSequenceNumber;
+		CNetBuffer *pBuffer;		// reduced to the payload
+	}
+	m_OutOfOrderQueue[TCP_MAX_OUT_OF_ORDER_SEGMENTS];
+	unsigned m_nOutOfOrderSegments;
+	u32 m_nLastOutOfOrderSequence;		// reported in the first SACK block
 
 	CRetransmissionQueue m_RetransmissionQueue;
+	volatile unsigned m_nTxBufferSize;	// applied, when m_RetransmissionQueue is empty
 	volatile boolean m_bRetransmit;		// reset m_RetransmissionQueue and send
 	volatile boolean m_bSendSYN;		// send SYN when in TCPStateSynSent or TCPStateSynReceived
 	volatile boolean m_bFINQueued;		// send FIN when TX and retransmission queues are empty
@@ -159,6 +212,41 @@ private:
 	//u16 m_nRCV_UP;	// receive urgent pointer
 	u32 m_nIRS;		// initial receive sequence number
 
+	u32 m_nRCV_ADV;		// right edge of the advertised receive window
+
+	// Window Scale and Timestamps Options (RFC 7323)
+	boolean m_bWindowScale;	// offered or negotiated
+	unsigned m_nSND_WND_SHIFT;
+	unsigned m_nRCV_WND_SHIFT;
+	boolean m_bTimestamps;	// offered or negotiated
+	u32 m_nTS_RECENT;	// timestamp to be echoed
+	u32 m_nLAST_ACK_SENT;
+
+	// Selective Acknowledgment Option (RFC 2018)
+	boolean m_bSACKPermitted;	// offered or negotiated
+	struct TSACKBlock
+	{
+		u32 nLeft;
+		u32 nRight;
+	}
+	m_Scoreboard[TCP_SACK_SCOREBOARD_SIZE];
+	unsigned m_nScoreboardBlocks;
+	boolean m_bTimeoutRetransmit;	// go-back-N since m_nSND_UNA advanced last time
+
+	// Congestion Control (RFC 5681, RFC 6582)
+	CTCPCongestionControl *m_pCongestionControl;
+	const char *volatile m_pCongestionControlRequest;	// algorithm to be selected
+	CSpinLock m_CongestionControlSpinLock;	// protects m_pCongestionControl on exchange
+	u32 m_nSND_MAX;		// highest sequence number sent (before go-back-N)
+	unsigned m_nDupAcks;
+	boolean m_bInRecovery;	// fast recovery
+	u32 m_nRecover;		// m_nSND_MAX, when entering fast recovery
+
+	// Statistics
+	unsigned m_nRetransmittedSegments;
+	unsigned m_nFastRetransmits;
+	unsigned m_nRetransmissionTimeouts;
+
 	// Other Variables
 	u16 m_nSND_MSS;		// send maximum segment size
 
@@ -0,0 +1,59 @@
+//
+// tcpcubic.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpcubic_h
+#define _circle_net_tcpcubic_h
+
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/timer.h>
+#include <circle/types.h>
+
+/// \brief CUBIC congestion control for fast and long-distance networks (RFC 9438)
+/// \details The window grows with a cubic function of the time since the last\n
+///	     congestion event, which is independent of the RTT. In the Reno-friendly\n
+///	     region the window grows at least as fast as with NewReno.
+class CTCPCubic : public CTCPCongestionControl
+{
+public:
+	CTCPCubic (void);
+	~CTCPCubic (void);
+
+	const char *GetName (void) const;
+
+	void Initialize (unsigned nMSS);
+
+	void DataAcknowledged (unsigned nBytesAcked, unsigned nFlightSize);
+
+private:
+	unsigned LossDetected (unsigned nFlightSize);
+
+	static float CubeRoot (float fValue);
+
+private:
+	CTimer *m_pTimer;
+
+	// all windows in segments
+	float m_fWMax;			// window before the last reduction
+	float m_fK;			// seconds until the window reaches m_fWMax again
+	float m_fWEst;			// window of a Reno flow, for the Reno-friendly region
+	unsigned m_nEpochStart;		// ticks, 0 if not in congestion avoidance epoch
+	float m_fIncrease;		// pending window increase in bytes (< 1)
+};
+
+#endif
@@ -0,0 +1,47 @@
+//
+// tcpnewreno.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpnewreno_h
+#define _circle_net_tcpnewreno_h
+
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/types.h>
+
+/// \brief TCP congestion control with additive increase, multiplicative decrease\n
+///	   (RFC 5681, with the NewReno modification of RFC 6582)
+class CTCPNewReno : public CTCPCongestionControl
+{
+public:
+	CTCPNewReno (void);
+	~CTCPNewReno (void);
+
+	const char *GetName (void) const;
+
+	void Initialize (unsigned nMSS);
+
+	void DataAcknowledged (unsigned nBytesAcked, unsigned nFlightSize);
+
+private:
+	unsigned LossDetected (unsigned nFlightSize);
+
+private:
+	unsigned m_nBytesAcked;		// in congestion avoidance, since last increase
+};
+
+#endif
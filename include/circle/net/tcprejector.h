@@ -48,8 +48,11 @@ public:
 	int ReceiveFrom (void *pBuffer, int nFlags,
 			 CIPAddress *pForeignIP, u16 *pForeignPort)	{ return -1; }
 	int SetOptionBroadcast (boolean bAllowed)			{ return -1; }
+	int SetOptionBufferSizes (unsigned nRxBufferSize,
+				  unsigned nTxBufferSize)		{ return -1; }
 	boolean IsConnected (void) const				{ return FALSE; }
 	boolean IsTerminated (void) const				{ return FALSE; }
+	boolean IsWildcard (void) const					{ return TRUE; }
 	void Process (void)						{ }
 	int NotificationReceived (TICMPNotificationType Type,
 				  CIPAddress &rSenderIP, CIPAddress &rReceiverIP,
@@ -0,0 +1,39 @@
+//
+// tcpstatistics.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_net_tcpstatistics_h
+#define _circle_net_tcpstatistics_h
+
+#include <circle/types.h>
+
+/// \brief Counters and state of a TCP connection, which can be used for monitoring
+struct TTCPStatistics
+{
+	const char *pCongestionControl;		///< name of the congestion control algorithm
+	unsigned nCongestionWindow;		///< cwnd in bytes
+	unsigned nSlowStartThreshold;		///< ssthresh in bytes (0xFFFFFFFF if not set yet)
+	unsigned nSendWindow;			///< window advertised by the peer in bytes
+	unsigned nFlightSize;			///< sent, but not acknowledged bytes
+	unsigned nRTO;				///< retransmission timeout in HZ units
+	unsigned nRetransmittedSegments;	///< all retransmitted data segments
+	unsigned nFastRetransmits;		///< on three duplicate ACKs
+	unsigned nRetransmissionTimeouts;	///< expired retransmission timer
+};
+
+#endif
@@ -55,6 +55,9 @@ public:
 	virtual int FileRead (void *pBuffer, unsigned nCount) = 0;
 	virtual int FileWrite (const void *pBuffer, unsigned nCount) = 0;
 
+	// returns the size of the file opened with FileOpen(), -1 if unknown ("tsize" option)
+	virtual int FileSize (void) { return -1; }
+
 	virtual boolean IsAccessAllowed (const CIPAddress *pForeignIP,
 					 const char *pFilename,
 					 boolean bWriteRequest) { return TRUE; }
@@ -65,6 +68,14 @@ private:
 	boolean DoRead (const char *pFileName);
 	boolean DoWrite (const char *pFileName);
 
+	// options from RFC 2348 (blksize), RFC 2349 (tsize) and RFC 7440 (windowsize)
+	void ParseOptions (const char *pOptions, const char *pEnd);
+	boolean SendOptionAck (void);
+
+	boolean SendAck (u16 usBlockNumber);
+	// returns the block number from a received ACK, -1 on timeout, -2 on error
+	int ReceiveAck (unsigned nTimeout);
+
 	// use m_pRequestSocket, if pSendTo/nPort are given; m_pTransferSocket otherwise
 	void SendError (u16 usErrorCode, const char *pErrorMessage,
 			CIPAddress *pSendTo = 0, u16 usPort = 0);
@@ -76,6 +87,15 @@ protected:
 	CSocket *m_pTransferSocket;
 
 	char m_Filename[MaxFilenameLen+1];
+
+private:
+	unsigned m_nBlockSize;
+	unsigned m_nWindowSize;			// number of blocks per ACK
+	unsigned m_nTransferSize;
+
+	boolean m_bBlockSizeOption;		// options to be acknowledged
+	boolean m_bWindowSizeOption;
+	boolean m_bTransferSizeOption;
 };
 
 #endif
@@ -31,6 +31,12 @@
 #include <circle/spinlock.h>
 #include <circle/types.h>
 
+#define TRANSPORT_HASH_BITS		8	// connections by protocol, own and foreign address
+#define TRANSPORT_WILDCARD_HASH_BITS	6	// connections by protocol and own port only
+
+#define OWN_PORT_MIN	60000			// for dynamic port assignment
+#define OWN_PORT_MAX	60999
+
 class CTransportLayer
 {
 public:
@@ -64,13 +70,40 @@ public:
 	int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP,
 			 u16 *pForeignPort, int hConnection);
 
+	int SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags, int hConnection);
+	int ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags, int hConnection);
+
+	int SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags, int hConnection);
+	int ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags, int hConnection);
+
 	int SetOptionBroadcast (boolean bAllowed, int hConnection);
+	int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize, int hConnection);
+	int SetOptionCongestionControl (const char *pAlgorithm, int hConnection);
+
+	int GetStatistics (TTCPStatistics *pStatistics, int hConnection);
+
+	// returns: mask of POLL* flags, pEvent will be set on changes (0 to remove it)
+	unsigned Poll (CSynchronizationEvent *pEvent, int hConnection);
 
 	boolean IsConnected (int hConnection) const;
 	const u8 *GetForeignIP (int hConnection) const;		// returns 0 if not connected
 
 	void ListConnections (CDevice *pTarget);
 
+private:
+	// returns: connection, which has consumed the packet, or 0
+	CNetConnection *PacketReceived (CNetBuffer *pBuffer, CIPAddress &rSenderIP,
+					CIPAddress &rReceiverIP, int nProtocol);
+
+	// following methods must be called with m_SpinLock acquired
+	void AddConnection (unsigned nIndex, CNetConnection *pConnection);
+	void RemoveConnection (unsigned nIndex);
+	void InsertHash (CNetConnection *pConnection);
+	void RemoveHash (CNetConnection *pConnection);
+
+	static unsigned Hash (int nProtocol, u16 nOwnPort, u32 nForeignIP, u16 nForeignPort);
+	static unsigned WildcardHash (int nProtocol, u16 nOwnPort);
+
 private:
 	CNetConfig    *m_pNetConfig;
 	CNetworkLayer *m_pNetworkLayer;
@@ -79,6 +112,12 @@ private:
 	u16 m_nOwnPort;
 	CSpinLock m_SpinLock;
 
+	CNetConnection *m_pHashTable[1 << TRANSPORT_HASH_BITS];
+	CNetConnection *m_pWildcardHashTable[1 << TRANSPORT_WILDCARD_HASH_BITS];
+	u16 m_nOwnPortUsers[OWN_PORT_MAX-OWN_PORT_MIN+1];	// connections using a dynamic port
+
+	unsigned m_nLastSweepTicks;
+
 	CTCPRejector m_TCPRejector;
 };
 
@@ -53,16 +53,28 @@ public:
 		    const CIPAddress &rForeignIP, u16 nForeignPort);
 	int ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort);
 
+	int SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+	int ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags);
+
+	int SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags);
+	int ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags);
+
 	int SetOptionBroadcast (boolean bAllowed);
+	int SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize);
 
 	boolean IsConnected (void) const;
 	boolean IsTerminated (void) const;
+	boolean IsWildcard (void) const;
+
+	unsigned GetPollEvents (void) const;
 	
 	void Process (void);
 
 	// returns: -1: invalid packet, 0: not to me, 1: packet consumed
 	int PacketReceived (const void *pPacket, unsigned nLength,
 			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
+	int PacketReceived (CNetBuffer *pBuffer,
+			    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol);
 
 	// returns: 0: not to me, 1: notification consumed
 	int NotificationReceived (TICMPNotificationType Type,
@@ -70,10 +82,17 @@ public:
 				  u16 nSendPort, u16 nReceivePort,
 				  int nProtocol);
 
+private:
+	void SetEvent (void);			// set m_Event and signal the poll event
+
+	// returns datagram or 0 with *pResult set (0 if none available with MSG_DONTWAIT, or error)
+	CNetBuffer *DequeueDatagram (int nFlags, void **ppParam, int *pResult);
+
 private:
 	boolean m_bOpen;
 	boolean m_bActiveOpen;
 	CNetQueue m_RxQueue;
+	CNetBuffer *m_pRxBuffer;		// holds the currently received datagram
 	CSynchronizationEvent m_Event;
 	boolean m_bBroadcastsAllowed;
 
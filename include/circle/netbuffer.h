@@ -0,0 +1,177 @@
+//
+// netbuffer.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _circle_netbuffer_h
+#define _circle_netbuffer_h
+
+#include <circle/spinlock.h>
+#include <circle/synchronize.h>
+#include <circle/macros.h>
+#include <circle/types.h>
+#include <assert.h>
+
+#define NET_BUFFER_SIZE		2048		// data area, including headroom
+#define NET_BUFFER_HEADROOM	128		// default space reserved for headers
+
+#ifndef NET_BUFFER_COUNT
+#define NET_BUFFER_COUNT	256		// buffers added to the pool at once
+#endif
+
+enum TNetChecksumState		/// Result of checksum offload on reception
+{
+	NetChecksumNone,		///< checksums have to be verified in software
+	NetChecksumVerified,		///< IP header and TCP/UDP checksum have been verified
+	NetChecksumComplete		///< GetChecksum() returns the sum over the data
+};
+
+/// \brief Reference counted packet buffer, which is allocated from a pool
+/// \details A frame is received into a net buffer once and is handed over by pointer\n
+///	     through the layers of the TCP/IP stack. Each layer strips its header with\n
+///	     Pull(), so that the payload does not need to be copied. The data area\n
+///	     is cache-line aligned and can be used as DMA buffer by net device drivers.
+class CNetBuffer
+{
+public:
+	/// \brief Allocate a buffer from the pool
+	/// \param nHeadroom Number of bytes, which are reserved in front of the data
+	/// \return Pointer to the buffer with reference count 1 and length 0,\n
+	///	    0 if the pool is exhausted
+	/// \note The pool is created on the first call. When it is exhausted at task level,\n
+	///	  it is extended by NET_BUFFER_COUNT buffers. Memory of the pool is never\n
+	///	  returned to the heap.
+	static CNetBuffer *Alloc (unsigned nHeadroom = NET_BUFFER_HEADROOM);
+
+	/// \brief Allocate a buffer with a data area, which is larger than NET_BUFFER_SIZE
+	/// \param nSize Size of the data area, including headroom
+	/// \param nHeadroom Number of bytes, which are reserved in front of the data
+	/// \return Pointer to the buffer with reference count 1 and length 0,\n
+	///	    0 if the pool or the heap is exhausted
+	/// \note The data area is allocated from the heap and is returned to it on the\n
+	///	  final Release(). Must be called at TASK_LEVEL.
+	static CNetBuffer *AllocLarge (unsigned nSize, unsigned nHeadroom = 0);
+
+	/// \brief Increment the reference count
+	void AddRef (void);
+	/// \brief Decrement the reference count, return buffer to the pool if it drops to 0
+	void Release (void);
+
+	/// \return Pointer to the valid data
+	u8 *GetData (void) const		{ return m_pData + m_nOffset; }
+	/// \return Number of valid data bytes
+	unsigned GetLength (void) const		{ return m_nLength; }
+
+	/// \return Number of free bytes in front of the data
+	unsigned GetHeadroom (void) const	{ return m_nOffset; }
+	/// \return Number of free bytes behind the data
+	unsigned GetTailroom (void) const	{ return m_nSize - m_nOffset - m_nLength; }
+
+	/// \brief Prepend space for a header in front of the data
+	/// \return Pointer to the new start of the data
+	u8 *Push (unsigned nBytes)
+	{
+		assert (nBytes <= m_nOffset);
+		m_nOffset -= nBytes;
+		m_nLength += nBytes;
+
+		return GetData ();
+	}
+
+	/// \brief Remove a header from the start of the data
+	/// \return Pointer to the new start of the data
+	u8 *Pull (unsigned nBytes)
+	{
+		assert (nBytes <= m_nLength);
+		m_nOffset += nBytes;
+		m_nLength -= nBytes;
+
+		return GetData ();
+	}
+
+	/// \brief Append space to the end of the data
+	/// \return Pointer to the appended space
+	u8 *Put (unsigned nBytes)
+	{
+		assert (nBytes <= GetTailroom ());
+		u8 *pTail = GetData () + m_nLength;
+		m_nLength += nBytes;
+
+		return pTail;
+	}
+
+	/// \brief Cut the data to the given length
+	/// \note A complete checksum does not cover the data any more, if it has been cut.
+	void Trim (unsigned nLength)
+	{
+		assert (nLength <= m_nLength);
+		if (   nLength < m_nLength
+		    && m_ChecksumState == NetChecksumComplete)
+		{
+			m_ChecksumState = NetChecksumNone;
+		}
+
+		m_nLength = nLength;
+	}
+
+	/// \brief Mark the checksums of a received packet as verified by the net device
+	void SetChecksumVerified (void)		{ m_ChecksumState = NetChecksumVerified; }
+	/// \brief Set the ones' complement sum over the data behind the link layer header
+	/// \param nSum 16-bit sum, as it is calculated from little endian words
+	/// \note The sum remains valid, when a header with a valid IPv4 style checksum\n
+	///	  is pulled, because such a header sums up to zero.
+	void SetChecksumComplete (u16 nSum)
+	{
+		m_ChecksumState = NetChecksumComplete;
+		m_nChecksum = nSum;
+	}
+
+	/// \return Checksum offload result, which has been set by the net device driver
+	TNetChecksumState GetChecksumState (void) const	{ return m_ChecksumState; }
+	/// \return Sum over the data, if the state is NetChecksumComplete
+	u16 GetChecksum (void) const		{ return m_nChecksum; }
+
+	/// \return Number of currently free buffers in the pool
+	static unsigned GetFreeCount (void);
+
+private:
+	CNetBuffer (void) {}
+	~CNetBuffer (void) {}
+
+	static boolean ExtendPool (void);
+
+private:
+	u8 m_Buffer[NET_BUFFER_SIZE] ALIGN (DATA_CACHE_LINE_LENGTH_MAX);  // must be first
+
+	u8 *m_pData;				// m_Buffer or heap block
+	unsigned m_nSize;			// size of the data area
+
+	volatile int m_nRefCount;
+	unsigned m_nOffset;
+	unsigned m_nLength;
+
+	TNetChecksumState m_ChecksumState;
+	u16 m_nChecksum;
+
+	CNetBuffer *m_pNext;			// in free list
+
+	static CNetBuffer *s_pFreeList;
+	static unsigned s_nFreeCount;
+	static CSpinLock s_SpinLock;
+};
+
+#endif
@@ -21,12 +21,17 @@
 #define _circle_netdevice_h
 
 #include <circle/macaddress.h>
+#include <circle/netbuffer.h>
 #include <circle/types.h>
 
 #define FRAME_BUFFER_SIZE	1600
 
 #define MAX_NET_DEVICES		5
 
+// checksum offload capabilities (returned by GetChecksumOffload())
+#define NET_CHECKSUM_OFFLOAD_TX	(1 << 0)	// inserts TCP/UDP checksums of IPv4 frames
+#define NET_CHECKSUM_OFFLOAD_RX	(1 << 1)	// reports checksum state of received frames
+
 enum TNetDeviceType
 {
 	NetDeviceTypeEthernet,
@@ -46,9 +51,12 @@ enum TNetDeviceSpeed
 	NetDeviceSpeedUnknown
 };
 
+typedef void TNetDeviceEventHandler (void *pParam);
+
 class CNetDevice	/// Base class (interface) of net devices
 {
 public:
+	CNetDevice (void) : m_pEventHandler (0), m_pEventParam (0) {}
 	virtual ~CNetDevice (void) {}
 
 	/// \return Type of this net device
@@ -73,6 +81,21 @@ public:
 	/// \return TRUE if a frame is returned in buffer, FALSE if nothing has been received
 	virtual boolean ReceiveFrame (void *pBuffer, unsigned *pResultLength) = 0;
 
+	/// \brief Poll for a received Ethernet frame, which is returned in a net buffer
+	/// \return Pointer to the buffer (reference is passed to the caller),\n
+	///	    0 if nothing has been received or no buffer is available
+	/// \note The default implementation copies the frame from ReceiveFrame().\n
+	///	  Drivers, which receive directly into net buffers, override this.
+	virtual CNetBuffer *ReceiveNetBuffer (void);
+
+	/// \return Checksum offload capabilities (NET_CHECKSUM_OFFLOAD_* flags)
+	/// \note With NET_CHECKSUM_OFFLOAD_TX the device has to insert the TCP/UDP checksum\n
+	///	  into all sent IPv4 frames, which are not fragmented. The checksum field\n
+	///	  contains the (not complemented) sum over the pseudo header then.\n
+	///	  With NET_CHECKSUM_OFFLOAD_RX ReceiveNetBuffer() sets the checksum state\n
+	///	  of the returned buffer.
+	virtual unsigned GetChecksumOffload (void) const	{ return 0; }
+
 	/// \return TRUE if PHY link is up
 	virtual boolean IsLinkUp (void)			{ return TRUE; }
 
@@ -84,6 +107,15 @@ public:
 	/// \note This is called continuously every 2 seconds by the net PHY task
 	virtual boolean UpdatePHY (void)		{ return FALSE; }
 
+	/// \return TRUE if this device calls the event handler on frame reception and\n
+	///	    transmit completion, otherwise it has to be polled continuously
+	virtual boolean IsEventDriven (void)		{ return FALSE; }
+
+	/// \param pHandler Handler to be called, when a frame has been received or sent
+	/// \param pParam User parameter to be handed over to the handler
+	/// \note The handler may be called from interrupt context.
+	void RegisterEventHandler (TNetDeviceEventHandler *pHandler, void *pParam = 0);
+
 	/// \param Speed A value returned by GetLinkSpeed()
 	/// \return Description for this speed value
 	static const char *GetSpeedString (TNetDeviceSpeed Speed);
@@ -99,7 +131,29 @@ public:
 protected:
 	void AddNetDevice (void);
 
+	/// \brief Locate the TCP/UDP checksum in an Ethernet frame for checksum offload
+	/// \param pFrame Pointer to the Ethernet frame
+	/// \param nLength Frame length in bytes
+	/// \param pStart Offset of the TCP/UDP header in the frame will be returned here
+	/// \param pbUDP TRUE will be returned here, if it is an UDP datagram
+	/// \return Offset of the checksum field in the frame,\n
+	///	    0 if it is not a TCP/UDP over IPv4 frame or if it is fragmented
+	static unsigned GetChecksumOffset (const void *pFrame, unsigned nLength,
+					   unsigned *pStart, boolean *pbUDP);
+
+	/// \brief Call the registered event handler (if any)
+	void SignalEvent (void)
+	{
+		if (m_pEventHandler != 0)
+		{
+			(*m_pEventHandler) (m_pEventParam);
+		}
+	}
+
 private:
+	TNetDeviceEventHandler *volatile m_pEventHandler;
+	void *m_pEventParam;
+
 	static unsigned s_nDeviceNumber;
 	static CNetDevice *s_pDevice[MAX_NET_DEVICES];
 
@@ -28,7 +28,12 @@
 
 typedef void TSchedulerTaskHandler (CTask *pTask);
 
-/// \note This scheduler uses the round-robin policy, without priorities.
+/// \note This scheduler runs the ready task with the highest priority (see CTask::SetPriority()).\n
+///	  Tasks with the same priority are scheduled using the round-robin policy.
+/// \note With ARM_ALLOW_MULTI_CORE each core has its own ready queues. The scheduler runs on\n
+///	  core 0 and on each secondary core, which calls RunSecondaryCore(). Tasks are pinned\n
+///	  to core 0 by default (see CTask::SetCoreAffinity()). A core, which has no ready task,\n
+///	  steals a ready task, which is allowed to run on any core, from the other cores.
 
 class CScheduler /// Cooperative non-preemtive scheduler, which controls which task runs at a time
 {
@@ -47,9 +52,16 @@ public:
 	/// \param nMicroSeconds Number of microseconds, the current task will be sleep
 	void usSleep (unsigned nMicroSeconds);
 
-	/// \return Pointer to the CTask object of the currently running task
+	/// \return Pointer to the CTask object of the task currently running on this core
 	CTask *GetCurrentTask (void);
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	/// \brief Run tasks on this secondary core, never returns
+	/// \note Has to be called from CMultiCoreSupport::Run() on the cores 1..CORES-1,\n
+	///	  which should take part in scheduling.
+	void RunSecondaryCore (void);
+#endif
+
 	/// \param pTaskName Task name to look for
 	/// \return Pointer to the CTask object of the task with the given name (0 if not found)
 	CTask *GetTask (const char *pTaskName);
@@ -90,21 +102,53 @@ public:
 
 private:
 	void AddTask (CTask *pTask);
+	void StartTask (CTask *pTask);
+	void SuspendTask (CTask *pTask);
+	void SetTaskPriority (CTask *pTask, unsigned nPriority);
+	void SetTaskAffinity (CTask *pTask, unsigned nCore);
+	void FinishTaskSwitch (void);	// must be called after each TaskSwitch()
 	friend class CTask;
 
-	boolean BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds);
+	// returns FALSE without blocking, if *pState is set
+	boolean BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds,
+			   const volatile boolean *pState);
 	void WakeTasks (CTask **ppWaitListHead); // can be called from interrupt context
 	friend class CSynchronizationEvent;
 
 	void RemoveTask (CTask *pTask);
-	unsigned GetNextTask (void); // returns index into m_pTask or MAX_TASKS if no task was found
+	void ReapTerminatedTasks (void);
+
+	// must be called with spin lock acquired
+	boolean IsRunning (CTask *pTask) const;
+	CTask *GetNextTask (unsigned nCore);	// returns 0 if no task is ready
+	CTask *FindReadyTask (unsigned nQueueCore, unsigned nCore);
+	void EnqueueReady (CTask *pTask);
+	void DequeueReady (CTask *pTask);
+	void EnqueueSleeping (CTask *pTask);
+	void DequeueSleeping (CTask *pTask);
+	void WakeSleepingTasks (void);
 
 private:
-	CTask *m_pTask[MAX_TASKS];
+	CTask *m_pFirstTask;		// list of all tasks
+	CTask *m_pLastTask;
 	unsigned m_nTasks;
 
-	CTask *m_pCurrent;
-	unsigned m_nCurrent;	// index into m_pTask
+	CTask *m_pCurrent[SCHED_CORES];
+	CTask *m_pPrevious[SCHED_CORES];	// task switched away from, until FinishTaskSwitch()
+	CTask *m_pIdleTask[SCHED_CORES];	// secondary cores only
+
+	struct TTaskQueue
+	{
+		CTask *pHead;
+		CTask *pTail;
+	};
+
+	TTaskQueue m_ReadyQueue[SCHED_CORES][TASK_PRIORITIES];
+	volatile u32 m_nReadyMask[SCHED_CORES];	// bit n is set, if m_ReadyQueue[][n] is not empty
+
+	CTask *m_pSleepingQueue;	// ordered by wake ticks (sleeping or blocked with timeout)
+	volatile unsigned m_nNextWakeTicks;	// wake ticks of the head of m_pSleepingQueue
+	CTask *m_pTerminatedQueue;
 
 	TSchedulerTaskHandler *m_pTaskSwitchHandler;
 	TSchedulerTaskHandler *m_pTaskTerminationHandler;
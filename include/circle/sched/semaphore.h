@@ -21,6 +21,7 @@
 #define _circle_sched_semaphore_h
 
 #include <circle/sched/synchronizationevent.h>
+#include <circle/spinlock.h>
 #include <circle/types.h>
 
 class CSemaphore	/// Implements a semaphore synchronization class
@@ -48,7 +49,8 @@ public:
 private:
 	volatile int m_nCount;
 
-	CSynchronizationEvent m_Event;
+	CSynchronizationEvent m_Event;		// set, while m_nCount > 0
+	CSpinLock m_SpinLock;			// Up() may be called on another core
 };
 
 #endif
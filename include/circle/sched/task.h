@@ -26,6 +26,12 @@
 #include <circle/string.h>
 #include <circle/types.h>
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	#define SCHED_CORES	CORES
+#else
+	#define SCHED_CORES	1
+#endif
+
 enum TTaskState
 {
 	TaskStateNew,
@@ -61,6 +67,31 @@ public:
 	/// \return Is task suspended from running?
 	boolean IsSuspended (void) const	{ return m_bSuspended; }
 
+#define TASK_PRIORITY_LOWEST		0
+#define TASK_PRIORITY_DEFAULT		3	// all tasks are created with this priority
+#define TASK_PRIORITY_HIGHEST		7
+#define TASK_PRIORITIES			8	// number of priority levels
+	/// \brief Set the scheduling priority of this task
+	/// \param nPriority TASK_PRIORITY_LOWEST..TASK_PRIORITY_HIGHEST
+	/// \note On Yield() or when the running task blocks, the ready task with the\n
+	///	  highest priority gets control. Tasks of the same priority run round-robin.
+	/// \note A task with a higher priority than other tasks must block or sleep\n
+	///	  from time to time, otherwise tasks with a lower priority will never run.
+	void SetPriority (unsigned nPriority);
+	/// \return Scheduling priority of this task
+	unsigned GetPriority (void) const	{ return m_nPriority; }
+
+#define TASK_CORE_ANY			SCHED_CORES	// task may run on any core
+	/// \brief Select the CPU core(s), on which this task is allowed to run
+	/// \param nCore Core number (0..SCHED_CORES-1) or TASK_CORE_ANY (default: 0)
+	/// \note Tasks run on other cores than 0 only with ARM_ALLOW_MULTI_CORE,\n
+	///	  when CScheduler::RunSecondaryCore() has been called on these cores.
+	/// \note Only tasks, which do not use classes, which are restricted to\n
+	///	  core 0, should be made migratable with TASK_CORE_ANY.
+	void SetCoreAffinity (unsigned nCore);
+	/// \return Core number (0..SCHED_CORES-1) or TASK_CORE_ANY
+	unsigned GetCoreAffinity (void) const	{ return m_nAffinity; }
+
 	/// \brief Terminate the execution of this task
 	/// \note Callable from this task only
 	/// \note The task terminates on return from Run() too.
@@ -116,6 +147,15 @@ private:
 	void		   *m_pUserData[TASK_USER_DATA_SLOTS];
 	CSynchronizationEvent m_Event;
 	CTask		   *m_pWaitListNext;	// next in list of tasks waiting on an event
+
+	unsigned	    m_nPriority;
+	unsigned	    m_nAffinity;
+	unsigned	    m_nCore;		// core, which runs or last ran this task
+	volatile boolean    m_bOnCore;		// registers are in use by a core
+	CTask		   *m_pQueuePrev;	// links in ready, sleeping or terminated queue
+	CTask		   *m_pQueueNext;
+	CTask		   *m_pTaskPrev;	// links in list of all tasks
+	CTask		   *m_pTaskNext;
 };
 
 #endif
@@ -75,17 +75,38 @@
 // (buckets). Each free list contains blocks of a specific size. On
 // block allocation the requested block size is rounded up to the
 // size of next available bucket size. If the requested size is greater
-// than the largest available bucket size, the block can be allocated,
-// but the memory space is lost, if the block will be freed later.
-// Because the block buckets have to be walked through on each allocate
-// and free operation, it is preferable to have only a few buckets.
-// With this option you can configure the bucket sizes, so that they
-// fit best for your application needs. You have to define a comma
-// separated list of increasing bucket sizes. All sizes must be a
-// multiple of 64. Up to 20 sizes can be defined.
+// than the largest available bucket size, the block is allocated from
+// a separate, address ordered list of free large blocks, where freed
+// blocks are merged with adjacent free blocks.
+// The bucket for a block size is selected using a lookup table, which
+// is generated at compile time, so the number of buckets does not
+// influence the allocation speed. More buckets reduce the memory space,
+// which is wasted by rounding up the block size, but free blocks are
+// not shared between buckets. With this option you can configure the
+// bucket sizes, so that they fit best for your application needs. You
+// have to define a comma separated list of increasing bucket sizes.
+// All sizes must be a multiple of 64. Up to 20 sizes can be defined.
 
 #ifndef HEAP_BLOCK_BUCKET_SIZES
-#define HEAP_BLOCK_BUCKET_SIZES	0x40,0x400,0x1000,0x4000,0x10000,0x40000,0x80000
+#define HEAP_BLOCK_BUCKET_SIZES	0x40,0x80,0xC0,0x100,0x180,0x200,0x300,0x400,0x600,0x800,\
+				0xC00,0x1000,0x4000,0x10000,0x40000,0x80000
+#endif
+
+// HEAP_CORE_CACHE_BLOCKS enables a per-core cache of free heap blocks,
+// which is placed in front of the buckets of the heap allocator, if
+// ARM_ALLOW_MULTI_CORE is defined. Blocks with a size up to
+// HEAP_CORE_CACHE_MAX_SIZE are allocated from and freed to the cache
+// of the calling core without acquiring the global heap spin lock.
+// This value is the maximum number of free blocks per core and bucket.
+// The cache is refilled from and returned to the global buckets in
+// batches of the half of this number. Set it to 0 to disable the cache.
+
+#ifndef HEAP_CORE_CACHE_BLOCKS
+#define HEAP_CORE_CACHE_BLOCKS	32
+#endif
+
+#ifndef HEAP_CORE_CACHE_MAX_SIZE
+#define HEAP_CORE_CACHE_MAX_SIZE	0x1000
 #endif
 
 ///////////////////////////////////////////////////////////////////////
@@ -270,12 +291,6 @@
 //
 ///////////////////////////////////////////////////////////////////////
 
-// MAX_TASKS is the maximum number of tasks in the system.
-
-#ifndef MAX_TASKS
-#define MAX_TASKS		20
-#endif
-
 // TASK_STACK_SIZE is the stack size for each task.
 
 #ifndef TASK_STACK_SIZE
@@ -462,6 +477,17 @@
 
 //#define USE_NAK_USB_FIX
 
+// TCP_CONGESTION_CONTROL selects the default congestion control
+// algorithm for TCP connections ("cubic" or "newreno"). It can be
+// modified for a specific socket with the socket option method
+// SetOptionCongestionControl(). CUBIC gives a better throughput on
+// links with a high bandwidth-delay product, NewReno is the classic
+// AIMD algorithm.
+
+#ifndef TCP_CONGESTION_CONTROL
+#define TCP_CONGESTION_CONTROL	"cubic"
+#endif
+
 ///////////////////////////////////////////////////////////////////////
 
 // GNU-C 12.x uses floating point registers for optimization. This may
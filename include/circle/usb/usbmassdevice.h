@@ -23,6 +23,7 @@
 #include <circle/usb/usbfunction.h>
 #include <circle/usb/usbendpoint.h>
 #include <circle/fs/partitionmanager.h>
+#include <circle/blockrequestqueue.h>
 #include <circle/numberpool.h>
 #include <circle/types.h>
 
@@ -48,7 +49,14 @@ public:
 	u64 GetSize (void) const;		// in bytes
 	unsigned GetCapacity (void) const;	// in blocks
 
+	boolean SubmitRequest (CBlockRequest *pRequest);
+	boolean FlushRequests (void);
+
 private:
+	int Transfer (boolean bWrite, void *pBuffer, size_t nCount, u64 ullOffset);
+	static int TransferHandler (boolean bWrite, void *pBuffer, size_t nCount,
+				    u64 ullOffset, void *pParam);
+
 	int TryRead (void *pBuffer, size_t nCount);
 	int TryWrite (const void *pBuffer, size_t nCount);
 
@@ -64,6 +72,8 @@ private:
 	unsigned m_nBlockCount;
 	u64 m_ullOffset;
 
+	CBlockRequestQueue m_RequestQueue;
+
 	CPartitionManager *m_pPartitionManager;
 
 	static CNumberPool s_DeviceNumberPool;
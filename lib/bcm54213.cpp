@@ -62,6 +62,10 @@
 
 #define RX_BUF_LENGTH			2048
 
+#if RX_BUF_LENGTH > NET_BUFFER_SIZE
+	#error RX_BUF_LENGTH must fit into a net buffer
+#endif
+
 // DMA descriptors
 #define TOTAL_DESC			256	// number of buffer descriptors (same for Rx/Tx)
 
@@ -201,6 +205,7 @@
 #define RBUF_CHK_CTRL			0x14
 #define  RBUF_RXCHK_EN			(1 << 0)
 #define  RBUF_SKIP_FCS			(1 << 4)
+#define  RBUF_L3_PARSE_DIS		(1 << 5)
 
 #define RBUF_ENERGY_CTRL		0x9C
 #define  RBUF_EEE_EN			(1 << 0)
@@ -281,6 +286,7 @@
 #define GENET_INTRL2_0_OFF		0x0200
 #define GENET_INTRL2_1_OFF		0x0240
 #define GENET_RBUF_OFF			0x0300
+#define GENET_TBUF_OFF			0x0600
 #define GENET_UMAC_OFF			0x0800
 
 // SYS block offsets and register definitions
@@ -433,6 +439,24 @@
 #define DMA_ARBITER_WRR			0x01
 #define DMA_ARBITER_SP			0x02
 
+// 64 byte status block in front of each Rx and Tx frame (with RBUF_64B_EN)
+struct TGEnetStatus64
+{
+	u32	length_status;
+	u32	ext_status;
+	u32	rx_csum;		// partial Rx checksum
+#define STATUS_RX_CSUM_MASK		0xFFFF
+	u32	unused1[9];
+	u32	tx_csum_info;		// Tx checksum info
+#define STATUS_TX_CSUM_START_SHIFT	16
+#define STATUS_TX_CSUM_PROTO_UDP	0x8000
+#define STATUS_TX_CSUM_LV		0x80000000
+	u32	unused2[3];
+}
+PACKED;
+
+#define STATUS_BLOCK_SIZE		sizeof (TGEnetStatus64)
+
 // RX/TX DMA register accessors
 enum dma_reg
 {
@@ -545,6 +569,9 @@ GENET_IO_MACRO(hfb_reg, HFB_REG_OFFSET);
 // RBUF register accessors
 GENET_IO_MACRO(rbuf, GENET_RBUF_OFF);
 
+// TBUF register accessors
+GENET_IO_MACRO(tbuf, GENET_TBUF_OFF);
+
 // more I/O helper macros
 #define rbuf_ctrl_get()			sys_readl(SYS_RBUF_FLUSH_CTRL)
 #define rbuf_ctrl_set(val)		sys_writel(val, SYS_RBUF_FLUSH_CTRL)
@@ -645,6 +672,8 @@ boolean CBcm54213Device::Initialize (void)
 	reg = umac_readl(UMAC_CMD);		// make sure we reflect the value of CRC_CMD_FWD
 	m_crc_fwd_en = !!(reg & CMD_CRC_FWD);
 
+	init_csum();				// enable checksum offload
+
 	int ret = set_hw_addr();
 	if (ret)
 	{
@@ -739,14 +768,35 @@ boolean CBcm54213Device::SendFrame (const void *pBuffer, unsigned nLength)
 		return FALSE;
 	}
 
-	u8 *pTxBuffer = new u8[ENET_MAX_MTU_SIZE];	// allocate and fill DMA buffer
-	memcpy (pTxBuffer, pBuffer, nLength);
+	// allocate and fill DMA buffer, the frame is preceded by the status block
+	u8 *pTxBuffer = new u8[STATUS_BLOCK_SIZE + ENET_MAX_MTU_SIZE];
+	TGEnetStatus64 *pStatus = (TGEnetStatus64 *) pTxBuffer;
+	memset (pStatus, 0, STATUS_BLOCK_SIZE);
+
+	u8 *pFrame = pTxBuffer + STATUS_BLOCK_SIZE;
+	memcpy (pFrame, pBuffer, nLength);
 	if (nLength < ETH_ZLEN)				// pad frame if necessary
 	{
-		memset (pTxBuffer+nLength, 0, ETH_ZLEN-nLength);
+		memset (pFrame+nLength, 0, ETH_ZLEN-nLength);
 		nLength = ETH_ZLEN;
 	}
 
+	// let the HW insert the TCP/UDP checksum, the field holds the pseudo header sum
+	u32 dma_csum = 0;
+	unsigned csum_start;
+	boolean bUDP;
+	unsigned csum_offset = GetChecksumOffset (pFrame, nLength, &csum_start, &bUDP);
+	if (csum_offset)
+	{
+		pStatus->tx_csum_info =   (csum_start << STATUS_TX_CSUM_START_SHIFT)
+					| csum_offset | STATUS_TX_CSUM_LV
+					| (bUDP ? STATUS_TX_CSUM_PROTO_UDP : 0);
+
+		dma_csum = DMA_TX_DO_CSUM;
+	}
+
+	nLength += STATUS_BLOCK_SIZE;
+
 	TGEnetCB *tx_cb_ptr = get_txcb (ring);		// get Tx control block from ring
 	assert (tx_cb_ptr != 0);
 
@@ -758,7 +808,8 @@ boolean CBcm54213Device::SendFrame (const void *pBuffer, unsigned nLength)
 	// set DMA descriptor and start transfer
 	dmadesc_set (tx_cb_ptr->bd_addr, pTxBuffer,   (nLength << DMA_BUFLENGTH_SHIFT)
 						    | (QTAG_MASK << DMA_TX_QTAG_SHIFT)
-						    | DMA_TX_APPEND_CRC | DMA_SOP | DMA_EOP);
+						    | DMA_TX_APPEND_CRC | dma_csum
+						    | DMA_SOP | DMA_EOP);
 
 	// decrement total BD count and advance our write pointer
 	ring->free_bds--;
@@ -778,11 +829,28 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 	assert (pBuffer != 0);
 	assert (pResultLength != 0);
 
+	CNetBuffer *pNetBuffer = ReceiveNetBuffer ();
+	if (pNetBuffer == 0)
+	{
+		return FALSE;
+	}
+
+	unsigned nLength = pNetBuffer->GetLength ();
+	assert (nLength <= FRAME_BUFFER_SIZE);
+	memcpy (pBuffer, pNetBuffer->GetData (), nLength);
+
+	*pResultLength = nLength;
+
+	pNetBuffer->Release ();
+
+	return TRUE;
+}
+
+CNetBuffer *CBcm54213Device::ReceiveNetBuffer (void)
+{
 	TGEnetRxRing *ring = &m_rx_rings[GENET_DESC_INDEX];	// the only supported Rx queue
 
-	// clear status before servicing to reduce spurious interrupts
-	// NOTE: Rx interrupts are not used
-	//intrl2_0_writel (UMAC_IRQ_RXDMA_DONE, INTRL2_CPU_CLEAR);
+	// NOTE: Rx interrupts only wake up the event handler, they are cleared there
 
 	unsigned p_index = rdma_ring_readl (ring->index, RDMA_PROD_INDEX);
 
@@ -803,7 +871,7 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 
 	p_index &= DMA_P_INDEX_MASK;
 
-	boolean bResult = FALSE;
+	CNetBuffer *pResult = 0;
 
 	unsigned rxpkttoprocess = (p_index - ring->c_index) & DMA_C_INDEX_MASK;
 	if (rxpkttoprocess > 0)
@@ -811,13 +879,15 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 		u32 dma_length_status;
 		u32 dma_flag;
 		int nLength;
+		TGEnetStatus64 *pStatus;
+		u16 rx_csum;
 
 		TGEnetCB *cb = &m_rx_cbs[ring->read_ptr];
 
-		u8 *pRxBuffer = rx_refill (cb);
+		CNetBuffer *pRxBuffer = rx_refill (cb);
 		if (pRxBuffer == 0)
 		{
-			CLogger::Get ()->Write (FromBcm54213, LogWarning, "Missing RX buffer!");
+			CLogger::Get ()->Write (FromBcm54213, LogWarning, "No free net buffer, frame dropped");
 
 			goto out;
 		}
@@ -832,7 +902,7 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 			CLogger::Get ()->Write (FromBcm54213, LogWarning,
 						"Dropping fragmented RX packet!");
 
-			delete [] pRxBuffer;
+			pRxBuffer->Release ();
 
 			goto out;
 		}
@@ -843,13 +913,14 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 			CLogger::Get ()->Write (FromBcm54213, LogWarning, "RX error (0x%x)",
 						(unsigned) dma_flag);
 
-			delete [] pRxBuffer;
+			pRxBuffer->Release ();
 
 			goto out;
 		}
 
 #define LEADING_PAD	2
-		nLength -= LEADING_PAD;		// remove HW 2 bytes added for IP alignment
+		// remove status block and HW 2 bytes added for IP alignment
+		nLength -= STATUS_BLOCK_SIZE + LEADING_PAD;
 
 		if (m_crc_fwd_en)
 		{
@@ -859,13 +930,19 @@ boolean CBcm54213Device::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 
 		assert (nLength > 0);
 		assert (nLength <= FRAME_BUFFER_SIZE);
-		memcpy (pBuffer, pRxBuffer+LEADING_PAD, nLength);
+		pRxBuffer->Put (STATUS_BLOCK_SIZE + LEADING_PAD + nLength);
 
-		*pResultLength = nLength;
+		// the HW sums up the frame behind the Ethernet header
+		pStatus = (TGEnetStatus64 *) pRxBuffer->GetData ();
+		rx_csum = pStatus->rx_csum & STATUS_RX_CSUM_MASK;
+		if (rx_csum)
+		{
+			pRxBuffer->SetChecksumComplete (be2le16 (rx_csum));
+		}
 
-		delete [] pRxBuffer;
+		pRxBuffer->Pull (STATUS_BLOCK_SIZE + LEADING_PAD);
 
-		bResult = TRUE;
+		pResult = pRxBuffer;
 
 out:
 		if (ring->read_ptr < ring->end_ptr)
@@ -881,7 +958,7 @@ out:
 		rdma_ring_writel (ring->index, ring->c_index, RDMA_CONS_INDEX);
 	}
 
-	return bResult;
+	return pResult;
 }
 
 boolean CBcm54213Device::IsLinkUp (void)
@@ -973,6 +1050,27 @@ void CBcm54213Device::init_umac(void)
 	//intrl2_0_writel(UMAC_IRQ_MDIO_DONE | UMAC_IRQ_MDIO_ERROR, INTRL2_CPU_MASK_CLEAR);
 }
 
+// Rx and Tx frames are preceded by a 64 byte status block, which holds the checksum info
+void CBcm54213Device::init_csum(void)
+{
+	u32 reg = rbuf_readl(RBUF_CTRL);
+	reg |= RBUF_64B_EN;
+	rbuf_writel(reg, RBUF_CTRL);
+
+	reg = tbuf_readl(TBUF_CTRL);
+	reg |= RBUF_64B_EN;
+	tbuf_writel(reg, TBUF_CTRL);
+
+	reg = rbuf_readl(RBUF_CHK_CTRL);
+	reg |= RBUF_RXCHK_EN;
+	reg &= ~RBUF_L3_PARSE_DIS;
+	if (m_crc_fwd_en)			// skip FCS to get a valid checksum
+		reg |= RBUF_SKIP_FCS;
+	else
+		reg &= ~RBUF_SKIP_FCS;
+	rbuf_writel(reg, RBUF_CHK_CTRL);
+}
+
 void CBcm54213Device::umac_enable_set(u32 mask, bool enable)
 {
 	u32 reg = umac_readl(UMAC_CMD);
@@ -1131,7 +1229,7 @@ void CBcm54213Device::hfb_init(void)
 // Start the network engine
 void CBcm54213Device::netif_start(void)
 {
-	//enable_rx_intr();		// NOTE: Rx interrupts are not needed
+	enable_rx_intr();		// only signal the event handler
 
 	umac_enable_set(CMD_TX_EN | CMD_RX_EN, true);
 
@@ -1458,6 +1556,7 @@ int CBcm54213Device::init_rx_ring(unsigned index, unsigned size,
 	rdma_ring_writel(index, 0, RDMA_PROD_INDEX);
 	rdma_ring_writel(index, 0, RDMA_CONS_INDEX);
 	rdma_ring_writel(index, ((size << DMA_RING_SIZE_SHIFT) | RX_BUF_LENGTH), DMA_RING_BUF_SIZE);
+	rdma_ring_writel(index, 1, DMA_MBUF_DONE_THRESH);	// interrupt on each frame
 	rdma_ring_writel(index,   (DMA_FC_THRESH_LO << DMA_XOFF_THRESHOLD_SHIFT)
 				|  DMA_FC_THRESH_HI, RDMA_XON_XOFF_THRESH);
 
@@ -1489,40 +1588,47 @@ void CBcm54213Device::free_rx_buffers(void)
 	for (unsigned i = 0; i < TOTAL_DESC; i++)
 	{
 		TGEnetCB *cb = &m_rx_cbs[i];
-		u8 *buffer = free_rx_cb(cb);
-		delete [] buffer;
+		CNetBuffer *netbuf = free_rx_cb(cb);
+		if (netbuf)
+			netbuf->Release ();
 	}
 }
 
-u8 *CBcm54213Device::rx_refill(struct TGEnetCB *cb)
+CNetBuffer *CBcm54213Device::rx_refill(struct TGEnetCB *cb)
 {
-	// Allocate a new Rx DMA buffer
-	u8 *buffer = new u8[RX_BUF_LENGTH];
-	if (!buffer)
+	// Allocate a new Rx DMA buffer from the net buffer pool
+	CNetBuffer *netbuf = CNetBuffer::Alloc (0);
+	if (!netbuf)
 		return 0;
 
+	u8 *buffer = netbuf->GetData ();
+
 	// prepare buffer for DMA
 	CleanAndInvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
 
 	// Grab the current Rx buffer from the ring and DMA-unmap it
-	u8 *rx_buffer = free_rx_cb(cb);
+	CNetBuffer *rx_netbuf = free_rx_cb(cb);
 
 	// Put the new Rx buffer on the ring
 	cb->buffer = buffer;
+	cb->netbuf = netbuf;
 	dmadesc_set_addr(cb->bd_addr, buffer);
 
 	// Return the current Rx buffer to caller
-	return rx_buffer;
+	return rx_netbuf;
 }
 
-u8 *CBcm54213Device::free_rx_cb(TGEnetCB *cb)
+CNetBuffer *CBcm54213Device::free_rx_cb(TGEnetCB *cb)
 {
 	u8 *buffer = cb->buffer;
+	CNetBuffer *netbuf = cb->netbuf;
 	cb->buffer = 0;
+	cb->netbuf = 0;
 
-	CleanAndInvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
+	if (netbuf)
+		CleanAndInvalidateDataCacheRange ((u32) (uintptr) buffer, RX_BUF_LENGTH);
 
-	return buffer;
+	return netbuf;
 }
 
 // Combined address + length/status setter
@@ -1572,6 +1678,10 @@ void CBcm54213Device::InterruptHandler0 (void)
 
 		m_TxSpinLock.Release ();
 	}
+
+	if (status & (UMAC_IRQ_RXDMA_DONE | UMAC_IRQ_TXDMA_DONE)) {
+		SignalEvent ();
+	}
 }
 
 // handle Rx and Tx priority queues
@@ -1596,6 +1706,10 @@ void CBcm54213Device::InterruptHandler1 (void)
 	}
 
 	m_TxSpinLock.Release ();
+
+	if (status & UMAC_IRQ1_TX_INTR_MASK) {
+		SignalEvent ();
+	}
 }
 
 void CBcm54213Device::InterruptStub0 (void *pParam)
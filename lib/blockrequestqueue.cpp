@@ -0,0 +1,330 @@
+//
+// blockrequestqueue.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/blockrequestqueue.h>
+#include <circle/synchronize.h>
+#include <circle/util.h>
+#include <assert.h>
+
+CBlockRequestQueue::CBlockRequestQueue (TBlockTransferHandler *pHandler, void *pParam)
+:	m_pHandler (pHandler),
+	m_pParam (pParam),
+	m_pReadList (0),
+	m_pWriteList (0),
+	m_nQueued (0),
+	m_bFlushing (FALSE),
+	m_pDeferredList (0),
+	m_pDeferredTail (0),
+	m_pMergeBuffer (0)
+{
+	assert (m_pHandler != 0);
+}
+
+CBlockRequestQueue::~CBlockRequestQueue (void)
+{
+	assert (IsEmpty ());
+
+	delete [] m_pMergeBuffer;
+	m_pMergeBuffer = 0;
+
+	m_pHandler = 0;
+}
+
+void CBlockRequestQueue::Submit (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	assert (!pRequest->IsComplete ());
+	assert ((pRequest->GetCount () & (BLOCK_REQUEST_SIZE-1)) == 0);
+	assert ((pRequest->GetDeviceOffset () & (BLOCK_REQUEST_SIZE-1)) == 0);
+	assert (CurrentExecutionLevel () == TASK_LEVEL);
+
+	pRequest->m_pNext = 0;
+
+	if (m_bFlushing)
+	{
+		// called from a completion routine, keep the order of overlapping requests
+		if (   m_pDeferredList != 0
+		    || Overlaps (pRequest))
+		{
+			if (m_pDeferredList == 0)
+			{
+				m_pDeferredList = pRequest;
+			}
+			else
+			{
+				assert (m_pDeferredTail != 0);
+				m_pDeferredTail->m_pNext = pRequest;
+			}
+
+			m_pDeferredTail = pRequest;
+
+			return;
+		}
+	}
+	else if (Overlaps (pRequest))
+	{
+		Flush ();
+	}
+
+	Enqueue (pRequest);
+
+	if (   !m_bFlushing
+	    && m_nQueued >= BLOCK_REQUEST_MAX_QUEUED)
+	{
+		Flush ();
+	}
+}
+
+boolean CBlockRequestQueue::Flush (void)
+{
+	assert (CurrentExecutionLevel () == TASK_LEVEL);
+
+	if (m_bFlushing)
+	{
+		return TRUE;		// requests will be processed by the running Flush()
+	}
+
+	m_bFlushing = TRUE;
+
+	boolean bOK = TRUE;
+	while (!IsEmpty ())
+	{
+		// take deferred requests in order, until one overlaps a queued request
+		while (   m_pDeferredList != 0
+		       && !Overlaps (m_pDeferredList))
+		{
+			CBlockRequest *pRequest = m_pDeferredList;
+			m_pDeferredList = pRequest->m_pNext;
+			pRequest->m_pNext = 0;
+
+			Enqueue (pRequest);
+		}
+
+		// completion routines may submit new requests, while the lists are processed
+		CBlockRequest *pReadList = m_pReadList;
+		CBlockRequest *pWriteList = m_pWriteList;
+		m_pReadList = 0;
+		m_pWriteList = 0;
+		m_nQueued = 0;
+
+		// reads first, because a task is probably waiting for the data
+		if (!ProcessList (pReadList))
+		{
+			bOK = FALSE;
+		}
+
+		if (!ProcessList (pWriteList))
+		{
+			bOK = FALSE;
+		}
+	}
+
+	m_bFlushing = FALSE;
+
+	return bOK;
+}
+
+void CBlockRequestQueue::Cancel (void)
+{
+	CBlockRequest *Lists[] = {m_pReadList, m_pWriteList, m_pDeferredList};
+	m_pReadList = 0;
+	m_pWriteList = 0;
+	m_pDeferredList = 0;
+	m_nQueued = 0;
+
+	for (unsigned i = 0; i < sizeof Lists / sizeof Lists[0]; i++)
+	{
+		CBlockRequest *pRequest = Lists[i];
+		while (pRequest != 0)
+		{
+			CBlockRequest *pNext = pRequest->m_pNext;
+
+			pRequest->Complete (-1);
+
+			pRequest = pNext;
+		}
+	}
+}
+
+void CBlockRequestQueue::Enqueue (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	Insert (pRequest->IsWrite () ? &m_pWriteList : &m_pReadList, pRequest);
+
+	m_nQueued++;
+}
+
+boolean CBlockRequestQueue::Overlaps (const CBlockRequest *pRequest) const
+{
+	assert (pRequest != 0);
+	if (pRequest->IsWrite ())
+	{
+		return    Overlaps (m_pReadList, pRequest)
+		       || Overlaps (m_pWriteList, pRequest);
+	}
+
+	return Overlaps (m_pWriteList, pRequest);
+}
+
+boolean CBlockRequestQueue::Overlaps (const CBlockRequest *pList, const CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullStart = pRequest->GetDeviceOffset ();
+	u64 ullEnd = ullStart + pRequest->GetCount ();
+
+	for (; pList != 0; pList = pList->m_pNext)
+	{
+		u64 ullListStart = pList->GetDeviceOffset ();
+		if (ullListStart >= ullEnd)
+		{
+			break;			// list is sorted
+		}
+
+		if (ullListStart + pList->GetCount () > ullStart)
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+void CBlockRequestQueue::Insert (CBlockRequest **ppList, CBlockRequest *pRequest)
+{
+	assert (ppList != 0);
+	assert (pRequest != 0);
+
+	u64 ullOffset = pRequest->GetDeviceOffset ();
+
+	// insert behind requests with the same offset to keep the order
+	while (   *ppList != 0
+	       && (*ppList)->GetDeviceOffset () <= ullOffset)
+	{
+		ppList = &(*ppList)->m_pNext;
+	}
+
+	pRequest->m_pNext = *ppList;
+	*ppList = pRequest;
+}
+
+boolean CBlockRequestQueue::ProcessList (CBlockRequest *pList)
+{
+	boolean bOK = TRUE;
+	while (pList != 0)
+	{
+		pList = ProcessRun (pList, &bOK);
+	}
+
+	return bOK;
+}
+
+CBlockRequest *CBlockRequestQueue::ProcessRun (CBlockRequest *pFirst, boolean *pOK)
+{
+	assert (pFirst != 0);
+	assert (pOK != 0);
+
+	u64 ullOffset = pFirst->GetDeviceOffset ();
+	size_t nCount = pFirst->GetCount ();
+	boolean bContiguous = TRUE;
+
+	// find the run of requests to adjacent blocks
+	CBlockRequest *pLast = pFirst;
+	CBlockRequest *pNext;
+	while (   (pNext = pLast->m_pNext) != 0
+	       && pNext->GetDeviceOffset () == ullOffset + nCount
+	       && nCount + pNext->GetCount () <= BLOCK_REQUEST_MAX_MERGE)
+	{
+		if ((u8 *) pNext->GetBuffer () != (u8 *) pLast->GetBuffer () + pLast->GetCount ())
+		{
+			bContiguous = FALSE;
+		}
+
+		nCount += pNext->GetCount ();
+		pLast = pNext;
+	}
+
+	if (!bContiguous)
+	{
+		if (m_pMergeBuffer == 0)
+		{
+			m_pMergeBuffer = new u8[BLOCK_REQUEST_MAX_MERGE];
+		}
+
+		if (m_pMergeBuffer == 0)
+		{
+			// process the first request alone
+			pLast = pFirst;
+			nCount = pFirst->GetCount ();
+			bContiguous = TRUE;
+		}
+	}
+
+	pNext = pLast->m_pNext;
+
+	boolean bWrite = pFirst->IsWrite ();
+	u8 *pBuffer = (u8 *) pFirst->GetBuffer ();
+	if (!bContiguous)
+	{
+		pBuffer = m_pMergeBuffer;
+
+		if (bWrite)
+		{
+			u8 *p = pBuffer;
+			for (CBlockRequest *pRequest = pFirst; pRequest != pNext;
+			     pRequest = pRequest->m_pNext)
+			{
+				memcpy (p, pRequest->GetBuffer (), pRequest->GetCount ());
+				p += pRequest->GetCount ();
+			}
+		}
+	}
+
+	assert (m_pHandler != 0);
+	boolean bOK = (*m_pHandler) (bWrite, pBuffer, nCount, ullOffset, m_pParam) == (int) nCount;
+	if (!bOK)
+	{
+		*pOK = FALSE;
+	}
+
+	if (   !bContiguous
+	    && !bWrite
+	    && bOK)
+	{
+		u8 *p = pBuffer;
+		for (CBlockRequest *pRequest = pFirst; pRequest != pNext;
+		     pRequest = pRequest->m_pNext)
+		{
+			memcpy (pRequest->GetBuffer (), p, pRequest->GetCount ());
+			p += pRequest->GetCount ();
+		}
+	}
+
+	// the completion routine may re-use or free the request
+	CBlockRequest *pRequest = pFirst;
+	while (pRequest != pNext)
+	{
+		CBlockRequest *pNextRequest = pRequest->m_pNext;
+
+		pRequest->Complete (bOK ? (int) pRequest->GetCount () : -1);
+
+		pRequest = pNextRequest;
+	}
+
+	return pNext;
+}
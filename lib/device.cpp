@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/device.h>
+#include <circle/blockrequest.h>
 
 struct TRemovedHandlerEntry
 {
@@ -66,6 +67,35 @@ u64 CDevice::GetSize (void) const
 	return (u64) -1;
 }
 
+boolean CDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullOffset = pRequest->GetDeviceOffset ();
+	if (Seek (ullOffset) != ullOffset)
+	{
+		return FALSE;
+	}
+
+	int nResult;
+	if (pRequest->IsWrite ())
+	{
+		nResult = Write (pRequest->GetBuffer (), pRequest->GetCount ());
+	}
+	else
+	{
+		nResult = Read (pRequest->GetBuffer (), pRequest->GetCount ());
+	}
+
+	pRequest->Complete (nResult);
+
+	return TRUE;
+}
+
+boolean CDevice::FlushRequests (void)
+{
+	return TRUE;
+}
+
 int CDevice::IOCtl (unsigned long ulCmd, void *pData)
 {
 	return -1;
@@ -105,33 +105,8 @@ unsigned CFAT::AllocateCluster (void)
 
 	while (nCluster < m_pFATInfo->GetClusterCount () + 2)
 	{
-		assert (nCluster >= 2);
-
-		unsigned nSectorOffset;
-		TFATBuffer *pBuffer = GetSector (nCluster, &nSectorOffset, m_pFATInfo->GetReadFAT ());
-		assert (pBuffer != 0);
-
-		unsigned nClusterEntry = GetEntry (pBuffer, nSectorOffset);
-		
-		assert (m_pCache != 0);
-		m_pCache->FreeSector (pBuffer, 1);
-		
-		if (nClusterEntry == 0)
+		if (Allocate (nCluster))
 		{
-			for (unsigned nFAT = m_pFATInfo->GetFirstWriteFAT ();
-			     nFAT <= m_pFATInfo->GetLastWriteFAT (); nFAT++)
-			{
-				pBuffer = GetSector (nCluster, &nSectorOffset, nFAT);
-				assert (pBuffer != 0);
-
-				SetEntry (pBuffer, nSectorOffset, m_pFATInfo->GetFATType () == FAT16 ? 0xFFFF : 0x0FFFFFFF);
-				
-				m_pCache->MarkDirty (pBuffer);
-				m_pCache->FreeSector (pBuffer, 1);
-			}
-
-			m_pFATInfo->ClusterAllocated (nCluster);
-
 			m_Lock.Release ();
 
 			return nCluster;
@@ -145,6 +120,24 @@ unsigned CFAT::AllocateCluster (void)
 	return 0;
 }
 
+boolean CFAT::AllocateClusterAt (unsigned nCluster)
+{
+	assert (m_pFATInfo != 0);
+	if (   nCluster < 2
+	    || nCluster >= m_pFATInfo->GetClusterCount () + 2)
+	{
+		return FALSE;
+	}
+
+	m_Lock.Acquire ();
+
+	boolean bResult = Allocate (nCluster);
+
+	m_Lock.Release ();
+
+	return bResult;
+}
+
 void CFAT::FreeClusterChain (unsigned nFirstCluster)
 {
 	do
@@ -161,6 +154,41 @@ void CFAT::FreeClusterChain (unsigned nFirstCluster)
 	while (!IsEOC (nFirstCluster));
 }
 
+boolean CFAT::Allocate (unsigned nCluster)
+{
+	assert (nCluster >= 2);
+
+	unsigned nSectorOffset;
+	TFATBuffer *pBuffer = GetSector (nCluster, &nSectorOffset, m_pFATInfo->GetReadFAT ());
+	assert (pBuffer != 0);
+
+	unsigned nClusterEntry = GetEntry (pBuffer, nSectorOffset);
+
+	assert (m_pCache != 0);
+	m_pCache->FreeSector (pBuffer, 1);
+
+	if (nClusterEntry != 0)
+	{
+		return FALSE;
+	}
+
+	for (unsigned nFAT = m_pFATInfo->GetFirstWriteFAT ();
+	     nFAT <= m_pFATInfo->GetLastWriteFAT (); nFAT++)
+	{
+		pBuffer = GetSector (nCluster, &nSectorOffset, nFAT);
+		assert (pBuffer != 0);
+
+		SetEntry (pBuffer, nSectorOffset, m_pFATInfo->GetFATType () == FAT16 ? 0xFFFF : 0x0FFFFFFF);
+
+		m_pCache->MarkDirty (pBuffer);
+		m_pCache->FreeSector (pBuffer, 1);
+	}
+
+	m_pFATInfo->ClusterAllocated (nCluster);
+
+	return TRUE;
+}
+
 TFATBuffer *CFAT::GetSector (unsigned nCluster, unsigned *pSectorOffset, unsigned nFAT)
 {
 	assert (nCluster >= 2);
@@ -2,7 +2,7 @@
 // fatcache.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2014-2021  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2014-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,324 +19,1129 @@
 //
 #include <circle/fs/fat/fatcache.h>
 #include <circle/logger.h>
+#include <circle/util.h>
 #include <circle/new.h>
 #include <assert.h>
 
 #define BUFFER_MAGIC		0x4641544D
 #define BUFFER_NOSECTOR		0xFFFFFFFF
 
+#define EXTENT_MAGIC		0x46415445
+#define EXTENT_NOKEY		0xFFFFFFFF
+
+#define QUEUE_IN		0		// A1in, extents referenced once
+#define QUEUE_MAIN		1		// Am, extents referenced again
+#define QUEUE_NONE		2
+
+#define HASH_MULTIPLIER		0x9E3779B1U
+
 #define FAULT_NO_BUFFER		0x1501
 #define FAULT_READ_ERROR	0x1502
 #define FAULT_WRITE_ERROR	0x1503
 
+static inline u64 SectorMask (unsigned nFrom, unsigned nTo)
+{
+	assert (nFrom <= nTo && nTo <= 64);
+	u64 ullMask = nTo - nFrom < 64 ? ((u64) 1 << (nTo - nFrom)) - 1 : (u64) -1;
+
+	return ullMask << nFrom;
+}
+
 CFATCache::CFATCache (void)
-:	m_pPartition (0)
+:	m_pPartition (0),
+	m_nDeviceSectors (0),
+	m_nSectors (0),
+	m_pData (0),
+	m_pBuffers (0),
+	m_nExtentSectors (0),
+	m_nExtentOffset (0),
+	m_nExtents (0),
+	m_pExtents (0),
+	m_pFreeList (0),
+	m_nHashShift (0),
+	m_ppHash (0),
+	m_nInMax (0),
+	m_pGhostKeys (0),
+	m_nGhostMax (0),
+	m_nGhostCount (0),
+	m_nGhostNext (0),
+	m_nRecentNext (0),
+	m_nReadAheadEnd (0),
+	m_bWriteError (FALSE)
 {
-	m_BufferList.pFirst = 0;
-	m_BufferList.pLast = 0;
+	memset (&m_Statistics, 0, sizeof m_Statistics);
 }
 
 CFATCache::~CFATCache (void)
 {
 }
 
-int CFATCache::Open (CDevice *pPartition)
+int CFATCache::Open (CDevice *pPartition, unsigned nCacheSize)
 {
-	TFATBuffer *pBuffer;
-	TFATBuffer *pPrevBuffer = 0;
-	int i;
-	
 	assert (m_pPartition == 0);
 	m_pPartition = pPartition;
 	assert (m_pPartition != 0);
 
-	for (i = 1; i <= FAT_BUFFERS; i++)
+	// read-ahead must not go beyond the end of the device
+	u64 ullSize = m_pPartition->GetSize ();
+	m_nDeviceSectors = BUFFER_NOSECTOR;
+	if (   ullSize != (u64) -1
+	    && ullSize / FAT_SECTOR_SIZE < BUFFER_NOSECTOR)
+	{
+		m_nDeviceSectors = (unsigned) (ullSize / FAT_SECTOR_SIZE);
+	}
+
+	m_nSectors = nCacheSize / FAT_SECTOR_SIZE;
+	assert (m_nSectors >= FAT_CACHE_MIN_EXTENTS);
+
+	// heap blocks are cache-line aligned, so that the extents can be used for DMA
+	m_pData = new (HEAP_DMA30) unsigned char[m_nSectors * FAT_SECTOR_SIZE];
+	m_pBuffers = new TFATBuffer[m_nSectors];
+	if (   m_pData == 0
+	    || m_pBuffers == 0
+	    || !Setup (1, 0))
+	{
+		delete [] m_pBuffers;
+		m_pBuffers = 0;
+		delete [] m_pData;
+		m_pData = 0;
+
+		m_pPartition = 0;
+
+		return 0;
+	}
+
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+
+	return 1;
+}
+
+void CFATCache::SetClusterGeometry (unsigned nSectorsPerCluster, unsigned nFirstDataSector)
+{
+	assert (nSectorsPerCluster > 0);
+	unsigned nExtentSectors = nSectorsPerCluster;
+	while (   nExtentSectors > FAT_CACHE_MAX_EXTENT
+	       || (   nExtentSectors > 1
+		   && m_nSectors / nExtentSectors < FAT_CACHE_MIN_EXTENTS))
+	{
+		nExtentSectors /= 2;
+	}
+
+	m_CacheLock.Acquire ();
+
+	assert (m_pExtents != 0);
+	WriteBack ();
+
+#ifndef NDEBUG
+	for (unsigned i = 0; i < m_nExtents; i++)
 	{
-		pBuffer = new (HEAP_DMA30) TFATBuffer;
-		if (pBuffer == 0)
+		assert (m_pExtents[i].nUseCount == 0);
+	}
+#endif
+
+	Cleanup ();
+
+	if (!Setup (nExtentSectors, (nExtentSectors - nFirstDataSector % nExtentSectors)
+					% nExtentSectors))
+	{
+		Fault (FAULT_NO_BUFFER);
+	}
+
+	m_CacheLock.Release ();
+}
+
+void CFATCache::Close (void)
+{
+	Flush ();
+
+	m_CacheLock.Acquire ();
+
+	Cleanup ();
+
+	delete [] m_pBuffers;
+	m_pBuffers = 0;
+	delete [] m_pData;
+	m_pData = 0;
+
+	m_pPartition = 0;
+
+	m_CacheLock.Release ();
+}
+
+void CFATCache::Flush (void)
+{
+	m_CacheLock.Acquire ();
+
+	if (m_pExtents != 0)
+	{
+		WriteBack ();
+	}
+
+	m_CacheLock.Release ();
+}
+
+TFATBuffer *CFATCache::GetSector (unsigned nSector, int bWriteOnly)
+{
+	m_CacheLock.Acquire ();
+
+	assert (m_pExtents != 0);
+	unsigned nKey = GetKey (nSector);
+	unsigned nIndex = GetIndex (nSector);
+	u64 ullMask = (u64) 1 << nIndex;
+
+	// read-ahead in batches, when the end of the previous batch has been reached
+	boolean bReadAhead =    !bWriteOnly
+			     && FAT_CACHE_READ_AHEAD > 0
+			     && IsSequential (nKey)
+			     && nKey+1 >= m_nReadAheadEnd;
+
+	boolean bNew = FALSE;
+	TFATCacheExtent *pExtent = Lookup (nKey);
+	if (pExtent != 0)
+	{
+		Touch (pExtent);
+	}
+	else
+	{
+		// a key found in A1out has been referenced again, so it goes to Am directly
+		pExtent = Allocate (nKey, GhostRemove (nKey));
+		if (pExtent == 0)
 		{
+			Fault (FAULT_NO_BUFFER);
+			m_CacheLock.Release ();
 			return 0;
 		}
 
-		pBuffer->nMagic    = BUFFER_MAGIC;
-		pBuffer->pNext     = 0;
-		pBuffer->pPrev     = pPrevBuffer;
-		pBuffer->nSector   = BUFFER_NOSECTOR;
-		pBuffer->nUseCount = 0;
+		bNew = TRUE;
+	}
 
-		if (pPrevBuffer != 0)
-		{
-			pPrevBuffer->pNext = pBuffer;
-		}
+	TFATBuffer *pBuffer = &pExtent->pBuffers[nIndex];
+	assert (pBuffer->nMagic == BUFFER_MAGIC);
+	assert (pBuffer->nSector == nSector);
+
+	// the extent is pinned now and cannot be evicted by read-ahead
+	pBuffer->nUseCount++;
+	pExtent->nUseCount++;
 
-		pPrevBuffer = pBuffer;
-		
-		if (i == 1)
+	if (!(pExtent->ullValid & ullMask))
+	{
+		if (bWriteOnly)
 		{
-			m_BufferList.pFirst = pBuffer;
+			pExtent->ullValid |= ullMask;
 		}
-		else if (i == FAT_BUFFERS)
+		else
 		{
-			m_BufferList.pLast = pBuffer;
+			m_Statistics.nMisses++;
+
+			if (   bReadAhead
+			    && bNew)
+			{
+				// the demand extent is read together with the read-ahead
+				ReadAhead (pExtent, nKey+1, nKey+1 + FAT_CACHE_READ_AHEAD);
+
+				bReadAhead = FALSE;
+			}
+
+			if (   !(pExtent->ullValid & ullMask)
+			    && !ReadExtent (pExtent, nIndex))
+			{
+				pBuffer->nUseCount--;
+				pExtent->nUseCount--;
+
+				Fault (FAULT_READ_ERROR);
+				m_CacheLock.Release ();
+				return 0;
+			}
 		}
 	}
+	else if (!bWriteOnly)
+	{
+		m_Statistics.nHits++;
+	}
 
-	return 1;
+	if (bReadAhead)
+	{
+		ReadAhead (0, nKey+1, nKey+1 + FAT_CACHE_READ_AHEAD);
+	}
+
+	m_CacheLock.Release ();
+
+	return pBuffer;
 }
 
-void CFATCache::Close (void)
+void CFATCache::FreeSector (TFATBuffer *pBuffer, int bCritical)
 {
-	TFATBuffer *pBuffer;
-	TFATBuffer *pNextBuffer;
+	assert (pBuffer->nMagic == BUFFER_MAGIC);
+	assert (pBuffer->nUseCount > 0);
 
-	Flush ();
+	// the replacement order is maintained by the 2Q algorithm, bCritical is ignored
+
+	m_CacheLock.Acquire ();
+
+	TFATCacheExtent *pExtent = pBuffer->pExtent;
+	assert (pExtent != 0);
+	assert (pExtent->nMagic == EXTENT_MAGIC);
+	assert (pExtent->nUseCount > 0);
+
+	pBuffer->nUseCount--;
+	pExtent->nUseCount--;
+
+	m_CacheLock.Release ();
+}
+
+void CFATCache::MarkDirty (TFATBuffer *pBuffer)
+{
+	assert (pBuffer->nMagic == BUFFER_MAGIC);
+	assert (pBuffer->nUseCount > 0);
+
+	m_CacheLock.Acquire ();
+
+	TFATCacheExtent *pExtent = pBuffer->pExtent;
+	assert (pExtent != 0);
+	unsigned nIndex = pBuffer - pExtent->pBuffers;
+	assert (nIndex < m_nExtentSectors);
+
+	pExtent->ullDirty |= (u64) 1 << nIndex;
 
-	for (pBuffer = m_BufferList.pFirst; pBuffer != 0; pBuffer = pNextBuffer)
+	m_CacheLock.Release ();
+}
+
+int CFATCache::ReadDirect (unsigned nSector, unsigned nCount, void *pBuffer)
+{
+	assert (nCount > 0);
+	assert (pBuffer != 0);
+
+	m_CacheLock.Acquire ();
+
+	// dirty sectors are newer than the data on disk
+	if (   IsDirty (nSector, nCount)
+	    && !WriteBack ())
 	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
+		m_CacheLock.Release ();
+
+		return 0;
+	}
 
-		pNextBuffer = pBuffer->pNext;
+	m_CacheLock.Release ();
 
-		pBuffer->nMagic = 0;
+	// The cache lock is not held during the transfer, which may take long. File
+	// operations are serialized by CFATFileSystem, so that only the disk is locked.
+	m_DiskLock.Acquire ();
 
-		delete [] pBuffer;
+	int nBytes = nCount * FAT_SECTOR_SIZE;
+	m_pPartition->Seek ((u64) nSector * FAT_SECTOR_SIZE);
+	boolean bOK = m_pPartition->Read (pBuffer, nBytes) == nBytes;
+
+	m_DiskLock.Release ();
+
+	if (!bOK)
+	{
+		return 0;
 	}
 
-	m_BufferList.pFirst = 0;
-	m_BufferList.pLast = 0;
+	m_CacheLock.Acquire ();
+
+	m_Statistics.nDirectRequests++;
+	m_Statistics.nDirectSectors += nCount;
+
+	m_CacheLock.Release ();
+
+	return 1;
 }
 
-void CFATCache::Flush (void)
+int CFATCache::WriteDirect (unsigned nSector, unsigned nCount, const void *pBuffer)
 {
-	TFATBuffer *pBuffer;
+	assert (nCount > 0);
+	assert (pBuffer != 0);
 
-	m_BufferListLock.Acquire ();
+	m_CacheLock.Acquire ();
 
-	for (pBuffer = m_BufferList.pFirst; pBuffer != 0; pBuffer = pBuffer->pNext)
+	// a later write-back of older dirty sectors must not overwrite the new data on disk
+	if (   IsDirty (nSector, nCount)
+	    && !WriteBack ())
 	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
+		m_CacheLock.Release ();
 
-		if (pBuffer->nSector != BUFFER_NOSECTOR)
-		{
-			if (pBuffer->bDirty)
-			{
-				m_DiskLock.Acquire ();
+		return 0;
+	}
 
-				m_pPartition->Seek (pBuffer->nSector * FAT_SECTOR_SIZE);
-				if (m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
-				{
-					Fault (FAULT_WRITE_ERROR);
-				}
+	m_CacheLock.Release ();
+
+	m_DiskLock.Acquire ();
+
+	int nBytes = nCount * FAT_SECTOR_SIZE;
+	m_pPartition->Seek ((u64) nSector * FAT_SECTOR_SIZE);
+	boolean bOK = m_pPartition->Write (pBuffer, nBytes) == nBytes;
+
+	m_DiskLock.Release ();
+
+	if (!bOK)
+	{
+		return 0;
+	}
 
-				m_DiskLock.Release ();
+	m_CacheLock.Acquire ();
 
-				pBuffer->bDirty = 0;
+	m_Statistics.nDirectRequests++;
+	m_Statistics.nDirectSectors += nCount;
+
+	// cached sectors are updated after the data is on disk, so that they remain valid
+	for (unsigned nKey = GetKey (nSector); nKey <= GetKey (nSector + nCount-1); nKey++)
+	{
+		TFATCacheExtent *pExtent = Lookup (nKey);
+		if (pExtent == 0)
+		{
+			continue;
+		}
+
+		for (unsigned i = 0; i < m_nExtentSectors; i++)
+		{
+			unsigned nThisSector = GetSectorNumber (nKey, i);
+			if (   (pExtent->ullValid & ((u64) 1 << i))
+			    && nSector <= nThisSector && nThisSector < nSector + nCount)
+			{
+				memcpy (&pExtent->pData[i * FAT_SECTOR_SIZE],
+					(const u8 *) pBuffer + (nThisSector - nSector) * FAT_SECTOR_SIZE,
+					FAT_SECTOR_SIZE);
 			}
 		}
 	}
 
-	m_BufferListLock.Release ();
+	m_CacheLock.Release ();
+
+	return 1;
 }
 
-TFATBuffer *CFATCache::GetSector (unsigned nSector, int bWriteOnly)
+void CFATCache::GetStatistics (TFATCacheStatistics *pStatistics)
+{
+	assert (pStatistics != 0);
+
+	m_CacheLock.Acquire ();
+
+	memcpy (pStatistics, &m_Statistics, sizeof *pStatistics);
+
+	m_CacheLock.Release ();
+}
+
+boolean CFATCache::Setup (unsigned nExtentSectors, unsigned nExtentOffset)
 {
-	TFATBuffer *pBuffer;
+	assert (1 <= nExtentSectors && nExtentSectors <= FAT_CACHE_MAX_EXTENT);
+	assert (nExtentOffset < nExtentSectors);
+	m_nExtentSectors = nExtentSectors;
+	m_nExtentOffset = nExtentOffset;
 
-	m_BufferListLock.Acquire ();
+	m_nExtents = m_nSectors / m_nExtentSectors;
+	assert (m_nExtents > 0);
 
-	for (pBuffer = m_BufferList.pFirst; pBuffer != 0; pBuffer = pBuffer->pNext)
+	unsigned nHashBits = 1;
+	while ((1U << nHashBits) < 2*m_nExtents)
 	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
+		nHashBits++;
+	}
+	m_nHashShift = 32 - nHashBits;
 
-		if (pBuffer->nSector == nSector)
-		{
-			break;
-		}
+	m_nGhostMax = m_nExtents / 2;
+	if (m_nGhostMax == 0)
+	{
+		m_nGhostMax = 1;
 	}
 
-	if (pBuffer != 0)
+	m_pExtents = new TFATCacheExtent[m_nExtents];
+	m_ppHash = new TFATCacheExtent *[1U << nHashBits];
+	m_pGhostKeys = new unsigned[m_nGhostMax];
+	if (   m_pExtents == 0
+	    || m_ppHash == 0
+	    || m_pGhostKeys == 0)
 	{
-		MoveBufferFirst (pBuffer);
+		Cleanup ();
 
-		pBuffer->nUseCount++;
+		return FALSE;
+	}
 
-		m_BufferListLock.Release ();
+	memset (m_ppHash, 0, sizeof (TFATCacheExtent *) << nHashBits);
 
-		return pBuffer;
-	}
+	m_nGhostCount = 0;
+	m_nGhostNext = 0;
 
+	for (unsigned i = 0; i < 2; i++)
+	{
+		m_Queue[i].pFirst = 0;
+		m_Queue[i].pLast = 0;
+		m_Queue[i].nCount = 0;
+	}
 
-	for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+	m_nInMax = m_nExtents / 4;
+	if (m_nInMax == 0)
 	{
-		assert (pBuffer->nMagic == BUFFER_MAGIC);
+		m_nInMax = 1;
+	}
 
-		if (pBuffer->nSector == BUFFER_NOSECTOR)
+	m_pFreeList = 0;
+	for (unsigned i = m_nExtents; i-- > 0;)
+	{
+		TFATCacheExtent *pExtent = &m_pExtents[i];
+
+		pExtent->nMagic     = EXTENT_MAGIC;
+		pExtent->nKey       = EXTENT_NOKEY;
+		pExtent->pPrev      = 0;
+		pExtent->pHashNext  = 0;
+		pExtent->nQueue     = QUEUE_NONE;
+		pExtent->nUseCount  = 0;
+		pExtent->ullValid   = 0;
+		pExtent->ullDirty   = 0;
+		pExtent->bReadAhead = FALSE;
+		pExtent->pBuffers   = &m_pBuffers[i * m_nExtentSectors];
+		pExtent->pData      = &m_pData[i * m_nExtentSectors * FAT_SECTOR_SIZE];
+
+		for (unsigned j = 0; j < m_nExtentSectors; j++)
 		{
-			break;
+			TFATBuffer *pBuffer = &pExtent->pBuffers[j];
+
+			pBuffer->nMagic    = BUFFER_MAGIC;
+			pBuffer->nSector   = BUFFER_NOSECTOR;
+			pBuffer->nUseCount = 0;
+			pBuffer->pExtent   = pExtent;
+			pBuffer->Data      = &pExtent->pData[j * FAT_SECTOR_SIZE];
 		}
+
+		pExtent->pNext = m_pFreeList;
+		m_pFreeList = pExtent;
+	}
+
+	for (unsigned i = 0; i < FAT_CACHE_RECENT_KEYS; i++)
+	{
+		m_RecentKeys[i] = EXTENT_NOKEY;
 	}
+	m_nRecentNext = 0;
+	m_nReadAheadEnd = 0;
+
+	return TRUE;
+}
+
+void CFATCache::Cleanup (void)
+{
+	delete [] m_pGhostKeys;
+	m_pGhostKeys = 0;
+
+	delete [] m_ppHash;
+	m_ppHash = 0;
+
+	delete [] m_pExtents;
+	m_pExtents = 0;
+
+	m_pFreeList = 0;
+	m_nExtents = 0;
+}
+
+unsigned CFATCache::GetKey (unsigned nSector) const
+{
+	return (unsigned) (((u64) nSector + m_nExtentOffset) / m_nExtentSectors);
+}
+
+unsigned CFATCache::GetIndex (unsigned nSector) const
+{
+	return (unsigned) (((u64) nSector + m_nExtentOffset) % m_nExtentSectors);
+}
+
+unsigned CFATCache::GetSectorNumber (unsigned nKey, unsigned nIndex) const
+{
+	return (unsigned) ((u64) nKey * m_nExtentSectors + nIndex - m_nExtentOffset);
+}
+
+// Returns TRUE, if one of the sectors nSector to nSector+nCount-1 is dirty in the cache
+boolean CFATCache::IsDirty (unsigned nSector, unsigned nCount) const
+{
+	assert (nCount > 0);
 
-	if (pBuffer == 0)
+	for (unsigned nKey = GetKey (nSector); nKey <= GetKey (nSector + nCount-1); nKey++)
 	{
-		for (pBuffer = m_BufferList.pLast; pBuffer != 0; pBuffer = pBuffer->pPrev)
+		TFATCacheExtent *pExtent = Lookup (nKey);
+		if (   pExtent == 0
+		    || pExtent->ullDirty == 0)
 		{
-			assert (pBuffer->nMagic == BUFFER_MAGIC);
+			continue;
+		}
 
-			if (pBuffer->nUseCount == 0)
+		for (unsigned i = 0; i < m_nExtentSectors; i++)
+		{
+			unsigned nThisSector = GetSectorNumber (nKey, i);
+			if (   (pExtent->ullDirty & ((u64) 1 << i))
+			    && nSector <= nThisSector && nThisSector < nSector + nCount)
 			{
-				break;
+				return TRUE;
 			}
 		}
+	}
+
+	return FALSE;
+}
+
+// Returns the range of indices of an extent, which map to sectors of the device
+void CFATCache::GetRange (unsigned nKey, unsigned *pFrom, unsigned *pTo) const
+{
+	assert (pFrom != 0);
+	assert (pTo != 0);
 
-		if (pBuffer == 0)
+	u64 ullStart = (u64) nKey * m_nExtentSectors;
+	u64 ullEnd = (u64) m_nDeviceSectors + m_nExtentOffset;
+
+	*pFrom = ullStart < m_nExtentOffset ? (unsigned) (m_nExtentOffset - ullStart) : 0;
+
+	*pTo = m_nExtentSectors;
+	if (ullStart + m_nExtentSectors > ullEnd)
+	{
+		*pTo = ullEnd > ullStart ? (unsigned) (ullEnd - ullStart) : 0;
+	}
+
+	if (*pTo < *pFrom)
+	{
+		*pTo = *pFrom;
+	}
+}
+
+TFATCacheExtent *CFATCache::Lookup (unsigned nKey) const
+{
+	assert (m_ppHash != 0);
+	TFATCacheExtent *pExtent = m_ppHash[(nKey * HASH_MULTIPLIER) >> m_nHashShift];
+	while (   pExtent != 0
+	       && pExtent->nKey != nKey)
+	{
+		assert (pExtent->nMagic == EXTENT_MAGIC);
+		pExtent = pExtent->pHashNext;
+	}
+
+	return pExtent;
+}
+
+TFATCacheExtent *CFATCache::Allocate (unsigned nKey, boolean bFrequent)
+{
+	TFATCacheExtent *pExtent = m_pFreeList;
+	if (pExtent != 0)
+	{
+		m_pFreeList = pExtent->pNext;
+	}
+	else
+	{
+		pExtent = FindVictim ();
+		if (   pExtent == 0
+		    || !Evict (pExtent))
 		{
-			Fault (FAULT_NO_BUFFER);
-			m_BufferListLock.Release ();
 			return 0;
 		}
+	}
+
+	assert (pExtent->nMagic == EXTENT_MAGIC);
+	assert (pExtent->nUseCount == 0);
+	pExtent->nKey = nKey;
+	pExtent->ullValid = 0;
+	pExtent->ullDirty = 0;
+	pExtent->bReadAhead = FALSE;
+
+	unsigned nFrom, nTo;
+	GetRange (nKey, &nFrom, &nTo);
+
+	for (unsigned i = 0; i < m_nExtentSectors; i++)
+	{
+		assert (pExtent->pBuffers[i].nUseCount == 0);
+		pExtent->pBuffers[i].nSector =    nFrom <= i && i < nTo
+					       ? GetSectorNumber (nKey, i) : BUFFER_NOSECTOR;
+	}
+
+	HashInsert (pExtent);
+	QueueInsertFirst (bFrequent ? QUEUE_MAIN : QUEUE_IN, pExtent);
+
+	return pExtent;
+}
+
+// 2Q: take the oldest extent from A1in, if it exceeds its share, otherwise the LRU one from Am
+TFATCacheExtent *CFATCache::FindVictim (void)
+{
+	unsigned nFirstQueue = m_Queue[QUEUE_IN].nCount > m_nInMax ? QUEUE_IN : QUEUE_MAIN;
 
-		if (pBuffer->bDirty)
+	for (unsigned i = 0; i < 2; i++)
+	{
+		for (TFATCacheExtent *pExtent = m_Queue[nFirstQueue ^ i].pLast;
+		     pExtent != 0; pExtent = pExtent->pPrev)
 		{
-			m_DiskLock.Acquire ();
+			assert (pExtent->nMagic == EXTENT_MAGIC);
 
-			m_pPartition->Seek (pBuffer->nSector * FAT_SECTOR_SIZE);
-			if (m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
+			if (pExtent->nUseCount == 0)
 			{
-				Fault (FAULT_WRITE_ERROR);
-				m_DiskLock.Release ();
-				m_BufferListLock.Release ();
-				return 0;
+				return pExtent;
 			}
+		}
+	}
+
+	return 0;
+}
 
-			m_DiskLock.Release ();
+boolean CFATCache::Evict (TFATCacheExtent *pExtent)
+{
+	assert (pExtent != 0);
+	assert (pExtent->nUseCount == 0);
+
+	if (pExtent->ullDirty != 0)
+	{
+		// write back all dirty extents at once, so that the requests can be merged
+		if (!WriteBack ())
+		{
+			return FALSE;
 		}
 
-		pBuffer->nSector = BUFFER_NOSECTOR;
-		assert (pBuffer->nUseCount == 0);
+		assert (pExtent->ullDirty == 0);
+	}
+
+	// extents, which have been read ahead, but never used, are forgotten
+	if (   pExtent->nQueue == QUEUE_IN
+	    && !pExtent->bReadAhead)
+	{
+		GhostInsert (pExtent->nKey);
 	}
 
-	pBuffer->nUseCount = 1;
-	assert (pBuffer->nSector == BUFFER_NOSECTOR);
-	pBuffer->nSector = nSector;
-	pBuffer->bDirty = 0;
+	HashRemove (pExtent);
+	QueueRemove (pExtent);
+
+	pExtent->nKey = EXTENT_NOKEY;
+
+	return TRUE;
+}
 
-	if (!bWriteOnly)
+void CFATCache::Touch (TFATCacheExtent *pExtent)
+{
+	assert (pExtent != 0);
+
+	if (pExtent->bReadAhead)
 	{
-		m_DiskLock.Acquire ();
+		pExtent->bReadAhead = FALSE;
+
+		m_Statistics.nReadAheadHits++;
+	}
+
+	// extents in A1in are not moved, because repeated references to it are correlated
+	if (pExtent->nQueue == QUEUE_MAIN)
+	{
+		QueueRemove (pExtent);
+		QueueInsertFirst (QUEUE_MAIN, pExtent);
+	}
+}
+
+// An access is sequential, if the previous extent has been referenced recently.
+// A short history is needed, because FAT sectors are read in between.
+boolean CFATCache::IsSequential (unsigned nKey)
+{
+	boolean bResult = FALSE;
+	boolean bKnown = FALSE;
 
-		m_pPartition->Seek (nSector * FAT_SECTOR_SIZE);
-		if (m_pPartition->Read (pBuffer->Data, FAT_SECTOR_SIZE) != FAT_SECTOR_SIZE)
+	for (unsigned i = 0; i < FAT_CACHE_RECENT_KEYS; i++)
+	{
+		if (   nKey > 0
+		    && m_RecentKeys[i] == nKey-1)
+		{
+			bResult = TRUE;
+		}
+		else if (m_RecentKeys[i] == nKey)
 		{
-			pBuffer->nUseCount--;
-			pBuffer->nSector = BUFFER_NOSECTOR;
+			bKnown = TRUE;
+		}
+	}
 
-			Fault (FAULT_READ_ERROR);
-			m_DiskLock.Release ();
-			m_BufferListLock.Release ();
-			return 0;
+	if (!bKnown)
+	{
+		m_RecentKeys[m_nRecentNext] = nKey;
+		m_nRecentNext = (m_nRecentNext + 1) % FAT_CACHE_RECENT_KEYS;
+	}
+
+	return bResult;
+}
+
+// Reads all invalid sectors of an extent, returns TRUE, if sector nIndex is valid then
+boolean CFATCache::ReadExtent (TFATCacheExtent *pExtent, unsigned nIndex)
+{
+	assert (pExtent != 0);
+
+	unsigned nFrom, nTo;
+	GetRange (pExtent->nKey, &nFrom, &nTo);
+	assert (nFrom <= nIndex && nIndex < nTo);
+
+	m_DiskLock.Acquire ();
+
+	unsigned i = nFrom;
+	while (i < nTo)
+	{
+		if (pExtent->ullValid & ((u64) 1 << i))
+		{
+			i++;
+
+			continue;
 		}
 
-		m_DiskLock.Release ();
+		unsigned j = i+1;
+		while (   j < nTo
+		       && !(pExtent->ullValid & ((u64) 1 << j)))
+		{
+			j++;
+		}
+
+		if (   !ReadSectors (pExtent, i, j)
+		    && i <= nIndex && nIndex < j
+		    && j-i > 1)
+		{
+			// try the requested sector alone
+			ReadSectors (pExtent, nIndex, nIndex+1);
+		}
+
+		i = j;
 	}
 
-	MoveBufferFirst (pBuffer);
+	m_DiskLock.Release ();
+
+	return pExtent->ullValid & ((u64) 1 << nIndex) ? TRUE : FALSE;
+}
+
+boolean CFATCache::ReadSectors (TFATCacheExtent *pExtent, unsigned nFrom, unsigned nTo)
+{
+	assert (pExtent != 0);
+	assert (nFrom < nTo);
+	int nBytes = (nTo - nFrom) * FAT_SECTOR_SIZE;
 
-	m_BufferListLock.Release ();
+	m_Statistics.nReadRequests++;
 
-	return pBuffer;
+	m_pPartition->Seek ((u64) GetSectorNumber (pExtent->nKey, nFrom) * FAT_SECTOR_SIZE);
+	if (m_pPartition->Read (&pExtent->pData[nFrom * FAT_SECTOR_SIZE], nBytes) != nBytes)
+	{
+		return FALSE;
+	}
+
+	pExtent->ullValid |= SectorMask (nFrom, nTo);
+	m_Statistics.nSectorsRead += nTo - nFrom;
+
+	return TRUE;
 }
 
-void CFATCache::FreeSector (TFATBuffer *pBuffer, int bCritical)
+// Loads the extents nFromKey to nToKey-1 (and pDemand, if not 0) with one request each.
+// The requests are submitted together, so that the device can merge them.
+void CFATCache::ReadAhead (TFATCacheExtent *pDemand, unsigned nFromKey, unsigned nToKey)
 {
-	assert (pBuffer->nMagic == BUFFER_MAGIC);
-	assert (pBuffer->nUseCount > 0);
-	pBuffer->nUseCount--;
-	if (pBuffer->nUseCount > 0)
+	TFATCacheExtent *Extents[FAT_CACHE_READ_AHEAD+1];
+	CBlockRequest *Requests[FAT_CACHE_READ_AHEAD+1];
+	unsigned nCount = 0;
+
+	if (pDemand != 0)
 	{
-		return;
+		assert (pDemand->nUseCount > 0);
+		Extents[nCount++] = pDemand;
 	}
 
-	if (bCritical)
+	for (unsigned nKey = nFromKey; nKey < nToKey; nKey++)
 	{
-#if 0
-		if (pBuffer->bDirty)
+		unsigned nFrom, nTo;
+		GetRange (nKey, &nFrom, &nTo);
+		if (nFrom >= nTo)
+		{
+			break;			// end of device
+		}
+
+		if (Lookup (nKey) != 0)
+		{
+			continue;
+		}
+
+		TFATCacheExtent *pExtent = Allocate (nKey, FALSE);
+		if (pExtent == 0)
+		{
+			break;
+		}
+
+		pExtent->bReadAhead = TRUE;
+		pExtent->nUseCount++;		// pin it until it has been loaded
+
+		assert (nCount < FAT_CACHE_READ_AHEAD+1);
+		Extents[nCount++] = pExtent;
+	}
+
+	m_nReadAheadEnd = nToKey;
+
+	m_DiskLock.Acquire ();
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		TFATCacheExtent *pExtent = Extents[i];
+		assert (pExtent->ullValid == 0);
+
+		unsigned nFrom, nTo;
+		GetRange (pExtent->nKey, &nFrom, &nTo);
+		assert (nFrom < nTo);
+
+		Requests[i] = new CBlockRequest (FALSE, &pExtent->pData[nFrom * FAT_SECTOR_SIZE],
+						 (nTo - nFrom) * FAT_SECTOR_SIZE,
+						 (u64) GetSectorNumber (pExtent->nKey, nFrom)
+							* FAT_SECTOR_SIZE);
+		if (   Requests[i] != 0
+		    && !m_pPartition->SubmitRequest (Requests[i]))
+		{
+			delete Requests[i];
+			Requests[i] = 0;
+		}
+
+		m_Statistics.nReadRequests++;
+	}
+
+	m_pPartition->FlushRequests ();
+
+	m_DiskLock.Release ();
+
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		TFATCacheExtent *pExtent = Extents[i];
+		CBlockRequest *pRequest = Requests[i];
+
+		if (   pRequest != 0
+		    && pRequest->IsComplete ()
+		    && pRequest->GetResult () == (int) pRequest->GetCount ())
 		{
-			m_DiskLock.Acquire ();
+			unsigned nFrom, nTo;
+			GetRange (pExtent->nKey, &nFrom, &nTo);
 
-			m_pPartition->Seek (pBuffer->nSector * FAT_SECTOR_SIZE);
-			if (m_pPartition->Write (pBuffer->Data, FAT_SECTOR_SIZE) == FAT_SECTOR_SIZE)
+			pExtent->ullValid = SectorMask (nFrom, nTo);
+			m_Statistics.nSectorsRead += nTo - nFrom;
+
+			if (pExtent != pDemand)
 			{
-				pBuffer->bDirty = 0;
+				m_Statistics.nReadAheadExtents++;
 			}
+		}
 
-			m_DiskLock.Release ();
+		delete pRequest;
+
+		// a failed read-ahead extent remains invalid and is read again on demand
+		if (pExtent != pDemand)
+		{
+			assert (pExtent->nUseCount > 0);
+			pExtent->nUseCount--;
 		}
-#endif
 	}
-	else
+}
+
+// Writes all dirty sector runs, the requests are sorted and merged by the device
+boolean CFATCache::WriteBack (void)
+{
+	m_bWriteError = FALSE;
+
+	m_DiskLock.Acquire ();
+
+	for (unsigned n = 0; n < m_nExtents; n++)
 	{
-		m_BufferListLock.Acquire ();
+		TFATCacheExtent *pExtent = &m_pExtents[n];
+		assert (pExtent->nMagic == EXTENT_MAGIC);
+
+		u64 ullDirty = pExtent->ullDirty;
+		if (ullDirty == 0)
+		{
+			continue;
+		}
+
+		assert (pExtent->nKey != EXTENT_NOKEY);
+
+		unsigned i = 0;
+		while (i < m_nExtentSectors)
+		{
+			if (!(ullDirty & ((u64) 1 << i)))
+			{
+				i++;
+
+				continue;
+			}
 
-		MoveBufferLast (pBuffer);
+			unsigned j = i+1;
+			while (   j < m_nExtentSectors
+			       && (ullDirty & ((u64) 1 << j)))
+			{
+				j++;
+			}
+
+			unsigned char *pData = &pExtent->pData[i * FAT_SECTOR_SIZE];
+			int nBytes = (j - i) * FAT_SECTOR_SIZE;
+			u64 ullOffset = (u64) GetSectorNumber (pExtent->nKey, i) * FAT_SECTOR_SIZE;
+
+			m_Statistics.nWriteRequests++;
+
+			CBlockRequest *pRequest = new CBlockRequest (TRUE, pData, nBytes, ullOffset);
+			if (pRequest != 0)
+			{
+				// the completion routine clears the dirty bits and deletes the request
+				pRequest->SetCompletionRoutine (WriteCompletionRoutine, this);
 
-		m_BufferListLock.Release ();
+				if (m_pPartition->SubmitRequest (pRequest))
+				{
+					i = j;
+
+					continue;
+				}
+
+				delete pRequest;
+			}
+
+			m_pPartition->Seek (ullOffset);
+			if (m_pPartition->Write (pData, nBytes) == nBytes)
+			{
+				pExtent->ullDirty &= ~SectorMask (i, j);
+				m_Statistics.nSectorsWritten += j - i;
+			}
+			else
+			{
+				m_bWriteError = TRUE;
+			}
+
+			i = j;
+		}
 	}
+
+	m_pPartition->FlushRequests ();
+
+	m_DiskLock.Release ();
+
+	if (m_bWriteError)
+	{
+		Fault (FAULT_WRITE_ERROR);
+
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
-void CFATCache::MarkDirty (TFATBuffer *pBuffer)
+void CFATCache::WriteCompletionRoutine (CBlockRequest *pRequest, void *pParam)
 {
-	assert (pBuffer->nMagic == BUFFER_MAGIC);
-	assert (pBuffer->nUseCount > 0);
-	pBuffer->bDirty = 1;
+	CFATCache *pThis = (CFATCache *) pParam;
+	assert (pThis != 0);
+	assert (pRequest != 0);
+
+	if (pRequest->GetResult () == (int) pRequest->GetCount ())
+	{
+		unsigned nSector = (unsigned) (pRequest->GetOffset () / FAT_SECTOR_SIZE);
+		unsigned nCount = pRequest->GetCount () / FAT_SECTOR_SIZE;
+
+		TFATCacheExtent *pExtent = pThis->Lookup (pThis->GetKey (nSector));
+		assert (pExtent != 0);
+
+		unsigned nIndex = pThis->GetIndex (nSector);
+		pExtent->ullDirty &= ~SectorMask (nIndex, nIndex + nCount);
+
+		pThis->m_Statistics.nSectorsWritten += nCount;
+	}
+	else
+	{
+		pThis->m_bWriteError = TRUE;
+	}
+
+	delete pRequest;
 }
 
-void CFATCache::MoveBufferFirst (TFATBuffer *pBuffer)
+void CFATCache::HashInsert (TFATCacheExtent *pExtent)
 {
-	if (m_BufferList.pFirst != pBuffer)
+	assert (pExtent != 0);
+	assert (Lookup (pExtent->nKey) == 0);
+
+	TFATCacheExtent **ppHead = &m_ppHash[(pExtent->nKey * HASH_MULTIPLIER) >> m_nHashShift];
+	pExtent->pHashNext = *ppHead;
+	*ppHead = pExtent;
+}
+
+void CFATCache::HashRemove (TFATCacheExtent *pExtent)
+{
+	assert (pExtent != 0);
+
+	TFATCacheExtent **ppLink = &m_ppHash[(pExtent->nKey * HASH_MULTIPLIER) >> m_nHashShift];
+	while (*ppLink != pExtent)
 	{
-		TFATBuffer *pNext = pBuffer->pNext;
-		TFATBuffer *pPrev = pBuffer->pPrev;
+		assert (*ppLink != 0);
+		ppLink = &(*ppLink)->pHashNext;
+	}
 
-		pPrev->pNext = pNext;
+	*ppLink = pExtent->pHashNext;
+	pExtent->pHashNext = 0;
+}
 
-		if (pNext)
-		{
-			pNext->pPrev = pPrev;
-		}
-		else
-		{
-			m_BufferList.pLast = pPrev;
-		}
+void CFATCache::QueueInsertFirst (unsigned nQueue, TFATCacheExtent *pExtent)
+{
+	assert (nQueue < QUEUE_NONE);
+	TFATCacheQueue *pQueue = &m_Queue[nQueue];
 
-		m_BufferList.pFirst->pPrev = pBuffer;
-		pBuffer->pNext = m_BufferList.pFirst;
-		m_BufferList.pFirst = pBuffer;
-		pBuffer->pPrev = 0;
+	assert (pExtent != 0);
+	assert (pExtent->nQueue == QUEUE_NONE);
+	pExtent->nQueue = nQueue;
+	pExtent->pPrev = 0;
+	pExtent->pNext = pQueue->pFirst;
+
+	if (pQueue->pFirst != 0)
+	{
+		pQueue->pFirst->pPrev = pExtent;
+	}
+	else
+	{
+		pQueue->pLast = pExtent;
 	}
+
+	pQueue->pFirst = pExtent;
+	pQueue->nCount++;
 }
 
-void CFATCache::MoveBufferLast (TFATBuffer *pBuffer)
+void CFATCache::QueueRemove (TFATCacheExtent *pExtent)
 {
-	if (m_BufferList.pLast != pBuffer)
+	assert (pExtent != 0);
+	assert (pExtent->nQueue < QUEUE_NONE);
+	TFATCacheQueue *pQueue = &m_Queue[pExtent->nQueue];
+
+	if (pExtent->pPrev != 0)
+	{
+		pExtent->pPrev->pNext = pExtent->pNext;
+	}
+	else
 	{
-		TFATBuffer *pNext = pBuffer->pNext;
-		TFATBuffer *pPrev = pBuffer->pPrev;
+		pQueue->pFirst = pExtent->pNext;
+	}
 
-		pNext->pPrev = pPrev;
+	if (pExtent->pNext != 0)
+	{
+		pExtent->pNext->pPrev = pExtent->pPrev;
+	}
+	else
+	{
+		pQueue->pLast = pExtent->pPrev;
+	}
 
-		if (pPrev)
-		{
-			pPrev->pNext = pNext;
-		}
-		else
+	assert (pQueue->nCount > 0);
+	pQueue->nCount--;
+
+	pExtent->nQueue = QUEUE_NONE;
+	pExtent->pNext = 0;
+	pExtent->pPrev = 0;
+}
+
+boolean CFATCache::GhostRemove (unsigned nKey)
+{
+	for (unsigned i = 0; i < m_nGhostCount; i++)
+	{
+		if (m_pGhostKeys[i] == nKey)
 		{
-			m_BufferList.pFirst = pNext;
+			m_pGhostKeys[i] = EXTENT_NOKEY;
+
+			return TRUE;
 		}
+	}
+
+	return FALSE;
+}
 
-		m_BufferList.pLast->pNext = pBuffer;
-		pBuffer->pPrev = m_BufferList.pLast;
-		m_BufferList.pLast = pBuffer;
-		pBuffer->pNext = 0;
+void CFATCache::GhostInsert (unsigned nKey)
+{
+	assert (m_pGhostKeys != 0);
+	m_pGhostKeys[m_nGhostNext] = nKey;
+	m_nGhostNext = (m_nGhostNext + 1) % m_nGhostMax;
+
+	if (m_nGhostCount < m_nGhostMax)
+	{
+		m_nGhostCount++;
 	}
 }
 
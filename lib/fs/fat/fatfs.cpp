@@ -47,6 +47,9 @@ int CFATFileSystem::Mount (CDevice *pPartition)
 		return 0;
 	}
 
+	// cache extents are set to the cluster size
+	m_Cache.SetClusterGeometry (m_FATInfo.GetSectorsPerCluster (), m_FATInfo.GetFirstSector (2));
+
 	return 1;
 }
 
@@ -64,6 +67,11 @@ void CFATFileSystem::Synchronize (void)
 	m_Cache.Flush ();
 }
 
+void CFATFileSystem::GetCacheStatistics (TFATCacheStatistics *pStatistics)
+{
+	m_Cache.GetStatistics (pStatistics);
+}
+
 unsigned CFATFileSystem::RootFindFirst (TDirentry *pEntry, TFindCurrentEntry *pCurrentEntry)
 {
 	return m_Root.FindFirst (pEntry, pCurrentEntry) ? 1 : 0;
@@ -291,6 +299,31 @@ unsigned CFATFileSystem::FileRead (unsigned hFile, void *pBuffer, unsigned ulByt
 
 			unsigned nSector = m_FATInfo.GetFirstSector (pFile->nCluster) + nClusterOffset;
 
+			// read whole clusters directly, one request per contiguous run
+			// (the device drivers require a word-aligned buffer for this)
+			assert ((pFile->nOffset % FAT_SECTOR_SIZE) == 0);
+			unsigned nSectors = (ulBytes < ulBytesLeft ? ulBytes : ulBytesLeft) / FAT_SECTOR_SIZE;
+			if (   nSectors >= m_FATInfo.GetSectorsPerCluster ()
+			    && ((uintptr) pBuffer & 3) == 0)
+			{
+				unsigned nRunSectors = GetClusterRun (pFile, nClusterOffset, nSectors, FALSE);
+				if (!m_Cache.ReadDirect (nSector, nRunSectors, pBuffer))
+				{
+					m_FileTableLock.Release ();
+					return FS_ERROR;
+				}
+
+				unsigned nRunBytes = nRunSectors * FAT_SECTOR_SIZE;
+				pBuffer = (void *) (((unsigned char *) pBuffer) + nRunBytes);
+
+				pFile->nOffset += nRunBytes;
+
+				ulBytes -= nRunBytes;
+				ulBytesRead += nRunBytes;
+
+				continue;
+			}
+
 			pFile->pBuffer = m_Cache.GetSector (nSector, 0);
 			assert (pFile->pBuffer != 0);
 		}
@@ -399,6 +432,34 @@ unsigned CFATFileSystem::FileWrite (unsigned hFile, const void *pBuffer, unsigne
 
 			unsigned nSector = m_FATInfo.GetFirstSector (pFile->nCluster) + nClusterOffset;
 
+			// write whole clusters directly, one request per contiguous run
+			// (the device drivers require a word-aligned buffer for this)
+			assert ((pFile->nOffset % FAT_SECTOR_SIZE) == 0);
+			unsigned nSectors = (ulBytes < ulBytesLeft ? ulBytes : ulBytesLeft) / FAT_SECTOR_SIZE;
+			if (   nSectors >= m_FATInfo.GetSectorsPerCluster ()
+			    && ((uintptr) pBuffer & 3) == 0)
+			{
+				unsigned nRunSectors = GetClusterRun (pFile, nClusterOffset, nSectors, TRUE);
+				if (!m_Cache.WriteDirect (nSector, nRunSectors, pBuffer))
+				{
+					m_FileTableLock.Release ();
+					return FS_ERROR;
+				}
+
+				unsigned nRunBytes = nRunSectors * FAT_SECTOR_SIZE;
+				pBuffer = (const void *) (((const unsigned char *) pBuffer) + nRunBytes);
+
+				pFile->nOffset += nRunBytes;
+				assert (pFile->nOffset < FAT_MAX_FILESIZE);
+				pFile->nSize += nRunBytes;
+				assert (pFile->nSize == pFile->nOffset);
+
+				ulBytes -= nRunBytes;
+				ulBytesWritten += nRunBytes;
+
+				continue;
+			}
+
 			pFile->pBuffer = m_Cache.GetSector (nSector, 1);
 			assert (pFile->pBuffer != 0);
 		}
@@ -477,3 +538,46 @@ int CFATFileSystem::FileDelete (const char *pTitle)
 
 	return 1;
 }
+
+// Returns the number of sectors from the current position to the end of the run of physically
+// contiguous clusters (max. nMaxSectors), pFile->nCluster is set to the last cluster of the run.
+// For write, the following clusters are allocated, if they are free.
+unsigned CFATFileSystem::GetClusterRun (TFile *pFile, unsigned nClusterOffset, unsigned nMaxSectors,
+					boolean bWrite)
+{
+	assert (pFile != 0);
+
+	unsigned nSectorsPerCluster = m_FATInfo.GetSectorsPerCluster ();
+	assert (nClusterOffset < nSectorsPerCluster);
+	unsigned nRunSectors = nSectorsPerCluster - nClusterOffset;
+	assert (nRunSectors <= nMaxSectors);
+
+	if (nMaxSectors > FAT_DIRECT_TRANSFER_MAX / FAT_SECTOR_SIZE)
+	{
+		nMaxSectors = FAT_DIRECT_TRANSFER_MAX / FAT_SECTOR_SIZE;
+	}
+
+	while (nRunSectors + nSectorsPerCluster <= nMaxSectors)
+	{
+		unsigned nNextCluster = pFile->nCluster + 1;
+
+		if (bWrite)
+		{
+			if (!m_FAT.AllocateClusterAt (nNextCluster))
+			{
+				break;
+			}
+
+			m_FAT.SetClusterEntry (pFile->nCluster, nNextCluster);
+		}
+		else if (m_FAT.GetClusterEntry (pFile->nCluster) != nNextCluster)
+		{
+			break;
+		}
+
+		pFile->nCluster = nNextCluster;
+		nRunSectors += nSectorsPerCluster;
+	}
+
+	return nRunSectors;
+}
@@ -19,6 +19,7 @@
 //
 #include <circle/fs/partition.h>
 #include <circle/fs/fsdef.h>
+#include <circle/blockrequest.h>
 #include <assert.h>
 
 CPartition::CPartition (CDevice *pDevice, unsigned nFirstSector, unsigned nNumberOfSectors)
@@ -97,3 +98,36 @@ u64 CPartition::Seek (u64 ullOffset)
 
 	return m_ullOffset;
 }
+
+u64 CPartition::GetSize (void) const
+{
+	return (u64) m_nNumberOfSectors << FS_BLOCK_SHIFT;
+}
+
+boolean CPartition::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullOffset = pRequest->GetDeviceOffset ();
+	if ((ullOffset & FS_BLOCK_MASK) != 0)
+	{
+		return FALSE;
+	}
+
+	u64 ullTransferEnd = ullOffset + pRequest->GetCount () + FS_BLOCK_SIZE-1;
+	ullTransferEnd >>= FS_BLOCK_SHIFT;
+	if (ullTransferEnd > m_nNumberOfSectors)
+	{
+		return FALSE;
+	}
+
+	pRequest->AddBaseOffset ((u64) m_nFirstSector << FS_BLOCK_SHIFT);
+
+	assert (m_pDevice != 0);
+	return m_pDevice->SubmitRequest (pRequest);
+}
+
+boolean CPartition::FlushRequests (void)
+{
+	assert (m_pDevice != 0);
+	return m_pDevice->FlushRequests ();
+}
@@ -18,30 +18,109 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/heapallocator.h>
+#include <circle/multicore.h>
 #include <circle/logger.h>
 #include <circle/util.h>
 #include <assert.h>
 
-u32 CHeapAllocator::s_nBucketSize[] = { HEAP_BLOCK_BUCKET_SIZES };
+// A free large block is only split, if the remainder has at least this size
+#define HEAP_LARGE_BLOCK_MIN_SPLIT	0x1000
+
+static constexpr u32 s_nBucketSize[] = { HEAP_BLOCK_BUCKET_SIZES };
+
+#define HEAP_BUCKETS		(sizeof s_nBucketSize / sizeof s_nBucketSize[0])
+#define HEAP_MAX_BUCKET_SIZE	(s_nBucketSize[HEAP_BUCKETS-1])
+
+static constexpr boolean BucketSizesValid (void)
+{
+	for (unsigned i = 0; i < HEAP_BUCKETS; i++)
+	{
+		if (   s_nBucketSize[i] == 0
+		    || s_nBucketSize[i] % HEAP_BUCKET_GRANULE != 0
+		    || (i > 0 && s_nBucketSize[i] <= s_nBucketSize[i-1]))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+ASSERT_STATIC (HEAP_BUCKETS <= HEAP_BLOCK_MAX_BUCKETS);
+ASSERT_STATIC (BucketSizesValid ());
+
+// Maps a block size, rounded up to a multiple of HEAP_BUCKET_GRANULE, to the index of the
+// smallest bucket, which can hold it (HEAP_BUCKETS, if there is none). Bigger sizes than
+// HEAP_SIZE_CLASS_LIMIT continue with the bucket of this size and walk the few remaining.
+#define HEAP_SIZE_CLASS_LIMIT	0x10000
+
+struct TSizeClassTable
+{
+	u8 Bucket[HEAP_SIZE_CLASS_LIMIT / HEAP_BUCKET_GRANULE + 1];
+
+	constexpr TSizeClassTable (void)
+	:	Bucket ()
+	{
+		unsigned nBucket = 0;
+		for (unsigned i = 0; i < sizeof Bucket; i++)
+		{
+			while (   nBucket < HEAP_BUCKETS
+			       && s_nBucketSize[nBucket] < i * HEAP_BUCKET_GRANULE)
+			{
+				nBucket++;
+			}
+
+			Bucket[i] = (u8) nBucket;
+		}
+	}
+};
+
+static constexpr TSizeClassTable s_SizeClass;
+
+static inline unsigned GetBucketIndex (size_t nSize)
+{
+	if (nSize <= HEAP_SIZE_CLASS_LIMIT)
+	{
+		return s_SizeClass.Bucket[(nSize + HEAP_BUCKET_GRANULE-1) / HEAP_BUCKET_GRANULE];
+	}
+
+	unsigned nBucket = s_SizeClass.Bucket[HEAP_SIZE_CLASS_LIMIT / HEAP_BUCKET_GRANULE];
+	while (   nBucket < HEAP_BUCKETS
+	       && s_nBucketSize[nBucket] < nSize)
+	{
+		nBucket++;
+	}
+
+	return nBucket;
+}
 
 CHeapAllocator::CHeapAllocator (const char *pHeapName)
 :	m_pHeapName (pHeapName),
 	m_pNext (0),
 	m_pLimit (0),
-	m_nReserve (0)
+	m_nReserve (0),
+	m_pLargeFreeList (0),
+	m_nLargeBlocksUsed (0),
+	m_nLargeBytesUsed (0)
 {
 	memset (m_Bucket, 0, sizeof m_Bucket);
 
-	unsigned nBuckets = sizeof s_nBucketSize / sizeof s_nBucketSize[0];
-	if (nBuckets > HEAP_BLOCK_MAX_BUCKETS)
+	for (unsigned i = 0; i < HEAP_BUCKETS; i++)
 	{
-		nBuckets = HEAP_BLOCK_MAX_BUCKETS;
+		m_Bucket[i].nSize = s_nBucketSize[i];
 	}
 
-	for (unsigned i = 0; i < nBuckets; i++)
+#ifdef HEAP_CORE_CACHE
+	memset (m_CoreCache, 0, sizeof m_CoreCache);
+
+	for (m_nCoreCacheBuckets = 0; m_nCoreCacheBuckets < HEAP_BUCKETS; m_nCoreCacheBuckets++)
 	{
-		m_Bucket[i].nSize = s_nBucketSize[i];
+		if (m_Bucket[m_nCoreCacheBuckets].nSize > HEAP_CORE_CACHE_MAX_SIZE)
+		{
+			break;
+		}
 	}
+#endif
 }
 
 CHeapAllocator::~CHeapAllocator (void)
@@ -67,25 +146,43 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		return 0;
 	}
 
-	m_SpinLock.Acquire ();
-
-	THeapBlockBucket *pBucket;
-	for (pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
+	// the bucket sizes are constant, so the bucket can be selected without lock
+	THeapBlockBucket *pBucket = &m_Bucket[GetBucketIndex (nSize)];
+	if (pBucket->nSize > 0)
+	{
+		nSize = pBucket->nSize;
+	}
+	else
 	{
-		if (nSize <= pBucket->nSize)
+		if (nSize > (u32) -HEAP_BLOCK_ALIGN)
 		{
-			nSize = pBucket->nSize;
+			return 0;
+		}
 
-#ifdef HEAP_DEBUG
-			if (++pBucket->nCount > pBucket->nMaxCount)
-			{
-				pBucket->nMaxCount = pBucket->nCount;
-			}
-#endif
+		// large blocks occupy whole alignment units, so that they can be split and merged
+		nSize = (nSize + HEAP_ALIGN_MASK) & ~(size_t) HEAP_ALIGN_MASK;
+	}
 
-			break;
+#ifdef HEAP_CORE_CACHE
+	if ((unsigned) (pBucket - m_Bucket) < m_nCoreCacheBuckets)
+	{
+		void *pResult = AllocateCached (pBucket - m_Bucket);
+		if (pResult != 0)
+		{
+			return pResult;
 		}
 	}
+#endif
+
+	m_SpinLock.Acquire ();
+
+#ifdef HEAP_DEBUG
+	if (   pBucket->nSize > 0
+	    && ++pBucket->nCount > pBucket->nMaxCount)
+	{
+		pBucket->nMaxCount = pBucket->nCount;
+	}
+#endif
 
 	THeapBlockHeader *pBlockHeader;
 	if (   pBucket->nSize > 0
@@ -94,6 +191,11 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 		pBucket->pFreeList = pBlockHeader->pNext;
 	}
+	else if (   pBucket->nSize == 0
+		 && (pBlockHeader = AllocateLarge (nSize)) != 0)
+	{
+		assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+	}
 	else
 	{
 		pBlockHeader = (THeapBlockHeader *) m_pNext;
@@ -134,6 +236,12 @@ void *CHeapAllocator::Allocate (size_t nSize)
 		pBlockHeader->nSize = (u32) nSize;
 	}
 
+	if (pBucket->nSize == 0)
+	{
+		m_nLargeBlocksUsed++;
+		m_nLargeBytesUsed += pBlockHeader->nSize;
+	}
+
 	m_SpinLock.Release ();
 
 	pBlockHeader->pNext = 0;
@@ -166,6 +274,12 @@ void *CHeapAllocator::ReAllocate (void *pBlock, size_t nSize)
 		return pBlock;
 	}
 
+	if (   pBlockHeader->nSize > HEAP_MAX_BUCKET_SIZE
+	    && GrowLarge (pBlockHeader, nSize))
+	{
+		return pBlock;
+	}
+
 	void *pNewBlock = Allocate (nSize);
 	if (pNewBlock == 0)
 	{
@@ -190,40 +304,446 @@ void CHeapAllocator::Free (void *pBlock)
 		(THeapBlockHeader *) ((uintptr) pBlock - sizeof (THeapBlockHeader));
 	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
 
-	for (THeapBlockBucket *pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
+	if (pBlockHeader->nSize <= HEAP_MAX_BUCKET_SIZE)
 	{
-		if (pBlockHeader->nSize == pBucket->nSize)
+		unsigned nBucket = GetBucketIndex (pBlockHeader->nSize);
+		THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+		assert (pBucket->nSize == pBlockHeader->nSize);
+
+#ifdef HEAP_CORE_CACHE
+		if (nBucket < m_nCoreCacheBuckets)
 		{
-			m_SpinLock.Acquire ();
+			FreeCached (pBlockHeader, nBucket);
+
+			return;
+		}
+#endif
 
-			pBlockHeader->pNext = pBucket->pFreeList;
-			pBucket->pFreeList = pBlockHeader;
+		m_SpinLock.Acquire ();
+
+		pBlockHeader->pNext = pBucket->pFreeList;
+		pBucket->pFreeList = pBlockHeader;
 
 #ifdef HEAP_DEBUG
-			pBucket->nCount--;
+		pBucket->nCount--;
 #endif
 
+		m_SpinLock.Release ();
+
+		return;
+	}
+
+	m_SpinLock.Acquire ();
+
+	FreeLarge (pBlockHeader);
+
+	m_SpinLock.Release ();
+}
+
+// Large blocks (bigger than the largest bucket size) are managed in a single free list,
+// which is ordered by address. Adjacent free blocks are merged on free, and a free block
+// at the top of the used heap area is returned to the area, which is not allocated yet.
+// These functions have to be called with the spin lock acquired.
+
+THeapBlockHeader *CHeapAllocator::AllocateLarge (size_t nSize)
+{
+	assert ((nSize & HEAP_ALIGN_MASK) == 0);
+
+	// best fit
+	THeapBlockHeader *pBest = 0;
+	THeapBlockHeader *pBestPrev = 0;
+	THeapBlockHeader *pPrev = 0;
+	for (THeapBlockHeader *pBlock = m_pLargeFreeList; pBlock != 0; pBlock = pBlock->pNext)
+	{
+		assert (pBlock->nMagic == HEAP_BLOCK_MAGIC);
+
+		if (   pBlock->nSize >= nSize
+		    && (   pBest == 0
+			|| pBlock->nSize < pBest->nSize))
+		{
+			pBest = pBlock;
+			pBestPrev = pPrev;
+
+			if (pBlock->nSize == nSize)
+			{
+				break;
+			}
+		}
+
+		pPrev = pBlock;
+	}
+
+	if (pBest == 0)
+	{
+		return 0;
+	}
+
+	THeapBlockHeader *pNext = pBest->pNext;
+
+	if (pBest->nSize - nSize >= sizeof (THeapBlockHeader) + HEAP_LARGE_BLOCK_MIN_SPLIT)
+	{
+		// the remainder stays on the free list at the same position
+		THeapBlockHeader *pRemainder = (THeapBlockHeader *) (pBest->Data + nSize);
+		pRemainder->nMagic = HEAP_BLOCK_MAGIC;
+		pRemainder->nSize = (u32) (pBest->nSize - nSize - sizeof (THeapBlockHeader));
+		pRemainder->pNext = pNext;
+
+		pBest->nSize = (u32) nSize;
+
+		pNext = pRemainder;
+	}
+
+	if (pBestPrev != 0)
+	{
+		pBestPrev->pNext = pNext;
+	}
+	else
+	{
+		m_pLargeFreeList = pNext;
+	}
+
+	return pBest;
+}
+
+void CHeapAllocator::FreeLarge (THeapBlockHeader *pBlockHeader)
+{
+	assert (pBlockHeader != 0);
+	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+
+	assert (m_nLargeBlocksUsed > 0);
+	m_nLargeBlocksUsed--;
+	assert (m_nLargeBytesUsed >= pBlockHeader->nSize);
+	m_nLargeBytesUsed -= pBlockHeader->nSize;
+
+	THeapBlockHeader *pPrevPrev = 0;
+	THeapBlockHeader *pPrev = 0;
+	THeapBlockHeader *pNext = m_pLargeFreeList;
+	while (   pNext != 0
+	       && pNext < pBlockHeader)
+	{
+		pPrevPrev = pPrev;
+		pPrev = pNext;
+		pNext = pNext->pNext;
+	}
+
+	assert (pNext != pBlockHeader);		// freed twice?
+
+	// merge with following free block
+	if (   pNext != 0
+	    && pBlockHeader->Data + pBlockHeader->nSize == (u8 *) pNext)
+	{
+		pBlockHeader->nSize += sizeof (THeapBlockHeader) + pNext->nSize;
+		pNext = pNext->pNext;
+	}
+
+	// merge with preceding free block
+	if (   pPrev != 0
+	    && pPrev->Data + pPrev->nSize == (u8 *) pBlockHeader)
+	{
+		pPrev->nSize += sizeof (THeapBlockHeader) + pBlockHeader->nSize;
+		pBlockHeader = pPrev;
+		pPrev = pPrevPrev;
+	}
+
+	// the block is linked between pPrev and pNext now
+	if (pBlockHeader->Data + pBlockHeader->nSize == m_pNext)
+	{
+		// top most block, return it to the unallocated area
+		assert (pNext == 0);
+
+		m_pNext = (u8 *) pBlockHeader;
+
+		pBlockHeader = 0;
+	}
+	else
+	{
+		pBlockHeader->pNext = pNext;
+	}
+
+	if (pPrev != 0)
+	{
+		pPrev->pNext = pBlockHeader;
+	}
+	else
+	{
+		m_pLargeFreeList = pBlockHeader;
+	}
+}
+
+boolean CHeapAllocator::GrowLarge (THeapBlockHeader *pBlockHeader, size_t nSize)
+{
+	assert (pBlockHeader != 0);
+	assert (pBlockHeader->nSize < nSize);
+
+	nSize = (nSize + HEAP_ALIGN_MASK) & ~(size_t) HEAP_ALIGN_MASK;
+	if (nSize > (u32) -HEAP_BLOCK_ALIGN)
+	{
+		return FALSE;
+	}
+
+	m_SpinLock.Acquire ();
+
+	u8 *pEnd = pBlockHeader->Data + pBlockHeader->nSize;
+	size_t nMissing = nSize - pBlockHeader->nSize;
+
+	if (pEnd == m_pNext)
+	{
+		// top most block, take space from the unallocated area
+		if (nMissing + m_nReserve > (size_t) (m_pLimit - m_pNext))
+		{
 			m_SpinLock.Release ();
 
-			return;
+			return FALSE;
 		}
+
+		m_pNext += nMissing;
 	}
+	else
+	{
+		// take space from a following free block
+		THeapBlockHeader *pPrev = 0;
+		THeapBlockHeader *pNext;
+		for (pNext = m_pLargeFreeList; pNext != 0; pNext = pNext->pNext)
+		{
+			if ((u8 *) pNext >= pEnd)
+			{
+				break;
+			}
+
+			pPrev = pNext;
+		}
+
+		if (   pNext == 0
+		    || (u8 *) pNext != pEnd
+		    || sizeof (THeapBlockHeader) + pNext->nSize < nMissing)
+		{
+			m_SpinLock.Release ();
+
+			return FALSE;
+		}
+
+		size_t nAvailable = sizeof (THeapBlockHeader) + pNext->nSize;
+		THeapBlockHeader *pFollowing = pNext->pNext;
+
+		if (nAvailable - nMissing >= sizeof (THeapBlockHeader) + HEAP_LARGE_BLOCK_MIN_SPLIT)
+		{
+			THeapBlockHeader *pRemainder = (THeapBlockHeader *) (pEnd + nMissing);
+			pRemainder->nMagic = HEAP_BLOCK_MAGIC;
+			pRemainder->nSize = (u32) (nAvailable - nMissing - sizeof (THeapBlockHeader));
+			pRemainder->pNext = pFollowing;
+
+			pFollowing = pRemainder;
+		}
+		else
+		{
+			nMissing = nAvailable;
+		}
+
+		if (pPrev != 0)
+		{
+			pPrev->pNext = pFollowing;
+		}
+		else
+		{
+			m_pLargeFreeList = pFollowing;
+		}
+	}
+
+	pBlockHeader->nSize += (u32) nMissing;
+	m_nLargeBytesUsed += nMissing;
+
+	m_SpinLock.Release ();
+
+	return TRUE;
+}
+
+#ifdef HEAP_CORE_CACHE
+
+// The per-core cache is accessed with IRQs disabled only, because it cannot be
+// used from other cores. The spin lock is required, when the cache of a bucket
+// is refilled from or returned to the global free list.
+
+void *CHeapAllocator::AllocateCached (unsigned nBucket)
+{
+	assert (nBucket < m_nCoreCacheBuckets);
+
+	EnterCritical (IRQ_LEVEL);
+
+	THeapCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+
+	THeapBlockHeader *pBlockHeader = pCache->pFreeList[nBucket];
+	if (pBlockHeader == 0)
+	{
+		// refill the cache with a batch of blocks from the global free list
+		THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+
+		m_SpinLock.Acquire ();
+
+		unsigned nCount = 0;
+		THeapBlockHeader *pLast = 0;
+		for (pBlockHeader = pBucket->pFreeList;
+		     pBlockHeader != 0 && nCount < (HEAP_CORE_CACHE_BLOCKS+1) / 2;
+		     pBlockHeader = pBlockHeader->pNext)
+		{
+			assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+
+			pLast = pBlockHeader;
+			nCount++;
+		}
+
+		if (nCount == 0)
+		{
+			m_SpinLock.Release ();
+
+			LeaveCritical ();
+
+			return 0;		// allocate a new block from the global heap
+		}
+
+		pCache->pFreeList[nBucket] = pBucket->pFreeList;
+		pBucket->pFreeList = pLast->pNext;
+		pLast->pNext = 0;
 
 #ifdef HEAP_DEBUG
-	CLogger::Get ()->Write (m_pHeapName, LogDebug, "Trying to free large block (size %u)",
-				pBlockHeader->nSize);
+		pBucket->nCount += nCount;
+		if (pBucket->nCount > pBucket->nMaxCount)
+		{
+			pBucket->nMaxCount = pBucket->nCount;
+		}
 #endif
+
+		m_SpinLock.Release ();
+
+		pCache->nCount[nBucket] = nCount;
+
+		pBlockHeader = pCache->pFreeList[nBucket];
+	}
+
+	assert (pBlockHeader->nMagic == HEAP_BLOCK_MAGIC);
+	pCache->pFreeList[nBucket] = pBlockHeader->pNext;
+	pCache->nCount[nBucket]--;
+
+	LeaveCritical ();
+
+	pBlockHeader->pNext = 0;
+
+	void *pResult = pBlockHeader->Data;
+	assert (((uintptr) pResult & HEAP_ALIGN_MASK) == 0);
+
+	return pResult;
 }
 
+void CHeapAllocator::FreeCached (THeapBlockHeader *pBlockHeader, unsigned nBucket)
+{
+	assert (pBlockHeader != 0);
+	assert (nBucket < m_nCoreCacheBuckets);
+
+	EnterCritical (IRQ_LEVEL);
+
+	THeapCoreCache *pCache = &m_CoreCache[CMultiCoreSupport::ThisCore ()];
+
+	pBlockHeader->pNext = pCache->pFreeList[nBucket];
+	pCache->pFreeList[nBucket] = pBlockHeader;
+
+	if (++pCache->nCount[nBucket] > HEAP_CORE_CACHE_BLOCKS)
+	{
+		// keep the recently freed blocks and return the older half to the global free list
+		THeapBlockHeader *pLast = pCache->pFreeList[nBucket];
+		for (unsigned i = 1; i < HEAP_CORE_CACHE_BLOCKS / 2; i++)
+		{
+			pLast = pLast->pNext;
+			assert (pLast != 0);
+		}
+
+		THeapBlockHeader *pFirstReturned = pLast->pNext;
+		assert (pFirstReturned != 0);
+		pLast->pNext = 0;
+
+		unsigned nReturned = pCache->nCount[nBucket] - HEAP_CORE_CACHE_BLOCKS / 2;
+		pCache->nCount[nBucket] = HEAP_CORE_CACHE_BLOCKS / 2;
+
+		for (pLast = pFirstReturned; pLast->pNext != 0; pLast = pLast->pNext)
+		{
+			// find end of list
+		}
+
+		THeapBlockBucket *pBucket = &m_Bucket[nBucket];
+
+		m_SpinLock.Acquire ();
+
+		pLast->pNext = pBucket->pFreeList;
+		pBucket->pFreeList = pFirstReturned;
+
 #ifdef HEAP_DEBUG
+		pBucket->nCount -= nReturned;
+#else
+		(void) nReturned;
+#endif
+
+		m_SpinLock.Release ();
+	}
+
+	LeaveCritical ();
+}
+
+#endif
 
 void CHeapAllocator::DumpStatus (void)
 {
-	for (THeapBlockBucket *pBucket = m_Bucket; pBucket->nSize > 0; pBucket++)
+#ifdef HEAP_DEBUG
+	unsigned nBucket = 0;
+	for (THeapBlockBucket *pBucket = m_Bucket; pBucket->nSize > 0; pBucket++, nBucket++)
 	{
-		CLogger::Get ()->Write (m_pHeapName, LogDebug, "malloc(%lu): %u blocks (max %u)",
-					pBucket->nSize, pBucket->nCount, pBucket->nMaxCount);
-	}
-}
+		unsigned nCached = 0;
+#ifdef HEAP_CORE_CACHE
+		if (nBucket < m_nCoreCacheBuckets)
+		{
+			for (unsigned nCore = 0; nCore < CORES; nCore++)
+			{
+				nCached += m_CoreCache[nCore].nCount[nBucket];
+			}
+		}
+#endif
 
+		CLogger::Get ()->Write (m_pHeapName, LogDebug,
+					"malloc(%lu): %u blocks (max %u), %u cached",
+					pBucket->nSize, pBucket->nCount - nCached,
+					pBucket->nMaxCount, nCached);
+	}
 #endif
+
+	m_SpinLock.Acquire ();
+
+	unsigned nFreeBlocks = 0;
+	size_t nFreeBytes = 0;
+	size_t nLargestFree = 0;
+	for (THeapBlockHeader *pBlock = m_pLargeFreeList; pBlock != 0; pBlock = pBlock->pNext)
+	{
+		nFreeBlocks++;
+		nFreeBytes += pBlock->nSize;
+
+		if (pBlock->nSize > nLargestFree)
+		{
+			nLargestFree = pBlock->nSize;
+		}
+	}
+
+	unsigned nUsedBlocks = m_nLargeBlocksUsed;
+	size_t nUsedBytes = m_nLargeBytesUsed;
+	size_t nUnallocated = m_pLimit - m_pNext;
+
+	m_SpinLock.Release ();
+
+	// fragmentation: percentage of free large block space, which is not in the largest block
+	unsigned nFragmentation = nFreeBytes > 0 ? 100 - nLargestFree * 100 / nFreeBytes : 0;
+
+	CLogger::Get ()->Write (m_pHeapName, LogNotice,
+				"Large blocks: %u used (%lu KB), %u free (%lu KB, largest %lu KB)",
+				nUsedBlocks, (unsigned long) (nUsedBytes / 1024),
+				nFreeBlocks, (unsigned long) (nFreeBytes / 1024),
+				(unsigned long) (nLargestFree / 1024));
+
+	CLogger::Get ()->Write (m_pHeapName, LogNotice,
+				"Fragmentation %u%%, unallocated %lu KB",
+				nFragmentation, (unsigned long) (nUnallocated / 1024));
+}
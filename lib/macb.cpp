@@ -16,6 +16,8 @@
 #include <circle/bcmpciehostbridge.h>
 #include <circle/devicetreeblob.h>
 #include <circle/machineinfo.h>
+#include <circle/interrupt.h>
+#include <circle/rp1int.h>
 #include <circle/timer.h>
 #include <circle/memory.h>
 #include <circle/logger.h>
@@ -920,7 +922,8 @@ LOGMODULE ("macb");
 
 CMACBDevice::CMACBDevice (void)
 :	m_phy_addr (PHY_ID),
-	m_link (0)
+	m_link (0),
+	m_bInterruptConnected (FALSE)
 {
 	m_PHYResetPin.AssignPin (GPIO_PHY_RESET);
 	m_PHYResetPin.Write (HIGH);
@@ -929,6 +932,14 @@ CMACBDevice::CMACBDevice (void)
 
 CMACBDevice::~CMACBDevice (void)
 {
+	if (m_bInterruptConnected)
+	{
+		macb_writel (IDR, 0xFFFFFFFF);
+
+		CInterruptSystem::Get ()->DisconnectIRQ (RP1_IRQ_ETH);
+		m_bInterruptConnected = FALSE;
+	}
+
 	macb_halt ();
 
 	m_PHYResetPin.SetMode (GPIOModeInput);
@@ -987,6 +998,17 @@ boolean CMACBDevice::Initialize (void)
 		return FALSE;
 	}
 
+	// Enable RX and TX completion interrupts, they signal the event handler only
+
+	macb_writel (IDR, 0xFFFFFFFF);
+	macb_writel (ISR, macb_readl (ISR));
+
+	assert (!m_bInterruptConnected);
+	CInterruptSystem::Get ()->ConnectIRQ (RP1_IRQ_ETH, InterruptStub, this);
+	m_bInterruptConnected = TRUE;
+
+	macb_writel (IER, MACB_BIT (RCOMP) | MACB_BIT (TCOMP));
+
 	// Add network device
 
 	AddNetDevice ();
@@ -1057,6 +1079,20 @@ boolean CMACBDevice::SendFrame (const void *pBuffer, unsigned nLength)
 
 	assert (m_tx_buffer);
 	memcpy (m_tx_buffer, pBuffer, nLength);
+
+	/*
+	 * The checksum is generated by the HW. Clear the field, otherwise
+	 * wrong UDP checksums may be generated for very short datagrams.
+	 */
+	unsigned csum_start;
+	boolean bUDP;
+	unsigned csum_offset = GetChecksumOffset (m_tx_buffer, nLength, &csum_start, &bUDP);
+	if (csum_offset)
+	{
+		m_tx_buffer[csum_offset] = 0;
+		m_tx_buffer[csum_offset+1] = 0;
+	}
+
 	DataMemBarrier ();
 
 	u32 ctrl = nLength & TXBUF_FRMLEN_MASK;
@@ -1079,9 +1115,45 @@ boolean CMACBDevice::SendFrame (const void *pBuffer, unsigned nLength)
 }
 
 boolean CMACBDevice::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
+{
+	u32 ctrl;
+	return rx_frame (pBuffer, pResultLength, &ctrl);
+}
+
+CNetBuffer *CMACBDevice::ReceiveNetBuffer (void)
+{
+	CNetBuffer *pBuffer = CNetBuffer::Alloc (0);
+	if (!pBuffer)
+	{
+		return 0;
+	}
+
+	unsigned nLength;
+	u32 ctrl;
+	if (!rx_frame (pBuffer->Put (FRAME_BUFFER_SIZE), &nLength, &ctrl))
+	{
+		pBuffer->Release ();
+
+		return 0;
+	}
+
+	assert (nLength <= FRAME_BUFFER_SIZE);
+	pBuffer->Trim (nLength);
+
+	/* IP header and TCP/UDP checksum have been verified by the HW */
+	if (GEM_BFEXT (RX_CSUM, ctrl) & GEM_RX_CSUM_CHECKED_MASK)
+	{
+		pBuffer->SetChecksumVerified ();
+	}
+
+	return pBuffer;
+}
+
+boolean CMACBDevice::rx_frame (void *pBuffer, unsigned *pResultLength, u32 *pctrl)
 {
 	assert (pBuffer);
 	assert (pResultLength);
+	assert (pctrl);
 
 	DataSyncBarrier ();
 	u32 addr = m_rx_ring[m_rx_tail].addr;
@@ -1096,6 +1168,7 @@ boolean CMACBDevice::ReceiveFrame (void *pBuffer, unsigned *pResultLength)
 
 	DataMemBarrier ();
 	u32 ctrl = m_rx_ring[m_rx_tail].ctrl;
+	*pctrl = ctrl;
 	const u32 mask = MACB_BIT (RX_SOF) | MACB_BIT (RX_EOF);
 	if ((ctrl & mask) != mask)
 	{
@@ -1210,6 +1283,7 @@ int CMACBDevice::eth_alloc (void)
 	u32 ncfgr = gem_mdc_clk_div (0);
 	ncfgr |= macb_dbw ();
 	ncfgr |= MACB_BIT (DRFCS);		/* Discard Rx FCS */
+	ncfgr |= GEM_BIT (RXCOEN);		/* Rx checksum offload */
 	macb_writel (NCFGR, ncfgr);
 
 	return 0;
@@ -1374,6 +1448,7 @@ void CMACBDevice::gmac_configure_dma (void)
 	dmacfg &= ~GEM_BIT(ENDIA_PKT);
 	dmacfg &= ~GEM_BIT(ENDIA_DESC); /* little endian */
 	dmacfg |= GEM_BIT(ADDR64);
+	dmacfg |= GEM_BIT(TXCOEN);	/* Tx IP/TCP/UDP checksum generation */
 	gem_writel(DMACFG, dmacfg);
 }
 
@@ -1653,6 +1728,25 @@ void CMACBDevice::mdio_reset(void)
 	CTimer::Get ()->MsDelay (10);
 }
 
+void CMACBDevice::InterruptHandler (void)
+{
+	u32 isr = macb_readl (ISR);
+	macb_writel (ISR, isr);		// needed, if ISR is not cleared on read
+
+	if (isr & (MACB_BIT (RCOMP) | MACB_BIT (TCOMP)))
+	{
+		SignalEvent ();
+	}
+}
+
+void CMACBDevice::InterruptStub (void *pParam)
+{
+	CMACBDevice *pThis = static_cast<CMACBDevice *> (pParam);
+	assert (pThis != 0);
+
+	pThis->InterruptHandler ();
+}
+
 unsigned CMACBDevice::mii_nway_result (unsigned negotiated)
 {
 	unsigned ret;
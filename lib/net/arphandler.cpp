@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/arphandler.h>
+#include <circle/net/netsubsystem.h>
 #include <circle/net/linklayer.h>
 #include <circle/util.h>
 #include <circle/macros.h>
@@ -275,7 +276,7 @@ boolean CARPHandler::Resolve (const CIPAddress &rIPAddress, CMACAddress *pMACAdd
 			nFreeSlot = m_nEntries;
 			m_Entry[nFreeSlot].State = ARPStateFreeSlot;
 
-			m_Entry[nFreeSlot].pTxQueue = new CNetQueue;
+			m_Entry[nFreeSlot].pTxQueue = new CNetQueue (NET_QUEUE_SIZE, TRUE);
 			assert (m_Entry[nFreeSlot].pTxQueue != 0);
 
 			m_nEntries++;
@@ -368,7 +369,7 @@ void CARPHandler::RequestReceived (const CIPAddress &rForeignIP, const CMACAddre
 		nFreeSlot = m_nEntries;
 		m_Entry[nFreeSlot].State = ARPStateFreeSlot;
 
-		m_Entry[nFreeSlot].pTxQueue = new CNetQueue;
+		m_Entry[nFreeSlot].pTxQueue = new CNetQueue (NET_QUEUE_SIZE, TRUE);
 		assert (m_Entry[nFreeSlot].pTxQueue != 0);
 
 		m_nEntries++;
@@ -435,4 +436,6 @@ void CARPHandler::TimerHandler (TKernelTimerHandle hTimer, void *pParam, void *p
 	}
 
 	pThis->m_SpinLock.Release ();
+
+	CNetSubSystem::Get ()->SignalEvent ();
 }
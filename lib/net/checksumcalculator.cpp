@@ -18,9 +18,139 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/checksumcalculator.h>
+#include <circle/synchronize.h>
+#include <circle/sysconfig.h>
 #include <circle/util.h>
 #include <assert.h>
 
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+	#if defined (__has_include)
+		#if __has_include (<arm_neon.h>)
+			#include <arm_neon.h>
+			#define CHECKSUM_NEON
+		#endif
+	#endif
+#endif
+
+#ifdef CHECKSUM_NEON
+
+#define NEON_BLOCK_SIZE		64		// bytes per loop iteration
+#define NEON_MIN_LENGTH		128		// shorter chunks are summed up without NEON
+#define NEON_MAX_BLOCKS		4096		// 32-bit lanes cannot overflow in this run
+
+static inline boolean NEONAllowed (unsigned nLength)
+{
+	if (nLength < NEON_MIN_LENGTH)
+	{
+		return FALSE;
+	}
+
+	// the floating point registers are saved on task switch, but on IRQ and FIQ only,
+	// if the respective system option is defined
+#ifndef SAVE_VFP_REGS_ON_IRQ
+	return CurrentExecutionLevel () == TASK_LEVEL;
+#elif !defined (SAVE_VFP_REGS_ON_FIQ)
+	return CurrentExecutionLevel () != FIQ_LEVEL;
+#else
+	return TRUE;
+#endif
+}
+
+// VPADAL adds adjacent 16-bit words into the 32-bit lanes of four accumulators,
+// which are widened to 64-bit, before they can overflow.
+static u64 SumBlocksNEON (const u8 *pSource, unsigned nBlocks)
+{
+	uint64x2_t Sum64 = vdupq_n_u64 (0);
+
+	while (nBlocks > 0)
+	{
+		unsigned nCount = nBlocks < NEON_MAX_BLOCKS ? nBlocks : NEON_MAX_BLOCKS;
+		nBlocks -= nCount;
+
+		uint32x4_t Sum0 = vdupq_n_u32 (0);
+		uint32x4_t Sum1 = vdupq_n_u32 (0);
+		uint32x4_t Sum2 = vdupq_n_u32 (0);
+		uint32x4_t Sum3 = vdupq_n_u32 (0);
+
+		do
+		{
+			Sum0 = vpadalq_u16 (Sum0, vreinterpretq_u16_u8 (vld1q_u8 (pSource)));
+			Sum1 = vpadalq_u16 (Sum1, vreinterpretq_u16_u8 (vld1q_u8 (pSource + 16)));
+			Sum2 = vpadalq_u16 (Sum2, vreinterpretq_u16_u8 (vld1q_u8 (pSource + 32)));
+			Sum3 = vpadalq_u16 (Sum3, vreinterpretq_u16_u8 (vld1q_u8 (pSource + 48)));
+
+			pSource += NEON_BLOCK_SIZE;
+		}
+		while (--nCount != 0);
+
+		Sum64 = vpadalq_u32 (Sum64, Sum0);
+		Sum64 = vpadalq_u32 (Sum64, Sum1);
+		Sum64 = vpadalq_u32 (Sum64, Sum2);
+		Sum64 = vpadalq_u32 (Sum64, Sum3);
+	}
+
+	return vgetq_lane_u64 (Sum64, 0) + vgetq_lane_u64 (Sum64, 1);
+}
+
+// same as SumBlocksNEON(), but the data is stored to pDest, while it is in the registers
+static u64 CopyAndSumBlocksNEON (u8 *pDest, const u8 *pSource, unsigned nBlocks)
+{
+	uint64x2_t Sum64 = vdupq_n_u64 (0);
+
+	while (nBlocks > 0)
+	{
+		unsigned nCount = nBlocks < NEON_MAX_BLOCKS ? nBlocks : NEON_MAX_BLOCKS;
+		nBlocks -= nCount;
+
+		uint32x4_t Sum0 = vdupq_n_u32 (0);
+		uint32x4_t Sum1 = vdupq_n_u32 (0);
+		uint32x4_t Sum2 = vdupq_n_u32 (0);
+		uint32x4_t Sum3 = vdupq_n_u32 (0);
+
+		do
+		{
+			uint8x16_t Data0 = vld1q_u8 (pSource);
+			uint8x16_t Data1 = vld1q_u8 (pSource + 16);
+			uint8x16_t Data2 = vld1q_u8 (pSource + 32);
+			uint8x16_t Data3 = vld1q_u8 (pSource + 48);
+			pSource += NEON_BLOCK_SIZE;
+
+			vst1q_u8 (pDest, Data0);
+			vst1q_u8 (pDest + 16, Data1);
+			vst1q_u8 (pDest + 32, Data2);
+			vst1q_u8 (pDest + 48, Data3);
+			pDest += NEON_BLOCK_SIZE;
+
+			Sum0 = vpadalq_u16 (Sum0, vreinterpretq_u16_u8 (Data0));
+			Sum1 = vpadalq_u16 (Sum1, vreinterpretq_u16_u8 (Data1));
+			Sum2 = vpadalq_u16 (Sum2, vreinterpretq_u16_u8 (Data2));
+			Sum3 = vpadalq_u16 (Sum3, vreinterpretq_u16_u8 (Data3));
+		}
+		while (--nCount != 0);
+
+		Sum64 = vpadalq_u32 (Sum64, Sum0);
+		Sum64 = vpadalq_u32 (Sum64, Sum1);
+		Sum64 = vpadalq_u32 (Sum64, Sum2);
+		Sum64 = vpadalq_u32 (Sum64, Sum3);
+	}
+
+	return vgetq_lane_u64 (Sum64, 0) + vgetq_lane_u64 (Sum64, 1);
+}
+
+#endif
+
+// Because 2^16 and 2^32 are congruent to 1 modulo 0xFFFF, a 64-bit sum folds
+// to the same ones' complement sum as adding 16-bit words.
+static inline u32 FoldSum64 (u64 nSum)
+{
+	while (nSum >> 32)
+	{
+		nSum = (nSum & 0xFFFFFFFF) + (nSum >> 32);
+	}
+
+	return (u32) nSum;
+}
+
 CChecksumCalculator::CChecksumCalculator (const CIPAddress &rSourceIP, int nProtocol)
 :	m_bDestAddressSet (FALSE)
 {
@@ -69,6 +199,67 @@ u16 CChecksumCalculator::Calculate (const void *pBuffer, unsigned nLength)
 	return ~FoldResult (nChecksum);
 }
 
+u16 CChecksumCalculator::CalculatePseudoHeader (unsigned nLength)
+{
+	assert (m_bDestAddressSet);
+
+	m_Header.nTCPLength = le2be16 (nLength);
+
+	return FoldResult (CalculateChunk (&m_Header, sizeof m_Header, 0));
+}
+
+boolean CChecksumCalculator::IsValid (const void *pPacket, unsigned nLength,
+				      const CNetBuffer *pNetBuffer)
+{
+	if (   pNetBuffer != 0
+	    && pNetBuffer->GetData () == pPacket
+	    && pNetBuffer->GetLength () == nLength)
+	{
+		switch (pNetBuffer->GetChecksumState ())
+		{
+		case NetChecksumVerified:
+			return TRUE;
+
+		case NetChecksumComplete: {
+			// only the pseudo header has to be added to the sum from the net device
+			u32 nChecksum = CalculatePseudoHeader (nLength);
+			nChecksum += pNetBuffer->GetChecksum ();
+
+			return (u16) ~FoldResult (nChecksum) == CHECKSUM_OK;
+			}
+
+		default:
+			break;
+		}
+	}
+
+	return Calculate (pPacket, nLength) == CHECKSUM_OK;
+}
+
+u16 CChecksumCalculator::CopyAndCalculate (void *pPacket, unsigned nHeaderLength,
+					       const void *pData, unsigned nDataLength)
+{
+	assert (m_bDestAddressSet);
+	assert (pPacket != 0);
+	assert (nHeaderLength > 0);
+	assert (!(nHeaderLength & 1));		// data must start at a 16-bit word boundary
+
+	unsigned nLength = nHeaderLength + nDataLength;
+	m_Header.nTCPLength = le2be16 (nLength);
+	u32 nChecksum = CalculateChunk (&m_Header, sizeof m_Header, 0);
+
+	nChecksum = CalculateChunk (pPacket, nHeaderLength, nChecksum);
+
+	if (nDataLength > 0)
+	{
+		assert (pData != 0);
+		nChecksum = CopyAndCalculateChunk ((u8 *) pPacket + nHeaderLength,
+						   pData, nDataLength, nChecksum);
+	}
+
+	return ~FoldResult (nChecksum);
+}
+
 u16 CChecksumCalculator::SimpleCalculate (const void *pBuffer, unsigned nLength)
 {
 	assert (pBuffer != 0);
@@ -80,22 +271,174 @@ u16 CChecksumCalculator::SimpleCalculate (const void *pBuffer, unsigned nLength)
 
 u32 CChecksumCalculator::CalculateChunk (const void *pBuffer, unsigned nLength, u32 nChecksum)
 {
-	u16 *pBuffer16 = (u16 *) pBuffer;
-	assert (pBuffer16 != 0);
+	assert (pBuffer != 0);
 	assert (nLength > 0);
 
-	while (nLength >= 2)
+#ifdef CHECKSUM_NEON
+	if (NEONAllowed (nLength))
 	{
-		nChecksum += *pBuffer16++;
+		const u8 *pBuffer8 = (const u8 *) pBuffer;
+		unsigned nBlocks = nLength / NEON_BLOCK_SIZE;
+		nChecksum = FoldSum64 (nChecksum + SumBlocksNEON (pBuffer8, nBlocks));
+
+		// the rest starts at an even offset, so that the 16-bit words match
+		unsigned nDone = nBlocks * NEON_BLOCK_SIZE;
+		if (nDone == nLength)
+		{
+			return nChecksum;
+		}
+
+		return CalculateChunkScalar (pBuffer8 + nDone, nLength - nDone, nChecksum);
+	}
+#endif
+
+	return CalculateChunkScalar (pBuffer, nLength, nChecksum);
+}
+
+u32 CChecksumCalculator::CalculateChunkScalar (const void *pBuffer, unsigned nLength,
+					       u32 nChecksum)
+{
+	assert (pBuffer != 0);
+	assert (nLength > 0);
+
+	u64 nSum = nChecksum;
+
+	if ((uintptr) pBuffer & 1)
+	{
+		// odd address, sum up 16-bit words
+		const u16 *pBuffer16 = (const u16 *) pBuffer;
+		while (nLength >= 2)
+		{
+			nSum += *pBuffer16++;
+			nLength -= 2;
+		}
+
+		assert (nLength <= 1);
+		if (nLength != 0)
+		{
+			nSum += *(const u8 *) pBuffer16;
+		}
+
+		return FoldSum64 (nSum);
+	}
+
+	// sum up 32-bit words into a 64-bit accumulator, which cannot overflow here
+	const u8 *pBuffer8 = (const u8 *) pBuffer;
+
+	if (   ((uintptr) pBuffer8 & 2)
+	    && nLength >= 2)
+	{
+		nSum += *(const u16 *) pBuffer8;
+		pBuffer8 += 2;
+		nLength -= 2;
+	}
+
+	const u32 *pBuffer32 = (const u32 *) pBuffer8;
+	while (nLength >= 16)
+	{
+		nSum += pBuffer32[0];
+		nSum += pBuffer32[1];
+		nSum += pBuffer32[2];
+		nSum += pBuffer32[3];
+		pBuffer32 += 4;
+		nLength -= 16;
+	}
+
+	while (nLength >= 4)
+	{
+		nSum += *pBuffer32++;
+		nLength -= 4;
+	}
+
+	pBuffer8 = (const u8 *) pBuffer32;
+	if (nLength >= 2)
+	{
+		nSum += *(const u16 *) pBuffer8;
+		pBuffer8 += 2;
 		nLength -= 2;
 	}
 
 	assert (nLength <= 1);
 	if (nLength != 0)
 	{
-		nChecksum += *(u8 *) pBuffer16;
+		nSum += *pBuffer8;
 	}
-	
+
+	return FoldSum64 (nSum);
+}
+
+u32 CChecksumCalculator::CopyAndCalculateChunk (void *pDest, const void *pSource, unsigned nLength,
+						u32 nChecksum)
+{
+	assert (pDest != 0);
+	assert (pSource != 0);
+
+	u8 *pDest8 = (u8 *) pDest;
+	const u8 *pSource8 = (const u8 *) pSource;
+
+#ifdef CHECKSUM_NEON
+	if (NEONAllowed (nLength))
+	{
+		unsigned nBlocks = nLength / NEON_BLOCK_SIZE;
+		nChecksum = FoldSum64 (nChecksum + CopyAndSumBlocksNEON (pDest8, pSource8, nBlocks));
+
+		unsigned nDone = nBlocks * NEON_BLOCK_SIZE;
+		pDest8 += nDone;
+		pSource8 += nDone;
+		nLength -= nDone;
+	}
+#endif
+
+	if (   !(((uintptr) pDest8 | (uintptr) pSource8) & 3)
+	    && nLength >= 4)
+	{
+		// copy and sum up 32-bit words, if both buffers are aligned
+		u64 nSum = nChecksum;
+
+		u32 *pDest32 = (u32 *) pDest8;
+		const u32 *pSource32 = (const u32 *) pSource8;
+		while (nLength >= 16)
+		{
+			u32 nWord0 = pSource32[0];
+			u32 nWord1 = pSource32[1];
+			u32 nWord2 = pSource32[2];
+			u32 nWord3 = pSource32[3];
+			pSource32 += 4;
+
+			pDest32[0] = nWord0;
+			pDest32[1] = nWord1;
+			pDest32[2] = nWord2;
+			pDest32[3] = nWord3;
+			pDest32 += 4;
+
+			nSum += nWord0;
+			nSum += nWord1;
+			nSum += nWord2;
+			nSum += nWord3;
+			nLength -= 16;
+		}
+
+		while (nLength >= 4)
+		{
+			u32 nWord = *pSource32++;
+			*pDest32++ = nWord;
+			nSum += nWord;
+			nLength -= 4;
+		}
+
+		nChecksum = FoldSum64 (nSum);
+
+		pDest8 = (u8 *) pDest32;
+		pSource8 = (const u8 *) pSource32;
+	}
+
+	if (nLength > 0)
+	{
+		// unaligned buffers and the rest are copied first and summed up afterwards
+		memcpy (pDest8, pSource8, nLength);
+		nChecksum = CalculateChunkScalar (pDest8, nLength, nChecksum);
+	}
+
 	return nChecksum;
 }
 
@@ -112,3 +455,12 @@ u16 CChecksumCalculator::FoldResult (u32 nChecksum)
 	
 	return (u16) nChecksum;
 }
+
+boolean CChecksumCalculator::IsNEONSupported (void)
+{
+#ifdef CHECKSUM_NEON
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
@@ -19,15 +19,25 @@
 //
 #include <circle/net/dnsclient.h>
 #include <circle/net/socket.h>
+#include <circle/net/socketset.h>
 #include <circle/net/in.h>
 #include <circle/sched/scheduler.h>
+#include <circle/timer.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <assert.h>
 
-#define MAX_HOSTNAME_SIZE	256
+#define MAX_HOSTNAME_SIZE	DNS_MAX_HOSTNAME_SIZE
 #define DNS_MAX_MESSAGE_SIZE	512
 
+#define DNS_MAX_TTL		86400		// seconds, longer TTLs are reduced
+#define DNS_NEGATIVE_TTL	60		// seconds, for non-existing names
+#define DNS_FAILURE_TTL		10		// seconds, for other errors (e.g. time-out)
+#define DNS_PREFETCH_FRACTION	10		// prefetch in the last 1/10 of the TTL
+
+#define DNS_RESPONSE_TIMEOUT_MS	1000		// per try
+#define DNS_MAX_TRIES		3
+
 struct TDNSHeader
 {
 	unsigned short nID;
@@ -80,6 +90,10 @@ PACKED;
 
 u16 CDNSClient::s_nXID = 1;
 
+CDNSClient::TCacheEntry CDNSClient::s_Cache[DNS_CACHE_SIZE];
+CSynchronizationEvent CDNSClient::s_QueryDoneEvent;
+TDNSCacheStatistics CDNSClient::s_Statistics;
+
 CDNSClient::CDNSClient (CNetSubSystem *pNetSubSystem)
 :	m_pNetSubSystem (pNetSubSystem)
 {
@@ -103,17 +117,255 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		}
 	}
 
+	return Lookup (pHostname, pIPAddress, FALSE);
+}
+
+boolean CDNSClient::Prefetch (const char *pHostname)
+{
+	assert (pHostname != 0);
+
+	if ('1' <= *pHostname && *pHostname <= '9')
+	{
+		CIPAddress IPAddress;
+		if (ConvertIPString (pHostname, &IPAddress))
+		{
+			return TRUE;
+		}
+	}
+
+	CIPAddress IPAddress;
+	return Lookup (pHostname, &IPAddress, TRUE);
+}
+
+void CDNSClient::GetCacheStatistics (TDNSCacheStatistics *pStatistics)
+{
+	assert (pStatistics != 0);
+	*pStatistics = s_Statistics;
+}
+
+void CDNSClient::FlushCache (void)
+{
+	for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+	{
+		// running queries will update their entry later
+		if (s_Cache[i].bRefreshing)
+		{
+			s_Cache[i].State = CacheStatePending;
+			s_Cache[i].bRefreshing = FALSE;
+		}
+		else if (s_Cache[i].State != CacheStatePending)
+		{
+			s_Cache[i].State = CacheStateFree;
+		}
+	}
+}
+
+boolean CDNSClient::Lookup (const char *pHostname, CIPAddress *pIPAddress, boolean bPrefetch)
+{
+	assert (pHostname != 0);
+	assert (pIPAddress != 0);
+
+	if (strlen (pHostname) >= MAX_HOSTNAME_SIZE)
+	{
+		return FALSE;
+	}
+
+	CTimer *pTimer = CTimer::Get ();
+	assert (pTimer != 0);
+
+	// find the entry, wait for a query of another task for the same name to complete
+	TCacheEntry *pEntry;
+	boolean bWaited = FALSE;
+	while (1)
+	{
+		pEntry = 0;
+		for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+		{
+			if (   s_Cache[i].State != CacheStateFree
+			    && strcasecmp (s_Cache[i].Hostname, pHostname) == 0)
+			{
+				pEntry = &s_Cache[i];
+
+				break;
+			}
+		}
+
+		if (   pEntry == 0
+		    || pEntry->State != CacheStatePending)
+		{
+			break;
+		}
+
+		if (!bWaited)
+		{
+			s_Statistics.nCoalesced++;
+			bWaited = TRUE;
+		}
+
+		s_QueryDoneEvent.Clear ();
+		s_QueryDoneEvent.Wait ();
+	}
+
+	unsigned nTicks = pTimer->GetTicks ();
+
+	boolean bRefresh = FALSE;
+	if (pEntry != 0)
+	{
+		unsigned nRemaining = pEntry->nExpireTicks - nTicks;
+		if ((int) nRemaining > 0)
+		{
+			pEntry->nLastUsedTicks = nTicks;
+
+			if (   !bPrefetch
+			    || pEntry->bRefreshing
+			    || nRemaining > pEntry->nTTLTicks / DNS_PREFETCH_FRACTION)
+			{
+				if (pEntry->State == CacheStateNegative)
+				{
+					s_Statistics.nNegativeHits++;
+
+					return FALSE;
+				}
+
+				assert (pEntry->State == CacheStateValid);
+				s_Statistics.nHits++;
+
+				pIPAddress->Set (pEntry->IPAddress);
+
+				return TRUE;
+			}
+
+			bRefresh = TRUE;
+		}
+	}
+	else
+	{
+		// use a free entry or replace the least recently used one
+		for (unsigned i = 0; i < DNS_CACHE_SIZE; i++)
+		{
+			TCacheEntry *pCandidate = &s_Cache[i];
+			if (pCandidate->State == CacheStateFree)
+			{
+				pEntry = pCandidate;
+
+				break;
+			}
+
+			if (   pCandidate->State != CacheStatePending
+			    && !pCandidate->bRefreshing
+			    && (   pEntry == 0
+				||    nTicks - pCandidate->nLastUsedTicks
+				    > nTicks - pEntry->nLastUsedTicks))
+			{
+				pEntry = pCandidate;
+			}
+		}
+
+		if (pEntry != 0)
+		{
+			strcpy (pEntry->Hostname, pHostname);
+		}
+	}
+
+	s_Statistics.nMisses++;
+
+	// the query is not cached, if all entries are pending,
+	// an entry, which is refreshed, remains valid until the query is done
+	if (pEntry != 0)
+	{
+		if (bRefresh)
+		{
+			pEntry->bRefreshing = TRUE;
+		}
+		else
+		{
+			pEntry->State = CacheStatePending;
+		}
+	}
+
+	u8 IPAddress[IP_ADDRESS_SIZE];
+	unsigned nTTL;
+	int nResult = Query (pHostname, IPAddress, &nTTL);
+
+	if (   pEntry != 0
+	    && pEntry->bRefreshing)
+	{
+		pEntry->bRefreshing = FALSE;
+
+		// keep the old record on error, it will be tried again on the next prefetch
+		if (nResult < 0)
+		{
+			s_QueryDoneEvent.Set ();
+
+			if (pEntry->State != CacheStateValid)
+			{
+				return FALSE;
+			}
+
+			pIPAddress->Set (pEntry->IPAddress);
+
+			return TRUE;
+		}
+	}
+
+	if (pEntry != 0)
+	{
+		switch (nResult)
+		{
+		case 1:
+			pEntry->State = CacheStateValid;
+			memcpy (pEntry->IPAddress, IPAddress, IP_ADDRESS_SIZE);
+			break;
+
+		case 0:
+			pEntry->State = CacheStateNegative;
+			nTTL = DNS_NEGATIVE_TTL;
+			break;
+
+		default:
+			pEntry->State = CacheStateNegative;
+			nTTL = DNS_FAILURE_TTL;
+			break;
+		}
+
+		if (nTTL > DNS_MAX_TTL)
+		{
+			nTTL = DNS_MAX_TTL;
+		}
+
+		nTicks = pTimer->GetTicks ();
+		pEntry->nTTLTicks = nTTL * HZ;
+		pEntry->nExpireTicks = nTicks + pEntry->nTTLTicks;
+		pEntry->nLastUsedTicks = nTicks;
+
+		s_QueryDoneEvent.Set ();
+	}
+
+	if (nResult <= 0)
+	{
+		return FALSE;
+	}
+
+	pIPAddress->Set (IPAddress);
+
+	return TRUE;
+}
+
+int CDNSClient::Query (const char *pHostname, u8 *pIPAddress, unsigned *pTTL)
+{
+	assert (pHostname != 0);
+
 	assert (m_pNetSubSystem != 0);
 	CIPAddress DNSServer (m_pNetSubSystem->GetConfig ()->GetDNSServer ()->Get ());
 	if (DNSServer.IsNull ())
 	{
-		return FALSE;
+		return -1;
 	}
 
 	CSocket Socket (m_pNetSubSystem, IPPROTO_UDP);
 	if (Socket.Connect (DNSServer, 53) != 0)
 	{
-		return FALSE;
+		return -1;
 	}
 
 	u8 Buffer[DNS_MAX_MESSAGE_SIZE];
@@ -141,7 +393,7 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		if (   nLength > 255
 		    || (int) (nLength+1+1) >= DNS_MAX_MESSAGE_SIZE-(pQuery-Buffer))
 		{
-			return FALSE;
+			return -1;
 		}
 
 		*pQuery++ = (u8) nLength;
@@ -160,7 +412,7 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 
 	if ((int) (sizeof QueryTrailer) > DNS_MAX_MESSAGE_SIZE-(pQuery-Buffer))
 	{
-		return FALSE;
+		return -1;
 	}
 	memcpy (pQuery, &QueryTrailer, sizeof QueryTrailer);
 	pQuery += sizeof QueryTrailer;
@@ -168,40 +420,72 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 	int nSize = pQuery - Buffer;
 	assert (nSize <= DNS_MAX_MESSAGE_SIZE);
 
-	unsigned char RecvBuffer[DNS_MAX_MESSAGE_SIZE];
-	int nRecvSize;
+	unsigned char RecvBuffer[FRAME_BUFFER_SIZE];
+	int nRecvSize = 0;
+
+	CTimer *pTimer = CTimer::Get ();
+	assert (pTimer != 0);
+
+	CSocketSet SocketSet (1);
+	SocketSet.Add (&Socket, POLLIN);
 
-	unsigned nTry = 1;
-	do
+	boolean bReceived = FALSE;
+	for (unsigned nTry = 1; !bReceived && nTry <= DNS_MAX_TRIES; nTry++)
 	{
-		if (   nTry++ > 3
-		    || Socket.Send (Buffer, nSize, 0) != nSize)
+		if (Socket.Send (Buffer, nSize, 0) != nSize)
 		{
-			return FALSE;
+			return -1;
 		}
 
-		CScheduler::Get ()->MsSleep (1000);
-
-		nRecvSize = Socket.Receive (RecvBuffer, DNS_MAX_MESSAGE_SIZE, MSG_DONTWAIT);
-		assert (nRecvSize < DNS_MAX_MESSAGE_SIZE);
-		if (nRecvSize < 0)
+		// wait for the response, so that it is processed as soon as it arrives
+		unsigned nStartTicks = pTimer->GetTicks ();
+		unsigned nElapsed;
+		while (   !bReceived
+		       && (nElapsed = pTimer->GetTicks () - nStartTicks) < MSEC2HZ (DNS_RESPONSE_TIMEOUT_MS))
 		{
-			return FALSE;
+			SocketSet.Wait (DNS_RESPONSE_TIMEOUT_MS - nElapsed * 1000 / HZ);
+
+			nRecvSize = Socket.Receive (RecvBuffer, sizeof RecvBuffer, MSG_DONTWAIT);
+			if (nRecvSize < 0)
+			{
+				return -1;
+			}
+
+			// ignore late responses to previous queries
+			if (   nRecvSize >= (int) sizeof (TDNSHeader)
+			    && nRecvSize <= DNS_MAX_MESSAGE_SIZE
+			    && ((TDNSHeader *) RecvBuffer)->nID == le2be16 (nXID))
+			{
+				bReceived = TRUE;
+			}
 		}
 	}
-	while (nRecvSize < (int) (sizeof (TDNSHeader)+sizeof (TDNSResourceRecordTrailerAIN)));
+
+	if (!bReceived)
+	{
+		return -1;
+	}
 
 	pDNSHeader = (TDNSHeader *) RecvBuffer;
-	if (   pDNSHeader->nID != le2be16 (nXID)
-	    ||    (pDNSHeader->nFlags & BE (  DNS_FLAGS_QR
-	                                    | DNS_FLAGS_OPCODE
-	                                    | DNS_FLAGS_TC
-	                                    | DNS_FLAGS_RCODE))
-	       != BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE_QUERY | DNS_RCODE_SUCCESS)
-	    || pDNSHeader->nQDCount != BE (1)
-	    || pDNSHeader->nANCount == BE (0))
+	if (   (pDNSHeader->nFlags & BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE | DNS_FLAGS_RCODE))
+	    == BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE_QUERY | DNS_RCODE_NAME_ERROR))
 	{
-		return FALSE;
+		return 0;			// name does not exist
+	}
+
+	if (   (pDNSHeader->nFlags & BE (  DNS_FLAGS_QR
+	                                 | DNS_FLAGS_OPCODE
+	                                 | DNS_FLAGS_TC
+	                                 | DNS_FLAGS_RCODE))
+	    != BE (DNS_FLAGS_QR | DNS_FLAGS_OPCODE_QUERY | DNS_RCODE_SUCCESS)
+	    || pDNSHeader->nQDCount != BE (1))
+	{
+		return -1;
+	}
+
+	if (pDNSHeader->nANCount == BE (0))
+	{
+		return 0;			// no record for this name
 	}
 
 	u8 *pResponse = RecvBuffer + sizeof (TDNSHeader);
@@ -212,14 +496,14 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		pResponse += nLength;
 		if (pResponse-RecvBuffer >= nRecvSize)
 		{
-			return FALSE;
+			return -1;
 		}
 	}
 
 	pResponse += sizeof (TDNSQueryTrailer);
 	if (pResponse-RecvBuffer >= nRecvSize)
 	{
-		return FALSE;
+		return -1;
 	}
 
 	TDNSResourceRecordTrailerAIN RRTrailer;
@@ -239,7 +523,7 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 				pResponse += nLength;
 				if (pResponse-RecvBuffer >= nRecvSize)
 				{
-					return FALSE;
+					return -1;
 				}
 			}
 			while ((nLength = *pResponse++) > 0);
@@ -247,7 +531,7 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 
 		if (pResponse-RecvBuffer > (int) (nRecvSize-sizeof RRTrailer))
 		{
-			return FALSE;
+			return -1;
 		}
 
 		memcpy (&RRTrailer, pResponse, sizeof RRTrailer);
@@ -262,14 +546,17 @@ boolean CDNSClient::Resolve (const char *pHostname, CIPAddress *pIPAddress)
 		pResponse += DNS_RR_TRAILER_HEADER_LENGTH + BE (RRTrailer.nRDLength);
 		if (pResponse-RecvBuffer >= nRecvSize)
 		{
-			return FALSE;
+			return -1;
 		}
 	}
 
 	assert (pIPAddress != 0);
-	pIPAddress->Set (RRTrailer.RData);
+	memcpy (pIPAddress, RRTrailer.RData, IP_ADDRESS_SIZE);
 
-	return TRUE;
+	assert (pTTL != 0);
+	*pTTL = be2le32 (RRTrailer.nTTL);
+
+	return 1;
 }
 
 boolean CDNSClient::ConvertIPString (const char *pIPString, CIPAddress *pIPAddress)
@@ -20,25 +20,31 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/httpdaemon.h>
+#include <circle/net/socketset.h>
 #include <circle/net/in.h>
+#include <circle/sched/scheduler.h>
 #include <circle/netdevice.h>
 #include <circle/sysconfig.h>
+#include <circle/timer.h>
 #include <circle/logger.h>
 #include <circle/string.h>
 #include <circle/util.h>
 #include <assert.h>
 
-#define HTTPD_VERSION		"0.02"
+#define HTTPD_VERSION		"0.03"
 #define SERVER			"CHTTPDaemon/" HTTPD_VERSION " (Circle)"
 
 #define MAX_CLIENTS		10
+#define MAX_WORKERS		MAX_CLIENTS
+
+#define KEEP_ALIVE_TIMEOUT	5		// seconds, idle connection is closed then
+#define REQUEST_TIMEOUT		10		// seconds, to receive the rest of a request
+#define PENDING_CHECK_MS	100		// idle connection checks for waiting clients
 
 #define HTTPD_STACK_SIZE	TASK_STACK_SIZE
 
 static const char FromHTTPDaemon[] = "httpd";
 
-unsigned CHTTPDaemon::s_nInstanceCount = 0;
-
 CHTTPDaemon::CHTTPDaemon (CNetSubSystem *pNetSubSystem, CSocket *pSocket,
 			  unsigned nMaxContentSize, u16 nPort, unsigned nMaxMultipartSize)
 :	CTask (HTTPD_STACK_SIZE),
@@ -47,9 +53,27 @@ CHTTPDaemon::CHTTPDaemon (CNetSubSystem *pNetSubSystem, CSocket *pSocket,
 	m_nMaxContentSize (nMaxContentSize),
 	m_nPort (nPort),
 	m_nMaxMultipartSize (nMaxMultipartSize),
-	m_pContentBuffer (0)
+	m_pContentBuffer (0),
+	m_nPendingIn (0),
+	m_nPendingOut (0),
+	m_nPendingCount (0),
+	m_nWorkers (0),
+	m_nIdleWorkers (0),
+	m_pListener (0),
+	m_nRxOffset (0),
+	m_nRxLength (0),
+	m_nTxLength (0),
+	m_nRequestHeaderLength (0),
+	m_pMultipartBuffer (0),
+	m_bKeepAlive (FALSE),
+	m_bResponseStarted (FALSE),
+	m_ResponseStatus (HTTPOK),
+	m_bChunked (FALSE),
+	m_nResponseLength (0),
+	m_nContentSent (0),
+	m_bSendError (FALSE)
 {
-	s_nInstanceCount++;
+	m_RequestHeader[0] = '\0';
 
 	if (m_nMaxContentSize > 0)
 	{
@@ -74,12 +98,14 @@ CHTTPDaemon::~CHTTPDaemon (void)
 {
 	assert (m_pSocket == 0);
 
+	delete [] m_pMultipartBuffer;
+	m_pMultipartBuffer = 0;
+
 	delete m_pContentBuffer;
 	m_pContentBuffer = 0;
 
+	m_pListener = 0;
 	m_pNetSubSystem = 0;
-
-	s_nInstanceCount--;
 }
 
 void CHTTPDaemon::Run (void)
@@ -94,6 +120,46 @@ void CHTTPDaemon::Run (void)
 	}
 }
 
+THTTPStatus CHTTPDaemon::GetContent (const char  *pPath,
+				     const char  *pParams,
+				     const char  *pFormData,
+				     u8		 *pBuffer,
+				     unsigned	 *pLength,
+				     const char **ppContentType)
+{
+	return HTTPNotFound;
+}
+
+THTTPStatus CHTTPDaemon::StreamContent (const char *pPath, const char *pParams,
+					const char *pFormData)
+{
+	if (m_pContentBuffer == 0)
+	{
+		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Content buffer required");
+
+		return HTTPInternalServerError;
+	}
+
+	unsigned nContentLength = m_nMaxContentSize;
+	const char *pContentType = "text/html";
+	THTTPStatus Status = GetContent (pPath, pParams, pFormData,
+					 m_pContentBuffer, &nContentLength, &pContentType);
+	if (Status != HTTPOK)
+	{
+		return Status;
+	}
+
+	assert (nContentLength <= m_nMaxContentSize);
+	assert (pContentType != 0);
+
+	if (BeginResponse (HTTPOK, nContentLength, pContentType))
+	{
+		SendContent (m_pContentBuffer, nContentLength);
+	}
+
+	return HTTPOK;
+}
+
 void CHTTPDaemon::WriteAccessLog (const CIPAddress &rRemoteIP, THTTPRequestMethod RequestMethod,
 				  const char *pRequestURI, THTTPStatus Status,
 				  unsigned nContentLength)
@@ -116,6 +182,114 @@ void CHTTPDaemon::WriteAccessLog (const CIPAddress &rRemoteIP, THTTPRequestMetho
 				(const char *) IPString, pMethod, pRequestURI, Status, nContentLength);
 }
 
+boolean CHTTPDaemon::BeginResponse (THTTPStatus Status, unsigned nContentLength,
+				    const char *pContentType, const char *pExtraHeader)
+{
+	assert (!m_bResponseStarted);
+	m_bResponseStarted = TRUE;
+
+	m_ResponseStatus = Status;
+	if (Status == HTTPNotModified)
+	{
+		nContentLength = 0;		// has no body and no Content-Length
+	}
+	m_nResponseLength = nContentLength;
+	m_bChunked = nContentLength == HTTPD_CONTENT_LENGTH_UNKNOWN;
+
+	assert (pContentType != 0);
+	CString Header;
+	Header.Format ("HTTP/1.1 %u %s\r\n"
+		       "Server: " SERVER "\r\n"
+		       "Content-Type: %s\r\n", Status, GetStatusMessage (Status), pContentType);
+
+	if (m_bChunked)
+	{
+		Header.Append ("Transfer-Encoding: chunked\r\n");
+	}
+	else if (Status != HTTPNotModified)
+	{
+		CString ContentLength;
+		ContentLength.Format ("Content-Length: %u\r\n", nContentLength);
+		Header.Append (ContentLength);
+	}
+
+	if (pExtraHeader != 0)
+	{
+		Header.Append (pExtraHeader);
+	}
+
+	if (!m_bKeepAlive)
+	{
+		Header.Append ("Connection: close\r\n");
+	}
+
+	Header.Append ("\r\n");
+
+	return WriteData ((const char *) Header, Header.GetLength ());
+}
+
+boolean CHTTPDaemon::SendContent (const void *pData, unsigned nLength)
+{
+	assert (m_bResponseStarted);
+
+	if (   m_RequestMethod == HTTPRequestMethodHead
+	    || nLength == 0)
+	{
+		return !m_bSendError;
+	}
+
+	if (m_bChunked)
+	{
+		CString ChunkHeader;
+		ChunkHeader.Format ("%X\r\n", nLength);
+
+		WriteData ((const char *) ChunkHeader, ChunkHeader.GetLength ());
+	}
+	else
+	{
+		assert (m_nContentSent + nLength <= m_nResponseLength);
+	}
+
+	assert (pData != 0);
+	WriteData (pData, nLength);
+	m_nContentSent += nLength;
+
+	if (m_bChunked)
+	{
+		WriteData ("\r\n", 2);
+	}
+
+	return !m_bSendError;
+}
+
+THTTPRequestMethod CHTTPDaemon::GetRequestMethod (void) const
+{
+	return m_RequestMethod;
+}
+
+const char *CHTTPDaemon::GetRequestHeader (const char *pName) const
+{
+	assert (pName != 0);
+	size_t nNameLen = strlen (pName);
+
+	for (const char *p = m_RequestHeader; *p != '\0'; p += strlen (p) + 1)
+	{
+		if (   strncasecmp (p, pName, nNameLen) == 0
+		    && p[nNameLen] == ':')
+		{
+			p += nNameLen + 1;
+			while (*p == ' ')
+			{
+				p++;
+			}
+
+			return p;
+		}
+	}
+
+	return 0;
+}
+
 void CHTTPDaemon::Listener (void)
 {
 	assert (m_pNetSubSystem != 0);
@@ -154,7 +328,20 @@ void CHTTPDaemon::Listener (void)
 			continue;
 		}
 
-		if (s_nInstanceCount >= MAX_CLIENTS+1)
+		// grow the worker pool, if all workers are busy
+		if (   m_nIdleWorkers == 0
+		    && m_nWorkers < MAX_WORKERS)
+		{
+			CHTTPDaemon *pWorker = CreateWorker (m_pNetSubSystem, pConnection);
+			assert (pWorker != 0);
+			pWorker->m_pListener = this;	// set before the worker runs
+
+			m_nWorkers++;
+
+			continue;
+		}
+
+		if (m_nPendingCount >= HTTPD_MAX_PENDING)
 		{
 			CLogger::Get ()->Write (FromHTTPDaemon, LogWarning, "Too many clients");
 
@@ -163,57 +350,101 @@ void CHTTPDaemon::Listener (void)
 			continue;
 		}
 
-		CreateWorker (m_pNetSubSystem, pConnection);
+		m_pPendingSocket[m_nPendingIn] = pConnection;
+		if (++m_nPendingIn >= HTTPD_MAX_PENDING)
+		{
+			m_nPendingIn = 0;
+		}
+
+		m_nPendingCount++;
+
+		m_PendingEvent.Set ();
 	}
 }
 
 void CHTTPDaemon::Worker (void)
 {
-	assert (m_pSocket != 0);
+	CHTTPDaemon *pListener = m_pListener;
+	assert (pListener != 0);
 
-	// parse HTTP request
-	THTTPStatus Status = ParseRequest ();
-	if (Status == HTTPUnknownError)		// unknown error cannot be reported to client
+	while (1)
 	{
-		delete m_pSocket;
+		assert (m_pSocket != 0);
+
+		m_nRxOffset = 0;
+		m_nRxLength = 0;
+
+		while (ProcessRequest ())
+		{
+			// keep-alive
+		}
+
+		delete m_pSocket;		// closes connection
 		m_pSocket = 0;
 
-		return;
+		// wait for the next connection from the listener
+		while (pListener->m_nPendingCount == 0)
+		{
+			pListener->m_nIdleWorkers++;
+
+			pListener->m_PendingEvent.Clear ();
+			pListener->m_PendingEvent.Wait ();
+
+			pListener->m_nIdleWorkers--;
+		}
+
+		m_pSocket = pListener->m_pPendingSocket[pListener->m_nPendingOut];
+		if (++pListener->m_nPendingOut >= HTTPD_MAX_PENDING)
+		{
+			pListener->m_nPendingOut = 0;
+		}
+
+		pListener->m_nPendingCount--;
 	}
+}
 
-	// process HTTP request
-	unsigned nContentLength = m_nMaxContentSize;
-	const char *pContentType = "text/html";
+boolean CHTTPDaemon::ProcessRequest (void)
+{
+	m_bResponseStarted = FALSE;
+	m_ResponseStatus = HTTPOK;
+	m_bChunked = FALSE;
+	m_nResponseLength = 0;
+	m_nContentSent = 0;
+	m_bSendError = FALSE;
+	m_nTxLength = 0;
 
-	const char *pStatusMsg = "OK";
+	// parse HTTP request
+	THTTPStatus Status = ParseRequest ();
+	if (Status == HTTPUnknownError)		// unknown error cannot be reported to client
+	{
+		delete [] m_pMultipartBuffer;
+		m_pMultipartBuffer = 0;
+
+		return FALSE;
+	}
 
 	if (Status == HTTPOK)
 	{
 		// get content
-		assert (m_pContentBuffer != 0);
-		Status = GetContent (m_RequestPath, m_RequestParams, m_RequestFormData,
-				     m_pContentBuffer, &nContentLength, &pContentType);
-		assert (nContentLength <= m_nMaxContentSize);
-		assert (pContentType != 0);
-
-		delete [] m_pMultipartBuffer;
-		m_pMultipartBuffer = 0;
+		Status = StreamContent (m_RequestPath, m_RequestParams, m_RequestFormData);
+	}
+	else
+	{
+		m_bKeepAlive = FALSE;		// rest of the request may not have been read
 	}
 
-	if (Status != HTTPOK)
+	delete [] m_pMultipartBuffer;
+	m_pMultipartBuffer = 0;
+
+	if (!m_bResponseStarted)
 	{
-		switch (Status)
+		if (Status == HTTPOK)
 		{
-		case HTTPBadRequest:		pStatusMsg = "Bad Request";			break;
-		case HTTPNotFound:		pStatusMsg = "Not Found";			break;
-		case HTTPRequestEntityTooLarge:	pStatusMsg = "Request Entity Too Large";	break;
-		case HTTPRequestURITooLong:	pStatusMsg = "Request-URI Too Long";		break;
-		case HTTPInternalServerError:	pStatusMsg = "Internal Server Error";		break;
-		case HTTPMethodNotImplemented:	pStatusMsg = "Method Not Implemented";		break;
-		case HTTPVersionNotSupported:	pStatusMsg = "Version Not Supported";		break;
-		default:			pStatusMsg = "Unknown Error";			break;
+			Status = HTTPInternalServerError;	// no response from StreamContent()
 		}
 
+		const char *pStatusMsg = GetStatusMessage (Status);
+
 		CString ErrorPage;
 		ErrorPage.Format ("<!DOCTYPE html>\n"
 				  "<html>\n"
@@ -221,67 +452,48 @@ void CHTTPDaemon::Worker (void)
 				  "<body><h1>%s</h1></body>\n"
 				  "</html>\n", Status, pStatusMsg, pStatusMsg);
 
-		nContentLength = ErrorPage.GetLength ();
-		if (nContentLength > m_nMaxContentSize)
+		if (BeginResponse (Status, ErrorPage.GetLength ()))
 		{
-			nContentLength = m_nMaxContentSize;
+			SendContent ((const char *) ErrorPage, ErrorPage.GetLength ());
 		}
-
-		assert (m_pContentBuffer != 0);
-		memcpy (m_pContentBuffer, (const char *) ErrorPage, nContentLength);
-		pContentType = "text/html";	// may has been changed by GetContent()
 	}
-
-	// write access log
-	const u8 *pClientIP = m_pSocket->GetForeignIP ();
-	if (pClientIP == 0)			// connection closed in the meantime?
+	else if (Status != HTTPOK)
 	{
-		delete m_pSocket;
-		m_pSocket = 0;
-
-		return;
+		m_bKeepAlive = FALSE;		// response may be incomplete, cannot report error
 	}
-	CIPAddress ClientIP (pClientIP);
-
-	WriteAccessLog (ClientIP, m_RequestMethod, m_RequestURI, Status, nContentLength);
-
-	// send HTTP response header
-	CString Header;
-	Header.Format ("HTTP/1.1 %u %s\r\n"
-		       "Server: " SERVER "\r\n"
-		       "Content-Type: %s\r\n"
-		       "Content-Length: %u\r\n"
-		       "Connection: close\r\n"
-		       "\r\n", Status, pStatusMsg, pContentType, nContentLength);
 
-	if (m_pSocket->Send ((const char *) Header, Header.GetLength (), MSG_DONTWAIT) < 0)
+	// finish response
+	if (m_RequestMethod != HTTPRequestMethodHead)
 	{
-		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response header");
-
-		delete m_pSocket;
-		m_pSocket = 0;
-
-		return;
+		if (m_bChunked)
+		{
+			WriteData ("0\r\n\r\n", 5);	// last chunk
+		}
+		else if (m_nContentSent != m_nResponseLength)
+		{
+			m_bKeepAlive = FALSE;		// client cannot find the end of the response
+		}
 	}
 
-	// send response
-	if (   m_RequestMethod != HTTPRequestMethodHead
-	    && nContentLength > 0)
+	if (!FlushData ())
 	{
-		assert (m_pContentBuffer != 0);
-		if (m_pSocket->Send (m_pContentBuffer, nContentLength, MSG_DONTWAIT) < 0)
-		{
-			CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response");
+		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Cannot send response");
 
-			delete m_pSocket;
-			m_pSocket = 0;
+		return FALSE;
+	}
 
-			return;
-		}
+	// write access log
+	const u8 *pClientIP = m_pSocket->GetForeignIP ();
+	if (pClientIP == 0)			// connection closed in the meantime?
+	{
+		return FALSE;
 	}
+	CIPAddress ClientIP (pClientIP);
 
-	delete m_pSocket;		// closes connection
-	m_pSocket = 0;
+	WriteAccessLog (ClientIP, m_RequestMethod, m_RequestURI, m_ResponseStatus,
+			m_bChunked ? m_nContentSent : m_nResponseLength);
+
+	return m_bKeepAlive;
 }
 
 THTTPStatus CHTTPDaemon::ParseRequest (void)
@@ -292,6 +504,8 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 	m_RequestURI[0] = '\0';
 	m_RequestPath[0] = '\0';
 	m_RequestParams[0] = '\0';
+	m_RequestHeader[0] = '\0';
+	m_nRequestHeaderLength = 0;
 	m_bRequestFormDataAvailable = FALSE;
 	m_nRequestContentLength = 0;
 	m_RequestFormData[0] = '\0';
@@ -299,159 +513,182 @@ THTTPStatus CHTTPDaemon::ParseRequest (void)
 	m_MultipartBoundary[0] = '\0';
 	m_nMultipartContentLength = 0;
 	m_pMultipartBuffer = 0;
+	m_bKeepAlive = TRUE;
 
-	char Buffer[FRAME_BUFFER_SIZE];
 	char Line[HTTP_MAX_REQUEST_LINE+1];
-#if HTTP_MAX_REQUEST_LINE+FRAME_BUFFER_SIZE+2000 > HTTPD_STACK_SIZE
+#if HTTP_MAX_REQUEST_LINE+2000 > HTTPD_STACK_SIZE
 	#error Increase HTTPD_STACK_SIZE!
 #endif
 
-	unsigned nState = 0; // 0: parse header, 1: parse form data, 2: parse multipart data, 3: leave
+	// 0: parse header, 1: parse form data, 2: parse multipart data, 3: skip body, 4: leave
+	unsigned nState = 0;
 	unsigned nLine = 0;
 	unsigned nChar = 0;
 
-	int nResult;
-
-	assert (m_pSocket != 0);
-	while (   nState < 3
-	       && (nResult = m_pSocket->Receive (Buffer, sizeof Buffer, 0)) > 0)
+	while (nState < 4)
 	{
-		for (unsigned i = 0; i < (unsigned) nResult; i++)
+		// data of a following request may be left in m_RxBuffer
+		if (m_nRxOffset >= m_nRxLength)
 		{
-			char chChar = Buffer[i];
+			boolean bIdle = nState == 0 && nLine == 0 && nChar == 0;
 
-			if (nState == 0)
+			int nResult = ReceiveData (bIdle);
+			if (nResult <= 0)
 			{
-				if (chChar == '\r')
+				if (!bIdle)
 				{
-					continue;
+					CLogger::Get ()->Write (FromHTTPDaemon, LogError,
+								nResult < 0 ? "Receive failed"
+									    : "Request timed out");
 				}
 
-				if (chChar == '\n')		// end of line
+				return HTTPUnknownError;
+			}
+
+			m_nRxOffset = 0;
+			m_nRxLength = nResult;
+		}
+
+		char chChar = (char) m_RxBuffer[m_nRxOffset++];
+
+		if (nState == 0)
+		{
+			if (chChar == '\r')
+			{
+				continue;
+			}
+
+			if (chChar == '\n')		// end of line
+			{
+				if (nChar == 0)		// empty line is end of header
 				{
-					if (nChar == 0)		// empty line is end of header
+					if (nLine == 0)
+					{
+						continue;	// ignore empty lines in front of request
+					}
+
+					if (   m_bRequestFormDataAvailable
+					    && m_nRequestContentLength > 0)
 					{
-						if (   m_bRequestFormDataAvailable
-						    && m_nRequestContentLength > 0)
+						if (m_nRequestContentLength <= HTTP_MAX_FORM_DATA)
 						{
-							if (m_nRequestContentLength <= HTTP_MAX_FORM_DATA)
-							{
-								nChar = 0;
-								nState = 1;
-							}
-							else
-							{
-								Status = HTTPRequestEntityTooLarge;
-								nState = 3;
-							}
+							nChar = 0;
+							nState = 1;
 						}
-						else if (   m_bMultipartFormDataAvailable
-							 && m_nRequestContentLength > 0)
+						else
 						{
-							m_nMultipartContentLength = m_nRequestContentLength;
-							m_nRequestContentLength = 0;
+							Status = HTTPRequestEntityTooLarge;
+							nState = 4;
+						}
+					}
+					else if (   m_bMultipartFormDataAvailable
+						 && m_nRequestContentLength > 0)
+					{
+						m_nMultipartContentLength = m_nRequestContentLength;
+						m_nRequestContentLength = 0;
 
-							if (m_nMultipartContentLength <= m_nMaxMultipartSize)
+						if (m_nMultipartContentLength <= m_nMaxMultipartSize)
+						{
+							assert (m_pMultipartBuffer == 0);
+							m_pMultipartBuffer = new char[m_nMultipartContentLength];
+							if (m_pMultipartBuffer == 0)
 							{
-								assert (m_pMultipartBuffer == 0);
-								m_pMultipartBuffer = new char[m_nMultipartContentLength];
-								if (m_pMultipartBuffer == 0)
-								{
-									Status = HTTPInternalServerError;
-									nState = 3;
-								}
-								else
-								{
-									nChar = 0;
-									nState = 2;
-								}
+								Status = HTTPInternalServerError;
+								nState = 4;
 							}
 							else
 							{
-								Status = HTTPRequestEntityTooLarge;
-								nState = 3;
+								nChar = 0;
+								nState = 2;
 							}
 						}
 						else
 						{
-							nState = 3;
+							Status = HTTPRequestEntityTooLarge;
+							nState = 4;
 						}
 					}
-					else
+					else if (m_nRequestContentLength > 0)
 					{
-						if (nLine++ == 0)	// first line?
-						{
-							if (Status == HTTPOK)
-							{						
-								Status = ParseMethod (Line);
-							}
-						}
-						else
-						{
-							if (Status == HTTPOK)
-							{						
-								Status = ParseHeaderField (Line);
-							}
-						}
-
+						// unsupported body, must be consumed to find the next request
 						nChar = 0;
+						nState = 3;
+					}
+					else
+					{
+						nState = 4;
 					}
 				}
 				else
 				{
-					// accumulate option line
-					if (nChar < sizeof Line-1)
+					if (nLine++ == 0)	// first line?
 					{
-						Line[nChar++] = chChar;
-						Line[nChar] = '\0';
+						if (Status == HTTPOK)
+						{
+							Status = ParseMethod (Line);
+						}
 					}
 					else
 					{
-						Status = HTTPRequestEntityTooLarge;
+						if (Status == HTTPOK)
+						{
+							Status = ParseHeaderField (Line);
+						}
 					}
+
+					nChar = 0;
 				}
 			}
-			else if (nState == 1)
+			else
 			{
-				m_RequestFormData[nChar++] = chChar;
-				m_RequestFormData[nChar] = '\0';
-
-				if (nChar >= m_nRequestContentLength)
+				// accumulate option line
+				if (nChar < sizeof Line-1)
 				{
-					nState = 3;
+					Line[nChar++] = chChar;
+					Line[nChar] = '\0';
+				}
+				else
+				{
+					Status = HTTPRequestEntityTooLarge;
 				}
 			}
-			else if (nState == 2)
+		}
+		else if (nState == 1)
+		{
+			m_RequestFormData[nChar++] = chChar;
+			m_RequestFormData[nChar] = '\0';
+
+			if (nChar >= m_nRequestContentLength)
 			{
-				m_pMultipartBuffer[nChar++] = chChar;
+				nState = 4;
+			}
+		}
+		else if (nState == 2)
+		{
+			m_pMultipartBuffer[nChar++] = chChar;
 
-				if (nChar >= m_nMultipartContentLength)
-				{
-					m_pMultipartPointer = m_pMultipartBuffer;
+			if (nChar >= m_nMultipartContentLength)
+			{
+				m_pMultipartPointer = m_pMultipartBuffer;
 
-					nState = 3;
-				}
+				nState = 4;
+			}
+		}
+		else
+		{
+			assert (nState == 3);
+			if (++nChar >= m_nRequestContentLength)
+			{
+				nState = 4;
 			}
 		}
 	}
 
-	if (nResult < 0)
-	{
-		CLogger::Get ()->Write (FromHTTPDaemon, LogError, "Receive failed");
-
-		return HTTPUnknownError;
-	}
-	
 	if (Status != HTTPOK)
 	{
 		return Status;
 	}
 	
-	if (nLine == 0)
-	{
-		return HTTPUnknownError;
-	}
-
 	// check for parameters
 	const char *pParams = strchr (m_RequestURI, '?');
 	if (pParams != 0)
@@ -532,10 +769,19 @@ THTTPStatus CHTTPDaemon::ParseMethod (char *pLine)
 
 THTTPStatus CHTTPDaemon::ParseHeaderField (char *pLine)
 {
+	// keep a copy for GetRequestHeader()
+	assert (pLine != 0);
+	unsigned nLength = strlen (pLine) + 1;
+	if (m_nRequestHeaderLength + nLength <= HTTP_MAX_REQUEST_HEADER)
+	{
+		strcpy (m_RequestHeader + m_nRequestHeaderLength, pLine);
+		m_nRequestHeaderLength += nLength;
+		m_RequestHeader[m_nRequestHeaderLength] = '\0';
+	}
+
 	char *pToken;
 	char *pSavePtr;
 
-	assert (pLine != 0);
 	if ((pToken = strtok_r (pLine, ":", &pSavePtr)) == 0)
 	{
 		return HTTPBadRequest;
@@ -594,6 +840,16 @@ THTTPStatus CHTTPDaemon::ParseHeaderField (char *pLine)
 
 		m_nRequestContentLength = nAccu;
 	}
+	else if (strcmp (pToken, "Connection") == 0)
+	{
+		while ((pToken = strtok_r (0, " ,", &pSavePtr)) != 0)
+		{
+			if (strcasecmp (pToken, "close") == 0)
+			{
+				m_bKeepAlive = FALSE;
+			}
+		}
+	}
 
 	return HTTPOK;
 }
@@ -675,6 +931,153 @@ boolean CHTTPDaemon::GetMultipartFormPart (const char **ppHeader,
 	return TRUE;
 }
 
+int CHTTPDaemon::ReceiveData (boolean bIdle)
+{
+	assert (m_pSocket != 0);
+	assert (m_pListener != 0);
+
+	int nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, MSG_DONTWAIT);
+	if (nResult != 0)
+	{
+		return nResult;
+	}
+
+	// wait for the receive event with a timeout,
+	// so that a worker is not blocked by an idle or stalled connection forever
+	CSocketSet SocketSet (1);
+	SocketSet.Add (m_pSocket, POLLIN);
+
+	unsigned nTimeout = (bIdle ? KEEP_ALIVE_TIMEOUT : REQUEST_TIMEOUT) * HZ;
+	unsigned nStartTicks = CTimer::Get ()->GetTicks ();
+	while (1)
+	{
+		unsigned nElapsed = CTimer::Get ()->GetTicks () - nStartTicks;
+		if (nElapsed >= nTimeout)
+		{
+			break;
+		}
+
+		// give up an idle connection, if other clients are waiting for a worker
+		if (   bIdle
+		    && m_pListener->m_nPendingCount > 0)
+		{
+			break;
+		}
+
+		unsigned nWaitMs = (nTimeout - nElapsed) * 1000 / HZ;
+		if (   bIdle
+		    && nWaitMs > PENDING_CHECK_MS)
+		{
+			nWaitMs = PENDING_CHECK_MS;
+		}
+
+		SocketSet.Wait ((int) nWaitMs);
+
+		nResult = m_pSocket->Receive (m_RxBuffer, sizeof m_RxBuffer, MSG_DONTWAIT);
+		if (nResult != 0)
+		{
+			break;
+		}
+	}
+
+	SocketSet.Remove (m_pSocket);
+
+	return nResult;
+}
+
+boolean CHTTPDaemon::WriteData (const void *pData, unsigned nLength)
+{
+	if (m_bSendError)
+	{
+		return FALSE;
+	}
+
+	assert (pData != 0);
+	const u8 *pBuffer = (const u8 *) pData;
+
+	// collect small pieces, so that they can be sent in one segment
+	unsigned nFree = sizeof m_TxBuffer - m_nTxLength;
+	if (nLength <= nFree)
+	{
+		memcpy (m_TxBuffer + m_nTxLength, pBuffer, nLength);
+		m_nTxLength += nLength;
+
+		return TRUE;
+	}
+
+	memcpy (m_TxBuffer + m_nTxLength, pBuffer, nFree);
+	m_nTxLength += nFree;
+	pBuffer += nFree;
+	nLength -= nFree;
+
+	if (!FlushData ())
+	{
+		return FALSE;
+	}
+
+	// send large pieces directly from the caller's buffer
+	if (nLength >= sizeof m_TxBuffer)
+	{
+		assert (m_pSocket != 0);
+		if (m_pSocket->Send (pBuffer, nLength, 0) != (int) nLength)
+		{
+			m_bSendError = TRUE;
+
+			return FALSE;
+		}
+
+		return TRUE;
+	}
+
+	memcpy (m_TxBuffer, pBuffer, nLength);
+	m_nTxLength = nLength;
+
+	return TRUE;
+}
+
+boolean CHTTPDaemon::FlushData (void)
+{
+	if (m_bSendError)
+	{
+		return FALSE;
+	}
+
+	if (m_nTxLength > 0)
+	{
+		assert (m_pSocket != 0);
+		if (m_pSocket->Send (m_TxBuffer, m_nTxLength, 0) != (int) m_nTxLength)
+		{
+			m_bSendError = TRUE;
+
+			return FALSE;
+		}
+
+		m_nTxLength = 0;
+	}
+
+	return TRUE;
+}
+
+const char *CHTTPDaemon::GetStatusMessage (THTTPStatus Status)
+{
+	switch (Status)
+	{
+	case HTTPOK:			return "OK";
+	case HTTPPartialContent:	return "Partial Content";
+	case HTTPNotModified:		return "Not Modified";
+	case HTTPBadRequest:		return "Bad Request";
+	case HTTPNotFound:		return "Not Found";
+	case HTTPRequestTimeout:	return "Request Timeout";
+	case HTTPRequestEntityTooLarge:	return "Request Entity Too Large";
+	case HTTPRequestURITooLong:	return "Request-URI Too Long";
+	case HTTPRangeNotSatisfiable:	return "Range Not Satisfiable";
+	case HTTPInternalServerError:	return "Internal Server Error";
+	case HTTPMethodNotImplemented:	return "Method Not Implemented";
+	case HTTPVersionNotSupported:	return "Version Not Supported";
+	default:			return "Unknown Error";
+	}
+}
+
 // TODO: optimize
 void *CHTTPDaemon::Search (const void *pBuffer, unsigned nBufLen,
 			   const void *pNeedle, unsigned nNeedleLen)
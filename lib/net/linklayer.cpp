@@ -19,6 +19,7 @@
 //
 #include <circle/net/linklayer.h>
 #include <circle/net/networklayer.h>
+#include <circle/net/netsubsystem.h>
 #include <circle/util.h>
 #include <assert.h>
 
@@ -32,6 +33,7 @@ CLinkLayer::CLinkLayer (CNetConfig *pNetConfig, CNetDeviceLayer *pNetDevLayer)
 	m_pNetDevLayer (pNetDevLayer),
 	m_pNetworkLayer (0),
 	m_pARPHandler (0),
+	m_IPRxQueue (NET_QUEUE_SIZE, TRUE),		// loopback frames come from any task
 	m_nRawProtocolType (0)
 {
 	assert (m_pNetConfig != 0);
@@ -74,48 +76,63 @@ void CLinkLayer::Process (void)
 	}
 
 	assert (m_pNetDevLayer != 0);
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	unsigned nLength;
-	while (m_pNetDevLayer->Receive (Buffer, &nLength))
+	CNetBuffer *Buffers[NET_QUEUE_BATCH_SIZE];
+	unsigned nCount;
+	while ((nCount = m_pNetDevLayer->Receive (Buffers, NET_QUEUE_BATCH_SIZE)) > 0)
 	{
-		assert (nLength <= FRAME_BUFFER_SIZE);
-		if (nLength <= sizeof (TEthernetHeader))
+		for (unsigned i = 0; i < nCount; i++)
 		{
-			continue;
-		}
-		TEthernetHeader *pHeader = (TEthernetHeader *) Buffer;
-
-		CMACAddress MACAddressReceiver (pHeader->MACReceiver);
-		if (    MACAddressReceiver != *pOwnMACAddress
-		    && !MACAddressReceiver.IsBroadcast ())
-		{
-			continue;
-		}
+			CNetBuffer *pBuffer = Buffers[i];
 
-		nLength -= sizeof (TEthernetHeader);
-		assert (nLength > 0);
-		
-		switch (pHeader->nProtocolType)
-		{
-		case BE (ETH_PROT_IP):
-			m_IPRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader), nLength);
-			break;
+			assert (pBuffer->GetLength () <= FRAME_BUFFER_SIZE);
+			if (pBuffer->GetLength () <= sizeof (TEthernetHeader))
+			{
+				pBuffer->Release ();
 
-		case BE (ETH_PROT_ARP):
-			m_ARPRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader), nLength);
-			break;
+				continue;
+			}
+			TEthernetHeader *pHeader = (TEthernetHeader *) pBuffer->GetData ();
 
-		default:
-			if (pHeader->nProtocolType == m_nRawProtocolType)
+			CMACAddress MACAddressReceiver (pHeader->MACReceiver);
+			if (    MACAddressReceiver != *pOwnMACAddress
+			    && !MACAddressReceiver.IsBroadcast ())
 			{
-				TRawPrivateData *pParam = new TRawPrivateData;
-				assert (pParam != 0);
-				memcpy (pParam->MACSender, pHeader->MACSender, MAC_ADDRESS_SIZE);
+				pBuffer->Release ();
+
+				continue;
+			}
+
+			pBuffer->Pull (sizeof (TEthernetHeader));	// pHeader remains accessible
+			assert (pBuffer->GetLength () > 0);
 
-				m_RawRxQueue.Enqueue (Buffer+sizeof (TEthernetHeader),
-						      nLength, pParam);
+			switch (pHeader->nProtocolType)
+			{
+			case BE (ETH_PROT_IP):
+				m_IPRxQueue.Enqueue (pBuffer);
+				break;
+
+			case BE (ETH_PROT_ARP):
+				m_ARPRxQueue.Enqueue (pBuffer);
+				break;
+
+			default:
+				if (pHeader->nProtocolType == m_nRawProtocolType)
+				{
+					TRawPrivateData *pParam = new TRawPrivateData;
+					assert (pParam != 0);
+					memcpy (pParam->MACSender, pHeader->MACSender, MAC_ADDRESS_SIZE);
+
+					if (!m_RawRxQueue.Enqueue (pBuffer, pParam))
+					{
+						delete pParam;
+					}
+				}
+				else
+				{
+					pBuffer->Release ();
+				}
+				break;
 			}
-			break;
 		}
 	}
 
@@ -139,6 +156,7 @@ boolean CLinkLayer::Send (const CIPAddress &rReceiver, const void *pIPPacket, un
 	    && rReceiver == *m_pNetConfig->GetIPAddress ())
 	{
 		m_IPRxQueue.Enqueue (pIPPacket, nLength);	// loop back to own address
+		CNetSubSystem::Get ()->SignalEvent ();
 
 		return TRUE;
 	}
@@ -186,13 +204,15 @@ boolean CLinkLayer::Send (const CIPAddress &rReceiver, const void *pIPPacket, un
 	return TRUE;
 }
 
-boolean CLinkLayer::Receive (void *pBuffer, unsigned *pResultLength)
+CNetBuffer *CLinkLayer::Receive (void)
 {
-	assert (pBuffer != 0);
-	assert (pResultLength != 0);
-	*pResultLength = m_IPRxQueue.Dequeue (pBuffer);
+	return m_IPRxQueue.Dequeue ();
+}
 
-	return *pResultLength != 0 ? TRUE : FALSE;
+unsigned CLinkLayer::GetChecksumOffload (void) const
+{
+	assert (m_pNetDevLayer != 0);
+	return m_pNetDevLayer->GetChecksumOffload ();
 }
 
 boolean CLinkLayer::SendRaw (const void *pFrame, unsigned nLength)
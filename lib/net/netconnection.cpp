@@ -18,8 +18,13 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/netconnection.h>
+#include <circle/net/netsubsystem.h>
 #include <assert.h>
 
+CNetConnection *CNetConnection::s_pFirstPending = 0;
+CNetConnection *CNetConnection::s_pLastPending = 0;
+CSpinLock CNetConnection::s_PendingSpinLock;
+
 CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 				CNetworkLayer	*pNetworkLayer,
 				const CIPAddress &rForeignIP,
@@ -32,7 +37,14 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 	m_nForeignPort (nForeignPort),
 	m_nOwnPort (nOwnPort),
 	m_nProtocol (nProtocol),
-	m_Checksum (*pNetConfig->GetIPAddress (), rForeignIP, nProtocol)
+	m_Checksum (*pNetConfig->GetIPAddress (), rForeignIP, nProtocol),
+	m_pPollEvent (0),
+	m_bHashed (FALSE),
+	m_bWildcardHashed (FALSE),
+	m_nHashBucket (0),
+	m_pNextHashed (0),
+	m_bPending (FALSE),
+	m_pNextPending (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
@@ -47,7 +59,14 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 	m_nForeignPort (0),
 	m_nOwnPort (nOwnPort),
 	m_nProtocol (nProtocol),
-	m_Checksum (*pNetConfig->GetIPAddress (), nProtocol)
+	m_Checksum (*pNetConfig->GetIPAddress (), nProtocol),
+	m_pPollEvent (0),
+	m_bHashed (FALSE),
+	m_bWildcardHashed (FALSE),
+	m_nHashBucket (0),
+	m_pNextHashed (0),
+	m_bPending (FALSE),
+	m_pNextPending (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
@@ -55,6 +74,41 @@ CNetConnection::CNetConnection (CNetConfig	*pNetConfig,
 
 CNetConnection::~CNetConnection (void)
 {
+	assert (!m_bHashed);
+
+	// a timer may have requested processing in the meantime
+	s_PendingSpinLock.Acquire ();
+
+	if (m_bPending)
+	{
+		CNetConnection *pPrev = 0;
+		CNetConnection *pConnection = s_pFirstPending;
+		while (pConnection != this)
+		{
+			assert (pConnection != 0);
+			pPrev = pConnection;
+			pConnection = pConnection->m_pNextPending;
+		}
+
+		if (pPrev == 0)
+		{
+			s_pFirstPending = m_pNextPending;
+		}
+		else
+		{
+			pPrev->m_pNextPending = m_pNextPending;
+		}
+
+		if (s_pLastPending == this)
+		{
+			s_pLastPending = pPrev;
+		}
+
+		m_bPending = FALSE;
+	}
+
+	s_PendingSpinLock.Release ();
+
 	m_pNetworkLayer = 0;
 	m_pNetConfig = 0;
 }
@@ -90,3 +144,77 @@ const char *CNetConnection::GetStateName (void) const
 {
 	return "";
 }
+
+void CNetConnection::SetPollEvent (CSynchronizationEvent *pEvent)
+{
+	m_pPollEvent = pEvent;
+}
+
+void CNetConnection::SignalPollEvent (void)
+{
+	CSynchronizationEvent *pEvent = m_pPollEvent;
+	if (pEvent != 0)
+	{
+		pEvent->Set ();
+	}
+}
+
+void CNetConnection::RequestProcess (void)
+{
+	MarkPending ();
+
+	CNetSubSystem::Get ()->SignalEvent ();
+}
+
+void CNetConnection::MarkPending (void)
+{
+	s_PendingSpinLock.Acquire ();
+
+	if (!m_bPending)
+	{
+		m_bPending = TRUE;
+		m_pNextPending = 0;
+
+		if (s_pLastPending != 0)
+		{
+			s_pLastPending->m_pNextPending = this;
+		}
+		else
+		{
+			s_pFirstPending = this;
+		}
+
+		s_pLastPending = this;
+	}
+
+	s_PendingSpinLock.Release ();
+}
+
+CNetConnection *CNetConnection::TakePendingList (void)
+{
+	s_PendingSpinLock.Acquire ();
+
+	CNetConnection *pList = s_pFirstPending;
+	s_pFirstPending = 0;
+	s_pLastPending = 0;
+
+	s_PendingSpinLock.Release ();
+
+	return pList;
+}
+
+CNetConnection *CNetConnection::ClearPending (void)
+{
+	s_PendingSpinLock.Acquire ();
+
+	assert (m_bPending);
+	m_bPending = FALSE;
+
+	// may be requested again from now on
+	CNetConnection *pNext = m_pNextPending;
+	m_pNextPending = 0;
+
+	s_PendingSpinLock.Release ();
+
+	return pNext;
+}
@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/netdevlayer.h>
+#include <circle/net/netsubsystem.h>
 #include <circle/net/phytask.h>
 #include <circle/logger.h>
 #include <circle/timer.h>
@@ -30,7 +31,8 @@ const char FromNetDev[] = "netdev";
 CNetDeviceLayer::CNetDeviceLayer (CNetConfig *pNetConfig, TNetDeviceType DeviceType)
 :	m_DeviceType (DeviceType),
 	m_pNetConfig (pNetConfig),
-	m_pDevice (0)
+	m_pDevice (0),
+	m_TxQueue (NET_QUEUE_SIZE, TRUE)
 {
 }
 
@@ -68,7 +70,7 @@ boolean CNetDeviceLayer::Initialize (boolean bWaitForActivate)
 		return FALSE;
 	}
 
-	new CPHYTask (m_pDevice);
+	AttachDevice ();
 
 	// wait for Ethernet PHY to come up
 	unsigned nStartTicks = CTimer::Get ()->GetTicks ();
@@ -93,25 +95,29 @@ boolean CNetDeviceLayer::Initialize (boolean bWaitForActivate)
 	return TRUE;
 }
 
-void CNetDeviceLayer::Process (void)
+boolean CNetDeviceLayer::Process (void)
 {
 	if (m_pDevice == 0)
 	{
 		m_pDevice = CNetDevice::GetNetDevice (m_DeviceType);
 		if (m_pDevice == 0)
 		{
-			return;
+			return FALSE;
 		}
 
-		new CPHYTask (m_pDevice);
+		AttachDevice ();
 	}
 
-	DMA_BUFFER (u8, Buffer, FRAME_BUFFER_SIZE);
-	unsigned nLength;
+	CNetBuffer *pBuffer;
 	while (   m_pDevice->IsSendFrameAdvisable ()
-	       && (nLength = m_TxQueue.Dequeue (Buffer)) > 0)
+	       && (pBuffer = m_TxQueue.Dequeue ()) != 0)
 	{
-		if (!m_pDevice->SendFrame (Buffer, nLength))
+		// the data area of a net buffer is suitable for DMA
+		boolean bOK = m_pDevice->SendFrame (pBuffer->GetData (), pBuffer->GetLength ());
+
+		pBuffer->Release ();
+
+		if (!bOK)
 		{
 			CLogger::Get ()->Write (FromNetDev, LogWarning, "Frame dropped");
 
@@ -119,11 +125,39 @@ void CNetDeviceLayer::Process (void)
 		}
 	}
 
-	while (m_pDevice->ReceiveFrame (Buffer, &nLength))
+	boolean bReceived = FALSE;
+	unsigned nCount;
+	do
 	{
-		assert (nLength > 0);
-		m_RxQueue.Enqueue (Buffer, nLength);
+		CNetBuffer *Buffers[NET_QUEUE_BATCH_SIZE];
+		nCount = 0;
+		while (   nCount < NET_QUEUE_BATCH_SIZE
+		       && (pBuffer = m_pDevice->ReceiveNetBuffer ()) != 0)
+		{
+			if (pBuffer->GetLength () == 0)
+			{
+				pBuffer->Release ();
+
+				continue;
+			}
+
+			Buffers[nCount++] = pBuffer;
+		}
+
+		if (nCount > 0)
+		{
+			unsigned nQueued = m_RxQueue.EnqueueBatch (Buffers, nCount);
+			while (nQueued < nCount)
+			{
+				Buffers[nQueued++]->Release ();		// queue is full
+			}
+
+			bReceived = TRUE;
+		}
 	}
+	while (nCount == NET_QUEUE_BATCH_SIZE);
+
+	return bReceived;
 }
 
 const CMACAddress *CNetDeviceLayer::GetMACAddress (void) const
@@ -139,23 +173,44 @@ const CMACAddress *CNetDeviceLayer::GetMACAddress (void) const
 void CNetDeviceLayer::Send (const void *pBuffer, unsigned nLength)
 {
 	m_TxQueue.Enqueue (pBuffer, nLength);
+
+	CNetSubSystem::Get ()->SignalEvent ();
 }
 
-boolean CNetDeviceLayer::Receive (void *pBuffer, unsigned *pResultLength)
+unsigned CNetDeviceLayer::Receive (CNetBuffer **ppBuffer, unsigned nMaxCount)
+{
+	return m_RxQueue.DequeueBatch (ppBuffer, nMaxCount);
+}
+
+boolean CNetDeviceLayer::IsRunning (void) const
 {
-	unsigned nLength = m_RxQueue.Dequeue (pBuffer);
-	if (nLength == 0)
+	return m_pDevice != 0;
+}
+
+boolean CNetDeviceLayer::IsEventDriven (void) const
+{
+	return m_pDevice != 0 && m_pDevice->IsEventDriven ();
+}
+
+unsigned CNetDeviceLayer::GetChecksumOffload (void) const
+{
+	if (m_pDevice == 0)
 	{
-		return FALSE;
+		return 0;
 	}
 
-	assert (pResultLength != 0);
-	*pResultLength = nLength;
+	return m_pDevice->GetChecksumOffload ();
+}
 
-	return TRUE;
+void CNetDeviceLayer::AttachDevice (void)
+{
+	assert (m_pDevice != 0);
+	m_pDevice->RegisterEventHandler (DeviceEventHandler, this);
+
+	new CPHYTask (m_pDevice);
 }
 
-boolean CNetDeviceLayer::IsRunning (void) const
+void CNetDeviceLayer::DeviceEventHandler (void *pParam)
 {
-	return m_pDevice != 0;
+	CNetSubSystem::Get ()->SignalEvent ();
 }
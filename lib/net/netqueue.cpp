@@ -2,7 +2,7 @@
 // netqueue.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2017  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -19,132 +19,215 @@
 //
 #include <circle/net/netqueue.h>
 #include <circle/netdevice.h>
+#include <circle/atomic.h>
+#include <circle/macros.h>
 #include <circle/util.h>
 #include <assert.h>
 
 struct TNetQueueEntry
 {
-	volatile TNetQueueEntry *pPrev;
-	volatile TNetQueueEntry *pNext;
-	unsigned		 nLength;
-	unsigned char		 Buffer[FRAME_BUFFER_SIZE];
-	void			*pParam;
+	CNetBuffer	*pBuffer;
+	void		*pParam;
 };
 
-CNetQueue::CNetQueue (void)
-:	m_pFirst (0),
-	m_pLast (0),
+CNetQueue::CNetQueue (unsigned nSize, boolean bMultiProducer)
+:	m_pEntry (new TNetQueueEntry[nSize]),
+	m_nSizeMask (nSize-1),
+	m_nIn (0),
+	m_nOut (0),
+	m_bMultiProducer (bMultiProducer),
 	m_SpinLock (TASK_LEVEL)
 {
+	assert (IS_POWEROF_2 (nSize));
+	assert (m_pEntry != 0);
 }
 
 CNetQueue::~CNetQueue (void)
 {
 	Flush ();
+
+	delete [] m_pEntry;
+	m_pEntry = 0;
 }
 
 boolean CNetQueue::IsEmpty (void) const
 {
-	return m_pFirst == 0 ? TRUE : FALSE;
+	return AtomicGet (&m_nIn) == AtomicGet (&m_nOut) ? TRUE : FALSE;
 }
 
 void CNetQueue::Flush (void)
 {
-	while (m_pFirst != 0)
+	CNetBuffer *pBuffer;
+	while ((pBuffer = Dequeue ()) != 0)
 	{
-		m_SpinLock.Acquire ();
-
-		volatile TNetQueueEntry *pEntry = m_pFirst;
-		assert (pEntry != 0);
-
-		m_pFirst = pEntry->pNext;
-		if (m_pFirst != 0)
-		{
-			m_pFirst->pPrev = 0;
-		}
-		else
-		{
-			assert (m_pLast == pEntry);
-			m_pLast = 0;
-		}
-
-		m_SpinLock.Release ();
-
-		delete pEntry;
+		pBuffer->Release ();
 	}
 }
 	
-void CNetQueue::Enqueue (const void *pBuffer, unsigned nLength, void *pParam)
+boolean CNetQueue::Enqueue (const void *pBuffer, unsigned nLength, void *pParam)
 {
-	TNetQueueEntry *pEntry = new TNetQueueEntry;
-	assert (pEntry != 0);
+	CNetBuffer *pNetBuffer = CNetBuffer::Alloc ();
+	if (pNetBuffer == 0)
+	{
+		return FALSE;			// out of memory
+	}
 
 	assert (nLength > 0);
 	assert (nLength <= FRAME_BUFFER_SIZE);
-	pEntry->nLength = nLength;
+	assert (pBuffer != 0);
+	memcpy (pNetBuffer->Put (nLength), pBuffer, nLength);
+
+	return Enqueue (pNetBuffer, pParam);
+}
+
+unsigned CNetQueue::Dequeue (void *pBuffer, void **ppParam)
+{
+	CNetBuffer *pNetBuffer = Dequeue (ppParam);
+	if (pNetBuffer == 0)
+	{
+		return 0;
+	}
+
+	unsigned nResult = pNetBuffer->GetLength ();
+	assert (nResult > 0);
+	assert (nResult <= FRAME_BUFFER_SIZE);
+
+	assert (pBuffer != 0);
+	memcpy (pBuffer, pNetBuffer->GetData (), nResult);
 
+	pNetBuffer->Release ();
+
+	return nResult;
+}
+
+boolean CNetQueue::Enqueue (CNetBuffer *pBuffer, void *pParam)
+{
 	assert (pBuffer != 0);
-	memcpy (pEntry->Buffer, pBuffer, nLength);
+	assert (pBuffer->GetLength () > 0);
+
+	if (m_bMultiProducer)
+	{
+		m_SpinLock.Acquire ();
+	}
+
+	// m_nIn is written by the (serialized) producers only
+	unsigned nIn = (unsigned) m_nIn;
+	if (nIn - (unsigned) AtomicGet (&m_nOut) > m_nSizeMask)
+	{
+		if (m_bMultiProducer)
+		{
+			m_SpinLock.Release ();
+		}
+
+		pBuffer->Release ();		// queue is full
 
+		return FALSE;
+	}
+
+	TNetQueueEntry *pEntry = &m_pEntry[nIn & m_nSizeMask];
+	pEntry->pBuffer = pBuffer;
 	pEntry->pParam = pParam;
 
-	m_SpinLock.Acquire ();
+	AtomicSet (&m_nIn, (int) (nIn + 1));	// publish the entry
+
+	if (m_bMultiProducer)
+	{
+		m_SpinLock.Release ();
+	}
 
-	pEntry->pPrev = m_pLast;
-	pEntry->pNext = 0;
+	return TRUE;
+}
 
-	if (m_pFirst == 0)
+CNetBuffer *CNetQueue::Dequeue (void **ppParam)
+{
+	unsigned nOut;
+	TNetQueueEntry Entry;
+	do
 	{
-		m_pFirst = pEntry;
+		nOut = (unsigned) AtomicGet (&m_nOut);
+		if (nOut == (unsigned) AtomicGet (&m_nIn))
+		{
+			return 0;
+		}
+
+		// read the entry, before it can be reused by the producer
+		Entry = m_pEntry[nOut & m_nSizeMask];
 	}
-	else
+	while ((unsigned) AtomicCompareExchange (&m_nOut, (int) nOut, (int) (nOut + 1)) != nOut);
+
+	assert (Entry.pBuffer != 0);
+
+	if (ppParam != 0)
 	{
-		assert (m_pLast != 0);
-		assert (m_pLast->pNext == 0);
-		m_pLast->pNext = pEntry;
+		*ppParam = Entry.pParam;
 	}
-	m_pLast = pEntry;
 
-	m_SpinLock.Release ();
+	return Entry.pBuffer;
 }
 
-unsigned CNetQueue::Dequeue (void *pBuffer, void **ppParam)
+unsigned CNetQueue::EnqueueBatch (CNetBuffer *const *ppBuffer, unsigned nCount)
 {
-	unsigned nResult = 0;
-	
-	if (m_pFirst != 0)
+	assert (ppBuffer != 0);
+
+	if (m_bMultiProducer)
 	{
 		m_SpinLock.Acquire ();
+	}
+
+	unsigned nIn = (unsigned) m_nIn;
+	unsigned nFree = m_nSizeMask + 1 - (nIn - (unsigned) AtomicGet (&m_nOut));
+	if (nCount > nFree)
+	{
+		nCount = nFree;
+	}
 
-		volatile TNetQueueEntry *pEntry = m_pFirst;
-		assert (pEntry != 0);
+	for (unsigned i = 0; i < nCount; i++)
+	{
+		assert (ppBuffer[i] != 0);
+		assert (ppBuffer[i]->GetLength () > 0);
 
-		m_pFirst = pEntry->pNext;
-		if (m_pFirst != 0)
-		{
-			m_pFirst->pPrev = 0;
-		}
-		else
-		{
-			assert (m_pLast == pEntry);
-			m_pLast = 0;
-		}
+		TNetQueueEntry *pEntry = &m_pEntry[(nIn + i) & m_nSizeMask];
+		pEntry->pBuffer = ppBuffer[i];
+		pEntry->pParam = 0;
+	}
+
+	AtomicSet (&m_nIn, (int) (nIn + nCount));
 
+	if (m_bMultiProducer)
+	{
 		m_SpinLock.Release ();
+	}
 
-		nResult = pEntry->nLength;
-		assert (nResult > 0);
-		assert (nResult <= FRAME_BUFFER_SIZE);
+	return nCount;
+}
 
-		memcpy (pBuffer, (const void *) pEntry->Buffer, nResult);
+unsigned CNetQueue::DequeueBatch (CNetBuffer **ppBuffer, unsigned nMaxCount)
+{
+	assert (ppBuffer != 0);
 
-		if (ppParam != 0)
+	unsigned nOut;
+	unsigned nCount;
+	do
+	{
+		nOut = (unsigned) AtomicGet (&m_nOut);
+		nCount = (unsigned) AtomicGet (&m_nIn) - nOut;
+		if (nCount == 0)
 		{
-			*ppParam = pEntry->pParam;
+			return 0;
 		}
 
-		delete pEntry;
+		if (nCount > nMaxCount)
+		{
+			nCount = nMaxCount;
+		}
+
+		for (unsigned i = 0; i < nCount; i++)
+		{
+			ppBuffer[i] = m_pEntry[(nOut + i) & m_nSizeMask].pBuffer;
+		}
 	}
+	while ((unsigned) AtomicCompareExchange (&m_nOut, (int) nOut,
+						 (int) (nOut + nCount)) != nOut);
 
-	return nResult;
+	return nCount;
 }
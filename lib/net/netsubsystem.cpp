@@ -23,6 +23,9 @@
 #include <circle/sched/scheduler.h>
 #include <assert.h>
 
+// the net task wakes up at least in this interval, even if not signalled
+#define MAX_WAIT_US	10000
+
 CNetSubSystem *CNetSubSystem::s_pThis = 0;
 
 CNetSubSystem::CNetSubSystem (const u8 *pIPAddress, const u8 *pNetMask, const u8 *pDefaultGateway,
@@ -111,13 +114,17 @@ boolean CNetSubSystem::Initialize (boolean bWaitForActivate)
 	return TRUE;
 }
 
-void CNetSubSystem::Process (void)
+boolean CNetSubSystem::Process (void)
 {
 	if (s_pThis == 0)
 	{
-		return;
+		return FALSE;
 	}
 
+	// events signalled from now on cause another run
+	boolean bSignalled = m_Event.GetState ();
+	m_Event.Clear ();
+
 	if (   m_bUseDHCP
 	    && m_pDHCPClient == 0
 	    && m_NetDevLayer.IsRunning ())
@@ -126,13 +133,39 @@ void CNetSubSystem::Process (void)
 		assert (m_pDHCPClient != 0);
 	}
 
-	m_NetDevLayer.Process ();
+	boolean bReceived = m_NetDevLayer.Process ();
 
-	m_LinkLayer.Process ();
+	// the link and network layers have work, only if frames have been received,
+	// or packets have been sent (e.g. to the loopback address) in the meantime
+	if (   bReceived
+	    || bSignalled
+	    || !m_NetDevLayer.IsEventDriven ())
+	{
+		m_LinkLayer.Process ();
 
-	m_NetworkLayer.Process ();
+		m_NetworkLayer.Process ();
+	}
 
 	m_TransportLayer.Process ();
+
+	return bReceived;
+}
+
+void CNetSubSystem::SignalEvent (void)
+{
+	m_Event.Set ();
+}
+
+void CNetSubSystem::WaitForWork (void)
+{
+	if (!m_NetDevLayer.IsEventDriven ())
+	{
+		CScheduler::Get ()->Yield ();	// device must be polled
+
+		return;
+	}
+
+	m_Event.WaitWithTimeout (MAX_WAIT_US);
 }
 
 CNetConfig *CNetSubSystem::GetConfig (void)
@@ -37,8 +37,13 @@ void CNetTask::Run (void)
 	while (1)
 	{
 		assert (m_pNetSubSystem != 0);
-		m_pNetSubSystem->Process ();
-
-		CScheduler::Get ()->Yield ();
+		if (m_pNetSubSystem->Process ())
+		{
+			CScheduler::Get ()->Yield ();		// more frames may follow soon
+		}
+		else
+		{
+			m_pNetSubSystem->WaitForWork ();
+		}
 	}
 }
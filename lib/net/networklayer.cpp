@@ -20,21 +20,38 @@
 #include <circle/net/networklayer.h>
 #include <circle/net/checksumcalculator.h>
 #include <circle/net/in.h>
+#include <circle/timer.h>
 #include <circle/util.h>
 #include <assert.h>
 
+#define REASSEMBLY_TIMEOUT_HZ	(5 * HZ)
+
 CNetworkLayer::CNetworkLayer (CNetConfig *pNetConfig, CLinkLayer *pLinkLayer)
 :	m_pNetConfig (pNetConfig),
 	m_pLinkLayer (pLinkLayer),
 	m_pICMPHandler (0),
-	m_pICMPRxQueue2 (0)
+	m_pICMPRxQueue2 (0),
+	m_nIdentification (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pLinkLayer != 0);
+
+	for (unsigned i = 0; i < IP_REASSEMBLY_SLOTS; i++)
+	{
+		m_Reassembly[i].bInUse = FALSE;
+		m_Reassembly[i].pBuffer = 0;
+	}
+
+	memset (&m_FragmentStatistics, 0, sizeof m_FragmentStatistics);
 }
 
 CNetworkLayer::~CNetworkLayer (void)
 {
+	for (unsigned i = 0; i < IP_REASSEMBLY_SLOTS; i++)
+	{
+		FreeReassemblySlot (&m_Reassembly[i]);
+	}
+
 	delete m_pICMPRxQueue2;
 	m_pICMPRxQueue2 = 0;
 
@@ -60,32 +77,42 @@ void CNetworkLayer::Process (void)
 	const CIPAddress *pOwnIPAddress = m_pNetConfig->GetIPAddress ();
 	assert (pOwnIPAddress != 0);
 
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	unsigned nResultLength;
+	CNetBuffer *pBuffer;
 	assert (m_pLinkLayer != 0);
-	while (m_pLinkLayer->Receive (Buffer, &nResultLength))
+	while ((pBuffer = m_pLinkLayer->Receive ()) != 0)
 	{
+		unsigned nResultLength = pBuffer->GetLength ();
 		if (nResultLength <= sizeof (TIPHeader))
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
-		TIPHeader *pHeader = (TIPHeader *) Buffer;
+		TIPHeader *pHeader = (TIPHeader *) pBuffer->GetData ();
 
 		unsigned nHeaderLength = pHeader->nVersionIHL & 0xF;
 		if (   nHeaderLength < IP_HEADER_LENGTH_DWORD_MIN
 		    || nHeaderLength > IP_HEADER_LENGTH_DWORD_MAX)
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
 		nHeaderLength *= 4;
 		if (nResultLength <= nHeaderLength)
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
 
-		if (   CChecksumCalculator::SimpleCalculate (pHeader, nHeaderLength) != CHECKSUM_OK
-		    || (pHeader->nVersionIHL >> 4) != IP_VERSION)
+		if (   (pHeader->nVersionIHL >> 4) != IP_VERSION
+		    || (   pBuffer->GetChecksumState () != NetChecksumVerified
+			&&    CChecksumCalculator::SimpleCalculate (pHeader, nHeaderLength)
+			   != CHECKSUM_OK))
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
 
@@ -96,6 +123,8 @@ void CNetworkLayer::Process (void)
 			    && !IPAddressDestination.IsBroadcast ()
 			    && *m_pNetConfig->GetBroadcastAddress () != IPAddressDestination)
 			{
+				pBuffer->Release ();
+
 				continue;
 			}
 		}
@@ -103,20 +132,22 @@ void CNetworkLayer::Process (void)
 		{
 			if (!IPAddressDestination.IsBroadcast ())
 			{
+				pBuffer->Release ();
+
 				continue;
 			}
 		}
 
-		if (   (pHeader->nFlagsFragmentOffset & IP_FLAGS_MF)
-		    ||    IP_FRAGMENT_OFFSET (le2be16 (pHeader->nFlagsFragmentOffset))
-		       != IP_FRAGMENT_OFFSET_FIRST)
-		{
-			continue;
-		}
-		
+		boolean bFragment =    (pHeader->nFlagsFragmentOffset & IP_FLAGS_MF)
+				    ||    IP_FRAGMENT_OFFSET (le2be16 (pHeader->nFlagsFragmentOffset))
+				       != IP_FRAGMENT_OFFSET_FIRST;
+
 		unsigned nTotalLength = le2be16 (pHeader->nTotalLength);
-		if (nResultLength < nTotalLength)
+		if (   nResultLength < nTotalLength
+		    || nTotalLength <= nHeaderLength)
 		{
+			pBuffer->Release ();
+
 			continue;
 		}
 		nResultLength = nTotalLength;		// ignore padding
@@ -127,9 +158,21 @@ void CNetworkLayer::Process (void)
 		memcpy (pParam->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE);
 		memcpy (pParam->DestinationAddress, pHeader->DestinationAddress, IP_ADDRESS_SIZE);
 
-		nResultLength -= nHeaderLength;
+		pBuffer->Trim (nResultLength);
+		pBuffer->Pull (nHeaderLength);
 
-		if (pHeader->nProtocol == IPPROTO_ICMP)
+		if (bFragment)
+		{
+			pBuffer = Reassemble (pHeader, pBuffer);	// pHeader is invalid now
+			if (pBuffer == 0)
+			{
+				delete pParam;
+
+				continue;
+			}
+		}
+
+		if (pParam->nProtocol == IPPROTO_ICMP)
 		{
 			if (m_pICMPRxQueue2 != 0)
 			{
@@ -137,18 +180,29 @@ void CNetworkLayer::Process (void)
 				assert (pParam2 != 0);
 				memcpy (pParam2, pParam, sizeof *pParam);
 
-				m_pICMPRxQueue2->Enqueue (Buffer+nHeaderLength, nResultLength,
-							  pParam2);
+				pBuffer->AddRef ();		// shared read-only by both queues
+				if (!m_pICMPRxQueue2->Enqueue (pBuffer, pParam2))
+				{
+					delete pParam2;
+				}
 			}
 
-			m_ICMPRxQueue.Enqueue (Buffer+nHeaderLength, nResultLength, pParam);
+			if (!m_ICMPRxQueue.Enqueue (pBuffer, pParam))
+			{
+				delete pParam;
+			}
 		}
 		else
 		{
-			m_RxQueue.Enqueue (Buffer+nHeaderLength, nResultLength, pParam);
+			if (!m_RxQueue.Enqueue (pBuffer, pParam))
+			{
+				delete pParam;
+			}
 		}
 	}
 
+	ExpireReassembly ();
+
 	assert (m_pICMPHandler != 0);
 	m_pICMPHandler->Process ();
 }
@@ -157,19 +211,62 @@ boolean CNetworkLayer::Send (const CIPAddress &rReceiver, const void *pPacket, u
 {
 	unsigned nPacketLength = sizeof (TIPHeader) + nLength;		// may wrap
 	if (   nPacketLength <= sizeof (TIPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	    || nPacketLength > IP_MAX_DATAGRAM_SIZE)
 	{
 		return FALSE;
 	}
 
+	if (nPacketLength <= IP_MTU)
+	{
+		return SendPacket (rReceiver, pPacket, nLength, nProtocol,
+				   IP_FLAGS_DF | BE (IP_FRAGMENT_OFFSET_FIRST),
+				   BE (IP_IDENTIFICATION_DEFAULT));
+	}
+
+	// fragment the packet, all fragments but the last carry a multiple of 8 bytes
+	const unsigned nMaxFragmentLength =
+		(IP_MTU - sizeof (TIPHeader)) & ~(IP_FRAGMENT_UNIT-1);
+
+	u16 nIdentification = le2be16 (++m_nIdentification);
+
+	assert (pPacket != 0);
+	const u8 *pFragment = (const u8 *) pPacket;
+	for (unsigned nOffset = 0; nOffset < nLength; nOffset += nMaxFragmentLength)
+	{
+		unsigned nFragmentLength = nLength - nOffset;
+		u16 nFlagsFragmentOffset = le2be16 (nOffset / IP_FRAGMENT_UNIT);
+		if (nFragmentLength > nMaxFragmentLength)
+		{
+			nFragmentLength = nMaxFragmentLength;
+			nFlagsFragmentOffset |= IP_FLAGS_MF;
+		}
+
+		if (!SendPacket (rReceiver, pFragment + nOffset, nFragmentLength, nProtocol,
+				 nFlagsFragmentOffset, nIdentification))
+		{
+			return FALSE;
+		}
+
+		m_FragmentStatistics.nFragmentsSent++;
+	}
+
+	return TRUE;
+}
+
+boolean CNetworkLayer::SendPacket (const CIPAddress &rReceiver, const void *pPacket, unsigned nLength,
+				   int nProtocol, u16 nFlagsFragmentOffset, u16 nIdentification)
+{
+	unsigned nPacketLength = sizeof (TIPHeader) + nLength;
+	assert (nPacketLength <= IP_MTU);
+
 	u8 PacketBuffer[nPacketLength];
 	TIPHeader *pHeader = (TIPHeader *) PacketBuffer;
 
 	pHeader->nVersionIHL          = IP_VERSION << 4 | IP_HEADER_LENGTH_DWORD_MIN;
 	pHeader->nTypeOfService       = IP_TOS_ROUTINE;
 	pHeader->nTotalLength         = le2be16 ((u16) nPacketLength);
-	pHeader->nIdentification      = BE (IP_IDENTIFICATION_DEFAULT);
-	pHeader->nFlagsFragmentOffset = IP_FLAGS_DF | BE (IP_FRAGMENT_OFFSET_FIRST);
+	pHeader->nIdentification      = nIdentification;
+	pHeader->nFlagsFragmentOffset = nFlagsFragmentOffset;
 	pHeader->nTTL                 = rReceiver.IsMulticast () ? IP_TTL_MULTICAST : IP_TTL_DEFAULT;
 	pHeader->nProtocol            = (u8) nProtocol;
 
@@ -225,16 +322,13 @@ boolean CNetworkLayer::Send (const CIPAddress &rReceiver, const void *pPacket, u
 	return m_pLinkLayer->Send (*pNextHop, PacketBuffer, nPacketLength);
 }
 
-boolean CNetworkLayer::Receive (void *pBuffer, unsigned *pResultLength,
-				CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol)
+CNetBuffer *CNetworkLayer::Receive (CIPAddress *pSender, CIPAddress *pReceiver, int *pProtocol)
 {
 	void *pParam;
-	assert (pBuffer != 0);
-	assert (pResultLength != 0);
-	*pResultLength = m_RxQueue.Dequeue (pBuffer, &pParam);
-	if (*pResultLength == 0)
+	CNetBuffer *pBuffer = m_RxQueue.Dequeue (&pParam);
+	if (pBuffer == 0)
 	{
-		return FALSE;
+		return 0;
 	}
 	
 	TNetworkPrivateData *pData = (TNetworkPrivateData *) pParam;
@@ -252,7 +346,7 @@ boolean CNetworkLayer::Receive (void *pBuffer, unsigned *pResultLength,
 	delete pData;
 	pData = 0;
 	
-	return TRUE;
+	return pBuffer;
 }
 
 boolean CNetworkLayer::ReceiveNotification (TICMPNotificationType *pType,
@@ -351,6 +445,243 @@ boolean CNetworkLayer::ReceiveICMP (void *pBuffer, unsigned *pResultLength,
 	return TRUE;
 }
 
+void CNetworkLayer::GetFragmentStatistics (TIPFragmentStatistics *pStatistics) const
+{
+	assert (pStatistics != 0);
+	memcpy (pStatistics, &m_FragmentStatistics, sizeof *pStatistics);
+}
+
+boolean CNetworkLayer::IsChecksumOffload (const CIPAddress &rReceiver, unsigned nLength) const
+{
+	// fragmented packets cannot be handled by the net device
+	if (sizeof (TIPHeader) + nLength > IP_MTU)
+	{
+		return FALSE;
+	}
+
+	// looped back packets do not pass the net device
+	assert (m_pNetConfig != 0);
+	if (rReceiver == *m_pNetConfig->GetIPAddress ())
+	{
+		return FALSE;
+	}
+
+	assert (m_pLinkLayer != 0);
+	return !!(m_pLinkLayer->GetChecksumOffload () & NET_CHECKSUM_OFFLOAD_TX);
+}
+
+CNetBuffer *CNetworkLayer::Reassemble (const TIPHeader *pHeader, CNetBuffer *pFragment)
+{
+	assert (pHeader != 0);
+	assert (pFragment != 0);
+
+	m_FragmentStatistics.nFragmentsReceived++;
+
+	unsigned nOffset =   IP_FRAGMENT_OFFSET (le2be16 (pHeader->nFlagsFragmentOffset))
+			   * IP_FRAGMENT_UNIT;
+	boolean bMoreFragments = !!(pHeader->nFlagsFragmentOffset & IP_FLAGS_MF);
+	unsigned nLength = pFragment->GetLength ();
+	assert (nLength > 0);
+
+	if (   (   bMoreFragments
+		&& nLength % IP_FRAGMENT_UNIT != 0)
+	    || nOffset + nLength > IP_MAX_PAYLOAD_SIZE)
+	{
+		m_FragmentStatistics.nReassemblyFailures++;
+		pFragment->Release ();
+
+		return 0;
+	}
+
+	// find the datagram, this fragment belongs to
+	TReassemblySlot *pSlot = 0;
+	TReassemblySlot *pFreeSlot = 0;
+	TReassemblySlot *pOldestSlot = 0;
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	for (unsigned i = 0; i < IP_REASSEMBLY_SLOTS; i++)
+	{
+		TReassemblySlot *pEntry = &m_Reassembly[i];
+		if (!pEntry->bInUse)
+		{
+			if (pFreeSlot == 0)
+			{
+				pFreeSlot = pEntry;
+			}
+
+			continue;
+		}
+
+		if (   pEntry->nIdentification == pHeader->nIdentification
+		    && pEntry->nProtocol == pHeader->nProtocol
+		    && memcmp (pEntry->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE) == 0
+		    && memcmp (pEntry->DestinationAddress, pHeader->DestinationAddress,
+			       IP_ADDRESS_SIZE) == 0)
+		{
+			pSlot = pEntry;
+
+			break;
+		}
+
+		if (   pOldestSlot == 0
+		    || nTicks - pEntry->nStartTicks > nTicks - pOldestSlot->nStartTicks)
+		{
+			pOldestSlot = pEntry;
+		}
+	}
+
+	if (pSlot == 0)
+	{
+		if (pFreeSlot == 0)
+		{
+			// all slots busy, give up the oldest datagram
+			assert (pOldestSlot != 0);
+			FreeReassemblySlot (pOldestSlot);
+			m_FragmentStatistics.nReassemblyFailures++;
+
+			pFreeSlot = pOldestSlot;
+		}
+
+		pSlot = pFreeSlot;
+		pSlot->pBuffer = CNetBuffer::AllocLarge (IP_MAX_PAYLOAD_SIZE);
+		if (pSlot->pBuffer == 0)
+		{
+			m_FragmentStatistics.nReassemblyFailures++;
+			pFragment->Release ();
+
+			return 0;
+		}
+
+		pSlot->bInUse = TRUE;
+		memcpy (pSlot->SourceAddress, pHeader->SourceAddress, IP_ADDRESS_SIZE);
+		memcpy (pSlot->DestinationAddress, pHeader->DestinationAddress, IP_ADDRESS_SIZE);
+		pSlot->nIdentification = pHeader->nIdentification;
+		pSlot->nProtocol = pHeader->nProtocol;
+		pSlot->nStartTicks = nTicks;
+		pSlot->nTotalLength = 0;
+		pSlot->nReceivedUnits = 0;
+		memset (pSlot->UnitMap, 0, sizeof pSlot->UnitMap);
+	}
+
+	// check consistency with the fragments received so far
+	boolean bValid = TRUE;
+	if (!bMoreFragments)
+	{
+		if (   pSlot->nTotalLength != 0
+		    && pSlot->nTotalLength != nOffset + nLength)
+		{
+			bValid = FALSE;
+		}
+
+		pSlot->nTotalLength = nOffset + nLength;
+
+		// the upper layers, except UDP, expect payloads, which fit into a frame
+		if (   pSlot->nTotalLength > FRAME_BUFFER_SIZE
+		    && pSlot->nProtocol != IPPROTO_UDP)
+		{
+			bValid = FALSE;
+		}
+
+		// fragments received before must not contain data behind the last fragment,
+		// otherwise they would be counted as units of the datagram
+		unsigned nTotalUnits = (pSlot->nTotalLength + IP_FRAGMENT_UNIT-1) / IP_FRAGMENT_UNIT;
+		for (unsigned nUnit = nTotalUnits; bValid && nUnit < IP_MAX_FRAGMENT_UNITS; nUnit++)
+		{
+			if (pSlot->UnitMap[nUnit / 32] & (1 << (nUnit % 32)))
+			{
+				bValid = FALSE;
+			}
+		}
+	}
+	else if (   pSlot->nTotalLength != 0
+		 && nOffset + nLength > pSlot->nTotalLength)
+	{
+		bValid = FALSE;
+	}
+
+	if (!bValid)
+	{
+		FreeReassemblySlot (pSlot);
+		m_FragmentStatistics.nReassemblyFailures++;
+		pFragment->Release ();
+
+		return 0;
+	}
+
+	assert (pSlot->pBuffer != 0);
+	memcpy (pSlot->pBuffer->GetData () + nOffset, pFragment->GetData (), nLength);
+
+	pFragment->Release ();
+
+	unsigned nLastUnit = (nOffset + nLength - 1) / IP_FRAGMENT_UNIT;
+	for (unsigned nUnit = nOffset / IP_FRAGMENT_UNIT; nUnit <= nLastUnit; nUnit++)
+	{
+		u32 nMask = 1 << (nUnit % 32);
+		if (!(pSlot->UnitMap[nUnit / 32] & nMask))
+		{
+			pSlot->UnitMap[nUnit / 32] |= nMask;
+			pSlot->nReceivedUnits++;
+		}
+	}
+
+	if (pSlot->nTotalLength == 0)
+	{
+		return 0;
+	}
+
+	unsigned nTotalUnits = (pSlot->nTotalLength + IP_FRAGMENT_UNIT-1) / IP_FRAGMENT_UNIT;
+	if (pSlot->nReceivedUnits < nTotalUnits)
+	{
+		return 0;
+	}
+
+	if (pSlot->nReceivedUnits > nTotalUnits)	// data behind the last fragment
+	{
+		FreeReassemblySlot (pSlot);
+		m_FragmentStatistics.nReassemblyFailures++;
+
+		return 0;
+	}
+
+	// datagram is complete
+	CNetBuffer *pBuffer = pSlot->pBuffer;
+	pBuffer->Put (pSlot->nTotalLength);
+
+	pSlot->pBuffer = 0;
+	pSlot->bInUse = FALSE;
+
+	m_FragmentStatistics.nDatagramsReassembled++;
+
+	return pBuffer;
+}
+
+void CNetworkLayer::ExpireReassembly (void)
+{
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	for (unsigned i = 0; i < IP_REASSEMBLY_SLOTS; i++)
+	{
+		TReassemblySlot *pSlot = &m_Reassembly[i];
+		if (   pSlot->bInUse
+		    && nTicks - pSlot->nStartTicks >= REASSEMBLY_TIMEOUT_HZ)
+		{
+			FreeReassemblySlot (pSlot);
+			m_FragmentStatistics.nReassemblyTimeouts++;
+		}
+	}
+}
+
+void CNetworkLayer::FreeReassemblySlot (TReassemblySlot *pSlot)
+{
+	assert (pSlot != 0);
+
+	if (pSlot->pBuffer != 0)
+	{
+		pSlot->pBuffer->Release ();
+		pSlot->pBuffer = 0;
+	}
+
+	pSlot->bInUse = FALSE;
+}
+
 void CNetworkLayer::AddRoute (const u8 *pDestIP, const u8 *pGatewayIP)
 {
 	m_RouteCache.AddRoute (pDestIP, pGatewayIP);
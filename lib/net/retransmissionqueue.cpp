@@ -2,7 +2,7 @@
 // retransmissionqueue.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2016  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -18,6 +18,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/retransmissionqueue.h>
+#include <circle/util.h>
 #include <assert.h>
 
 CRetransmissionQueue::CRetransmissionQueue (unsigned nSize)
@@ -35,12 +36,31 @@ CRetransmissionQueue::CRetransmissionQueue (unsigned nSize)
 
 CRetransmissionQueue::~CRetransmissionQueue (void)
 {
-	delete m_pBuffer;
+	delete [] m_pBuffer;
 	m_pBuffer = 0;
 	
 	m_nSize = 0;
 }
 
+unsigned CRetransmissionQueue::GetSize (void) const
+{
+	return m_nSize;
+}
+
+void CRetransmissionQueue::SetSize (unsigned nSize)
+{
+	assert (nSize > 1);
+	assert (IsEmpty ());
+
+	delete [] m_pBuffer;
+
+	m_nSize = nSize;
+	m_pBuffer = new unsigned char[m_nSize];
+	assert (m_pBuffer != 0);
+
+	Flush ();
+}
+
 boolean CRetransmissionQueue::IsEmpty (void) const
 {
 	return m_nOutPtr == m_nInPtr ? TRUE: FALSE;
@@ -65,15 +85,23 @@ void CRetransmissionQueue::Write (const void *pBuffer, unsigned nLength)
 	assert (nLength > 0);
 	assert (GetFreeSpace () >= nLength);
 
-	unsigned char *p = (unsigned char *) pBuffer;
+	const unsigned char *p = (const unsigned char *) pBuffer;
 	assert (p != 0);
 	assert (m_pBuffer != 0);
 
-	while (nLength--)
+	unsigned nFirst = m_nSize-m_nInPtr;		// bytes up to the end of the buffer
+	if (nFirst > nLength)
 	{
-		m_pBuffer[m_nInPtr++] = *p++;
-		m_nInPtr %= m_nSize;
+		nFirst = nLength;
 	}
+
+	memcpy (m_pBuffer+m_nInPtr, p, nFirst);
+	if (nFirst < nLength)
+	{
+		memcpy (m_pBuffer, p+nFirst, nLength-nFirst);
+	}
+
+	m_nInPtr = (m_nInPtr+nLength) % m_nSize;
 }
 
 unsigned CRetransmissionQueue::GetBytesAvailable (void) const
@@ -95,15 +123,32 @@ void CRetransmissionQueue::Read (void *pBuffer, unsigned nLength)
 	assert (nLength > 0);
 	assert (GetBytesAvailable () >= nLength);
 
-	unsigned char *p = (unsigned char *) pBuffer;
-	assert (p != 0);
-	assert (m_pBuffer != 0);
+	Copy (m_nPreOutPtr, pBuffer, nLength);
 
-	while (nLength--)
-	{
-		*p++ = m_pBuffer[m_nPreOutPtr++];
-		m_nPreOutPtr %= m_nSize;
-	}
+	m_nPreOutPtr = (m_nPreOutPtr+nLength) % m_nSize;
+}
+
+void CRetransmissionQueue::Read (unsigned nOffset, void *pBuffer, unsigned nLength) const
+{
+	assert (nLength > 0);
+	assert (m_nSize > 1);
+	assert (m_nOutPtr < m_nSize);
+	assert (m_nPreOutPtr < m_nSize);
+
+	// the requested range must have been read before
+	unsigned nSent = m_nPreOutPtr >= m_nOutPtr ? m_nPreOutPtr-m_nOutPtr
+						   : m_nSize+m_nPreOutPtr-m_nOutPtr;
+	assert (nOffset+nLength <= nSent);
+	(void) nSent;
+
+	Copy ((m_nOutPtr+nOffset) % m_nSize, pBuffer, nLength);
+}
+
+void CRetransmissionQueue::Skip (unsigned nBytes)
+{
+	assert (GetBytesAvailable () >= nBytes);
+
+	m_nPreOutPtr = (m_nPreOutPtr+nBytes) % m_nSize;
 }
 
 void CRetransmissionQueue::Advance (unsigned nBytes)
@@ -127,3 +172,23 @@ void CRetransmissionQueue::Flush (void)
 	m_nOutPtr = 0;
 	m_nPreOutPtr = 0;
 }
+
+void CRetransmissionQueue::Copy (unsigned nFrom, void *pBuffer, unsigned nLength) const
+{
+	unsigned char *p = (unsigned char *) pBuffer;
+	assert (p != 0);
+	assert (m_pBuffer != 0);
+	assert (nFrom < m_nSize);
+
+	unsigned nFirst = m_nSize-nFrom;		// bytes up to the end of the buffer
+	if (nFirst > nLength)
+	{
+		nFirst = nLength;
+	}
+
+	memcpy (p, m_pBuffer+nFrom, nFirst);
+	if (nFirst < nLength)
+	{
+		memcpy (p+nFirst, m_pBuffer, nLength-nFirst);
+	}
+}
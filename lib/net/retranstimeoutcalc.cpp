@@ -4,7 +4,7 @@
 // Calculating TCP retransmission timeout according to RFC 6298
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -123,6 +123,24 @@ void CRetransmissionTimeoutCalculator::SegmentAcknowledged (u32 nAcknowledgmentN
 	m_SpinLock.Release ();
 }
 
+void CRetransmissionTimeoutCalculator::SegmentAcknowledged (u32 nAcknowledgmentNumber, unsigned nRTT)
+{
+	m_SpinLock.Acquire ();
+
+#ifdef RTO_DEBUG
+	CLogger::Get ()->Write (FromRTO, LogDebug, "Segment acknowledged (ack %u, rtt %u)",
+				nAcknowledgmentNumber-m_nISN, nRTT);
+#endif
+
+	// the echoed timestamp identifies the transmission, so that Karn's algorithm is not needed
+	Calculate (nRTT);
+
+	m_bMeasurementRuns = FALSE;
+	m_nRetransmissions = 0;
+
+	m_SpinLock.Release ();
+}
+
 void CRetransmissionTimeoutCalculator::RetransmissionTimerExpired (void)
 {
 	m_SpinLock.Acquire ();
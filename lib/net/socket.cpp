@@ -19,6 +19,7 @@
 //
 #include <circle/net/socket.h>
 #include <circle/net/netsubsystem.h>
+#include <circle/net/tcpcongestioncontrol.h>
 #include <circle/net/in.h>
 #include <circle/util.h>
 #include <assert.h>
@@ -30,7 +31,10 @@ CSocket::CSocket (CNetSubSystem *pNetSubSystem, int nProtocol)
 	m_nProtocol (nProtocol),
 	m_nOwnPort (0),
 	m_hConnection (-1),
-	m_nBackLog (0)
+	m_nBackLog (0),
+	m_nRxBufferSize (0),
+	m_nTxBufferSize (0),
+	m_pCongestionControl (0)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pTransportLayer != 0);
@@ -43,16 +47,25 @@ CSocket::CSocket (CSocket &rSocket, int hConnection)
 	m_nProtocol (rSocket.m_nProtocol),
 	m_nOwnPort (rSocket.m_nOwnPort),
 	m_hConnection (hConnection),
-	m_nBackLog (0)
+	m_nBackLog (0),
+	m_nRxBufferSize (rSocket.m_nRxBufferSize),
+	m_nTxBufferSize (rSocket.m_nTxBufferSize),
+	m_pCongestionControl (rSocket.m_pCongestionControl)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pTransportLayer != 0);
+
+	// the connection may have been polled in a socket set of the listening socket
+	m_pTransportLayer->Poll (0, m_hConnection);
 }
 
 CSocket::~CSocket (void)
 {
 	assert (m_pTransportLayer != 0);
 
+	// a closing connection may live longer than a socket set, it has been polled in
+	Poll (0);
+
 	if (m_hConnection >= 0)
 	{
 		assert (m_nBackLog == 0);
@@ -118,6 +131,7 @@ int CSocket::Connect (const CIPAddress &rForeignIP, u16 nForeignPort)
 			return -1;
 		}
 
+		m_pTransportLayer->Poll (0, m_hConnection);
 		m_pTransportLayer->Disconnect (m_hConnection);
 		m_hConnection = -1;
 	}
@@ -219,6 +233,19 @@ CSocket *CSocket::Accept (CIPAddress *pForeignIP, u16 *pForeignPort)
 	m_hListenConnection[nIndex] = m_pTransportLayer->Listen (m_nOwnPort, m_nProtocol);
 	assert (m_hListenConnection[nIndex] >= 0);
 
+	if (   m_nRxBufferSize != 0
+	    || m_nTxBufferSize != 0)
+	{
+		m_pTransportLayer->SetOptionBufferSizes (m_nRxBufferSize, m_nTxBufferSize,
+							 m_hListenConnection[nIndex]);
+	}
+
+	if (m_pCongestionControl != 0)
+	{
+		m_pTransportLayer->SetOptionCongestionControl (m_pCongestionControl,
+							       m_hListenConnection[nIndex]);
+	}
+
 	return pNewSocket;
 }
 
@@ -252,6 +279,15 @@ int CSocket::Receive (void *pBuffer, unsigned nLength, int nFlags)
 	}
 	
 	assert (m_pTransportLayer != 0);
+	if (m_nProtocol == IPPROTO_UDP)
+	{
+		// datagrams may exceed a frame, receive them into the caller's buffer
+		assert (pBuffer != 0);
+		TSocketIOVec IOVec = {pBuffer, nLength};
+
+		return m_pTransportLayer->ReceiveMsg (&IOVec, 1, nFlags, m_hConnection);
+	}
+
 	u8 TempBuffer[FRAME_BUFFER_SIZE];
 	int nResult = m_pTransportLayer->Receive (TempBuffer, nFlags, m_hConnection);
 	if (nResult < 0)
@@ -313,6 +349,30 @@ int CSocket::ReceiveFrom (void *pBuffer, unsigned nLength, int nFlags,
 	}
 	
 	assert (m_pTransportLayer != 0);
+	if (m_nProtocol == IPPROTO_UDP)
+	{
+		// datagrams may exceed a frame, receive them into the caller's buffer
+		TSocketMessage Message;
+		assert (pBuffer != 0);
+		Message.pBuffer = pBuffer;
+		Message.nSize = nLength;
+
+		int nResult = m_pTransportLayer->ReceiveBatch (&Message, 1, nFlags, m_hConnection);
+		if (nResult <= 0)
+		{
+			return nResult;
+		}
+
+		if (   pForeignIP != 0
+		    && pForeignPort != 0)
+		{
+			pForeignIP->Set (Message.ForeignIP);
+			*pForeignPort = Message.nForeignPort;
+		}
+
+		return Message.nLength;
+	}
+
 	u8 TempBuffer[FRAME_BUFFER_SIZE];
 	int nResult = m_pTransportLayer->ReceiveFrom (TempBuffer, nFlags,
 						      pForeignIP, pForeignPort, m_hConnection);
@@ -332,6 +392,82 @@ int CSocket::ReceiveFrom (void *pBuffer, unsigned nLength, int nFlags,
 	return nResult;
 }
 
+int CSocket::SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (nIOVecCount == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pIOVec != 0);
+	return m_pTransportLayer->SendMsg (pIOVec, nIOVecCount, nFlags, m_hConnection);
+}
+
+int CSocket::ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	if (nIOVecCount == 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pIOVec != 0);
+	return m_pTransportLayer->ReceiveMsg (pIOVec, nIOVecCount, nFlags, m_hConnection);
+}
+
+int CSocket::SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags)
+{
+	if (   m_hConnection < 0
+	    || m_nProtocol != IPPROTO_UDP)
+	{
+		return -1;
+	}
+
+	if (nCount == 0)
+	{
+		return 0;
+	}
+
+	assert (m_pNetConfig != 0);
+	if (m_pNetConfig->GetIPAddress ()->IsNull ())		// from null source address
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pMessage != 0);
+	return m_pTransportLayer->SendBatch (pMessage, nCount, nFlags, m_hConnection);
+}
+
+int CSocket::ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags)
+{
+	if (   m_hConnection < 0
+	    || m_nProtocol != IPPROTO_UDP)
+	{
+		return -1;
+	}
+
+	if (nCount == 0)
+	{
+		return 0;
+	}
+
+	assert (m_pTransportLayer != 0);
+	assert (pMessage != 0);
+	return m_pTransportLayer->ReceiveBatch (pMessage, nCount, nFlags, m_hConnection);
+}
+
 int CSocket::SetOptionBroadcast (boolean bAllowed)
 {
 	if (m_hConnection < 0)
@@ -348,6 +484,132 @@ int CSocket::SetOptionBroadcast (boolean bAllowed)
 	return m_pTransportLayer->SetOptionBroadcast (bAllowed, m_hConnection);
 }
 
+int CSocket::SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize)
+{
+	if (m_nProtocol != IPPROTO_TCP)
+	{
+		return 0;
+	}
+
+	if (   m_hConnection < 0
+	    && m_nBackLog == 0)
+	{
+		return -1;
+	}
+
+	if (nRxBufferSize != 0)
+	{
+		m_nRxBufferSize = nRxBufferSize;
+	}
+
+	if (nTxBufferSize != 0)
+	{
+		m_nTxBufferSize = nTxBufferSize;
+	}
+
+	assert (m_pTransportLayer != 0);
+
+	if (m_hConnection >= 0)
+	{
+		return m_pTransportLayer->SetOptionBufferSizes (nRxBufferSize, nTxBufferSize,
+								m_hConnection);
+	}
+
+	// apply to the listening connections, accepted connections will inherit the sizes
+	for (unsigned i = 0; i < m_nBackLog; i++)
+	{
+		if (m_pTransportLayer->SetOptionBufferSizes (nRxBufferSize, nTxBufferSize,
+							     m_hListenConnection[i]) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int CSocket::SetOptionCongestionControl (const char *pAlgorithm)
+{
+	if (m_nProtocol != IPPROTO_TCP)
+	{
+		return 0;
+	}
+
+	if (   m_hConnection < 0
+	    && m_nBackLog == 0)
+	{
+		return -1;
+	}
+
+	assert (pAlgorithm != 0);
+	pAlgorithm = CTCPCongestionControl::FindAlgorithm (pAlgorithm);
+	if (pAlgorithm == 0)
+	{
+		return -1;
+	}
+
+	m_pCongestionControl = pAlgorithm;
+
+	assert (m_pTransportLayer != 0);
+
+	if (m_hConnection >= 0)
+	{
+		return m_pTransportLayer->SetOptionCongestionControl (pAlgorithm, m_hConnection);
+	}
+
+	// apply to the listening connections, accepted connections will inherit the algorithm
+	for (unsigned i = 0; i < m_nBackLog; i++)
+	{
+		if (m_pTransportLayer->SetOptionCongestionControl (pAlgorithm,
+								   m_hListenConnection[i]) < 0)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int CSocket::GetStatistics (TTCPStatistics *pStatistics)
+{
+	if (m_hConnection < 0)
+	{
+		return -1;
+	}
+
+	assert (m_pTransportLayer != 0);
+	return m_pTransportLayer->GetStatistics (pStatistics, m_hConnection);
+}
+
+unsigned CSocket::Poll (CSynchronizationEvent *pEvent)
+{
+	assert (m_pTransportLayer != 0);
+
+	if (m_nBackLog > 0)
+	{
+		// a listening socket is readable, if Accept() will not block
+		unsigned nEvents = 0;
+		for (unsigned i = 0; i < m_nBackLog; i++)
+		{
+			m_pTransportLayer->Poll (pEvent, m_hListenConnection[i]);
+
+			if (m_pTransportLayer->IsConnected (m_hListenConnection[i]))
+			{
+				nEvents |= POLLIN;
+			}
+		}
+
+		return nEvents;
+	}
+
+	if (m_hConnection < 0)
+	{
+		return 0;
+	}
+
+	return m_pTransportLayer->Poll (pEvent, m_hConnection);
+}
+
 const u8 *CSocket::GetForeignIP (void) const
 {
 	if (m_hConnection < 0)
@@ -0,0 +1,165 @@
+//
+// socketset.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/socketset.h>
+#include <circle/timer.h>
+#include <assert.h>
+
+CSocketSet::CSocketSet (unsigned nMaxSockets)
+:	m_nMaxSockets (nMaxSockets),
+	m_nSockets (0),
+	m_pEntry (new TEntry[nMaxSockets]),
+	m_pReady (new TEntry[nMaxSockets]),
+	m_nReady (0)
+{
+	assert (m_nMaxSockets > 0);
+	assert (m_pEntry != 0);
+	assert (m_pReady != 0);
+}
+
+CSocketSet::~CSocketSet (void)
+{
+	// the event must not be set by any connection any more
+	for (unsigned i = 0; i < m_nSockets; i++)
+	{
+		assert (m_pEntry[i].pSocket != 0);
+		m_pEntry[i].pSocket->Poll (0);
+	}
+
+	delete [] m_pReady;
+	m_pReady = 0;
+
+	delete [] m_pEntry;
+	m_pEntry = 0;
+}
+
+boolean CSocketSet::Add (CSocket *pSocket, unsigned nEvents)
+{
+	assert (pSocket != 0);
+	assert (m_pEntry != 0);
+
+	for (unsigned i = 0; i < m_nSockets; i++)
+	{
+		if (m_pEntry[i].pSocket == pSocket)
+		{
+			m_pEntry[i].nEvents = nEvents;
+
+			return TRUE;
+		}
+	}
+
+	if (m_nSockets >= m_nMaxSockets)
+	{
+		return FALSE;
+	}
+
+	m_pEntry[m_nSockets].pSocket = pSocket;
+	m_pEntry[m_nSockets].nEvents = nEvents;
+	m_nSockets++;
+
+	return TRUE;
+}
+
+void CSocketSet::Remove (CSocket *pSocket)
+{
+	assert (pSocket != 0);
+	assert (m_pEntry != 0);
+
+	for (unsigned i = 0; i < m_nSockets; i++)
+	{
+		if (m_pEntry[i].pSocket == pSocket)
+		{
+			pSocket->Poll (0);
+
+			m_pEntry[i] = m_pEntry[--m_nSockets];
+
+			return;
+		}
+	}
+}
+
+unsigned CSocketSet::GetCount (void) const
+{
+	return m_nSockets;
+}
+
+int CSocketSet::Wait (int nTimeoutMs)
+{
+	assert (m_pEntry != 0);
+	assert (m_pReady != 0);
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	while (1)
+	{
+		// cleared before polling, so that no state change can get lost
+		m_Event.Clear ();
+
+		m_nReady = 0;
+		for (unsigned i = 0; i < m_nSockets; i++)
+		{
+			const TEntry *pEntry = &m_pEntry[i];
+
+			assert (pEntry->pSocket != 0);
+			unsigned nEvents =   pEntry->pSocket->Poll (&m_Event)
+					   & (pEntry->nEvents | POLLERR | POLLHUP);
+			if (nEvents != 0)
+			{
+				m_pReady[m_nReady].pSocket = pEntry->pSocket;
+				m_pReady[m_nReady].nEvents = nEvents;
+				m_nReady++;
+			}
+		}
+
+		if (   m_nReady > 0
+		    || nTimeoutMs == 0)
+		{
+			return m_nReady;
+		}
+
+		if (nTimeoutMs < 0)
+		{
+			m_Event.Wait ();
+
+			continue;
+		}
+
+		unsigned nElapsedUs = CTimer::GetClockTicks () - nStartTicks;
+		if (nElapsedUs >= (unsigned) nTimeoutMs * 1000)
+		{
+			return 0;
+		}
+
+		m_Event.WaitWithTimeout ((unsigned) nTimeoutMs * 1000 - nElapsedUs);
+	}
+}
+
+CSocket *CSocketSet::GetReady (unsigned nIndex, unsigned *pEvents) const
+{
+	assert (nIndex < m_nReady);
+	assert (m_pReady != 0);
+	const TEntry *pEntry = &m_pReady[nIndex];
+
+	if (pEvents != 0)
+	{
+		*pEvents = pEntry->nEvents;
+	}
+
+	return pEntry->pSocket;
+}
@@ -0,0 +1,152 @@
+//
+// tcpcongestioncontrol.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpcongestioncontrol.h>
+#include <circle/net/tcpnewreno.h>
+#include <circle/net/tcpcubic.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define TCP_INITIAL_WINDOW_BYTES	4380		// RFC 5681 section 3.1
+
+#define min(n, m)	((n) <= (m) ? (n) : (m))
+#define max(n, m)	((n) >= (m) ? (n) : (m))
+
+enum TAlgorithm
+{
+	AlgorithmCubic,
+	AlgorithmNewReno,
+	AlgorithmUnknown
+};
+
+static const char *s_Algorithms[] =		// must match TAlgorithm
+{
+	"cubic",
+	"newreno"
+};
+
+CTCPCongestionControl::CTCPCongestionControl (void)
+:	m_nMSS (536),
+	m_nCongestionWindow (0),
+	m_nSlowStartThreshold (TCP_SSTHRESH_INFINITE)
+{
+}
+
+CTCPCongestionControl::~CTCPCongestionControl (void)
+{
+}
+
+void CTCPCongestionControl::Initialize (unsigned nMSS)
+{
+	assert (nMSS > 0);
+	m_nMSS = nMSS;
+
+	m_nCongestionWindow = min (4*nMSS, max (2*nMSS, TCP_INITIAL_WINDOW_BYTES));
+	m_nSlowStartThreshold = TCP_SSTHRESH_INFINITE;
+}
+
+void CTCPCongestionControl::Inherit (const CTCPCongestionControl *pPrevious)
+{
+	assert (pPrevious != 0);
+	m_nMSS = pPrevious->m_nMSS;
+	m_nCongestionWindow = pPrevious->m_nCongestionWindow;
+	m_nSlowStartThreshold = pPrevious->m_nSlowStartThreshold;
+}
+
+void CTCPCongestionControl::EnterRecovery (unsigned nFlightSize)
+{
+	m_nSlowStartThreshold = LossDetected (nFlightSize);
+
+	m_nCongestionWindow = m_nSlowStartThreshold + 3*m_nMSS;
+}
+
+void CTCPCongestionControl::DuplicateAck (void)
+{
+	m_nCongestionWindow += m_nMSS;
+}
+
+void CTCPCongestionControl::PartialAck (unsigned nBytesAcked)
+{
+	// RFC 6582 section 3.2 step 3
+	if (m_nCongestionWindow > nBytesAcked)
+	{
+		m_nCongestionWindow -= nBytesAcked;
+	}
+	else
+	{
+		m_nCongestionWindow = 0;
+	}
+
+	if (nBytesAcked >= m_nMSS)
+	{
+		m_nCongestionWindow += m_nMSS;
+	}
+
+	m_nCongestionWindow = max (m_nCongestionWindow, m_nMSS);
+}
+
+void CTCPCongestionControl::ExitRecovery (unsigned nFlightSize)
+{
+	// RFC 6582 section 3.2 step 3, option 1
+	m_nCongestionWindow = min (m_nSlowStartThreshold, max (nFlightSize, m_nMSS) + m_nMSS);
+}
+
+void CTCPCongestionControl::RetransmissionTimeout (unsigned nFlightSize)
+{
+	m_nSlowStartThreshold = LossDetected (nFlightSize);
+
+	m_nCongestionWindow = m_nMSS;		// loss window
+}
+
+CTCPCongestionControl *CTCPCongestionControl::Create (const char *pName)
+{
+	pName = FindAlgorithm (pName);
+	if (pName == s_Algorithms[AlgorithmCubic])
+	{
+		return new CTCPCubic;
+	}
+	else if (pName == s_Algorithms[AlgorithmNewReno])
+	{
+		return new CTCPNewReno;
+	}
+
+	return 0;
+}
+
+const char *CTCPCongestionControl::FindAlgorithm (const char *pName)
+{
+	assert (pName != 0);
+
+	for (unsigned i = 0; i < AlgorithmUnknown; i++)
+	{
+		if (strcmp (pName, s_Algorithms[i]) == 0)
+		{
+			return s_Algorithms[i];
+		}
+	}
+
+	return 0;
+}
+
+void CTCPCongestionControl::SlowStart (unsigned nBytesAcked)
+{
+	assert (m_nCongestionWindow < m_nSlowStartThreshold);
+
+	m_nCongestionWindow += min (nBytesAcked, 2*m_nMSS);
+}
@@ -1,19 +1,21 @@
 //
 // tcpconnection.cpp
 //
-// This implements RFC 793 with some changes in RFC 1122 and RFC 6298.
+// This implements RFC 793 with some changes in RFC 1122 and RFC 6298,
+// the Window Scale and Timestamps options (RFC 7323), SACK (RFC 2018)
+// and congestion control with fast retransmit and fast recovery
+// (RFC 5681, RFC 6582) using NewReno or CUBIC (RFC 9438).
 //
 // Non-implemented features:
-//	dynamic receive window
 //	URG flag and urgent pointer
 //	delayed ACK
-//	queueing out-of-order TCP segments
+//	D-SACK (RFC 2883)
 //	security/compartment
 //	precedence
 //	user timeout
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2024  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,10 +31,12 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/net/tcpconnection.h>
+#include <circle/net/netsubsystem.h>
 #include <circle/macros.h>
 #include <circle/util.h>
 #include <circle/logger.h>
 #include <circle/net/in.h>
+#include <circle/atomic.h>
 #include <assert.h>
 
 //#define TCP_DEBUG
@@ -43,11 +47,21 @@
 #define MSS_S				1480	// maximum segment size to be send to network layer
 
 #define TCP_CONFIG_MSS			(MSS_R - 20)
-#define TCP_CONFIG_WINDOW		(TCP_CONFIG_MSS * 10)
 
-#define TCP_CONFIG_RETRANS_BUFFER_SIZE	0x10000	// should be greater than maximum send window size
+#define TCP_CONFIG_RX_BUFFER_SIZE	0x10000	// default, determines the receive window
+#define TCP_MIN_RX_BUFFER_SIZE		(TCP_CONFIG_MSS * 2)
+#define TCP_MAX_RX_BUFFER_SIZE		0x40000	// m_RxQueue must be able to hold it in segments
+
+#define TCP_CONFIG_RETRANS_BUFFER_SIZE	0x10000	// default, should be greater than send window size
+#define TCP_MIN_RETRANS_BUFFER_SIZE	(FRAME_BUFFER_SIZE * 2)
+#define TCP_MAX_RETRANS_BUFFER_SIZE	0x100000
+
+#define TCP_MAX_WINDOW			((u16) -1)	// without Window Scale option
+#define TCP_CONFIG_WINDOW_SHIFT		3	// (TCP_MAX_WINDOW << 3) >= TCP_MAX_RX_BUFFER_SIZE
+#define TCP_MAX_WINDOW_SHIFT		14	// RFC 7323 section 2.3
+
+#define TCP_MAX_SACK_BLOCKS		4	// in one segment
 
-#define TCP_MAX_WINDOW			((u16) -1)	// without Window extension option
 #define TCP_QUIET_TIME			30	// seconds after crash before another connection starts
 
 #define HZ_TIMEWAIT			(60 * HZ)
@@ -90,12 +104,27 @@ struct TTCPOption
 #define TCP_OPTION_MSS		2	//	Maximum segment size (2 byte)
 #define TCP_OPTION_WINDOW_SCALE	3	//	Shift count (1 byte)
 #define TCP_OPTION_SACK_PERM	4	//	None
+#define TCP_OPTION_SACK		5	//	Left edge, right edge of blocks (n*2*4 byte)
 #define TCP_OPTION_TIMESTAMP	8	//	Timestamp value, Timestamp echo reply (2*4 byte)
 	u8	nLength;
 	u8	Data[];
 }
 PACKED;
 
+#define TCP_TIMESTAMP_OPTION_SIZE	12	// including two NOPs, sent in each segment
+
+struct TTCPOptions			// found in a received segment
+{
+	int	 nWindowShift;		// -1 if not present
+	boolean	 bSACKPermitted;
+	boolean	 bTimestamp;
+	u32	 nTSval;
+	u32	 nTSecr;
+	unsigned nSACKBlocks;
+	u32	 SACKLeft[TCP_MAX_SACK_BLOCKS];
+	u32	 SACKRight[TCP_MAX_SACK_BLOCKS];
+};
+
 #define min(n, m)		((n) <= (m) ? (n) : (m))
 #define max(n, m)		((n) >= (m) ? (n) : (m))
 
@@ -141,6 +170,20 @@ const char *CTCPConnection::s_pStateName[] =	// must match TTCPState
 
 static const char FromTCP[] = "tcp";
 
+static inline void PutOptionWord (u8 *pOption, u32 nValue)
+{
+	pOption[0] = nValue >> 24;
+	pOption[1] = (nValue >> 16) & 0xFF;
+	pOption[2] = (nValue >> 8) & 0xFF;
+	pOption[3] = nValue & 0xFF;
+}
+
+static inline u32 GetOptionWord (const u8 *pOption)
+{
+	return   (u32) pOption[0] << 24 | (u32) pOption[1] << 16
+	       | (u32) pOption[2] << 8  | pOption[3];
+}
+
 CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 				CNetworkLayer	*pNetworkLayer,
 				const CIPAddress &rForeignIP,
@@ -150,20 +193,51 @@ CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 	m_bActiveOpen (TRUE),
 	m_State (TCPStateClosed),
 	m_nErrno (0),
+	m_nRxQueueBytes (0),
+	m_nRxBufferSize (TCP_CONFIG_RX_BUFFER_SIZE),
+	m_bWindowUpdate (FALSE),
+	m_pRxBuffer (0),
+	m_pRxPartial (0),
+	m_nOutOfOrderSegments (0),
+	m_nLastOutOfOrderSequence (0),
 	m_RetransmissionQueue (TCP_CONFIG_RETRANS_BUFFER_SIZE),
+	m_nTxBufferSize (TCP_CONFIG_RETRANS_BUFFER_SIZE),
 	m_bRetransmit (FALSE),
 	m_bSendSYN (FALSE),
 	m_bFINQueued (FALSE),
 	m_nRetransmissionCount (0),
 	m_bTimedOut (FALSE),
 	m_pTimer (CTimer::Get ()),
-	m_nSND_WND (TCP_CONFIG_WINDOW),
+	m_nSND_WND (TCP_MAX_WINDOW),
 	m_nSND_UP (0),
 	m_nRCV_NXT (0),
-	m_nRCV_WND (TCP_CONFIG_WINDOW),
+	m_nRCV_WND (0),
 	m_nIRS (0),
+	m_nRCV_ADV (0),
+	m_bWindowScale (TRUE),		// offer all options
+	m_nSND_WND_SHIFT (0),
+	m_nRCV_WND_SHIFT (0),
+	m_bTimestamps (TRUE),
+	m_nTS_RECENT (0),
+	m_nLAST_ACK_SENT (0),
+	m_bSACKPermitted (TRUE),
+	m_nScoreboardBlocks (0),
+	m_bTimeoutRetransmit (FALSE),
+	m_pCongestionControl (CTCPCongestionControl::Create ()),
+	m_pCongestionControlRequest (0),
+	m_CongestionControlSpinLock (TASK_LEVEL),
+	m_nSND_MAX (0),
+	m_nDupAcks (0),
+	m_bInRecovery (FALSE),
+	m_nRecover (0),
+	m_nRetransmittedSegments (0),
+	m_nFastRetransmits (0),
+	m_nRetransmissionTimeouts (0),
 	m_nSND_MSS (536)	// RFC 1122 section 4.2.2.6
 {
+	assert (m_pCongestionControl != 0);
+	m_pCongestionControl->Initialize (m_nSND_MSS);
+
 	s_nConnections++;
 
 	for (unsigned nTimer = TCPTimerUser; nTimer < TCPTimerUnknown; nTimer++)
@@ -176,6 +250,7 @@ CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 
 	m_nSND_UNA = m_nISS;
 	m_nSND_NXT = m_nISS+1;
+	m_nSND_MAX = m_nSND_NXT;
 
 	if (SendSegment (TCP_FLAG_SYN, m_nISS))
 	{
@@ -193,20 +268,51 @@ CTCPConnection::CTCPConnection (CNetConfig	*pNetConfig,
 	m_bActiveOpen (FALSE),
 	m_State (TCPStateListen),
 	m_nErrno (0),
+	m_nRxQueueBytes (0),
+	m_nRxBufferSize (TCP_CONFIG_RX_BUFFER_SIZE),
+	m_bWindowUpdate (FALSE),
+	m_pRxBuffer (0),
+	m_pRxPartial (0),
+	m_nOutOfOrderSegments (0),
+	m_nLastOutOfOrderSequence (0),
 	m_RetransmissionQueue (TCP_CONFIG_RETRANS_BUFFER_SIZE),
+	m_nTxBufferSize (TCP_CONFIG_RETRANS_BUFFER_SIZE),
 	m_bRetransmit (FALSE),
 	m_bSendSYN (FALSE),
 	m_bFINQueued (FALSE),
 	m_nRetransmissionCount (0),
 	m_bTimedOut (FALSE),
 	m_pTimer (CTimer::Get ()),
-	m_nSND_WND (TCP_CONFIG_WINDOW),
+	m_nSND_WND (TCP_MAX_WINDOW),
 	m_nSND_UP (0),
 	m_nRCV_NXT (0),
-	m_nRCV_WND (TCP_CONFIG_WINDOW),
+	m_nRCV_WND (0),
 	m_nIRS (0),
+	m_nRCV_ADV (0),
+	m_bWindowScale (FALSE),		// set from received SYN
+	m_nSND_WND_SHIFT (0),
+	m_nRCV_WND_SHIFT (0),
+	m_bTimestamps (FALSE),
+	m_nTS_RECENT (0),
+	m_nLAST_ACK_SENT (0),
+	m_bSACKPermitted (FALSE),
+	m_nScoreboardBlocks (0),
+	m_bTimeoutRetransmit (FALSE),
+	m_pCongestionControl (CTCPCongestionControl::Create ()),
+	m_pCongestionControlRequest (0),
+	m_CongestionControlSpinLock (TASK_LEVEL),
+	m_nSND_MAX (0),
+	m_nDupAcks (0),
+	m_bInRecovery (FALSE),
+	m_nRecover (0),
+	m_nRetransmittedSegments (0),
+	m_nFastRetransmits (0),
+	m_nRetransmissionTimeouts (0),
 	m_nSND_MSS (536)	// RFC 1122 section 4.2.2.6
 {
+	assert (m_pCongestionControl != 0);
+	m_pCongestionControl->Initialize (m_nSND_MSS);
+
 	s_nConnections++;
 
 	for (unsigned nTimer = TCPTimerUser; nTimer < TCPTimerUnknown; nTimer++)
@@ -228,9 +334,20 @@ CTCPConnection::~CTCPConnection (void)
 		StopTimer (nTimer);
 	}
 
+	FlushOutOfOrderData ();
+
+	if (m_pRxPartial != 0)
+	{
+		m_pRxPartial->Release ();
+		m_pRxPartial = 0;
+	}
+
+	delete m_pCongestionControl;
+	m_pCongestionControl = 0;
+
 	// ensure no task is waiting any more
-	m_Event.Set ();
-	m_TxEvent.Set ();
+	SetEvent ();
+	SetTxEvent ();
 
 	assert (s_nConnections > 0);
 	s_nConnections--;
@@ -253,6 +370,7 @@ int CTCPConnection::Connect (void)
 	case TCPStateSynSent:
 	case TCPStateSynReceived:
 		m_Event.Clear ();
+		RequestProcess ();				// send SYN
 		m_Event.Wait ();
 		break;
 
@@ -360,6 +478,8 @@ int CTCPConnection::Close (void)
 		return -1;
 	}
 
+	RequestProcess ();				// send FIN
+
 	if (m_nErrno < 0)
 	{
 		return m_nErrno;
@@ -369,6 +489,22 @@ int CTCPConnection::Close (void)
 }
 
 int CTCPConnection::Send (const void *pData, unsigned nLength, int nFlags)
+{
+	assert (pData != 0);
+	TSocketIOVec IOVec = {(void *) pData, nLength};
+
+	return SendMsg (&IOVec, 1, nFlags);
+}
+
+int CTCPConnection::Receive (void *pBuffer, int nFlags)
+{
+	assert (pBuffer != 0);
+	TSocketIOVec IOVec = {pBuffer, FRAME_BUFFER_SIZE};
+
+	return ReceiveMsg (&IOVec, 1, nFlags);
+}
+
+int CTCPConnection::SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
 {
 	if (   nFlags != 0
 	    && nFlags != MSG_DONTWAIT)
@@ -398,28 +534,103 @@ int CTCPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 	case TCPStateCloseWait:
 		break;
 	}
-	
+
+	assert (pIOVec != 0);
+	unsigned nLength = 0;
+	for (unsigned i = 0; i < nIOVecCount; i++)
+	{
+		nLength += pIOVec[i].nLength;
+	}
+
 	unsigned nResult = nLength;
 
-	assert (pData != 0);
-	u8 *pBuffer = (u8 *) pData;
+	// position in pIOVec[] of the next frame
+	unsigned nVec = 0;
+	unsigned nOffset = 0;
+
+	u8 TempBuffer[FRAME_BUFFER_SIZE];
 
-	while (nLength > FRAME_BUFFER_SIZE)
+	while (nLength > 0)
 	{
-		m_TxQueue.Enqueue (pBuffer, FRAME_BUFFER_SIZE);
+		unsigned nFrameLength = nLength < FRAME_BUFFER_SIZE ? nLength : FRAME_BUFFER_SIZE;
+
+		unsigned nNextVec = nVec;
+		unsigned nNextOffset = nOffset;
+		while (nNextOffset == pIOVec[nNextVec].nLength)
+		{
+			nNextVec++;
+			nNextOffset = 0;
+		}
+
+		// frames, which are contiguous in one buffer, are enqueued directly
+		const u8 *pFrame = (const u8 *) pIOVec[nNextVec].pBuffer + nNextOffset;
+		if (pIOVec[nNextVec].nLength - nNextOffset >= nFrameLength)
+		{
+			nNextOffset += nFrameLength;
+		}
+		else
+		{
+			// gather the frame from several buffers
+			for (unsigned nCopied = 0; nCopied < nFrameLength; )
+			{
+				while (nNextOffset == pIOVec[nNextVec].nLength)
+				{
+					nNextVec++;
+					nNextOffset = 0;
+				}
+
+				unsigned nChunk = pIOVec[nNextVec].nLength - nNextOffset;
+				if (nChunk > nFrameLength - nCopied)
+				{
+					nChunk = nFrameLength - nCopied;
+				}
+
+				assert (pIOVec[nNextVec].pBuffer != 0);
+				memcpy (TempBuffer + nCopied,
+					(const u8 *) pIOVec[nNextVec].pBuffer + nNextOffset, nChunk);
+
+				nNextOffset += nChunk;
+				nCopied += nChunk;
+			}
+
+			pFrame = TempBuffer;
+		}
+
+		if (!m_TxQueue.Enqueue (pFrame, nFrameLength))
+		{
+			// queue is full
+			if (nFlags & MSG_DONTWAIT)
+			{
+				RequestProcess ();
+
+				return nResult - nLength;
+			}
+
+			m_TxEvent.Clear ();
+			RequestProcess ();
+			m_TxEvent.Wait ();
+
+			if (m_nErrno < 0)
+			{
+				return m_nErrno;
+			}
+
+			continue;
+		}
 
-		pBuffer += FRAME_BUFFER_SIZE;
-		nLength -= FRAME_BUFFER_SIZE;
+		nVec = nNextVec;
+		nOffset = nNextOffset;
+		nLength -= nFrameLength;
 	}
 
-	if (nLength > 0)
+	if (nFlags & MSG_DONTWAIT)
 	{
-		m_TxQueue.Enqueue (pBuffer, nLength);
+		RequestProcess ();
 	}
-
-	if (!(nFlags & MSG_DONTWAIT))
+	else
 	{
 		m_TxEvent.Clear ();
+		RequestProcess ();
 		m_TxEvent.Wait ();
 
 		if (m_nErrno < 0)
@@ -431,7 +642,7 @@ int CTCPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 	return nResult;
 }
 
-int CTCPConnection::Receive (void *pBuffer, int nFlags)
+int CTCPConnection::ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
 {
 	if (   nFlags != 0
 	    && nFlags != MSG_DONTWAIT)
@@ -445,7 +656,7 @@ int CTCPConnection::Receive (void *pBuffer, int nFlags)
 	}
 	
 	unsigned nLength;
-	while ((nLength = m_RxQueue.Dequeue (pBuffer)) == 0)
+	while ((nLength = DequeueReceivedData (pIOVec, nIOVecCount)) == 0)
 	{
 		switch (m_State)
 		{
@@ -479,6 +690,15 @@ int CTCPConnection::Receive (void *pBuffer, int nFlags)
 		}
 	}
 
+	AtomicSub (&m_nRxQueueBytes, nLength);
+
+	// let the net task re-open the window, if it has been reduced considerably
+	if (m_nRCV_WND < m_nRxBufferSize / 2)
+	{
+		m_bWindowUpdate = TRUE;
+		RequestProcess ();
+	}
+
 	return nLength;
 }
 
@@ -512,6 +732,59 @@ int CTCPConnection::SetOptionBroadcast (boolean bAllowed)
 	return 0;
 }
 
+int CTCPConnection::SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize)
+{
+	if (nRxBufferSize != 0)
+	{
+		nRxBufferSize = max (nRxBufferSize, TCP_MIN_RX_BUFFER_SIZE);
+		m_nRxBufferSize = min (nRxBufferSize, TCP_MAX_RX_BUFFER_SIZE);
+		m_bWindowUpdate = TRUE;
+	}
+
+	if (nTxBufferSize != 0)
+	{
+		nTxBufferSize = max (nTxBufferSize, TCP_MIN_RETRANS_BUFFER_SIZE);
+		m_nTxBufferSize = min (nTxBufferSize, TCP_MAX_RETRANS_BUFFER_SIZE);
+	}
+
+	RequestProcess ();				// apply the sizes
+
+	return 0;
+}
+
+int CTCPConnection::SetOptionCongestionControl (const char *pAlgorithm)
+{
+	assert (pAlgorithm != 0);
+	m_pCongestionControlRequest = pAlgorithm;
+
+	RequestProcess ();				// apply the algorithm
+
+	return 0;
+}
+
+int CTCPConnection::GetStatistics (TTCPStatistics *pStatistics)
+{
+	assert (pStatistics != 0);
+
+	m_CongestionControlSpinLock.Acquire ();
+
+	assert (m_pCongestionControl != 0);
+	pStatistics->pCongestionControl = m_pCongestionControl->GetName ();
+	pStatistics->nCongestionWindow = m_pCongestionControl->GetWindow ();
+	pStatistics->nSlowStartThreshold = m_pCongestionControl->GetSlowStartThreshold ();
+
+	m_CongestionControlSpinLock.Release ();
+
+	pStatistics->nSendWindow = m_nSND_WND;
+	pStatistics->nFlightSize = m_nSND_NXT-m_nSND_UNA;
+	pStatistics->nRTO = m_RTOCalculator.GetRTO ();
+	pStatistics->nRetransmittedSegments = m_nRetransmittedSegments;
+	pStatistics->nFastRetransmits = m_nFastRetransmits;
+	pStatistics->nRetransmissionTimeouts = m_nRetransmissionTimeouts;
+
+	return 0;
+}
+
 boolean CTCPConnection::IsConnected (void) const
 {
 	return     m_State > TCPStateSynSent
@@ -523,16 +796,104 @@ boolean CTCPConnection::IsTerminated (void) const
 	return m_State == TCPStateClosed;
 }
 
+boolean CTCPConnection::IsWildcard (void) const
+{
+	return m_State == TCPStateListen;
+}
+
+unsigned CTCPConnection::GetPollEvents (void) const
+{
+	unsigned nEvents = 0;
+
+	if (   m_pRxPartial != 0
+	    || !m_RxQueue.IsEmpty ())
+	{
+		nEvents |= POLLIN;
+	}
+
+	switch (m_State)
+	{
+	case TCPStateListen:
+	case TCPStateSynSent:
+	case TCPStateSynReceived:
+		break;
+
+	case TCPStateEstablished:
+		if (m_TxQueue.IsEmpty ())
+		{
+			nEvents |= POLLOUT;
+		}
+		break;
+
+	case TCPStateCloseWait:
+		if (m_TxQueue.IsEmpty ())
+		{
+			nEvents |= POLLOUT;
+		}
+		// fall through
+
+	case TCPStateClosed:
+	case TCPStateFinWait1:
+	case TCPStateFinWait2:
+	case TCPStateClosing:
+	case TCPStateLastAck:
+	case TCPStateTimeWait:
+		nEvents |= POLLIN | POLLHUP;	// Receive() does not block any more
+		break;
+	}
+
+	if (m_nErrno < 0)
+	{
+		nEvents |= POLLERR;
+	}
+
+	return nEvents;
+}
+
 void CTCPConnection::Process (void)
 {
 	if (m_bTimedOut)
 	{
 		m_nErrno = -1;
 		NEW_STATE (TCPStateClosed);
-		m_Event.Set ();
+		SetEvent ();
 		return;
 	}
 
+	if (m_bWindowUpdate)
+	{
+		m_bWindowUpdate = FALSE;
+
+		if (   (   m_State == TCPStateEstablished
+			|| m_State == TCPStateFinWait1
+			|| m_State == TCPStateFinWait2)
+		    && UpdateReceiveWindow ())
+		{
+			SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+		}
+	}
+
+	const char *pAlgorithm = m_pCongestionControlRequest;
+	if (pAlgorithm != 0)
+	{
+		m_pCongestionControlRequest = 0;
+
+		CTCPCongestionControl *pCongestionControl = CTCPCongestionControl::Create (pAlgorithm);
+		if (pCongestionControl != 0)
+		{
+			// the new algorithm continues with the current window
+			assert (m_pCongestionControl != 0);
+			pCongestionControl->Inherit (m_pCongestionControl);
+
+			m_CongestionControlSpinLock.Acquire ();
+
+			delete m_pCongestionControl;
+			m_pCongestionControl = pCongestionControl;
+
+			m_CongestionControlSpinLock.Release ();
+		}
+	}
+
 	switch (m_State)
 	{
 	case TCPStateClosed:
@@ -571,6 +932,7 @@ void CTCPConnection::Process (void)
 			SendSegment (TCP_FLAG_FIN | TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 			m_RTOCalculator.SegmentSent (m_nSND_NXT);
 			m_nSND_NXT++;
+			m_nSND_MAX = m_nSND_NXT;
 			NEW_STATE (m_StateAfterFIN);
 			m_bFINQueued = FALSE;
 			StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
@@ -578,6 +940,13 @@ void CTCPConnection::Process (void)
 		break;
 	}
 
+	// apply new send buffer size, when there is no unacknowledged data
+	if (   m_nTxBufferSize != m_RetransmissionQueue.GetSize ()
+	    && m_RetransmissionQueue.IsEmpty ())
+	{
+		m_RetransmissionQueue.SetSize (m_nTxBufferSize);
+	}
+
 	u8 TempBuffer[FRAME_BUFFER_SIZE];
 	unsigned nLength;
 	while (    m_RetransmissionQueue.GetFreeSpace () >= FRAME_BUFFER_SIZE
@@ -595,7 +964,7 @@ void CTCPConnection::Process (void)
 		|| m_State == TCPStateCloseWait)
 	    && m_TxQueue.IsEmpty ())
 	{
-		m_TxEvent.Set ();
+		SetTxEvent ();
 	}
 
 	if (m_bRetransmit)
@@ -604,17 +973,70 @@ void CTCPConnection::Process (void)
 		CLogger::Get ()->Write (FromTCP, LogDebug, "Retransmission (nxt %u, una %u)", m_nSND_NXT-m_nISS, m_nSND_UNA-m_nISS);
 #endif
 		m_bRetransmit = FALSE;
+		m_nRetransmissionTimeouts++;
+
+		assert (m_pCongestionControl != 0);
+		m_pCongestionControl->RetransmissionTimeout (m_nSND_MAX-m_nSND_UNA);
+		m_bInRecovery = FALSE;
+		m_nDupAcks = 0;
+		m_nRecover = m_nSND_MAX;		// RFC 6582 section 3.2 step 4
+
+		// the receiver may have discarded SACKed data (RFC 2018 section 8),
+		// if the last go-back-N did not help
+		if (m_bTimeoutRetransmit)
+		{
+			m_nScoreboardBlocks = 0;
+		}
+
+		m_bTimeoutRetransmit = TRUE;
+
 		m_RetransmissionQueue.Reset ();
 		m_nSND_NXT = m_nSND_UNA;
 	}
 
+	unsigned nMSS = GetSendMSS ();
+
+	// the congestion window limits the usable send window
+	assert (m_pCongestionControl != 0);
+	u32 nWindow = min (m_nSND_WND, m_pCongestionControl->GetWindow ());
+
 	u32 nBytesAvail;
-	u32 nWindowLeft;
 	while (   (nBytesAvail = m_RetransmissionQueue.GetBytesAvailable ()) > 0
-	       && (nWindowLeft = m_nSND_UNA+m_nSND_WND-m_nSND_NXT) > 0)
+	       && lt (m_nSND_NXT, m_nSND_UNA+nWindow))
 	{
-		nLength = min (nBytesAvail, nWindowLeft);
-		nLength = min (nLength, m_nSND_MSS);
+		// skip data, which has been SACKed by the receiver, on retransmission
+		u32 nSendEnd = m_nSND_NXT+nBytesAvail;
+		for (unsigned i = 0; i < m_nScoreboardBlocks; i++)
+		{
+			if (le (m_Scoreboard[i].nRight, m_nSND_NXT))
+			{
+				continue;
+			}
+
+			if (gt (m_Scoreboard[i].nLeft, m_nSND_NXT))
+			{
+				nSendEnd = m_Scoreboard[i].nLeft;	// send up to the next block
+
+				break;
+			}
+
+			unsigned nSkip = m_Scoreboard[i].nRight-m_nSND_NXT;
+			assert (nSkip <= nBytesAvail);
+			m_RetransmissionQueue.Skip (nSkip);
+			m_nSND_NXT += nSkip;
+			nBytesAvail -= nSkip;
+		}
+
+		if (   nBytesAvail == 0
+		    || !lt (m_nSND_NXT, m_nSND_UNA+nWindow))
+		{
+			break;
+		}
+
+		u32 nWindowLeft = m_nSND_UNA+nWindow-m_nSND_NXT;
+
+		nLength = min (nSendEnd-m_nSND_NXT, nWindowLeft);
+		nLength = min (nLength, nMSS);
 
 #ifdef TCP_DEBUG
 		CLogger::Get ()->Write (FromTCP, LogDebug, "Transfering %u bytes into TX buffer", nLength);
@@ -633,9 +1055,35 @@ void CTCPConnection::Process (void)
 		m_RTOCalculator.SegmentSent (m_nSND_NXT, nLength);
 		m_nSND_NXT += nLength;
 		StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
+
+		if (gt (m_nSND_NXT, m_nSND_MAX))
+		{
+			m_nSND_MAX = m_nSND_NXT;
+		}
+		else
+		{
+			m_nRetransmittedSegments++;
+		}
 	}
 }
 
+int CTCPConnection::PacketReceived (CNetBuffer	*pBuffer,
+				    CIPAddress	&rSenderIP,
+				    CIPAddress	&rReceiverIP,
+				    int		 nProtocol)
+{
+	assert (pBuffer != 0);
+	assert (m_pRxBuffer == 0);
+	m_pRxBuffer = pBuffer;
+
+	int nResult = PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
+				      rSenderIP, rReceiverIP, nProtocol);
+
+	m_pRxBuffer = 0;
+
+	return nResult;
+}
+
 int CTCPConnection::PacketReceived (const void	*pPacket,
 				    unsigned	 nLength,
 				    CIPAddress	&rSenderIP,
@@ -678,7 +1126,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		m_Checksum.SetDestinationAddress (rSenderIP);
 	}
 
-	if (m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
+	if (!m_Checksum.IsValid (pPacket, nLength, m_pRxBuffer))
 	{
 		return 0;
 	}
@@ -702,10 +1150,15 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 	}
 	
 	u32 nSEG_WND = be2le16 (pHeader->nWindow);
+	if (!(nFlags & TCP_FLAG_SYN))		// window in SYN segment is never scaled
+	{
+		nSEG_WND <<= m_nSND_WND_SHIFT;
+	}
 	//u16 nSEG_UP  = be2le16 (pHeader->nUrgentPointer);
 	//u32 nSEG_PRC;	// segment precedence value
 
-	ScanOptions (pHeader);
+	TTCPOptions Options;
+	ScanOptions (pHeader, &Options);
 
 #ifdef TCP_DEBUG
 	CLogger::Get ()->Write (FromTCP, LogDebug,
@@ -725,6 +1178,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 #endif
 
 	boolean bAcceptable = FALSE;
+	boolean bRetransmitFirst = FALSE;	// on fast retransmit or partial ACK
 
 	// RFC 793 section 3.9 "SEGMENT ARRIVES"
 	switch (m_State)
@@ -779,8 +1233,11 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			}
 
 			m_nRCV_NXT = nSEG_SEQ+1;
+			m_nRCV_ADV = m_nRCV_NXT;
 			m_nIRS = nSEG_SEQ;
 
+			NegotiateOptions (&Options);
+
 			m_nSND_WND = nSEG_WND;
 			m_nSND_WL1 = nSEG_SEQ;
 			m_nSND_WL2 = nSEG_ACK;
@@ -789,7 +1246,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 
 			if (nDataLength > 0)
 			{
-				m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+				QueueReceivedData ((u8 *) pPacket+nDataOffset, nDataLength);
 			}
 
 			m_nISS = CalculateISN ();
@@ -803,11 +1260,12 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			m_RTOCalculator.SegmentSent (m_nISS);
 
 			m_nSND_NXT = m_nISS+1;
+			m_nSND_MAX = m_nSND_NXT;
 			m_nSND_UNA = m_nISS;
 			
 			NEW_STATE (TCPStateSynReceived);
 
-			m_Event.Set ();
+			SetEvent ();
 		}
 		break;
 
@@ -837,7 +1295,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				m_bSendSYN = FALSE;
 				m_nErrno = -1;
 
-				m_Event.Set ();
+				SetEvent ();
 			}
 			
 			break;
@@ -852,8 +1310,11 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		if (nFlags & TCP_FLAG_SYN)
 		{
 			m_nRCV_NXT = nSEG_SEQ+1;
+			m_nRCV_ADV = m_nRCV_NXT;
 			m_nIRS = nSEG_SEQ;
 
+			NegotiateOptions (&Options);
+
 			if (nFlags & TCP_FLAG_ACK)
 			{
 				m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
@@ -871,12 +1332,14 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				NEW_STATE (TCPStateEstablished);
 				m_bSendSYN = FALSE;
 
+				StartCongestionControl ();
+
 				StopTimer (TCPTimerRetransmission);
 
 				// next transmission starts with this count
 				m_nRetransmissionCount = MAX_RETRANSMISSIONS;
 
-				m_Event.Set ();
+				SetEvent ();
 
 				// RFC 1122 section 4.2.2.20 (c)
 				m_nSND_WND = nSEG_WND;
@@ -910,12 +1373,12 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 						SendSegment (TCP_FLAG_RESET, m_nSND_NXT);
 						NEW_STATE (TCPStateClosed);
 						m_nErrno = -1;
-						m_Event.Set ();
+						SetEvent ();
 					}
 
 					if (nDataLength > 0)
 					{
-						m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+						QueueReceivedData ((u8 *) pPacket+nDataOffset, nDataLength);
 					}
 
 					break;
@@ -932,6 +1395,20 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 	case TCPStateClosing:
 	case TCPStateLastAck:
 	case TCPStateTimeWait:
+		// PAWS (RFC 7323 section 5.3 R1)
+		if (   m_bTimestamps
+		    && Options.bTimestamp
+		    && !(nFlags & TCP_FLAG_RESET)
+		    && lt (Options.nTSval, m_nTS_RECENT))
+		{
+			if (m_State != TCPStateSynReceived)
+			{
+				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
+			}
+
+			break;
+		}
+
 		// step 1 ( check sequence number)
 		if (m_nRCV_WND > 0)
 		{
@@ -969,6 +1446,14 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			break;
 		}
 
+		// RFC 7323 section 4.3 (2)
+		if (   m_bTimestamps
+		    && Options.bTimestamp
+		    && le (nSEG_SEQ, m_nLAST_ACK_SENT))
+		{
+			m_nTS_RECENT = Options.nTSval;
+		}
+
 		// step 2 (check RST bit)
 		if (nFlags & TCP_FLAG_RESET)
 		{
@@ -985,7 +1470,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				{
 					m_nErrno = -1;
 					NEW_STATE (TCPStateClosed);
-					m_Event.Set ();
+					SetEvent ();
 					return 1;
 					
 				}
@@ -999,15 +1484,16 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 				m_RetransmissionQueue.Flush ();
 				m_TxQueue.Flush ();
 				m_RxQueue.Flush ();
+				FlushOutOfOrderData ();
 				NEW_STATE (TCPStateClosed);
-				m_Event.Set ();
+				SetEvent ();
 				return 1;
 
 			case TCPStateClosing:
 			case TCPStateLastAck:
 			case TCPStateTimeWait:
 				NEW_STATE (TCPStateClosed);
-				m_Event.Set ();
+				SetEvent ();
 				return 1;
 
 			default:
@@ -1034,8 +1520,9 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			m_RetransmissionQueue.Flush ();
 			m_TxQueue.Flush ();
 			m_RxQueue.Flush ();
+			FlushOutOfOrderData ();
 			NEW_STATE (TCPStateClosed);
-			m_Event.Set ();
+			SetEvent ();
 			return 1;
 		}
 
@@ -1061,6 +1548,8 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 
 				NEW_STATE (TCPStateEstablished);
 
+				StartCongestionControl ();
+
 				// next transmission starts with this count
 				m_nRetransmissionCount = MAX_RETRANSMISSIONS;
 			}
@@ -1075,12 +1564,50 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		case TCPStateFinWait2:
 		case TCPStateCloseWait:
 		case TCPStateClosing:
-			if (bwh (m_nSND_UNA, nSEG_ACK, m_nSND_NXT))
+			if (bwh (m_nSND_UNA, nSEG_ACK, m_nSND_MAX))
 			{
-				m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				if (gt (nSEG_ACK, m_nSND_NXT))
+				{
+					// data sent before go-back-N has arrived, do not send it again
+					m_RetransmissionQueue.Skip (nSEG_ACK-m_nSND_NXT);
+					m_nSND_NXT = nSEG_ACK;
+				}
+
+				if (   m_bTimestamps
+				    && Options.bTimestamp
+				    && Options.nTSecr != 0)
+				{
+					assert (m_pTimer != 0);
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK,
+									     m_pTimer->GetTicks ()-Options.nTSecr);
+				}
+				else
+				{
+					m_RTOCalculator.SegmentAcknowledged (nSEG_ACK);
+				}
 
 				unsigned nBytesAck = nSEG_ACK-m_nSND_UNA;
+				unsigned nFlightSize = m_nSND_NXT-m_nSND_UNA;
 				m_nSND_UNA = nSEG_ACK;
+				m_bTimeoutRetransmit = FALSE;
+
+				assert (m_pCongestionControl != 0);
+				if (!m_bInRecovery)
+				{
+					m_pCongestionControl->DataAcknowledged (nBytesAck, nFlightSize);
+				}
+				else if (ge (nSEG_ACK, m_nRecover))	// full ACK (RFC 6582 section 3.2)
+				{
+					m_pCongestionControl->ExitRecovery (m_nSND_NXT-m_nSND_UNA);
+					m_bInRecovery = FALSE;
+				}
+				else					// partial ACK
+				{
+					m_pCongestionControl->PartialAck (nBytesAck);
+					bRetransmitFirst = TRUE;
+				}
+
+				m_nDupAcks = 0;
 
 				if (nSEG_ACK == m_nSND_NXT)	// all segments are acknowledged
 				{
@@ -1120,7 +1647,30 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			}
 			else if (le (nSEG_ACK, m_nSND_UNA))	// RFC 1122 section 4.2.2.20 (g)
 			{
-				// ignore duplicate ACK ...
+				// ignore duplicate ACK, but count it for fast retransmit (RFC 5681 section 2) ...
+				if (   nSEG_ACK == m_nSND_UNA
+				    && nSEG_LEN == 0
+				    && nSEG_WND == m_nSND_WND
+				    && m_nSND_MAX != m_nSND_UNA
+				    && (   m_State == TCPStateEstablished
+					|| m_State == TCPStateCloseWait))
+				{
+					assert (m_pCongestionControl != 0);
+					if (m_bInRecovery)
+					{
+						m_pCongestionControl->DuplicateAck ();
+					}
+					else if (   ++m_nDupAcks == 3
+						 && gt (nSEG_ACK, m_nRecover))	// RFC 6582 section 3.2
+					{
+						m_pCongestionControl->EnterRecovery (m_nSND_MAX-m_nSND_UNA);
+						m_bInRecovery = TRUE;
+						m_nRecover = m_nSND_MAX;
+
+						m_nFastRetransmits++;
+						bRetransmitFirst = TRUE;
+					}
+				}
 				
 				// RFC 1122 section 4.2.2.20 (g)
 				if (bwlh (m_nSND_UNA, nSEG_ACK, m_nSND_NXT))
@@ -1136,11 +1686,24 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 					}
 				}
 			}
-			else if (gt (nSEG_ACK, m_nSND_NXT))
+			else if (gt (nSEG_ACK, m_nSND_MAX))
 			{
 				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 				return 1;
 			}
+
+			if (m_bSACKPermitted)
+			{
+				UpdateScoreboard (&Options);
+			}
+
+			// the retransmission is clipped at the first SACKed block
+			if (   bRetransmitFirst
+			    && (   m_State == TCPStateEstablished
+				|| m_State == TCPStateCloseWait))
+			{
+				RetransmitFirstSegment ();
+			}
 			
 			switch (m_State)
 			{
@@ -1167,7 +1730,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			case TCPStateFinWait2:
 				if (m_RetransmissionQueue.IsEmpty ())
 				{
-					m_Event.Set ();
+					SetEvent ();
 				}
 				break;
 				
@@ -1194,7 +1757,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 			{
 				m_bFINQueued = FALSE;
 				NEW_STATE (TCPStateClosed);
-				m_Event.Set ();
+				SetEvent ();
 				return 1;
 			}
 			break;
@@ -1226,32 +1789,65 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		{
 		case TCPStateEstablished:
 		case TCPStateFinWait1:
-		case TCPStateFinWait2:
-			if (nSEG_SEQ == m_nRCV_NXT)
+		case TCPStateFinWait2: {
+			u32 nDataSEQ = nFlags & TCP_FLAG_SYN ? nSEG_SEQ+1 : nSEG_SEQ;
+			u8 *pData = (u8 *) pPacket+nDataOffset;
+
+			// cut off data, which has been received before
+			if (   nDataLength > 0
+			    && lt (nDataSEQ, m_nRCV_NXT)
+			    && m_nRCV_NXT-nDataSEQ <= nDataLength)
 			{
-				if (nDataLength > 0)
-				{
-					m_RxQueue.Enqueue ((u8 *) pPacket+nDataOffset, nDataLength);
+				pData += m_nRCV_NXT-nDataSEQ;
+				nDataLength -= m_nRCV_NXT-nDataSEQ;
+				nDataSEQ = m_nRCV_NXT;
+			}
+
+			if (nDataSEQ == m_nRCV_NXT)
+			{
+				if (nDataLength > 0)
+				{
+					if (!QueueReceivedData (pData, nDataLength))
+					{
+						// drop segment, will be retransmitted, when user has read data
+						SetEvent ();
+
+						return 1;
+					}
 
 					m_nRCV_NXT += nDataLength;
 
-					// m_nRCV_WND should be adjusted here (section 3.7)
+					// the gap may be filled now
+					boolean bGapFilled = m_nOutOfOrderSegments > 0;
+					if (bGapFilled)
+					{
+						DequeueOutOfOrderData ();
+					}
 
 					// following ACK could be piggybacked with data
 					SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 
-					if (nFlags & TCP_FLAG_PUSH)
+					if (   (nFlags & TCP_FLAG_PUSH)
+					    || bGapFilled)
 					{
-						m_Event.Set ();
+						SetEvent ();
 					}
 				}
 			}
 			else
 			{
+				if (   nDataLength > 0
+				    && gt (nDataSEQ, m_nRCV_NXT)
+				    && !(nFlags & TCP_FLAG_FIN))
+				{
+					QueueOutOfOrderData (nDataSEQ, pData, nDataLength);
+				}
+
+				// duplicate ACK, reports the received data in SACK blocks
 				SendSegment (TCP_FLAG_ACK, m_nSND_NXT, m_nRCV_NXT);
 				return 1;
 			}
-			break;
+			} break;
 
 		case TCPStateSynReceived:	// this state not in RFC 793
 		case TCPStateCloseWait:
@@ -1287,7 +1883,7 @@ int CTCPConnection::PacketReceived (const void	*pPacket,
 		case TCPStateSynReceived:
 		case TCPStateEstablished:
 			NEW_STATE (TCPStateCloseWait);
-			m_Event.Set ();
+			SetEvent ();
 			break;
 
 		case TCPStateFinWait1:
@@ -1367,7 +1963,7 @@ int CTCPConnection::NotificationReceived (TICMPNotificationType  Type,
 	NEW_STATE (TCPStateTimeWait);
 	StartTimer (TCPTimerTimeWait, HZ_TIMEWAIT);
 
-	m_Event.Set ();
+	SetEvent ();
 
 	return 1;
 }
@@ -1375,47 +1971,132 @@ int CTCPConnection::NotificationReceived (TICMPNotificationType  Type,
 boolean CTCPConnection::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAcknowledgmentNumber,
 				     const void *pData, unsigned nDataLength)
 {
-	unsigned nDataOffset = 5;
-	assert (nDataOffset * 4 == sizeof (TTCPHeader));
+	u8 TxBuffer[FRAME_BUFFER_SIZE];
+	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
+
+	u32 nWindow = 0;
+	if (!(nFlags & TCP_FLAG_RESET))
+	{
+		UpdateReceiveWindow ();
+
+		if (nFlags & TCP_FLAG_SYN)
+		{
+			nWindow = min (m_nRCV_WND, TCP_MAX_WINDOW);	// never scaled
+		}
+		else
+		{
+			nWindow = min (m_nRCV_WND >> m_nRCV_WND_SHIFT, TCP_MAX_WINDOW);
+		}
+	}
+
+	// options are padded with NOPs to 32-bit boundaries
+	u8 *pOption = (u8 *) pHeader->Options;
 	if (nFlags & TCP_FLAG_SYN)
 	{
-		nDataOffset++;
+		*pOption++ = TCP_OPTION_MSS;
+		*pOption++ = 4;
+		*pOption++ = TCP_CONFIG_MSS >> 8;
+		*pOption++ = TCP_CONFIG_MSS & 0xFF;
+
+		if (m_bWindowScale)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_WINDOW_SCALE;
+			*pOption++ = 3;
+			*pOption++ = TCP_CONFIG_WINDOW_SHIFT;
+		}
+
+		if (m_bSACKPermitted)
+		{
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_NOP;
+			*pOption++ = TCP_OPTION_SACK_PERM;
+			*pOption++ = 2;
+		}
+	}
+
+	unsigned nMaxSACKBlocks = TCP_MAX_SACK_BLOCKS;
+	if (   m_bTimestamps
+	    && !(nFlags & TCP_FLAG_RESET))
+	{
+		assert (m_pTimer != 0);
+		u32 nTSval = m_pTimer->GetTicks ();
+
+		*pOption++ = TCP_OPTION_NOP;
+		*pOption++ = TCP_OPTION_NOP;
+		*pOption++ = TCP_OPTION_TIMESTAMP;
+		*pOption++ = 10;
+		PutOptionWord (pOption, nTSval);
+		PutOptionWord (pOption+4, m_nTS_RECENT);
+		pOption += 8;
+
+		nMaxSACKBlocks--;
+	}
+
+	// SACK blocks are sent in pure ACKs only, so that the MSS cannot be exceeded
+	if (   m_bSACKPermitted
+	    && m_nOutOfOrderSegments > 0
+	    && nDataLength == 0
+	    && (nFlags & (TCP_FLAG_ACK | TCP_FLAG_SYN | TCP_FLAG_RESET)) == TCP_FLAG_ACK)
+	{
+		u32 SACKLeft[TCP_MAX_SACK_BLOCKS];
+		u32 SACKRight[TCP_MAX_SACK_BLOCKS];
+		unsigned nBlocks = GetSACKBlocks (SACKLeft, SACKRight, nMaxSACKBlocks);
+		assert (nBlocks > 0);
+
+		*pOption++ = TCP_OPTION_NOP;
+		*pOption++ = TCP_OPTION_NOP;
+		*pOption++ = TCP_OPTION_SACK;
+		*pOption++ = 2 + nBlocks*8;
+
+		for (unsigned i = 0; i < nBlocks; i++)
+		{
+			PutOptionWord (pOption, SACKLeft[i]);
+			PutOptionWord (pOption+4, SACKRight[i]);
+			pOption += 8;
+		}
 	}
-	unsigned nHeaderLength = nDataOffset * 4;
+
+	unsigned nHeaderLength = pOption - TxBuffer;
+	assert (nHeaderLength % 4 == 0);
+	assert (nHeaderLength <= 60);
+	unsigned nDataOffset = nHeaderLength / 4;
 	
 	unsigned nPacketLength = nHeaderLength + nDataLength;		// may wrap
 	assert (nPacketLength >= nHeaderLength);
-	assert (nHeaderLength <= FRAME_BUFFER_SIZE);
-
-	u8 TxBuffer[FRAME_BUFFER_SIZE];
-	TTCPHeader *pHeader = (TTCPHeader *) TxBuffer;
+	assert (nPacketLength <= FRAME_BUFFER_SIZE);
 
 	pHeader->nSourcePort	 	= le2be16 (m_nOwnPort);
 	pHeader->nDestPort	 	= le2be16 (m_nForeignPort);
 	pHeader->nSequenceNumber 	= le2be32 (nSequenceNumber);
 	pHeader->nAcknowledgmentNumber	= nFlags & TCP_FLAG_ACK ? le2be32 (nAcknowledgmentNumber) : 0;
 	pHeader->nDataOffsetFlags	= (nDataOffset << TCP_DATA_OFFSET_SHIFT) | nFlags;
-	pHeader->nWindow		= le2be16 (m_nRCV_WND);
+	pHeader->nWindow		= le2be16 (nWindow);
 	pHeader->nUrgentPointer		= le2be16 (m_nSND_UP);
 
-	if (nFlags & TCP_FLAG_SYN)
+	if (nFlags & TCP_FLAG_ACK)
 	{
-		TTCPOption *pOption = (TTCPOption *) pHeader->Options;
-
-		pOption->nKind   = TCP_OPTION_MSS;
-		pOption->nLength = 4;
-		pOption->Data[0] = TCP_CONFIG_MSS >> 8;
-		pOption->Data[1] = TCP_CONFIG_MSS & 0xFF;
+		m_nLAST_ACK_SENT = nAcknowledgmentNumber;
 	}
 
-	if (nDataLength > 0)
+	pHeader->nChecksum = 0;		// must be 0 for calculation
+	assert (m_pNetworkLayer != 0);
+	if (m_pNetworkLayer->IsChecksumOffload (m_ForeignIP, nPacketLength))
 	{
-		assert (pData != 0);
-		memcpy (TxBuffer+nHeaderLength, pData, nDataLength);
-	}
+		if (nDataLength > 0)
+		{
+			assert (pData != 0);
+			memcpy (TxBuffer+nHeaderLength, pData, nDataLength);
+		}
 
-	pHeader->nChecksum = 0;		// must be 0 for calculation
-	pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
+		pHeader->nChecksum = m_Checksum.CalculatePseudoHeader (nPacketLength);
+	}
+	else
+	{
+		// the data is summed up, while it is copied from the retransmission queue
+		pHeader->nChecksum = m_Checksum.CopyAndCalculate (TxBuffer, nHeaderLength,
+								  pData, nDataLength);
+	}
 
 #ifdef TCP_DEBUG
 	CLogger::Get ()->Write (FromTCP, LogDebug,
@@ -1428,7 +2109,7 @@ boolean CTCPConnection::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 n
 				nFlags & TCP_FLAG_FIN    ? 'F' : '-',
 				nSequenceNumber-m_nISS,
 				nFlags & TCP_FLAG_ACK ? nAcknowledgmentNumber-m_nIRS : 0,
-				m_nRCV_WND,
+				nWindow,
 				nDataLength);
 #endif
 
@@ -1436,8 +2117,14 @@ boolean CTCPConnection::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 n
 	return m_pNetworkLayer->Send (m_ForeignIP, TxBuffer, nPacketLength, IPPROTO_TCP);
 }
 
-void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
+void CTCPConnection::ScanOptions (TTCPHeader *pHeader, TTCPOptions *pOptions)
 {
+	assert (pOptions != 0);
+	pOptions->nWindowShift = -1;
+	pOptions->bSACKPermitted = FALSE;
+	pOptions->bTimestamp = FALSE;
+	pOptions->nSACKBlocks = 0;
+
 	assert (pHeader != 0);
 	unsigned nDataOffset = TCP_DATA_OFFSET (pHeader->nDataOffsetFlags)*4;
 	u8 *pHeaderEnd = (u8 *) pHeader+nDataOffset;
@@ -1452,11 +2139,19 @@ void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
 
 		case TCP_OPTION_NOP:
 			pOption = (TTCPOption *) ((u8 *) pOption+1);
-			break;
-			
+			continue;
+		}
+
+		if (   pOption->nLength < 2			// malformed option
+		    || (u8 *) pOption+pOption->nLength > pHeaderEnd)
+		{
+			return;
+		}
+
+		switch (pOption->nKind)
+		{
 		case TCP_OPTION_MSS:
-			if (   pOption->nLength == 4
-			    && (u8 *) pOption+4 <= pHeaderEnd)
+			if (pOption->nLength == 4)
 			{
 				u32 nMSS = (u16) pOption->Data[0] << 8 | pOption->Data[1];
 
@@ -1468,15 +2163,493 @@ void CTCPConnection::ScanOptions (TTCPHeader *pHeader)
 					m_nSND_MSS = (u16) nMSS;
 				}
 			}
-			// fall through
+			break;
+
+		case TCP_OPTION_WINDOW_SCALE:
+			if (pOption->nLength == 3)
+			{
+				pOptions->nWindowShift = min (pOption->Data[0], TCP_MAX_WINDOW_SHIFT);
+			}
+			break;
+
+		case TCP_OPTION_SACK_PERM:
+			if (pOption->nLength == 2)
+			{
+				pOptions->bSACKPermitted = TRUE;
+			}
+			break;
+
+		case TCP_OPTION_SACK:
+			if ((pOption->nLength-2) % 8 == 0)
+			{
+				unsigned nBlocks = min ((pOption->nLength-2U) / 8, TCP_MAX_SACK_BLOCKS);
+				for (unsigned i = 0; i < nBlocks; i++)
+				{
+					pOptions->SACKLeft[i]  = GetOptionWord (&pOption->Data[i*8]);
+					pOptions->SACKRight[i] = GetOptionWord (&pOption->Data[i*8+4]);
+				}
+
+				pOptions->nSACKBlocks = nBlocks;
+			}
+			break;
+
+		case TCP_OPTION_TIMESTAMP:
+			if (pOption->nLength == 10)
+			{
+				pOptions->bTimestamp = TRUE;
+				pOptions->nTSval = GetOptionWord (&pOption->Data[0]);
+				pOptions->nTSecr = GetOptionWord (&pOption->Data[4]);
+			}
+			break;
 
 		default:
-			pOption = (TTCPOption *) ((u8 *) pOption+pOption->nLength);
 			break;
 		}
+
+		pOption = (TTCPOption *) ((u8 *) pOption+pOption->nLength);
 	}
 }
 
+void CTCPConnection::NegotiateOptions (const TTCPOptions *pOptions)
+{
+	assert (pOptions != 0);
+
+	// options are used, if they have been offered by both sides (on active OPEN)
+	if (   (m_bWindowScale || !m_bActiveOpen)
+	    && pOptions->nWindowShift >= 0)
+	{
+		m_bWindowScale = TRUE;
+		m_nSND_WND_SHIFT = pOptions->nWindowShift;
+		m_nRCV_WND_SHIFT = TCP_CONFIG_WINDOW_SHIFT;
+	}
+	else
+	{
+		m_bWindowScale = FALSE;
+		m_nSND_WND_SHIFT = 0;
+		m_nRCV_WND_SHIFT = 0;
+	}
+
+	m_bSACKPermitted =    (m_bSACKPermitted || !m_bActiveOpen)
+			   && pOptions->bSACKPermitted;
+
+	m_bTimestamps =    (m_bTimestamps || !m_bActiveOpen)
+			&& pOptions->bTimestamp;
+	if (m_bTimestamps)
+	{
+		m_nTS_RECENT = pOptions->nTSval;
+	}
+}
+
+boolean CTCPConnection::UpdateReceiveWindow (void)
+{
+	int nFree = (int) m_nRxBufferSize - AtomicGet (&m_nRxQueueBytes);
+	u32 nWindow = nFree > 0 ? nFree : 0;
+
+	u32 nMaxWindow = (u32) TCP_MAX_WINDOW << m_nRCV_WND_SHIFT;
+	if (nWindow > nMaxWindow)
+	{
+		nWindow = nMaxWindow;
+	}
+
+	nWindow &= ~((1U << m_nRCV_WND_SHIFT) - 1);	// must be representable in the header
+
+	u32 nCurrentWindow = lt (m_nRCV_NXT, m_nRCV_ADV) ? m_nRCV_ADV-m_nRCV_NXT : 0;
+
+	// receiver side silly window syndrome avoidance (RFC 1122 section 4.2.3.3)
+	if (nWindow >= nCurrentWindow + min (m_nRxBufferSize / 2, TCP_CONFIG_MSS))
+	{
+		m_nRCV_WND = nWindow;
+		m_nRCV_ADV = m_nRCV_NXT+nWindow;
+
+		return TRUE;
+	}
+
+	// the right window edge must not move to the left (RFC 7323 section 2.4)
+	m_nRCV_WND = nCurrentWindow;
+
+	return FALSE;
+}
+
+boolean CTCPConnection::QueueReceivedData (const u8 *pData, unsigned nLength)
+{
+	assert (pData != 0);
+	assert (nLength > 0);
+
+	if (m_pRxBuffer == 0)
+	{
+		AtomicAdd (&m_nRxQueueBytes, nLength);
+
+		if (!m_RxQueue.Enqueue (pData, nLength))
+		{
+			AtomicSub (&m_nRxQueueBytes, nLength);
+
+			return FALSE;
+		}
+
+		// a socket set must see the data, even if PSH is not set
+		SignalPollEvent ();
+
+		return TRUE;
+	}
+
+	// queue the received segment itself, reduced to its payload
+	assert (pData >= m_pRxBuffer->GetData ());
+	assert (pData + nLength <= m_pRxBuffer->GetData () + m_pRxBuffer->GetLength ());
+	m_pRxBuffer->Pull (pData - m_pRxBuffer->GetData ());
+	m_pRxBuffer->Trim (nLength);
+
+	m_pRxBuffer->AddRef ();
+	CNetBuffer *pBuffer = m_pRxBuffer;
+	m_pRxBuffer = 0;			// has been modified, cannot be used again
+
+	return QueueReceivedBuffer (pBuffer);
+}
+
+boolean CTCPConnection::QueueReceivedBuffer (CNetBuffer *pBuffer)
+{
+	assert (pBuffer != 0);
+	unsigned nLength = pBuffer->GetLength ();
+
+	// count first, so that Receive() cannot see a negative number
+	AtomicAdd (&m_nRxQueueBytes, nLength);
+
+	if (!m_RxQueue.Enqueue (pBuffer))
+	{
+		AtomicSub (&m_nRxQueueBytes, nLength);
+
+		return FALSE;
+	}
+
+	SignalPollEvent ();
+
+	return TRUE;
+}
+
+unsigned CTCPConnection::DequeueReceivedData (const TSocketIOVec *pIOVec, unsigned nIOVecCount)
+{
+	assert (pIOVec != 0);
+
+	unsigned nResult = 0;
+	for (unsigned i = 0; i < nIOVecCount; i++)
+	{
+		u8 *pBuffer = (u8 *) pIOVec[i].pBuffer;
+		unsigned nSize = pIOVec[i].nLength;
+
+		while (nSize > 0)
+		{
+			if (m_pRxPartial == 0)
+			{
+				m_pRxPartial = m_RxQueue.Dequeue ();
+				if (m_pRxPartial == 0)
+				{
+					return nResult;
+				}
+			}
+
+			unsigned nLength = m_pRxPartial->GetLength ();
+			if (nLength > nSize)
+			{
+				nLength = nSize;
+			}
+
+			assert (pBuffer != 0);
+			memcpy (pBuffer, m_pRxPartial->GetData (), nLength);
+			m_pRxPartial->Pull (nLength);
+
+			pBuffer += nLength;
+			nSize -= nLength;
+			nResult += nLength;
+
+			if (m_pRxPartial->GetLength () == 0)
+			{
+				m_pRxPartial->Release ();
+				m_pRxPartial = 0;
+			}
+		}
+	}
+
+	return nResult;
+}
+
+boolean CTCPConnection::QueueOutOfOrderData (u32 nSequenceNumber, const u8 *pData, unsigned nLength)
+{
+	assert (pData != 0);
+	assert (nLength > 0);
+
+	if (   m_pRxBuffer == 0
+	    || m_nOutOfOrderSegments >= TCP_MAX_OUT_OF_ORDER_SEGMENTS
+	    || gt (nSequenceNumber+nLength, m_nRCV_NXT+m_nRCV_WND))
+	{
+		return FALSE;
+	}
+
+	// find the insert position, ignore duplicates
+	unsigned nPos = m_nOutOfOrderSegments;
+	while (   nPos > 0
+	       && gt (m_OutOfOrderQueue[nPos-1].nSequenceNumber, nSequenceNumber))
+	{
+		nPos--;
+	}
+
+	if (nPos > 0)
+	{
+		TOutOfOrderSegment *pPrev = &m_OutOfOrderQueue[nPos-1];
+		if (ge (pPrev->nSequenceNumber+pPrev->pBuffer->GetLength (), nSequenceNumber+nLength))
+		{
+			return FALSE;
+		}
+	}
+
+	// queue the received segment itself, reduced to its payload
+	assert (pData >= m_pRxBuffer->GetData ());
+	assert (pData + nLength <= m_pRxBuffer->GetData () + m_pRxBuffer->GetLength ());
+	m_pRxBuffer->Pull (pData - m_pRxBuffer->GetData ());
+	m_pRxBuffer->Trim (nLength);
+
+	m_pRxBuffer->AddRef ();
+	CNetBuffer *pBuffer = m_pRxBuffer;
+	m_pRxBuffer = 0;			// has been modified, cannot be used again
+
+	memmove (&m_OutOfOrderQueue[nPos+1], &m_OutOfOrderQueue[nPos],
+		 (m_nOutOfOrderSegments-nPos) * sizeof m_OutOfOrderQueue[0]);
+
+	m_OutOfOrderQueue[nPos].nSequenceNumber = nSequenceNumber;
+	m_OutOfOrderQueue[nPos].pBuffer = pBuffer;
+	m_nOutOfOrderSegments++;
+
+	m_nLastOutOfOrderSequence = nSequenceNumber;
+
+	return TRUE;
+}
+
+void CTCPConnection::DequeueOutOfOrderData (void)
+{
+	unsigned nDequeued;
+	for (nDequeued = 0; nDequeued < m_nOutOfOrderSegments; nDequeued++)
+	{
+		TOutOfOrderSegment *pSegment = &m_OutOfOrderQueue[nDequeued];
+		if (gt (pSegment->nSequenceNumber, m_nRCV_NXT))
+		{
+			break;				// there is still a gap
+		}
+
+		CNetBuffer *pBuffer = pSegment->pBuffer;
+		assert (pBuffer != 0);
+
+		u32 nDuplicate = m_nRCV_NXT-pSegment->nSequenceNumber;
+		if (nDuplicate >= pBuffer->GetLength ())
+		{
+			pBuffer->Release ();
+
+			continue;
+		}
+
+		pBuffer->Pull (nDuplicate);
+		unsigned nLength = pBuffer->GetLength ();
+
+		if (!QueueReceivedBuffer (pBuffer))
+		{
+			nDequeued++;			// data is lost, will be retransmitted
+
+			break;
+		}
+
+		m_nRCV_NXT += nLength;
+	}
+
+	m_nOutOfOrderSegments -= nDequeued;
+	memmove (&m_OutOfOrderQueue[0], &m_OutOfOrderQueue[nDequeued],
+		 m_nOutOfOrderSegments * sizeof m_OutOfOrderQueue[0]);
+}
+
+void CTCPConnection::FlushOutOfOrderData (void)
+{
+	for (unsigned i = 0; i < m_nOutOfOrderSegments; i++)
+	{
+		assert (m_OutOfOrderQueue[i].pBuffer != 0);
+		m_OutOfOrderQueue[i].pBuffer->Release ();
+	}
+
+	m_nOutOfOrderSegments = 0;
+}
+
+unsigned CTCPConnection::GetSACKBlocks (u32 *pLeft, u32 *pRight, unsigned nMaxBlocks) const
+{
+	assert (pLeft != 0);
+	assert (pRight != 0);
+	assert (nMaxBlocks > 0);
+
+	// the first block contains the most recently received segment (RFC 2018 section 4),
+	// the others follow in ascending order
+	unsigned nBlocks = 0;
+	for (unsigned nPass = 0; nPass < 2; nPass++)
+	{
+		for (unsigned i = 0; i < m_nOutOfOrderSegments && nBlocks < nMaxBlocks; )
+		{
+			u32 nLeft = m_OutOfOrderQueue[i].nSequenceNumber;
+			u32 nRight = nLeft + m_OutOfOrderQueue[i].pBuffer->GetLength ();
+
+			// merge contiguous or overlapping segments
+			for (i++; i < m_nOutOfOrderSegments; i++)
+			{
+				u32 nSeq = m_OutOfOrderQueue[i].nSequenceNumber;
+				if (gt (nSeq, nRight))
+				{
+					break;
+				}
+
+				u32 nEnd = nSeq + m_OutOfOrderQueue[i].pBuffer->GetLength ();
+				if (gt (nEnd, nRight))
+				{
+					nRight = nEnd;
+				}
+			}
+
+			boolean bIsLast = bwl (nLeft, m_nLastOutOfOrderSequence, nRight);
+			if (   (nPass == 0 && bIsLast)
+			    || (nPass == 1 && !bIsLast))
+			{
+				pLeft[nBlocks] = nLeft;
+				pRight[nBlocks] = nRight;
+				nBlocks++;
+			}
+		}
+	}
+
+	return nBlocks;
+}
+
+void CTCPConnection::UpdateScoreboard (const TTCPOptions *pOptions)
+{
+	assert (pOptions != 0);
+
+	// remove acknowledged blocks
+	unsigned nRemoved = 0;
+	while (   nRemoved < m_nScoreboardBlocks
+	       && le (m_Scoreboard[nRemoved].nRight, m_nSND_UNA))
+	{
+		nRemoved++;
+	}
+
+	m_nScoreboardBlocks -= nRemoved;
+	memmove (&m_Scoreboard[0], &m_Scoreboard[nRemoved], m_nScoreboardBlocks * sizeof m_Scoreboard[0]);
+
+	for (unsigned i = 0; i < pOptions->nSACKBlocks; i++)
+	{
+		u32 nLeft = pOptions->SACKLeft[i];
+		u32 nRight = pOptions->SACKRight[i];
+		if (   !lt (nLeft, nRight)
+		    || !lt (m_nSND_UNA, nLeft)
+		    || gt (nRight, m_nSND_MAX))
+		{
+			continue;			// invalid or old block
+		}
+
+		// insert the block sorted, merge it with overlapping or adjacent blocks
+		unsigned nPos = 0;
+		while (   nPos < m_nScoreboardBlocks
+		       && lt (m_Scoreboard[nPos].nRight, nLeft))
+		{
+			nPos++;
+		}
+
+		unsigned nEnd = nPos;
+		while (   nEnd < m_nScoreboardBlocks
+		       && le (m_Scoreboard[nEnd].nLeft, nRight))
+		{
+			if (lt (m_Scoreboard[nEnd].nLeft, nLeft))
+			{
+				nLeft = m_Scoreboard[nEnd].nLeft;
+			}
+
+			if (gt (m_Scoreboard[nEnd].nRight, nRight))
+			{
+				nRight = m_Scoreboard[nEnd].nRight;
+			}
+
+			nEnd++;
+		}
+
+		if (nEnd == nPos)			// no merge, make room for a new block
+		{
+			if (m_nScoreboardBlocks == TCP_SACK_SCOREBOARD_SIZE)
+			{
+				if (nPos == m_nScoreboardBlocks)
+				{
+					continue;		// drop the highest block
+				}
+
+				m_nScoreboardBlocks--;
+			}
+
+			memmove (&m_Scoreboard[nPos+1], &m_Scoreboard[nPos],
+				 (m_nScoreboardBlocks-nPos) * sizeof m_Scoreboard[0]);
+			m_nScoreboardBlocks++;
+		}
+		else if (nEnd > nPos+1)			// multiple blocks merged
+		{
+			memmove (&m_Scoreboard[nPos+1], &m_Scoreboard[nEnd],
+				 (m_nScoreboardBlocks-nEnd) * sizeof m_Scoreboard[0]);
+			m_nScoreboardBlocks -= nEnd-nPos-1;
+		}
+
+		m_Scoreboard[nPos].nLeft = nLeft;
+		m_Scoreboard[nPos].nRight = nRight;
+	}
+}
+
+unsigned CTCPConnection::GetSendMSS (void) const
+{
+	// the Timestamps option is sent in each segment and reduces the payload
+	unsigned nMSS = m_nSND_MSS;
+	if (   m_bTimestamps
+	    && nMSS > TCP_TIMESTAMP_OPTION_SIZE * 2)
+	{
+		nMSS -= TCP_TIMESTAMP_OPTION_SIZE;
+	}
+
+	return nMSS;
+}
+
+void CTCPConnection::StartCongestionControl (void)
+{
+	assert (m_pCongestionControl != 0);
+	m_pCongestionControl->Initialize (GetSendMSS ());
+
+	m_nDupAcks = 0;
+	m_bInRecovery = FALSE;
+	m_nRecover = m_nISS;			// RFC 6582 section 3.2 step 1
+}
+
+void CTCPConnection::RetransmitFirstSegment (void)
+{
+	unsigned nLength = min (m_nSND_NXT-m_nSND_UNA, GetSendMSS ());
+	if (m_nScoreboardBlocks > 0)
+	{
+		nLength = min (nLength, m_Scoreboard[0].nLeft-m_nSND_UNA);
+	}
+
+	if (nLength == 0)
+	{
+		return;
+	}
+
+#ifdef TCP_DEBUG
+	CLogger::Get ()->Write (FromTCP, LogDebug, "Retransmitting %u bytes (seq %u)",
+				nLength, m_nSND_UNA-m_nISS);
+#endif
+
+	u8 TempBuffer[FRAME_BUFFER_SIZE];
+	assert (nLength <= FRAME_BUFFER_SIZE);
+	m_RetransmissionQueue.Read (0, TempBuffer, nLength);
+
+	SendSegment (TCP_FLAG_ACK, m_nSND_UNA, m_nRCV_NXT, TempBuffer, nLength);
+	m_RTOCalculator.SegmentSent (m_nSND_UNA, nLength);
+	m_nRetransmittedSegments++;
+
+	StartTimer (TCPTimerRetransmission, m_RTOCalculator.GetRTO ());
+}
+
 u32 CTCPConnection::CalculateISN (void)
 {
 	assert (m_pTimer != 0);
@@ -1485,6 +2658,20 @@ u32 CTCPConnection::CalculateISN (void)
 	       * (TCP_MAX_WINDOW / TCP_QUIET_TIME / HZ);
 }
 
+void CTCPConnection::SetEvent (void)
+{
+	m_Event.Set ();
+
+	SignalPollEvent ();
+}
+
+void CTCPConnection::SetTxEvent (void)
+{
+	m_TxEvent.Set ();
+
+	SignalPollEvent ();
+}
+
 void CTCPConnection::StartTimer (unsigned nTimer, unsigned nHZ)
 {
 	assert (nTimer < TCPTimerUnknown);
@@ -1579,6 +2766,8 @@ void CTCPConnection::TimerHandler (unsigned nTimer)
 		assert (0);
 		break;
 	}
+
+	RequestProcess ();
 }
 
 void CTCPConnection::TimerStub (TKernelTimerHandle hTimer, void *pParam, void *pContext)
@@ -1597,11 +2786,12 @@ void CTCPConnection::TimerStub (TKernelTimerHandle hTimer, void *pParam, void *p
 void CTCPConnection::DumpStatus (void)
 {
 	CLogger::Get ()->Write (FromTCP, LogDebug,
-				"sta %u, una %u, snx %u, swn %u, rnx %u, rwn %u, fprt %u",
+				"sta %u, una %u, snx %u, swn %u, cwn %u, rnx %u, rwn %u, fprt %u",
 				m_State,
 				m_nSND_UNA-m_nISS,
 				m_nSND_NXT-m_nISS,
 				m_nSND_WND,
+				m_pCongestionControl->GetWindow (),
 				m_nRCV_NXT-m_nIRS,
 				m_nRCV_WND,
 				(unsigned) m_nForeignPort);
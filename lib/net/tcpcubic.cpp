@@ -0,0 +1,169 @@
+//
+// tcpcubic.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpcubic.h>
+#include <assert.h>
+
+#define CUBIC_C			0.4f		// scaling constant
+#define CUBIC_BETA		0.7f		// multiplicative decrease factor
+#define CUBIC_ALPHA		(3.0f * (1.0f - CUBIC_BETA) / (1.0f + CUBIC_BETA))
+
+#define max(n, m)	((n) >= (m) ? (n) : (m))
+
+CTCPCubic::CTCPCubic (void)
+:	m_pTimer (CTimer::Get ()),
+	m_fWMax (0.0f),
+	m_fK (0.0f),
+	m_fWEst (0.0f),
+	m_nEpochStart (0),
+	m_fIncrease (0.0f)
+{
+}
+
+CTCPCubic::~CTCPCubic (void)
+{
+	m_pTimer = 0;
+}
+
+const char *CTCPCubic::GetName (void) const
+{
+	return "cubic";
+}
+
+void CTCPCubic::Initialize (unsigned nMSS)
+{
+	CTCPCongestionControl::Initialize (nMSS);
+
+	m_fWMax = 0.0f;
+	m_fK = 0.0f;
+	m_nEpochStart = 0;
+	m_fIncrease = 0.0f;
+}
+
+void CTCPCubic::DataAcknowledged (unsigned nBytesAcked, unsigned nFlightSize)
+{
+	if (m_nCongestionWindow < m_nSlowStartThreshold)
+	{
+		SlowStart (nBytesAcked);
+
+		return;
+	}
+
+	assert (m_nMSS > 0);
+	float fCWnd = (float) m_nCongestionWindow / m_nMSS;
+
+	assert (m_pTimer != 0);
+	unsigned nTicks = m_pTimer->GetTicks ();
+	if (m_nEpochStart == 0)
+	{
+		// begin of a new congestion avoidance stage (RFC 9438 section 4.2)
+		m_nEpochStart = nTicks != 0 ? nTicks : 1;
+
+		if (m_fWMax > fCWnd)
+		{
+			m_fK = CubeRoot ((m_fWMax - fCWnd) / CUBIC_C);
+		}
+		else
+		{
+			m_fK = 0.0f;
+			m_fWMax = fCWnd;
+		}
+
+		m_fWEst = fCWnd;
+	}
+
+	// we use the time at the next RTT for simplicity as the time now
+	float t = (float) (nTicks - m_nEpochStart) / HZ;
+	float fOffset = t - m_fK;
+	float fTarget = CUBIC_C * fOffset*fOffset*fOffset + m_fWMax;
+
+	// the target must be in the range [cwnd, 1.5*cwnd] (section 4.2)
+	if (fTarget < fCWnd)
+	{
+		fTarget = fCWnd;
+	}
+	else if (fTarget > 1.5f * fCWnd)
+	{
+		fTarget = 1.5f * fCWnd;
+	}
+
+	// Reno-friendly region (section 4.3)
+	float fSegmentsAcked = (float) nBytesAcked / m_nMSS;
+	m_fWEst += CUBIC_ALPHA * fSegmentsAcked / fCWnd;
+	if (m_fWEst > fTarget)
+	{
+		fTarget = m_fWEst;
+	}
+
+	// increase by (target - cwnd) / cwnd per acknowledged segment (section 4.4)
+	m_fIncrease += (fTarget - fCWnd) / fCWnd * fSegmentsAcked * m_nMSS;
+	if (m_fIncrease >= 1.0f)
+	{
+		unsigned nIncrease = (unsigned) m_fIncrease;
+		m_fIncrease -= nIncrease;
+
+		m_nCongestionWindow += nIncrease;
+	}
+}
+
+unsigned CTCPCubic::LossDetected (unsigned nFlightSize)
+{
+	assert (m_nMSS > 0);
+	float fCWnd = (float) m_nCongestionWindow / m_nMSS;
+
+	// fast convergence (RFC 9438 section 4.7)
+	if (fCWnd < m_fWMax)
+	{
+		m_fWMax = fCWnd * (1.0f + CUBIC_BETA) / 2.0f;
+	}
+	else
+	{
+		m_fWMax = fCWnd;
+	}
+
+	m_nEpochStart = 0;
+	m_fIncrease = 0.0f;
+
+	unsigned nSlowStartThreshold = (unsigned) (m_nCongestionWindow * CUBIC_BETA);
+
+	return max (nSlowStartThreshold, 2*m_nMSS);
+}
+
+float CTCPCubic::CubeRoot (float fValue)
+{
+	if (fValue <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	// Newton's method, starting with a value, which is greater than the result
+	float x = fValue > 1.0f ? fValue : 1.0f;
+	for (unsigned i = 0; i < 100; i++)
+	{
+		float xNew = (2.0f*x + fValue / (x*x)) / 3.0f;
+		if (x - xNew < 1e-4f * x)
+		{
+			return xNew;
+		}
+
+		x = xNew;
+	}
+
+	return x;
+}
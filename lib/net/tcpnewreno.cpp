@@ -0,0 +1,70 @@
+//
+// tcpnewreno.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/net/tcpnewreno.h>
+#include <assert.h>
+
+#define max(n, m)	((n) >= (m) ? (n) : (m))
+
+CTCPNewReno::CTCPNewReno (void)
+:	m_nBytesAcked (0)
+{
+}
+
+CTCPNewReno::~CTCPNewReno (void)
+{
+}
+
+const char *CTCPNewReno::GetName (void) const
+{
+	return "newreno";
+}
+
+void CTCPNewReno::Initialize (unsigned nMSS)
+{
+	CTCPCongestionControl::Initialize (nMSS);
+
+	m_nBytesAcked = 0;
+}
+
+void CTCPNewReno::DataAcknowledged (unsigned nBytesAcked, unsigned nFlightSize)
+{
+	if (m_nCongestionWindow < m_nSlowStartThreshold)
+	{
+		SlowStart (nBytesAcked);
+
+		return;
+	}
+
+	// appropriate byte counting (RFC 3465 section 2.1)
+	m_nBytesAcked += nBytesAcked;
+	if (m_nBytesAcked >= m_nCongestionWindow)
+	{
+		m_nBytesAcked -= m_nCongestionWindow;
+
+		m_nCongestionWindow += m_nMSS;
+	}
+}
+
+unsigned CTCPNewReno::LossDetected (unsigned nFlightSize)
+{
+	m_nBytesAcked = 0;
+
+	return max (nFlightSize / 2, 2*m_nMSS);
+}
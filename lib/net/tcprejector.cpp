@@ -179,7 +179,15 @@ boolean CTCPRejector::SendSegment (unsigned nFlags, u32 nSequenceNumber, u32 nAc
 	pHeader->nUrgentPointer		= 0;
 
 	pHeader->nChecksum = 0;		// must be 0 for calculation
-	pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
+	assert (m_pNetworkLayer != 0);
+	if (m_pNetworkLayer->IsChecksumOffload (m_ForeignIP, nPacketLength))
+	{
+		pHeader->nChecksum = m_Checksum.CalculatePseudoHeader (nPacketLength);
+	}
+	else
+	{
+		pHeader->nChecksum = m_Checksum.Calculate (TxBuffer, nPacketLength);
+	}
 
 #ifdef TCP_DEBUG
 	CLogger::Get ()->Write (FromTCP, LogDebug,
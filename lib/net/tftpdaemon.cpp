@@ -2,7 +2,7 @@
 // tftpdaemon.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2016-2024  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2016-2025  R. Stange <rsta2@o2online.de>
 //
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -31,6 +31,12 @@
 
 #define RECEIVE_TIMEOUT_HZ	(5 * HZ)
 #define MAX_TIMEOUT_HZ		(25 * HZ)
+#define DUP_ACK_INTERVAL_HZ	(HZ / 10)	// min. distance of ACKs for out of order blocks
+
+#define DEFAULT_BLOCK_SIZE	512
+#define MIN_BLOCK_SIZE		8		// RFC 2348
+#define MAX_BLOCK_SIZE		1468		// fits into an Ethernet frame (MTU 1500)
+#define MAX_WINDOW_SIZE		16
 
 struct TTFTPReqPacket
 {
@@ -42,7 +48,8 @@ struct TTFTPReqPacket
 #define MAX_MODE_LEN		16
 #define MIN_FILENAME_MODE_LEN	(1+1+1+1)
 #define MAX_FILENAME_MODE_LEN	(MAX_FILENAME_LEN+1+MAX_MODE_LEN+1)
-	char	FileNameMode[MAX_FILENAME_MODE_LEN];
+#define MAX_OPTIONS_LEN		256
+	char	FileNameMode[MAX_FILENAME_MODE_LEN+MAX_OPTIONS_LEN];	// options follow
 }
 PACKED;
 
@@ -52,8 +59,7 @@ struct TTFTPDataPacket
 #define OP_CODE_DATA		3
 
 	u16	BlockNumber;
-#define MAX_DATA_LEN		512
-	u8	Data[MAX_DATA_LEN];
+	u8	Data[MAX_BLOCK_SIZE];
 }
 PACKED;
 
@@ -80,12 +86,25 @@ struct TTFTPErrorPacket
 #define ERROR_CODE_INV_ID	5
 #define ERROR_CODE_EXISTS	6
 #define ERROR_CODE_INV_USER	7
+#define ERROR_CODE_OPTION	8
 
 #define MAX_ERRMSG_LEN		128
 	char	ErrMsg[MAX_ERRMSG_LEN];
 }
 PACKED;
 
+struct TTFTPOptionAckPacket
+{
+	u16	OpCode;
+#define OP_CODE_OACK		6
+
+#define MAX_OACK_LEN		64
+	char	Options[MAX_OACK_LEN];
+}
+PACKED;
+
+#define DATA_HEADER_LEN		(sizeof (u16) + sizeof (u16))
+
 typedef unsigned TIMER;
 #define START_TIMER(timer)		((timer) = CTimer::Get ()->GetTicks ())
 #define TIMER_EXPIRED(timer, timeout)	(CTimer::Get ()->GetTicks () - (timer) >= (timeout))
@@ -95,7 +114,13 @@ static const char FromTFPTDaemon[] = "tftpd";
 CTFTPDaemon::CTFTPDaemon (CNetSubSystem *pNetSubSystem)
 :	m_pNetSubSystem (pNetSubSystem),
 	m_pRequestSocket (0),
-	m_pTransferSocket (0)
+	m_pTransferSocket (0),
+	m_nBlockSize (DEFAULT_BLOCK_SIZE),
+	m_nWindowSize (1),
+	m_nTransferSize (0),
+	m_bBlockSizeOption (FALSE),
+	m_bWindowSizeOption (FALSE),
+	m_bTransferSizeOption (FALSE)
 {
 	SetName (FromTFPTDaemon);
 }
@@ -182,6 +207,8 @@ void CTFTPDaemon::Run (void)
 			continue;
 		}
 
+		ParseOptions (pMode + strlen (pMode) + 1, ReqPacket.FileNameMode + nLength);
+
 		if (!IsAccessAllowed (&ForeignIP, m_Filename, usOpCode == OP_CODE_WRQ))
 		{
 			SendError (ERROR_CODE_ACCESS, "Access violation",
@@ -252,25 +279,61 @@ boolean CTFTPDaemon::DoRead (const char *pFileName)
 		return FALSE;
 	}
 
+	if (m_bTransferSizeOption)
+	{
+		int nFileSize = FileSize ();
+		if (nFileSize >= 0)
+		{
+			m_nTransferSize = (unsigned) nFileSize;
+		}
+		else
+		{
+			m_bTransferSizeOption = FALSE;
+		}
+	}
+
 	CRetransmissionTimeoutCalculator RTCalc;
 	RTCalc.Initialize (0);
 
-	int nDataLength = MAX_DATA_LEN;
-	for (u16 usBlockNumber = 1; nDataLength == MAX_DATA_LEN; usBlockNumber++)
+	TIMER TransferTimer;
+	START_TIMER (TransferTimer);
+
+	// the option acknowledgment has to be answered with ACK 0 by the client
+	if (   m_bBlockSizeOption
+	    || m_bWindowSizeOption
+	    || m_bTransferSizeOption)
 	{
-		UpdateStatus (StatusReadInProgress, m_Filename);
+		int nAck;
+		do
+		{
+			if (TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
 
-		TTFTPDataPacket DataPacket;
-		DataPacket.OpCode = BE (OP_CODE_DATA);
-		DataPacket.BlockNumber = le2be16 (usBlockNumber);
+				nAck = -2;
 
-		nDataLength = FileRead (DataPacket.Data, MAX_DATA_LEN);
-		if (nDataLength < 0)
-		{
-			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot read");
+				break;
+			}
 
-			SendError (ERROR_CODE_OTHER, "Error reading file");
+			if (!SendOptionAck ())
+			{
+				nAck = -2;
+
+				break;
+			}
 
+			RTCalc.SegmentSent (0);
+
+			nAck = ReceiveAck (RTCalc.GetRTO ());
+			if (nAck < 0)
+			{
+				RTCalc.RetransmissionTimerExpired ();
+			}
+		}
+		while (nAck != 0 && nAck != -2);
+
+		if (nAck != 0)
+		{
 			FileClose ();
 
 			UpdateStatus (StatusReadAborted, m_Filename);
@@ -278,85 +341,144 @@ boolean CTFTPDaemon::DoRead (const char *pFileName)
 			return FALSE;
 		}
 
-		unsigned nPacketLength =   sizeof DataPacket.OpCode
-					 + sizeof DataPacket.BlockNumber
-					 + nDataLength;
+		RTCalc.SegmentAcknowledged (0);
+	}
 
-		TIMER TransferTimer;
-		START_TIMER (TransferTimer);
-		while (!TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+	// the blocks of the current window are kept for retransmission
+	TTFTPDataPacket *pWindow = new TTFTPDataPacket[m_nWindowSize];
+	unsigned *pPacketLength = new unsigned[m_nWindowSize];
+	assert (pWindow != 0);
+	assert (pPacketLength != 0);
+
+	// block numbers are counted with 32 bits here, and roll over on the wire
+	u32 nFirstBlock = 1;			// first block, which is not acknowledged yet
+	u32 nNextBlock = 1;			// next block to be read from file
+	u32 nLastBlock = 0;			// valid, if bEndOfFile is set
+	boolean bEndOfFile = FALSE;
+
+	boolean bOK = TRUE;
+	while (   !bEndOfFile
+	       || nFirstBlock <= nLastBlock)
+	{
+		UpdateStatus (StatusReadInProgress, m_Filename);
+
+		// fill up the window
+		while (   !bEndOfFile
+		       && nNextBlock - nFirstBlock < m_nWindowSize)
 		{
-			if (m_pTransferSocket->Send (&DataPacket, nPacketLength, MSG_DONTWAIT) < 0)
+			unsigned nSlot = nNextBlock % m_nWindowSize;
+			TTFTPDataPacket *pPacket = &pWindow[nSlot];
+			pPacket->OpCode = BE (OP_CODE_DATA);
+			pPacket->BlockNumber = le2be16 ((u16) nNextBlock);
+
+			int nDataLength = FileRead (pPacket->Data, m_nBlockSize);
+			if (nDataLength < 0)
 			{
-				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send data");
+				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot read");
 
-				FileClose ();
+				SendError (ERROR_CODE_OTHER, "Error reading file");
 
-				UpdateStatus (StatusReadAborted, m_Filename);
+				bOK = FALSE;
 
-				return FALSE;
+				break;
 			}
 
-			RTCalc.SegmentSent ((u32) (usBlockNumber-1) * MAX_DATA_LEN, nDataLength);
+			pPacketLength[nSlot] = DATA_HEADER_LEN + nDataLength;
 
-			TIMER ReceiveTimer;
-			START_TIMER (ReceiveTimer);
-			while (!TIMER_EXPIRED (ReceiveTimer, RTCalc.GetRTO ()))
+			if ((unsigned) nDataLength < m_nBlockSize)
 			{
-				CScheduler::Get ()->Yield ();
+				nLastBlock = nNextBlock;
+				bEndOfFile = TRUE;
+			}
 
-				TTFTPAckPacket AckPacket;
-				int nResult = m_pTransferSocket->Receive (&AckPacket, sizeof AckPacket,
-									  MSG_DONTWAIT);
-				if (nResult < 0)
-				{
-					CLogger::Get ()->Write (FromTFPTDaemon, LogError,
-								"Cannot receive ACK");
+			nNextBlock++;
+		}
 
-					FileClose ();
+		if (!bOK)
+		{
+			break;
+		}
 
-					UpdateStatus (StatusReadAborted, m_Filename);
+		// send the window
+		for (u32 nBlock = nFirstBlock; nBlock < nNextBlock; nBlock++)
+		{
+			unsigned nSlot = nBlock % m_nWindowSize;
+			if (m_pTransferSocket->Send (&pWindow[nSlot], pPacketLength[nSlot],
+						     MSG_DONTWAIT) < 0)
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send data");
 
-					return FALSE;
-				}
+				bOK = FALSE;
 
-				if (   nResult == sizeof AckPacket
-				    && AckPacket.OpCode == BE (OP_CODE_ACK)
-				    && AckPacket.BlockNumber == le2be16 (usBlockNumber))
-				{
-					break;
-				}
+				break;
 			}
+		}
 
-			if (!TIMER_EXPIRED (ReceiveTimer, RTCalc.GetRTO ()))
-			{
-				RTCalc.SegmentAcknowledged ((u32) (usBlockNumber-1) * MAX_DATA_LEN);
+		if (!bOK)
+		{
+			break;
+		}
 
-				break;
-			}
-			else
+		RTCalc.SegmentSent (nFirstBlock);
+
+		// wait for an ACK, which acknowledges at least one block of the window,
+		// duplicate ACKs are ignored to avoid the Sorcerer's Apprentice Syndrome
+		int nAck;
+		u16 usAcked = 0;
+		do
+		{
+			nAck = ReceiveAck (RTCalc.GetRTO ());
+			if (nAck >= 0)
 			{
-				RTCalc.RetransmissionTimerExpired ();
+				usAcked = (u16) nAck - (u16) (nFirstBlock-1);
+				if (usAcked > nNextBlock - nFirstBlock)
+				{
+					usAcked = 0;
+				}
 			}
 		}
+		while (   nAck >= 0
+		       && usAcked == 0);
 
-		if (TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+		if (nAck == -2)
 		{
-			CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
+			bOK = FALSE;
 
-			FileClose ();
+			break;
+		}
 
-			UpdateStatus (StatusReadAborted, m_Filename);
+		if (nAck == -1)
+		{
+			// retransmit the window, starting with the first unacknowledged block
+			RTCalc.RetransmissionTimerExpired ();
 
-			return FALSE;
+			if (TIMER_EXPIRED (TransferTimer, MAX_TIMEOUT_HZ))
+			{
+				CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer timed out");
+
+				bOK = FALSE;
+
+				break;
+			}
+
+			continue;
 		}
+
+		RTCalc.SegmentAcknowledged (nFirstBlock);
+
+		nFirstBlock += usAcked;
+
+		START_TIMER (TransferTimer);
 	}
 
+	delete [] pPacketLength;
+	delete [] pWindow;
+
 	FileClose ();
 
-	UpdateStatus (StatusReadCompleted, m_Filename);
+	UpdateStatus (bOK ? StatusReadCompleted : StatusReadAborted, m_Filename);
 
-	return TRUE;
+	return bOK;
 }
 
 boolean CTFTPDaemon::DoWrite (const char *pFileName)
@@ -364,23 +486,20 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	assert (m_pTransferSocket != 0);
 
 	assert (pFileName != 0);
-	if (FileCreate (pFileName))
+	if (!FileCreate (pFileName))
 	{
-		TTFTPAckPacket AckPacket;
-		AckPacket.OpCode = BE (OP_CODE_ACK);
-		AckPacket.BlockNumber = 0;
-		if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket, MSG_DONTWAIT) < 0)
-		{
-			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send ACK");
-
-			FileClose ();
+		SendError (ERROR_CODE_ACCESS, "Access violation");
 
-			return FALSE;
-		}
+		return FALSE;
 	}
-	else
+
+	// the option acknowledgment replaces ACK 0
+	if (!(  (   m_bBlockSizeOption
+		 || m_bWindowSizeOption
+		 || m_bTransferSizeOption)
+	      ? SendOptionAck () : SendAck (0)))
 	{
-		SendError (ERROR_CODE_ACCESS, "Access violation");
+		FileClose ();
 
 		return FALSE;
 	}
@@ -389,79 +508,88 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	// After the first data packet has been received, use a longer time-out.
 	unsigned nTimeout = RECEIVE_TIMEOUT_HZ;
 
-	int nLength = MAX_DATA_LEN;
-	for (u16 usBlockNumber = 1; nLength == MAX_DATA_LEN; usBlockNumber++)
+	TIMER DupAckTimer = CTimer::Get ()->GetTicks () - DUP_ACK_INTERVAL_HZ;
+
+	unsigned nBlocksInWindow = 0;		// received in order, since the last ACK
+
+	boolean bLastBlock = FALSE;
+	for (u16 usBlockNumber = 1; !bLastBlock; usBlockNumber++)
 	{
 		UpdateStatus (StatusWriteInProgress, m_Filename);
 
 		TTFTPDataPacket DataPacket;
-		do
+		int nLength;
+		while (1)
 		{
+			TIMER ReceiveTimer;
+			START_TIMER (ReceiveTimer);
+
+			int nResult;
 			do
 			{
-				TIMER ReceiveTimer;
-				START_TIMER (ReceiveTimer);
-
-				int nResult;
-				do
+				if (TIMER_EXPIRED (ReceiveTimer, nTimeout))
 				{
-					if (TIMER_EXPIRED (ReceiveTimer, nTimeout))
-					{
-						CLogger::Get ()->Write (FromTFPTDaemon, LogDebug,
-									"Transfer timed out");
+					CLogger::Get ()->Write (FromTFPTDaemon, LogDebug,
+								"Transfer timed out");
 
-						FileClose ();
+					FileClose ();
 
-						UpdateStatus (StatusWriteAborted, m_Filename);
+					UpdateStatus (StatusWriteAborted, m_Filename);
 
-						return FALSE;
-					}
+					return FALSE;
+				}
 
-					CScheduler::Get ()->Yield ();
+				CScheduler::Get ()->Yield ();
 
-					nResult = m_pTransferSocket->Receive (&DataPacket,
-									      sizeof DataPacket,
-									      MSG_DONTWAIT);
-					if (nResult < 0)
-					{
-						CLogger::Get ()->Write (FromTFPTDaemon, LogError,
-									"Cannot receive data");
+				nResult = m_pTransferSocket->Receive (&DataPacket,
+								      sizeof DataPacket,
+								      MSG_DONTWAIT);
+				if (nResult < 0)
+				{
+					CLogger::Get ()->Write (FromTFPTDaemon, LogError,
+								"Cannot receive data");
 
-						FileClose ();
+					FileClose ();
 
-						UpdateStatus (StatusWriteAborted, m_Filename);
+					UpdateStatus (StatusWriteAborted, m_Filename);
 
-						return FALSE;
-					}
+					return FALSE;
 				}
-				while (nResult == 0);
+			}
+			while (nResult == 0);
 
-				nLength = nResult - (  sizeof DataPacket.OpCode
-						     + sizeof DataPacket.BlockNumber);
+			nLength = nResult - DATA_HEADER_LEN;
+			if (   nLength < 0
+			    || nLength > (int) m_nBlockSize
+			    || DataPacket.OpCode != BE (OP_CODE_DATA))
+			{
+				continue;
 			}
-			while (   nLength < 0
-			       || DataPacket.OpCode != BE (OP_CODE_DATA));
 
-			if ((int) (usBlockNumber - be2le16 (DataPacket.BlockNumber)) >= 0)
+			if (DataPacket.BlockNumber == le2be16 (usBlockNumber))
 			{
-				TTFTPAckPacket AckPacket;
-				AckPacket.OpCode = BE (OP_CODE_ACK);
-				AckPacket.BlockNumber = DataPacket.BlockNumber;
-				if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket,
-							     MSG_DONTWAIT) < 0)
-				{
-					CLogger::Get ()->Write (FromTFPTDaemon, LogError,
-								"Cannot send ACK");
+				break;
+			}
 
+			// A block is missing or has been received twice. Acknowledge the last
+			// block received in order, so that the client restarts the window
+			// from there. Do this once per retransmitted window only.
+			if (TIMER_EXPIRED (DupAckTimer, DUP_ACK_INTERVAL_HZ))
+			{
+				if (!SendAck (usBlockNumber-1))
+				{
 					FileClose ();
 
 					UpdateStatus (StatusWriteAborted, m_Filename);
 
 					return FALSE;
 				}
+
+				START_TIMER (DupAckTimer);
+
+				nBlocksInWindow = 0;
 			}
 		}
-		while (DataPacket.BlockNumber != le2be16 (usBlockNumber));
 
 		if (nLength > 0)
 		{
@@ -479,6 +607,23 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 			}
 		}
 
+		bLastBlock = (unsigned) nLength < m_nBlockSize;
+
+		if (   ++nBlocksInWindow == m_nWindowSize
+		    || bLastBlock)
+		{
+			if (!SendAck (usBlockNumber))
+			{
+				FileClose ();
+
+				UpdateStatus (StatusWriteAborted, m_Filename);
+
+				return FALSE;
+			}
+
+			nBlocksInWindow = 0;
+		}
+
 		nTimeout = MAX_TIMEOUT_HZ;
 	}
 
@@ -489,6 +634,159 @@ boolean CTFTPDaemon::DoWrite (const char *pFileName)
 	return TRUE;
 }
 
+void CTFTPDaemon::ParseOptions (const char *pOptions, const char *pEnd)
+{
+	m_nBlockSize = DEFAULT_BLOCK_SIZE;
+	m_nWindowSize = 1;
+	m_nTransferSize = 0;
+
+	m_bBlockSizeOption = FALSE;
+	m_bWindowSizeOption = FALSE;
+	m_bTransferSizeOption = FALSE;
+
+	assert (pOptions != 0);
+	assert (pEnd != 0);
+	while (pOptions < pEnd)
+	{
+		const char *pValue = pOptions + strlen (pOptions) + 1;
+		if (pValue >= pEnd)
+		{
+			break;
+		}
+
+		// all supported options have a decimal value
+		unsigned nValue = 0;
+		const char *p = pValue;
+		for (; '0' <= *p && *p <= '9' && nValue <= 100000000; p++)
+		{
+			nValue = nValue * 10 + *p - '0';
+		}
+
+		if (   p != pValue
+		    && *p == '\0')
+		{
+			// unknown options and invalid values are ignored (RFC 2347)
+			if (strcasecmp (pOptions, "blksize") == 0)
+			{
+				if (nValue >= MIN_BLOCK_SIZE)
+				{
+					m_nBlockSize = nValue <= MAX_BLOCK_SIZE ? nValue : MAX_BLOCK_SIZE;
+					m_bBlockSizeOption = TRUE;
+				}
+			}
+			else if (strcasecmp (pOptions, "windowsize") == 0)
+			{
+				if (1 <= nValue && nValue <= 65535)
+				{
+					m_nWindowSize = nValue <= MAX_WINDOW_SIZE ? nValue : MAX_WINDOW_SIZE;
+					m_bWindowSizeOption = TRUE;
+				}
+			}
+			else if (strcasecmp (pOptions, "tsize") == 0)
+			{
+				// for RRQ this is 0 and will be replaced with the file size
+				m_nTransferSize = nValue;
+				m_bTransferSizeOption = TRUE;
+			}
+		}
+
+		pOptions = pValue + strlen (pValue) + 1;
+	}
+}
+
+boolean CTFTPDaemon::SendOptionAck (void)
+{
+	TTFTPOptionAckPacket OptionAckPacket;
+	OptionAckPacket.OpCode = BE (OP_CODE_OACK);
+
+	// name and value of each option are 0-terminated strings
+	unsigned nLength = 0;
+	const char *Names[] = {"blksize", "windowsize", "tsize"};
+	const unsigned Values[] = {m_nBlockSize, m_nWindowSize, m_nTransferSize};
+	const boolean Enabled[] = {m_bBlockSizeOption, m_bWindowSizeOption, m_bTransferSizeOption};
+	for (unsigned i = 0; i < sizeof Names / sizeof Names[0]; i++)
+	{
+		if (!Enabled[i])
+		{
+			continue;
+		}
+
+		CString Value;
+		Value.Format ("%u", Values[i]);
+
+		assert (nLength + strlen (Names[i]) + 1 + Value.GetLength () + 1 <= MAX_OACK_LEN);
+		strcpy (OptionAckPacket.Options + nLength, Names[i]);
+		nLength += strlen (Names[i]) + 1;
+		strcpy (OptionAckPacket.Options + nLength, Value);
+		nLength += Value.GetLength () + 1;
+	}
+
+	if (m_pTransferSocket->Send (&OptionAckPacket, sizeof OptionAckPacket.OpCode + nLength,
+				     MSG_DONTWAIT) < 0)
+	{
+		CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send OACK");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+boolean CTFTPDaemon::SendAck (u16 usBlockNumber)
+{
+	TTFTPAckPacket AckPacket;
+	AckPacket.OpCode = BE (OP_CODE_ACK);
+	AckPacket.BlockNumber = le2be16 (usBlockNumber);
+
+	assert (m_pTransferSocket != 0);
+	if (m_pTransferSocket->Send (&AckPacket, sizeof AckPacket, MSG_DONTWAIT) < 0)
+	{
+		CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot send ACK");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+int CTFTPDaemon::ReceiveAck (unsigned nTimeout)
+{
+	assert (m_pTransferSocket != 0);
+
+	TIMER ReceiveTimer;
+	START_TIMER (ReceiveTimer);
+	while (!TIMER_EXPIRED (ReceiveTimer, nTimeout))
+	{
+		CScheduler::Get ()->Yield ();
+
+		TTFTPAckPacket AckPacket;
+		int nResult = m_pTransferSocket->Receive (&AckPacket, sizeof AckPacket, MSG_DONTWAIT);
+		if (nResult < 0)
+		{
+			CLogger::Get ()->Write (FromTFPTDaemon, LogError, "Cannot receive ACK");
+
+			return -2;
+		}
+
+		if (   nResult >= (int) sizeof AckPacket.OpCode
+		    && AckPacket.OpCode == BE (OP_CODE_ERROR))
+		{
+			// the client may reject the option acknowledgment or abort
+			CLogger::Get ()->Write (FromTFPTDaemon, LogDebug, "Transfer aborted by client");
+
+			return -2;
+		}
+
+		if (   nResult == sizeof AckPacket
+		    && AckPacket.OpCode == BE (OP_CODE_ACK))
+		{
+			return be2le16 (AckPacket.BlockNumber);
+		}
+	}
+
+	return -1;
+}
+
 void CTFTPDaemon::SendError (u16 usErrorCode, const char *pErrorMessage, CIPAddress *pSendTo, u16 usPort)
 {
 	TTFTPErrorPacket ErrorPacket;
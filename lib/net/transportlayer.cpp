@@ -21,22 +21,38 @@
 #include <circle/net/tcpconnection.h>
 #include <circle/net/udpconnection.h>
 #include <circle/net/in.h>
+#include <circle/timer.h>
 #include <circle/string.h>
 #include <circle/macros.h>
 #include <assert.h>
 
-#define OWN_PORT_MIN	60000
-#define OWN_PORT_MAX	60999
+#define SWEEP_INTERVAL	(HZ / 10)		// all connections are processed then
 
 CTransportLayer::CTransportLayer (CNetConfig *pNetConfig, CNetworkLayer *pNetworkLayer)
 :	m_pNetConfig (pNetConfig),
 	m_pNetworkLayer (pNetworkLayer),
 	m_nOwnPort (OWN_PORT_MIN),
 	m_SpinLock (TASK_LEVEL),
+	m_nLastSweepTicks (0),
 	m_TCPRejector (pNetConfig, pNetworkLayer)
 {
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
+
+	for (unsigned i = 0; i < 1 << TRANSPORT_HASH_BITS; i++)
+	{
+		m_pHashTable[i] = 0;
+	}
+
+	for (unsigned i = 0; i < 1 << TRANSPORT_WILDCARD_HASH_BITS; i++)
+	{
+		m_pWildcardHashTable[i] = 0;
+	}
+
+	for (unsigned i = 0; i <= OWN_PORT_MAX-OWN_PORT_MIN; i++)
+	{
+		m_nOwnPortUsers[i] = 0;
+	}
 }
 
 CTransportLayer::~CTransportLayer (void)
@@ -52,71 +68,89 @@ boolean CTransportLayer::Initialize (void)
 
 void CTransportLayer::Process (void)
 {
-	unsigned nResultLength;
 	CIPAddress Sender;
 	CIPAddress Receiver;
 	int nProtocol;
 	assert (m_pNetworkLayer != 0);
-	u8 Buffer[FRAME_BUFFER_SIZE];
-	while (m_pNetworkLayer->Receive (Buffer, &nResultLength, &Sender, &Receiver, &nProtocol))
+	CNetBuffer *pBuffer;
+	while ((pBuffer = m_pNetworkLayer->Receive (&Sender, &Receiver, &nProtocol)) != 0)
 	{
-		unsigned i;
-		for (i = 0; i < m_pConnection.GetCount (); i++)
-		{
-			if (m_pConnection[i] == 0)
-			{
-				continue;
-			}
-
-			if (((CNetConnection *) m_pConnection[i])->PacketReceived (
-				Buffer, nResultLength, Sender, Receiver, nProtocol) != 0)
-			{
-				break;
-			}
-		}
-
-		if (i >= m_pConnection.GetCount ())
+		if (PacketReceived (pBuffer, Sender, Receiver, nProtocol) == 0)
 		{
 			// send RESET on not consumed TCP segment
-			m_TCPRejector.PacketReceived (Buffer, nResultLength,
+			m_TCPRejector.PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
 						      Sender, Receiver, nProtocol);
 		}
+
+		pBuffer->Release ();
 	}
 
+	// ICMP notifications are rare, so they are not demultiplexed via the hash tables
 	TICMPNotificationType Type;
 	u16 nSendPort;
 	u16 nReceivePort;
 	while (m_pNetworkLayer->ReceiveNotification (&Type, &Sender, &Receiver,
 						     &nSendPort, &nReceivePort, &nProtocol))
 	{
-		unsigned i;
-		for (i = 0; i < m_pConnection.GetCount (); i++)
+		for (unsigned i = 0; i < m_pConnection.GetCount (); i++)
 		{
-			if (m_pConnection[i] == 0)
+			CNetConnection *pConnection = (CNetConnection *) m_pConnection[i];
+			if (pConnection == 0)
 			{
 				continue;
 			}
 
-			if (((CNetConnection *) m_pConnection[i])->NotificationReceived (
-				Type, Sender, Receiver, nSendPort, nReceivePort, nProtocol) != 0)
+			if (pConnection->NotificationReceived (Type, Sender, Receiver,
+							       nSendPort, nReceivePort, nProtocol) != 0)
 			{
+				pConnection->MarkPending ();
+
 				break;
 			}
 		}
 	}
 
+	// process the connections, which have requested it, in order of their requests
+	CNetConnection *pConnection = CNetConnection::TakePendingList ();
+	while (pConnection != 0)
+	{
+		CNetConnection *pNext = pConnection->ClearPending ();
+
+		if (!pConnection->IsTerminated ())
+		{
+			pConnection->Process ();
+		}
+
+		pConnection = pNext;
+	}
+
+	// from time to time process all connections and remove the terminated ones
+	unsigned nTicks = CTimer::Get ()->GetTicks ();
+	if (nTicks - m_nLastSweepTicks < SWEEP_INTERVAL)
+	{
+		return;
+	}
+
+	m_nLastSweepTicks = nTicks;
+
 	for (unsigned i = 0; i < m_pConnection.GetCount (); i++)
 	{
-		if (m_pConnection[i] != 0)
+		pConnection = (CNetConnection *) m_pConnection[i];
+		if (pConnection != 0)
 		{
-			if (!((CNetConnection *) m_pConnection[i])->IsTerminated ())
-			{			
-				((CNetConnection *) m_pConnection[i])->Process ();
+			if (!pConnection->IsTerminated ())
+			{
+				pConnection->Process ();
 			}
 			else
 			{
-				delete (CNetConnection *) m_pConnection[i];
-				m_pConnection[i] = 0;
+				m_SpinLock.Acquire ();
+
+				RemoveConnection (i);
+
+				m_SpinLock.Release ();
+
+				delete pConnection;
 			}
 		}
 	}
@@ -173,8 +207,10 @@ int CTransportLayer::Bind (u16 nOwnPort, int nProtocol)
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
-	m_pConnection[i] = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
-	assert (m_pConnection[i] != 0);
+	CNetConnection *pConnection = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
+	assert (pConnection != 0);
+
+	AddConnection (i, pConnection);
 
 	m_SpinLock.Release ();
 
@@ -201,38 +237,36 @@ int CTransportLayer::Connect (const CIPAddress &rIPAddress, u16 nPort, u16 nOwnP
 
 	if (nOwnPort == 0)
 	{
-		unsigned j;
+		unsigned nTries = OWN_PORT_MAX-OWN_PORT_MIN+1;
 		do
 		{
-			nOwnPort = m_nOwnPort;
-			if (++m_nOwnPort > OWN_PORT_MAX)
+			if (nTries-- == 0)
 			{
-				m_nOwnPort = OWN_PORT_MIN;
+				m_SpinLock.Release ();
+
+				return -1;			// all dynamic ports are in use
 			}
 
-			for (j = 0; j < m_pConnection.GetCount (); j++)
+			nOwnPort = m_nOwnPort;
+			if (++m_nOwnPort > OWN_PORT_MAX)
 			{
-				if (   m_pConnection[j] != 0
-				    && ((CNetConnection *) m_pConnection[j])->GetOwnPort () == nOwnPort
-				    && ((CNetConnection *) m_pConnection[j])->GetProtocol () == nProtocol)
-				{
-					break;
-				}
+				m_nOwnPort = OWN_PORT_MIN;
 			}
 		}
-		while (j < m_pConnection.GetCount ());
+		while (m_nOwnPortUsers[nOwnPort-OWN_PORT_MIN] != 0);
 	}
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
+	CNetConnection *pConnection;
 	switch (nProtocol)
 	{
 	case IPPROTO_TCP:
-		m_pConnection[i] = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
+		pConnection = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
 		break;
 
 	case IPPROTO_UDP:
-		m_pConnection[i] = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
+		pConnection = new CUDPConnection (m_pNetConfig, m_pNetworkLayer, rIPAddress, nPort, nOwnPort);
 		break;
 
 	default:
@@ -240,10 +274,12 @@ int CTransportLayer::Connect (const CIPAddress &rIPAddress, u16 nPort, u16 nOwnP
 		return -1;
 	}
 
+	assert (pConnection != 0);
+	AddConnection (i, pConnection);
+
 	m_SpinLock.Release ();
 
-	assert (m_pConnection[i] != 0);
-	int nResult = ((CNetConnection *) m_pConnection[i])->Connect ();
+	int nResult = pConnection->Connect ();
 	if (nResult < 0)
 	{
 		return -1;
@@ -286,8 +322,10 @@ int CTransportLayer::Listen (u16 nOwnPort, int nProtocol)
 
 	assert (m_pNetConfig != 0);
 	assert (m_pNetworkLayer != 0);
-	m_pConnection[i] = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
-	assert (m_pConnection[i] != 0);
+	CNetConnection *pConnection = new CTCPConnection (m_pNetConfig, m_pNetworkLayer, nOwnPort);
+	assert (pConnection != 0);
+
+	AddConnection (i, pConnection);
 
 	m_SpinLock.Release ();
 
@@ -378,6 +416,54 @@ int CTransportLayer::ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeig
 									     pForeignIP, pForeignPort);
 }
 
+int CTransportLayer::SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->SendMsg (pIOVec, nIOVecCount, nFlags);
+}
+
+int CTransportLayer::ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->ReceiveMsg (pIOVec, nIOVecCount, nFlags);
+}
+
+int CTransportLayer::SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->SendBatch (pMessage, nCount, nFlags);
+}
+
+int CTransportLayer::ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->ReceiveBatch (pMessage, nCount, nFlags);
+}
+
 int CTransportLayer::SetOptionBroadcast (boolean bAllowed, int hConnection)
 {
 	assert (hConnection >= 0);
@@ -390,6 +476,59 @@ int CTransportLayer::SetOptionBroadcast (boolean bAllowed, int hConnection)
 	return ((CNetConnection *) m_pConnection[hConnection])->SetOptionBroadcast (bAllowed);
 }
 
+int CTransportLayer::SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize,
+					   int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->SetOptionBufferSizes (nRxBufferSize,
+										    nTxBufferSize);
+}
+
+int CTransportLayer::SetOptionCongestionControl (const char *pAlgorithm, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->SetOptionCongestionControl (pAlgorithm);
+}
+
+int CTransportLayer::GetStatistics (TTCPStatistics *pStatistics, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return -1;
+	}
+
+	return ((CNetConnection *) m_pConnection[hConnection])->GetStatistics (pStatistics);
+}
+
+unsigned CTransportLayer::Poll (CSynchronizationEvent *pEvent, int hConnection)
+{
+	assert (hConnection >= 0);
+	if (   hConnection >= (int) m_pConnection.GetCount ()
+	    || m_pConnection[hConnection] == 0)
+	{
+		return POLLHUP;			// connection has already been removed
+	}
+
+	CNetConnection *pConnection = (CNetConnection *) m_pConnection[hConnection];
+	pConnection->SetPollEvent (pEvent);
+
+	return pConnection->GetPollEvents ();
+}
+
 boolean CTransportLayer::IsConnected (int hConnection) const
 {
 	assert (hConnection >= 0);
@@ -418,10 +557,11 @@ void CTransportLayer::ListConnections (CDevice *pTarget)
 {
 	assert (pTarget != 0);
 
-	static const char Header[] = "PROT LOCAL ADDRESS         FOREIGN ADDRESS       STATE\n";
+	static const char Header[] = "PROT LOCAL ADDRESS         FOREIGN ADDRESS       STATE        "
+				     "CC          CWND SSTHRESH RETRANS\n";
 	pTarget->Write (Header, sizeof Header-1);
 
-	CString OwnIP, Local, Foreign, Line;
+	CString OwnIP, Local, Foreign, Line, Statistics;
 
 	assert (m_pNetConfig != 0);
 	const CIPAddress *pOwnIP = m_pNetConfig->GetIPAddress ();
@@ -450,10 +590,210 @@ void CTransportLayer::ListConnections (CDevice *pTarget)
 			(unsigned) pForeignIP[2], (unsigned) pForeignIP[3],
 			(unsigned) ((CNetConnection *) m_pConnection[i])->GetForeignPort ());
 
-		Line.Format ("%-4s %-21s %-21s %s\n", pProtocol,
+		TTCPStatistics Stat;
+		if (((CNetConnection *) m_pConnection[i])->GetStatistics (&Stat) == 0)
+		{
+			CString SlowStartThreshold ("-");
+			if (Stat.nSlowStartThreshold != TCP_SSTHRESH_INFINITE)
+			{
+				SlowStartThreshold.Format ("%u", Stat.nSlowStartThreshold);
+			}
+
+			Statistics.Format (" %-7s %8u %8s %7u", Stat.pCongestionControl,
+					   Stat.nCongestionWindow, (const char *) SlowStartThreshold,
+					   Stat.nRetransmittedSegments);
+		}
+		else
+		{
+			Statistics = "";
+		}
+
+		Line.Format ("%-4s %-21s %-21s %-12s%s\n", pProtocol,
 			     (const char *) Local, (const char *) Foreign,
-			     ((CNetConnection *) m_pConnection[i])->GetStateName ());
+			     ((CNetConnection *) m_pConnection[i])->GetStateName (),
+			     (const char *) Statistics);
 
 		pTarget->Write ((const char *) Line, Line.GetLength ());
 	}
 }
+
+CNetConnection *CTransportLayer::PacketReceived (CNetBuffer *pBuffer, CIPAddress &rSenderIP,
+						 CIPAddress &rReceiverIP, int nProtocol)
+{
+	assert (pBuffer != 0);
+	if (   (   nProtocol != IPPROTO_TCP
+		&& nProtocol != IPPROTO_UDP)
+	    || pBuffer->GetLength () < 4)
+	{
+		return 0;
+	}
+
+	// TCP and UDP headers start with the source and destination port
+	const u8 *pHeader = pBuffer->GetData ();
+	u16 nForeignPort = (u16) pHeader[0] << 8 | pHeader[1];
+	u16 nOwnPort = (u16) pHeader[2] << 8 | pHeader[3];
+
+	m_SpinLock.Acquire ();
+
+	// connections with a fully specified address take precedence over wildcard connections
+	boolean bWildcard = FALSE;
+	CNetConnection *pConnection = m_pHashTable[Hash (nProtocol, nOwnPort, rSenderIP, nForeignPort)];
+	while (TRUE)
+	{
+		if (pConnection == 0)
+		{
+			if (bWildcard)
+			{
+				break;
+			}
+
+			bWildcard = TRUE;
+			pConnection = m_pWildcardHashTable[WildcardHash (nProtocol, nOwnPort)];
+
+			continue;
+		}
+
+		if (   pConnection->m_nProtocol == nProtocol
+		    && pConnection->m_nOwnPort == nOwnPort
+		    && (   bWildcard
+			|| (   pConnection->m_nForeignPort == nForeignPort
+			    && pConnection->m_ForeignIP == rSenderIP)))
+		{
+			// connections are removed by the net task only, so this one stays valid
+			m_SpinLock.Release ();
+
+			int nResult = pConnection->PacketReceived (pBuffer, rSenderIP, rReceiverIP, nProtocol);
+
+			m_SpinLock.Acquire ();
+
+			if (nResult != 0)
+			{
+				// the connection may have been bound to a foreign address or unbound
+				if (pConnection->IsWildcard () != pConnection->m_bWildcardHashed)
+				{
+					RemoveHash (pConnection);
+					InsertHash (pConnection);
+				}
+
+				m_SpinLock.Release ();
+
+				pConnection->MarkPending ();
+
+				return pConnection;
+			}
+		}
+
+		pConnection = pConnection->m_pNextHashed;
+	}
+
+	m_SpinLock.Release ();
+
+	return 0;
+}
+
+void CTransportLayer::AddConnection (unsigned nIndex, CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	assert (m_pConnection[nIndex] == 0);
+	m_pConnection[nIndex] = pConnection;
+
+	InsertHash (pConnection);
+
+	u16 nOwnPort = pConnection->GetOwnPort ();
+	if (   OWN_PORT_MIN <= nOwnPort
+	    && nOwnPort <= OWN_PORT_MAX)
+	{
+		m_nOwnPortUsers[nOwnPort-OWN_PORT_MIN]++;
+	}
+}
+
+void CTransportLayer::RemoveConnection (unsigned nIndex)
+{
+	CNetConnection *pConnection = (CNetConnection *) m_pConnection[nIndex];
+	assert (pConnection != 0);
+
+	u16 nOwnPort = pConnection->GetOwnPort ();
+	if (   OWN_PORT_MIN <= nOwnPort
+	    && nOwnPort <= OWN_PORT_MAX)
+	{
+		assert (m_nOwnPortUsers[nOwnPort-OWN_PORT_MIN] > 0);
+		m_nOwnPortUsers[nOwnPort-OWN_PORT_MIN]--;
+	}
+
+	RemoveHash (pConnection);
+
+	m_pConnection[nIndex] = 0;
+}
+
+void CTransportLayer::InsertHash (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	assert (!pConnection->m_bHashed);
+
+	CNetConnection **ppConnection;
+	if (pConnection->IsWildcard ())
+	{
+		pConnection->m_nHashBucket = WildcardHash (pConnection->m_nProtocol,
+							   pConnection->m_nOwnPort);
+		pConnection->m_bWildcardHashed = TRUE;
+
+		ppConnection = &m_pWildcardHashTable[pConnection->m_nHashBucket];
+	}
+	else
+	{
+		pConnection->m_nHashBucket = Hash (pConnection->m_nProtocol, pConnection->m_nOwnPort,
+						   pConnection->m_ForeignIP, pConnection->m_nForeignPort);
+		pConnection->m_bWildcardHashed = FALSE;
+
+		ppConnection = &m_pHashTable[pConnection->m_nHashBucket];
+	}
+
+	// append to the bucket, so that older connections are found first
+	while (*ppConnection != 0)
+	{
+		ppConnection = &(*ppConnection)->m_pNextHashed;
+	}
+
+	*ppConnection = pConnection;
+	pConnection->m_pNextHashed = 0;
+
+	pConnection->m_bHashed = TRUE;
+}
+
+void CTransportLayer::RemoveHash (CNetConnection *pConnection)
+{
+	assert (pConnection != 0);
+	assert (pConnection->m_bHashed);
+
+	CNetConnection **ppConnection =
+		  pConnection->m_bWildcardHashed
+		? &m_pWildcardHashTable[pConnection->m_nHashBucket]
+		: &m_pHashTable[pConnection->m_nHashBucket];
+
+	while (*ppConnection != pConnection)
+	{
+		assert (*ppConnection != 0);
+		ppConnection = &(*ppConnection)->m_pNextHashed;
+	}
+
+	*ppConnection = pConnection->m_pNextHashed;
+	pConnection->m_pNextHashed = 0;
+
+	pConnection->m_bHashed = FALSE;
+}
+
+unsigned CTransportLayer::Hash (int nProtocol, u16 nOwnPort, u32 nForeignIP, u16 nForeignPort)
+{
+	// multiplicative hashing, the upper bits are the best mixed ones
+	u32 nKey = (nForeignIP ^ nProtocol) * 0x9E3779B1U;
+	nKey ^= (u32) nForeignPort << 16 | nOwnPort;
+
+	return (nKey * 0x9E3779B1U) >> (32-TRANSPORT_HASH_BITS);
+}
+
+unsigned CTransportLayer::WildcardHash (int nProtocol, u16 nOwnPort)
+{
+	u32 nKey = (u32) nProtocol << 16 | nOwnPort;
+
+	return (nKey * 0x9E3779B1U) >> (32-TRANSPORT_WILDCARD_HASH_BITS);
+}
@@ -47,6 +47,7 @@ CUDPConnection::CUDPConnection (CNetConfig	*pNetConfig,
 :	CNetConnection (pNetConfig, pNetworkLayer, rForeignIP, nForeignPort, nOwnPort, IPPROTO_UDP),
 	m_bOpen (TRUE),
 	m_bActiveOpen (TRUE),
+	m_pRxBuffer (0),
 	m_bBroadcastsAllowed (FALSE),
 	m_nErrno (0)
 {
@@ -58,6 +59,7 @@ CUDPConnection::CUDPConnection (CNetConfig	*pNetConfig,
 :	CNetConnection (pNetConfig, pNetworkLayer, nOwnPort, IPPROTO_UDP),
 	m_bOpen (TRUE),
 	m_bActiveOpen (FALSE),
+	m_pRxBuffer (0),
 	m_bBroadcastsAllowed (FALSE),
 	m_nErrno (0)
 {
@@ -115,7 +117,7 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 
 	unsigned nPacketLength = sizeof (TUDPHeader) + nLength;		// may wrap
 	if (   nPacketLength <= sizeof (TUDPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	    || nPacketLength > IP_MAX_PAYLOAD_SIZE)
 	{
 		return -1;
 	}
@@ -128,7 +130,18 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 		return -1;
 	}
 
-	u8 PacketBuffer[nPacketLength];
+	// datagrams, which exceed a frame, are built on the heap and fragmented by IP
+	u8 FrameBuffer[FRAME_BUFFER_SIZE];
+	u8 *PacketBuffer = FrameBuffer;
+	if (nPacketLength > sizeof FrameBuffer)
+	{
+		PacketBuffer = new u8[nPacketLength];
+		if (PacketBuffer == 0)
+		{
+			return -1;
+		}
+	}
+
 	TUDPHeader *pHeader = (TUDPHeader *) PacketBuffer;
 
 	pHeader->nSourcePort = le2be16 (m_nOwnPort);
@@ -136,63 +149,41 @@ int CUDPConnection::Send (const void *pData, unsigned nLength, int nFlags)
 	pHeader->nLength     = le2be16 (nPacketLength);
 	pHeader->nChecksum   = 0;
 	
-	assert (pData != 0);
-	assert (nLength > 0);
-	memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
-
 	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
 	m_Checksum.SetDestinationAddress (m_ForeignIP);
-	pHeader->nChecksum = m_Checksum.Calculate (PacketBuffer, nPacketLength);
 
+	assert (pData != 0);
+	assert (nLength > 0);
 	assert (m_pNetworkLayer != 0);
+	if (m_pNetworkLayer->IsChecksumOffload (m_ForeignIP, nPacketLength))
+	{
+		memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
+
+		pHeader->nChecksum = m_Checksum.CalculatePseudoHeader (nPacketLength);
+	}
+	else
+	{
+		// the data is summed up, while it is copied into the packet
+		pHeader->nChecksum = m_Checksum.CopyAndCalculate (PacketBuffer, sizeof (TUDPHeader),
+								  pData, nLength);
+	}
+
 	boolean bOK = m_pNetworkLayer->Send (m_ForeignIP, PacketBuffer, nPacketLength, IPPROTO_UDP);
+
+	if (PacketBuffer != FrameBuffer)
+	{
+		delete [] PacketBuffer;
+	}
 	
 	return bOK ? nLength : -1;
 }
 
 int CUDPConnection::Receive (void *pBuffer, int nFlags)
 {
-	void *pParam;
-	unsigned nLength;
-	do
-	{
-		if (m_nErrno < 0)
-		{
-			int nErrno = m_nErrno;
-			m_nErrno = 0;
-
-			return nErrno;
-		}
+	// datagrams, which are larger than a frame, are truncated here
+	TSocketIOVec IOVec = {pBuffer, FRAME_BUFFER_SIZE};
 
-		assert (pBuffer != 0);
-		nLength = m_RxQueue.Dequeue (pBuffer, &pParam);
-		if (nLength == 0)
-		{
-			if (nFlags == MSG_DONTWAIT)
-			{
-				return 0;
-			}
-
-			m_Event.Clear ();
-			m_Event.Wait ();
-
-			if (m_nErrno < 0)
-			{
-				int nErrno = m_nErrno;
-				m_nErrno = 0;
-
-				return nErrno;
-			}
-		}
-	}
-	while (nLength == 0);
-
-	TUDPPrivateData *pData = (TUDPPrivateData *) pParam;
-	assert (pData != 0);
-
-	delete pData;
-
-	return nLength;
+	return ReceiveMsg (&IOVec, 1, nFlags);
 }
 
 int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
@@ -220,7 +211,7 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 
 	unsigned nPacketLength = sizeof (TUDPHeader) + nLength;		// may wrap
 	if (   nPacketLength <= sizeof (TUDPHeader)
-	    || nPacketLength > FRAME_BUFFER_SIZE)
+	    || nPacketLength > IP_MAX_PAYLOAD_SIZE)
 	{
 		return -1;
 	}
@@ -233,7 +224,18 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 		return -1;
 	}
 
-	u8 PacketBuffer[nPacketLength];
+	// datagrams, which exceed a frame, are built on the heap and fragmented by IP
+	u8 FrameBuffer[FRAME_BUFFER_SIZE];
+	u8 *PacketBuffer = FrameBuffer;
+	if (nPacketLength > sizeof FrameBuffer)
+	{
+		PacketBuffer = new u8[nPacketLength];
+		if (PacketBuffer == 0)
+		{
+			return -1;
+		}
+	}
+
 	TUDPHeader *pHeader = (TUDPHeader *) PacketBuffer;
 
 	pHeader->nSourcePort = le2be16 (m_nOwnPort);
@@ -241,70 +243,225 @@ int CUDPConnection::SendTo (const void *pData, unsigned nLength, int nFlags,
 	pHeader->nLength     = le2be16 (nPacketLength);
 	pHeader->nChecksum   = 0;
 	
-	assert (pData != 0);
-	assert (nLength > 0);
-	memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
-
 	m_Checksum.SetSourceAddress (*m_pNetConfig->GetIPAddress ());
 	m_Checksum.SetDestinationAddress (rForeignIP);
-	pHeader->nChecksum = m_Checksum.Calculate (PacketBuffer, nPacketLength);
 
+	assert (pData != 0);
+	assert (nLength > 0);
 	assert (m_pNetworkLayer != 0);
+	if (m_pNetworkLayer->IsChecksumOffload (rForeignIP, nPacketLength))
+	{
+		memcpy (PacketBuffer+sizeof (TUDPHeader), pData, nLength);
+
+		pHeader->nChecksum = m_Checksum.CalculatePseudoHeader (nPacketLength);
+	}
+	else
+	{
+		// the data is summed up, while it is copied into the packet
+		pHeader->nChecksum = m_Checksum.CopyAndCalculate (PacketBuffer, sizeof (TUDPHeader),
+								  pData, nLength);
+	}
+
 	boolean bOK = m_pNetworkLayer->Send (rForeignIP, PacketBuffer, nPacketLength, IPPROTO_UDP);
+
+	if (PacketBuffer != FrameBuffer)
+	{
+		delete [] PacketBuffer;
+	}
 	
 	return bOK ? nLength : -1;
 }
 
 int CUDPConnection::ReceiveFrom (void *pBuffer, int nFlags, CIPAddress *pForeignIP, u16 *pForeignPort)
+{
+	// datagrams, which are larger than a frame, are truncated here
+	TSocketMessage Message;
+	Message.pBuffer = pBuffer;
+	Message.nSize = FRAME_BUFFER_SIZE;
+
+	int nResult = ReceiveBatch (&Message, 1, nFlags);
+	if (nResult <= 0)
+	{
+		return nResult;
+	}
+
+	if (   pForeignIP != 0
+	    && pForeignPort != 0)
+	{
+		pForeignIP->Set (Message.ForeignIP);
+		*pForeignPort = Message.nForeignPort;
+	}
+
+	return Message.nLength;
+}
+
+int CUDPConnection::SendMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
+{
+	assert (pIOVec != 0);
+	if (nIOVecCount == 1)
+	{
+		return Send (pIOVec[0].pBuffer, pIOVec[0].nLength, nFlags);
+	}
+
+	unsigned nTotalLength = 0;
+	for (unsigned i = 0; i < nIOVecCount; i++)
+	{
+		if (pIOVec[i].nLength > IP_MAX_PAYLOAD_SIZE - nTotalLength)
+		{
+			return -1;
+		}
+
+		nTotalLength += pIOVec[i].nLength;
+	}
+
+	// gather the datagram
+	u8 FrameBuffer[FRAME_BUFFER_SIZE];
+	u8 *pBuffer = FrameBuffer;
+	if (nTotalLength > sizeof FrameBuffer)
+	{
+		pBuffer = new u8[nTotalLength];
+		if (pBuffer == 0)
+		{
+			return -1;
+		}
+	}
+
+	unsigned nLength = 0;
+	for (unsigned i = 0; i < nIOVecCount; i++)
+	{
+		assert (pIOVec[i].pBuffer != 0 || pIOVec[i].nLength == 0);
+		memcpy (pBuffer + nLength, pIOVec[i].pBuffer, pIOVec[i].nLength);
+		nLength += pIOVec[i].nLength;
+	}
+
+	int nResult = Send (pBuffer, nLength, nFlags);
+
+	if (pBuffer != FrameBuffer)
+	{
+		delete [] pBuffer;
+	}
+
+	return nResult;
+}
+
+int CUDPConnection::ReceiveMsg (const TSocketIOVec *pIOVec, unsigned nIOVecCount, int nFlags)
 {
 	void *pParam;
-	unsigned nLength;
-	do
+	int nResult;
+	CNetBuffer *pBuffer = DequeueDatagram (nFlags, &pParam, &nResult);
+	if (pBuffer == 0)
 	{
-		if (m_nErrno < 0)
+		return nResult;
+	}
+
+	// scatter the datagram, the rest is discarded if the buffers are too small
+	nResult = 0;
+	assert (pIOVec != 0);
+	for (unsigned i = 0; i < nIOVecCount && pBuffer->GetLength () > 0; i++)
+	{
+		unsigned nLength = pBuffer->GetLength ();
+		if (nLength > pIOVec[i].nLength)
 		{
-			int nErrno = m_nErrno;
-			m_nErrno = 0;
+			nLength = pIOVec[i].nLength;
+		}
+
+		assert (pIOVec[i].pBuffer != 0 || nLength == 0);
+		memcpy (pIOVec[i].pBuffer, pBuffer->GetData (), nLength);
+		pBuffer->Pull (nLength);
 
-			return nErrno;
+		nResult += nLength;
+	}
+
+	pBuffer->Release ();
+
+	delete (TUDPPrivateData *) pParam;
+
+	return nResult;
+}
+
+int CUDPConnection::SendBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags)
+{
+	assert (pMessage != 0);
+
+	unsigned i;
+	for (i = 0; i < nCount; i++)
+	{
+		int nResult;
+		if (m_bActiveOpen)
+		{
+			nResult = Send (pMessage[i].pBuffer, pMessage[i].nLength, nFlags);
+		}
+		else
+		{
+			nResult = SendTo (pMessage[i].pBuffer, pMessage[i].nLength, nFlags,
+					  pMessage[i].ForeignIP, pMessage[i].nForeignPort);
 		}
 
-		assert (pBuffer != 0);
-		nLength = m_RxQueue.Dequeue (pBuffer, &pParam);
-		if (nLength == 0)
+		if (nResult < 0)
 		{
-			if (nFlags == MSG_DONTWAIT)
+			if (i == 0)
 			{
-				return 0;
+				return nResult;
 			}
 
-			m_Event.Clear ();
-			m_Event.Wait ();
+			break;
+		}
+	}
 
-			if (m_nErrno < 0)
-			{
-				int nErrno = m_nErrno;
-				m_nErrno = 0;
+	return i;
+}
+
+int CUDPConnection::ReceiveBatch (TSocketMessage *pMessage, unsigned nCount, int nFlags)
+{
+	assert (pMessage != 0);
+
+	unsigned i;
+	for (i = 0; i < nCount; i++)
+	{
+		// an error is reported with the next call, if datagrams have been received
+		if (   i > 0
+		    && m_nErrno < 0)
+		{
+			break;
+		}
 
-				return nErrno;
+		// wait for the first datagram only
+		void *pParam;
+		int nResult;
+		CNetBuffer *pBuffer = DequeueDatagram (i == 0 ? nFlags : MSG_DONTWAIT,
+						       &pParam, &nResult);
+		if (pBuffer == 0)
+		{
+			if (i == 0)
+			{
+				return nResult;
 			}
+
+			break;
 		}
-	}
-	while (nLength == 0);
 
-	TUDPPrivateData *pData = (TUDPPrivateData *) pParam;
-	assert (pData != 0);
+		unsigned nLength = pBuffer->GetLength ();
+		if (nLength > pMessage[i].nSize)
+		{
+			nLength = pMessage[i].nSize;
+		}
 
-	if (   pForeignIP != 0
-	    && pForeignPort != 0)
-	{
-		pForeignIP->Set (pData->SourceAddress);
-		*pForeignPort = pData->nSourcePort;
-	}
+		assert (pMessage[i].pBuffer != 0 || nLength == 0);
+		memcpy (pMessage[i].pBuffer, pBuffer->GetData (), nLength);
+		pMessage[i].nLength = nLength;
+
+		pBuffer->Release ();
+
+		TUDPPrivateData *pData = (TUDPPrivateData *) pParam;
+		assert (pData != 0);
 
-	delete pData;
+		pMessage[i].ForeignIP.Set (pData->SourceAddress);
+		pMessage[i].nForeignPort = pData->nSourcePort;
 
-	return nLength;
+		delete pData;
+	}
+
+	return i;
 }
 
 int CUDPConnection::SetOptionBroadcast (boolean bAllowed)
@@ -314,6 +471,11 @@ int CUDPConnection::SetOptionBroadcast (boolean bAllowed)
 	return 0;
 }
 
+int CUDPConnection::SetOptionBufferSizes (unsigned nRxBufferSize, unsigned nTxBufferSize)
+{
+	return 0;
+}
+
 boolean CUDPConnection::IsConnected (void) const
 {
 	return FALSE;
@@ -323,11 +485,54 @@ boolean CUDPConnection::IsTerminated (void) const
 {
 	return !m_bOpen;
 }
+
+boolean CUDPConnection::IsWildcard (void) const
+{
+	// a connection to a broadcast address accepts packets from any host
+	return TRUE;
+}
 	
+unsigned CUDPConnection::GetPollEvents (void) const
+{
+	unsigned nEvents = 0;
+
+	if (!m_RxQueue.IsEmpty ())
+	{
+		nEvents |= POLLIN;
+	}
+
+	if (m_bOpen)
+	{
+		nEvents |= POLLOUT;		// sending does never block
+	}
+
+	if (m_nErrno < 0)
+	{
+		nEvents |= POLLERR;
+	}
+
+	return nEvents;
+}
+
 void CUDPConnection::Process (void)
 {
 }
 
+int CUDPConnection::PacketReceived (CNetBuffer *pBuffer,
+				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol)
+{
+	assert (pBuffer != 0);
+	assert (m_pRxBuffer == 0);
+	m_pRxBuffer = pBuffer;
+
+	int nResult = PacketReceived (pBuffer->GetData (), pBuffer->GetLength (),
+				      rSenderIP, rReceiverIP, nProtocol);
+
+	m_pRxBuffer = 0;
+
+	return nResult;
+}
+
 int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 				    CIPAddress &rSenderIP, CIPAddress &rReceiverIP, int nProtocol)
 {
@@ -375,7 +580,7 @@ int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 		m_Checksum.SetSourceAddress (rSenderIP);
 		m_Checksum.SetDestinationAddress (rReceiverIP);
 
-		if (m_Checksum.Calculate (pPacket, nLength) != CHECKSUM_OK)
+		if (!m_Checksum.IsValid (pPacket, nLength, m_pRxBuffer))
 		{
 			return -1;
 		}
@@ -396,9 +601,25 @@ int CUDPConnection::PacketReceived (const void *pPacket, unsigned nLength,
 	rSenderIP.CopyTo (pData->SourceAddress);
 	pData->nSourcePort = nSourcePort;
 
-	m_RxQueue.Enqueue ((u8 *) pPacket + sizeof (TUDPHeader), nLength, pData);
+	if (m_pRxBuffer != 0)
+	{
+		// queue the received datagram itself, reduced to its payload
+		assert (m_pRxBuffer->GetData () == pPacket);
+		m_pRxBuffer->Pull (sizeof (TUDPHeader));
+		m_pRxBuffer->Trim (nLength);
 
-	m_Event.Set ();
+		m_pRxBuffer->AddRef ();
+		if (!m_RxQueue.Enqueue (m_pRxBuffer, pData))
+		{
+			delete pData;
+		}
+	}
+	else if (!m_RxQueue.Enqueue ((u8 *) pPacket + sizeof (TUDPHeader), nLength, pData))
+	{
+		delete pData;
+	}
+
+	SetEvent ();
 
 	return 1;
 }
@@ -441,7 +662,54 @@ int CUDPConnection::NotificationReceived (TICMPNotificationType  Type,
 
 	m_nErrno = -1;
 
-	m_Event.Set ();
+	SetEvent ();
 
 	return 1;
 }
+
+void CUDPConnection::SetEvent (void)
+{
+	m_Event.Set ();
+
+	SignalPollEvent ();
+}
+
+CNetBuffer *CUDPConnection::DequeueDatagram (int nFlags, void **ppParam, int *pResult)
+{
+	assert (pResult != 0);
+
+	if (   nFlags != 0
+	    && nFlags != MSG_DONTWAIT)
+	{
+		*pResult = -1;
+
+		return 0;
+	}
+
+	while (1)
+	{
+		if (m_nErrno < 0)
+		{
+			*pResult = m_nErrno;
+			m_nErrno = 0;
+
+			return 0;
+		}
+
+		CNetBuffer *pBuffer = m_RxQueue.Dequeue (ppParam);
+		if (pBuffer != 0)
+		{
+			return pBuffer;
+		}
+
+		if (nFlags == MSG_DONTWAIT)
+		{
+			*pResult = 0;
+
+			return 0;
+		}
+
+		m_Event.Clear ();
+		m_Event.Wait ();
+	}
+}
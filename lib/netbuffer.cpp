@@ -0,0 +1,157 @@
+//
+// netbuffer.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include <circle/netbuffer.h>
+#include <circle/atomic.h>
+#include <circle/synchronize.h>
+#include <circle/logger.h>
+
+LOGMODULE ("netbuf");
+
+CNetBuffer *CNetBuffer::s_pFreeList = 0;
+unsigned CNetBuffer::s_nFreeCount = 0;
+CSpinLock CNetBuffer::s_SpinLock;
+
+CNetBuffer *CNetBuffer::Alloc (unsigned nHeadroom)
+{
+	assert (nHeadroom <= NET_BUFFER_SIZE);
+
+	s_SpinLock.Acquire ();
+
+	CNetBuffer *pBuffer;
+	while ((pBuffer = s_pFreeList) == 0)
+	{
+		s_SpinLock.Release ();
+
+		if (   CurrentExecutionLevel () != TASK_LEVEL
+		    || !ExtendPool ())
+		{
+			return 0;
+		}
+
+		s_SpinLock.Acquire ();
+	}
+
+	s_pFreeList = pBuffer->m_pNext;
+	s_nFreeCount--;
+
+	s_SpinLock.Release ();
+
+	pBuffer->m_pData = pBuffer->m_Buffer;
+	pBuffer->m_nSize = NET_BUFFER_SIZE;
+	pBuffer->m_nRefCount = 1;
+	pBuffer->m_nOffset = nHeadroom;
+	pBuffer->m_nLength = 0;
+	pBuffer->m_ChecksumState = NetChecksumNone;
+	pBuffer->m_pNext = 0;
+
+	return pBuffer;
+}
+
+CNetBuffer *CNetBuffer::AllocLarge (unsigned nSize, unsigned nHeadroom)
+{
+	assert (nHeadroom <= nSize);
+	if (nSize <= NET_BUFFER_SIZE)
+	{
+		return Alloc (nHeadroom);
+	}
+
+	assert (CurrentExecutionLevel () == TASK_LEVEL);
+	u8 *pData = new u8[nSize];
+	if (pData == 0)
+	{
+		return 0;
+	}
+
+	CNetBuffer *pBuffer = Alloc (nHeadroom);
+	if (pBuffer == 0)
+	{
+		delete [] pData;
+
+		return 0;
+	}
+
+	pBuffer->m_pData = pData;
+	pBuffer->m_nSize = nSize;
+
+	return pBuffer;
+}
+
+void CNetBuffer::AddRef (void)
+{
+	assert (m_nRefCount > 0);
+	AtomicIncrement (&m_nRefCount);
+}
+
+void CNetBuffer::Release (void)
+{
+	assert (m_nRefCount > 0);
+	if (AtomicDecrement (&m_nRefCount) > 0)
+	{
+		return;
+	}
+
+	if (m_pData != m_Buffer)
+	{
+		delete [] m_pData;
+		m_pData = m_Buffer;
+	}
+
+	s_SpinLock.Acquire ();
+
+	m_pNext = s_pFreeList;
+	s_pFreeList = this;
+	s_nFreeCount++;
+
+	s_SpinLock.Release ();
+}
+
+unsigned CNetBuffer::GetFreeCount (void)
+{
+	return s_nFreeCount;
+}
+
+boolean CNetBuffer::ExtendPool (void)
+{
+	// heap blocks are cache-line aligned and the object size is a multiple of it
+	u8 *pMemory = new u8[NET_BUFFER_COUNT * sizeof (CNetBuffer)];
+	if (pMemory == 0)
+	{
+		LOGERR ("Cannot extend pool");
+
+		return FALSE;
+	}
+
+	CNetBuffer *pPool = (CNetBuffer *) pMemory;
+	for (unsigned i = 0; i < NET_BUFFER_COUNT; i++)
+	{
+		pPool[i].m_nRefCount = 0;
+		pPool[i].m_pNext = &pPool[i+1];
+	}
+
+	s_SpinLock.Acquire ();
+
+	pPool[NET_BUFFER_COUNT-1].m_pNext = s_pFreeList;
+	s_pFreeList = pPool;
+	s_nFreeCount += NET_BUFFER_COUNT;
+
+	s_SpinLock.Release ();
+
+	return TRUE;
+}
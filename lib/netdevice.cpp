@@ -18,6 +18,18 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/netdevice.h>
+#include <circle/net/in.h>
+#include <assert.h>
+
+#define ETH_HEADER_SIZE		14
+#define ETH_TYPE_OFFSET		12
+#define IP_HEADER_SIZE_MIN	20
+#define IP_FRAGMENT_OFFSET	6
+#define IP_PROTOCOL_OFFSET	9
+#define TCP_CHECKSUM_OFFSET	16
+#define TCP_HEADER_SIZE_MIN	20
+#define UDP_CHECKSUM_OFFSET	6
+#define UDP_HEADER_SIZE		8
 
 const char *CNetDevice::s_SpeedString[NetDeviceSpeedUnknown] =
 {
@@ -41,6 +53,94 @@ void CNetDevice::AddNetDevice (void)
 	}
 }
 
+CNetBuffer *CNetDevice::ReceiveNetBuffer (void)
+{
+	CNetBuffer *pBuffer = CNetBuffer::Alloc (0);
+	if (pBuffer == 0)
+	{
+		return 0;
+	}
+
+	unsigned nLength;
+	if (!ReceiveFrame (pBuffer->Put (FRAME_BUFFER_SIZE), &nLength))
+	{
+		pBuffer->Release ();
+
+		return 0;
+	}
+
+	assert (nLength <= FRAME_BUFFER_SIZE);
+	pBuffer->Trim (nLength);
+
+	return pBuffer;
+}
+
+unsigned CNetDevice::GetChecksumOffset (const void *pFrame, unsigned nLength,
+					unsigned *pStart, boolean *pbUDP)
+{
+	const u8 *pBuffer = (const u8 *) pFrame;
+	assert (pBuffer != 0);
+
+	if (   nLength < ETH_HEADER_SIZE + IP_HEADER_SIZE_MIN
+	    || pBuffer[ETH_TYPE_OFFSET] != 0x08			// IPv4
+	    || pBuffer[ETH_TYPE_OFFSET+1] != 0x00)
+	{
+		return 0;
+	}
+
+	const u8 *pIPHeader = pBuffer + ETH_HEADER_SIZE;
+	unsigned nIPHeaderLength = (pIPHeader[0] & 0xF) * 4;
+	if (   pIPHeader[0] >> 4 != 4
+	    || nIPHeaderLength < IP_HEADER_SIZE_MIN)
+	{
+		return 0;
+	}
+
+	// MF flag or fragment offset set?
+	if (   (pIPHeader[IP_FRAGMENT_OFFSET] & 0x3F) != 0
+	    || pIPHeader[IP_FRAGMENT_OFFSET+1] != 0)
+	{
+		return 0;
+	}
+
+	unsigned nStart = ETH_HEADER_SIZE + nIPHeaderLength;
+	unsigned nOffset;
+	switch (pIPHeader[IP_PROTOCOL_OFFSET])
+	{
+	case IPPROTO_TCP:
+		if (nLength < nStart + TCP_HEADER_SIZE_MIN)
+		{
+			return 0;
+		}
+		nOffset = nStart + TCP_CHECKSUM_OFFSET;
+		*pbUDP = FALSE;
+		break;
+
+	case IPPROTO_UDP:
+		if (nLength < nStart + UDP_HEADER_SIZE)
+		{
+			return 0;
+		}
+		nOffset = nStart + UDP_CHECKSUM_OFFSET;
+		*pbUDP = TRUE;
+		break;
+
+	default:
+		return 0;
+	}
+
+	assert (pStart != 0);
+	*pStart = nStart;
+
+	return nOffset;
+}
+
+void CNetDevice::RegisterEventHandler (TNetDeviceEventHandler *pHandler, void *pParam)
+{
+	m_pEventParam = pParam;
+	m_pEventHandler = pHandler;
+}
+
 const char *CNetDevice::GetSpeedString (TNetDeviceSpeed Speed)
 {
 	if (Speed >= NetDeviceSpeedUnknown)
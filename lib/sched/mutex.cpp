@@ -29,7 +29,9 @@
 
 CMutex::CMutex (void)
 :   m_pOwningTask (0),
-    m_iReentrancyCount (0)
+    m_iReentrancyCount (0),
+    m_event (TRUE),
+    m_SpinLock (TASK_LEVEL)
 {
 }
 
@@ -44,17 +46,26 @@ void CMutex::Acquire (void)
 
     while (true)
     {
+        m_SpinLock.Acquire();
+
         if (m_pOwningTask == nullptr)
         {
             m_pOwningTask = pTask;
             m_iReentrancyCount = 1;
+            m_event.Clear();
+            m_SpinLock.Release();
             return;
         }
         else if (m_pOwningTask == pTask)
         {
             m_iReentrancyCount++;
+            m_SpinLock.Release();
             return;
         }
+
+        m_SpinLock.Release();
+
+        // the event is set on release, so a wake-up cannot get lost
         m_event.Wait();
     }
 }
@@ -65,8 +76,11 @@ void CMutex::Release (void)
     m_iReentrancyCount--;
     if (m_iReentrancyCount == 0)
     {
+        m_SpinLock.Acquire();
         m_pOwningTask = 0;
-        m_event.Pulse();
+        m_event.Set();
+        m_SpinLock.Release();
+
         CScheduler::Get()->Yield();
     }
 }
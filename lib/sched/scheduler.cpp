@@ -22,16 +22,33 @@
 #include <circle/logger.h>
 #include <circle/string.h>
 #include <circle/util.h>
+#include <circle/synchronize.h>
 #include <assert.h>
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	#include <circle/multicore.h>
+#endif
+
 static const char FromScheduler[] = "sched";
 
+static inline unsigned ThisCore (void)
+{
+#ifdef ARM_ALLOW_MULTI_CORE
+	return CMultiCoreSupport::ThisCore ();
+#else
+	return 0;
+#endif
+}
+
 CScheduler *CScheduler::s_pThis = 0;
 
 CScheduler::CScheduler (void)
-:	m_nTasks (0),
-	m_pCurrent (0),
-	m_nCurrent (0),
+:	m_pFirstTask (0),
+	m_pLastTask (0),
+	m_nTasks (0),
+	m_pSleepingQueue (0),
+	m_nNextWakeTicks (0),
+	m_pTerminatedQueue (0),
 	m_pTaskSwitchHandler (0),
 	m_pTaskTerminationHandler (0),
 	m_iSuspendNewTasks (0)
@@ -39,9 +56,24 @@ CScheduler::CScheduler (void)
 	assert (s_pThis == 0);
 	s_pThis = this;
 
-	m_pCurrent = new CTask (0);		// main task currently running
-	assert (m_pCurrent != 0);
-	m_pCurrent->SetName ("main");
+	for (unsigned nCore = 0; nCore < SCHED_CORES; nCore++)
+	{
+		m_pCurrent[nCore] = 0;
+		m_pPrevious[nCore] = 0;
+		m_pIdleTask[nCore] = 0;
+
+		for (unsigned i = 0; i < TASK_PRIORITIES; i++)
+		{
+			m_ReadyQueue[nCore][i].pHead = 0;
+			m_ReadyQueue[nCore][i].pTail = 0;
+		}
+
+		m_nReadyMask[nCore] = 0;
+	}
+
+	CTask *pMainTask = new CTask (0);	// main task currently running
+	assert (pMainTask != 0);
+	pMainTask->SetName ("main");
 }
 
 CScheduler::~CScheduler (void)
@@ -54,31 +86,94 @@ CScheduler::~CScheduler (void)
 
 void CScheduler::Yield (void)
 {
-	while ((m_nCurrent = GetNextTask ()) == MAX_TASKS)	// no task is ready
+	ReapTerminatedTasks ();
+
+	unsigned nCore = ThisCore ();
+
+	m_SpinLock.Acquire ();
+
+	CTask *pCurrent = m_pCurrent[nCore];
+	assert (pCurrent != 0);
+
+	switch (pCurrent->GetState ())
+	{
+	case TaskStateReady:
+		if (   !pCurrent->IsSuspended ()
+		    && pCurrent != m_pIdleTask[nCore])
+		{
+			EnqueueReady (pCurrent);
+		}
+		break;
+
+	case TaskStateSleeping:
+	case TaskStateBlockedWithTimeout:
+		EnqueueSleeping (pCurrent);
+		break;
+
+	case TaskStateBlocked:
+		break;
+
+	case TaskStateTerminated:
+		// cannot be deleted here, because we are running on its stack
+		pCurrent->m_pQueueNext = m_pTerminatedQueue;
+		m_pTerminatedQueue = pCurrent;
+		break;
+
+	default:
+		assert (0);
+		break;
+	}
+
+	CTask *pNext;
+	while ((pNext = GetNextTask (nCore)) == 0)	// no task is ready
 	{
 		assert (m_nTasks > 0);
+
+		if (m_pIdleTask[nCore] != 0)
+		{
+			pNext = m_pIdleTask[nCore];
+
+			break;
+		}
+
+		// allow interrupts to wake a task
+		m_SpinLock.Release ();
+		m_SpinLock.Acquire ();
 	}
 
-	assert (m_nCurrent < MAX_TASKS);
-	CTask *pNext = m_pTask[m_nCurrent];
-	assert (pNext != 0);
-	if (m_pCurrent == pNext)
+	pNext->m_nCore = nCore;
+
+	if (pCurrent != pNext)
+	{
+		// pCurrent remains on this core, until its registers have been saved
+		pNext->m_bOnCore = TRUE;
+
+		m_pPrevious[nCore] = pCurrent;
+	}
+
+	m_pCurrent[nCore] = pNext;
+
+	m_SpinLock.Release ();
+
+	if (pCurrent == pNext)
 	{
 		return;
 	}
-	
-	TTaskRegisters *pOldRegs = m_pCurrent->GetRegs ();
-	m_pCurrent = pNext;
-	TTaskRegisters *pNewRegs = m_pCurrent->GetRegs ();
+
+	TTaskRegisters *pOldRegs = pCurrent->GetRegs ();
+	TTaskRegisters *pNewRegs = pNext->GetRegs ();
 
 	if (m_pTaskSwitchHandler != 0)
 	{
-		(*m_pTaskSwitchHandler) (m_pCurrent);
+		(*m_pTaskSwitchHandler) (pNext);
 	}
 
 	assert (pOldRegs != 0);
 	assert (pNewRegs != 0);
 	TaskSwitch (pOldRegs, pNewRegs);
+
+	// may continue on another core here
+	FinishTaskSwitch ();
 }
 
 void CScheduler::Sleep (unsigned nSeconds)
@@ -111,10 +206,11 @@ void CScheduler::usSleep (unsigned nMicroSeconds)
 
 		unsigned nStartTicks = CTimer::Get ()->GetClockTicks ();
 
-		assert (m_pCurrent != 0);
-		assert (m_pCurrent->GetState () == TaskStateReady);
-		m_pCurrent->SetWakeTicks (nStartTicks + nTicks);
-		m_pCurrent->SetState (TaskStateSleeping);
+		CTask *pCurrent = GetCurrentTask ();
+		assert (pCurrent != 0);
+		assert (pCurrent->GetState () == TaskStateReady);
+		pCurrent->SetWakeTicks (nStartTicks + nTicks);
+		pCurrent->SetState (TaskStateSleeping);
 
 		Yield ();
 	}
@@ -122,19 +218,55 @@ void CScheduler::usSleep (unsigned nMicroSeconds)
 
 CTask *CScheduler::GetCurrentTask (void)
 {
-	return m_pCurrent;
+	return m_pCurrent[ThisCore ()];
 }
 
+#ifdef ARM_ALLOW_MULTI_CORE
+
+void CScheduler::RunSecondaryCore (void)
+{
+	unsigned nCore = ThisCore ();
+	assert (0 < nCore && nCore < SCHED_CORES);
+	assert (m_pIdleTask[nCore] == 0);
+
+	CTask *pIdleTask = new CTask (0);	// becomes the current task of this core
+	assert (pIdleTask != 0);
+
+	CString Name;
+	Name.Format ("idle%u", nCore);
+	pIdleTask->SetName (Name);
+
+	m_pIdleTask[nCore] = pIdleTask;
+
+	while (1)
+	{
+		DataMemBarrier ();
+
+		// look for work without acquiring the spin lock
+		boolean bWork =    m_pTerminatedQueue != 0
+				|| (   m_pSleepingQueue != 0
+				    && (int) (m_nNextWakeTicks - CTimer::GetClockTicks ()) <= 0);
+		for (unsigned i = 0; !bWork && i < SCHED_CORES; i++)
+		{
+			bWork = m_nReadyMask[i] != 0;
+		}
+
+		if (bWork)
+		{
+			Yield ();
+		}
+	}
+}
+
+#endif
+
 CTask *CScheduler::GetTask (const char *pTaskName)
 {
 	assert (pTaskName != 0);
 
-	for (unsigned i = 0; i < m_nTasks; i++)
+	for (CTask *pTask = m_pFirstTask; pTask != 0; pTask = pTask->m_pTaskNext)
 	{
-		CTask *pTask = m_pTask[i];
-
-		if (   pTask != 0
-		    && strcmp (pTask->GetName (), pTaskName) == 0)
+		if (strcmp (pTask->GetName (), pTaskName) == 0)
 		{
 			return pTask;
 		}
@@ -145,10 +277,9 @@ CTask *CScheduler::GetTask (const char *pTaskName)
 
 boolean CScheduler::IsValidTask (CTask *pTask)
 {
-	unsigned i;
-	for (i = 0; i < m_nTasks; i++)
+	for (CTask *pListTask = m_pFirstTask; pListTask != 0; pListTask = pListTask->m_pTaskNext)
 	{
-		if (m_pTask[i] != 0 && m_pTask[i] == pTask)
+		if (pListTask == pTask)
 			return TRUE;
 	}
 
@@ -181,12 +312,11 @@ void CScheduler::ResumeNewTasks (void)
 	if (m_iSuspendNewTasks == 0)
 	{
 		// Resume all new tasks
-		unsigned i;
-		for (i = 0; i < m_nTasks; i++)
+		for (CTask *pTask = m_pFirstTask; pTask != 0; pTask = pTask->m_pTaskNext)
 		{
-			if (m_pTask[i] != 0 && m_pTask[i]->GetState() == TaskStateNew)
+			if (pTask->GetState() == TaskStateNew)
 			{
-				m_pTask[i]->Start();
+				pTask->Start();
 			}
 		}
 
@@ -197,17 +327,12 @@ void CScheduler::ListTasks (CDevice *pTarget)
 {
 	assert (pTarget != 0);
 
-	static const char Header[] = "#  ADDR     STAT  FL NAME\n";
+	static const char Header[] = "#  ADDR     STAT  FL PR C NAME\n";
 	pTarget->Write (Header, sizeof Header-1);
 
-	for (unsigned i = 0; i < m_nTasks; i++)
+	unsigned i = 0;
+	for (CTask *pTask = m_pFirstTask; pTask != 0; pTask = pTask->m_pTaskNext, i++)
 	{
-		CTask *pTask = m_pTask[i];
-		if (pTask == 0)
-		{
-			continue;
-		}
-
 		TTaskState State = pTask->GetState ();
 		assert (State < TaskStateUnknown);
 
@@ -216,11 +341,13 @@ void CScheduler::ListTasks (CDevice *pTarget)
 			{"new", "ready", "block", "block", "sleep", "term"};
 
 		CString Line;
-		Line.Format ("%02u %08lX %-5s %c%c %s\n",
+		Line.Format ("%02u %08lX %-5s %c%c %2u %u %s\n",
 			     i, (uintptr) pTask,
-			     pTask == m_pCurrent ? "run" : StateNames[State],
+			     IsRunning (pTask) ? "run" : StateNames[State],
 			     pTask->IsSuspended () ? 'S' : ' ',
 			     State == TaskStateBlockedWithTimeout ? 'T' : ' ',
+			     pTask->GetPriority (),
+			     pTask->m_nCore,
 			     pTask->GetName ());
 
 		pTarget->Write (Line, Line.GetLength ());
@@ -236,69 +363,269 @@ void CScheduler::AddTask (CTask *pTask)
 		pTask->SetState(TaskStateNew);
 	}
 
-	unsigned i;
-	for (i = 0; i < m_nTasks; i++)
+	m_SpinLock.Acquire ();
+
+	pTask->m_pTaskPrev = m_pLastTask;
+	pTask->m_pTaskNext = 0;
+	if (m_pLastTask != 0)
 	{
-		if (m_pTask[i] == 0)
-		{
-			m_pTask[i] = pTask;
+		m_pLastTask->m_pTaskNext = pTask;
+	}
+	else
+	{
+		m_pFirstTask = pTask;
+	}
+	m_pLastTask = pTask;
 
-			return;
-		}
+	m_nTasks++;
+
+	if (pTask->m_nStackSize == 0)
+	{
+		// the main task or the idle task of a secondary core is running and not queued
+		unsigned nCore = ThisCore ();
+		assert (nCore < SCHED_CORES);
+		assert (m_pCurrent[nCore] == 0);
+
+		pTask->m_nAffinity = nCore;
+		pTask->m_nCore = nCore;
+		pTask->m_bOnCore = TRUE;
+
+		m_pCurrent[nCore] = pTask;
+	}
+	else if (pTask->GetState () == TaskStateReady)
+	{
+		EnqueueReady (pTask);
 	}
 
-	if (m_nTasks >= MAX_TASKS)
+	m_SpinLock.Release ();
+}
+
+void CScheduler::StartTask (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	m_SpinLock.Acquire ();
+
+	if (pTask->GetState () == TaskStateNew)
+	{
+		pTask->SetState (TaskStateReady);
+	}
+	else
+	{
+		assert (pTask->m_bSuspended);
+		pTask->m_bSuspended = FALSE;
+	}
+
+	if (   pTask->GetState () == TaskStateReady
+	    && !IsRunning (pTask))
+	{
+		EnqueueReady (pTask);
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CScheduler::SuspendTask (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	m_SpinLock.Acquire ();
+
+	assert (pTask->GetState () != TaskStateNew);
+	assert (!pTask->m_bSuspended);
+	pTask->m_bSuspended = TRUE;
+
+	if (   pTask->GetState () == TaskStateReady
+	    && !IsRunning (pTask))
+	{
+		DequeueReady (pTask);
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CScheduler::SetTaskPriority (CTask *pTask, unsigned nPriority)
+{
+	assert (pTask != 0);
+	assert (nPriority < TASK_PRIORITIES);
+
+	m_SpinLock.Acquire ();
+
+	if (   pTask->GetState () == TaskStateReady
+	    && !pTask->IsSuspended ()
+	    && !IsRunning (pTask))
+	{
+		DequeueReady (pTask);
+		pTask->m_nPriority = nPriority;
+		EnqueueReady (pTask);
+	}
+	else
+	{
+		pTask->m_nPriority = nPriority;
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CScheduler::SetTaskAffinity (CTask *pTask, unsigned nCore)
+{
+	assert (pTask != 0);
+	assert (nCore < SCHED_CORES || nCore == TASK_CORE_ANY);
+
+	m_SpinLock.Acquire ();
+
+	// a running task moves to the new core, when it yields next time
+	if (   pTask->GetState () == TaskStateReady
+	    && !pTask->IsSuspended ()
+	    && !IsRunning (pTask))
 	{
-		CLogger::Get ()->Write (FromScheduler, LogPanic, "System limit of tasks exceeded");
+		DequeueReady (pTask);
+		pTask->m_nAffinity = nCore;
+		EnqueueReady (pTask);
+	}
+	else
+	{
+		pTask->m_nAffinity = nCore;
 	}
 
-	m_pTask[m_nTasks++] = pTask;
+	m_SpinLock.Release ();
+}
+
+void CScheduler::FinishTaskSwitch (void)
+{
+	unsigned nCore = ThisCore ();
+
+	CTask *pPrevious = m_pPrevious[nCore];
+	if (pPrevious != 0)
+	{
+		m_pPrevious[nCore] = 0;
+
+#ifdef ARM_ALLOW_MULTI_CORE
+		DataMemBarrier ();	// registers of pPrevious have been saved before
+#endif
+
+		pPrevious->m_bOnCore = FALSE;
+	}
 }
 
 void CScheduler::RemoveTask (CTask *pTask)
 {
-	for (unsigned i = 0; i < m_nTasks; i++)
+	assert (pTask != 0);
+	assert (m_nTasks > 0);
+
+	m_SpinLock.Acquire ();
+
+	if (pTask->m_pTaskPrev != 0)
 	{
-		if (m_pTask[i] == pTask)
-		{
-			m_pTask[i] = 0;
+		pTask->m_pTaskPrev->m_pTaskNext = pTask->m_pTaskNext;
+	}
+	else
+	{
+		assert (m_pFirstTask == pTask);
+		m_pFirstTask = pTask->m_pTaskNext;
+	}
 
-			if (i == m_nTasks-1)
-			{
-				m_nTasks--;
-			}
+	if (pTask->m_pTaskNext != 0)
+	{
+		pTask->m_pTaskNext->m_pTaskPrev = pTask->m_pTaskPrev;
+	}
+	else
+	{
+		assert (m_pLastTask == pTask);
+		m_pLastTask = pTask->m_pTaskPrev;
+	}
+
+	m_nTasks--;
+
+	m_SpinLock.Release ();
+}
 
-			return;
+void CScheduler::ReapTerminatedTasks (void)
+{
+	if (m_pTerminatedQueue == 0)
+	{
+		return;
+	}
+
+	m_SpinLock.Acquire ();
+
+	// a task cannot be deleted, before another core has switched away from it
+	CTask *pTask = 0;
+	CTask **ppPrev = &m_pTerminatedQueue;
+	while (*ppPrev != 0)
+	{
+		CTask *pTerminated = *ppPrev;
+		if (!pTerminated->m_bOnCore)
+		{
+			*ppPrev = pTerminated->m_pQueueNext;
+
+			pTerminated->m_pQueueNext = pTask;
+			pTask = pTerminated;
+		}
+		else
+		{
+			ppPrev = &pTerminated->m_pQueueNext;
 		}
 	}
 
-	assert (0);
+	m_SpinLock.Release ();
+
+	while (pTask != 0)
+	{
+		assert (!IsRunning (pTask));
+		assert (pTask->GetState () == TaskStateTerminated);
+
+		CTask *pNext = pTask->m_pQueueNext;
+
+		if (m_pTaskTerminationHandler != 0)
+		{
+			(*m_pTaskTerminationHandler) (pTask);
+		}
+
+		RemoveTask (pTask);
+		delete pTask;
+
+		pTask = pNext;
+	}
 }
 
-boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
+boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds,
+			       const volatile boolean *pState)
 {
 	assert (ppWaitListHead != 0);
-	assert (m_pCurrent->m_pWaitListNext == 0);
-	assert (m_pCurrent != 0);
-	assert (m_pCurrent->GetState () == TaskStateReady);
+	assert (pState != 0);
+
+	// the task may continue on another core after Yield()
+	CTask *pCurrent = GetCurrentTask ();
+	assert (pCurrent != 0);
+	assert (pCurrent->m_pWaitListNext == 0);
+	assert (pCurrent->GetState () == TaskStateReady);
 
 	m_SpinLock.Acquire ();
 
+	// the event may have been set on another core in the meantime
+	if (*pState)
+	{
+		m_SpinLock.Release ();
+
+		return FALSE;
+	}
+
 	// Add current task to waiting task list
-	m_pCurrent->m_pWaitListNext = *ppWaitListHead;
-	*ppWaitListHead = m_pCurrent;
+	pCurrent->m_pWaitListNext = *ppWaitListHead;
+	*ppWaitListHead = pCurrent;
 
 	if (nMicroSeconds == 0)
 	{
-		m_pCurrent->SetState (TaskStateBlocked);
+		pCurrent->SetState (TaskStateBlocked);
 	}
 	else
 	{
 		unsigned nTicks = nMicroSeconds * (CLOCKHZ / 1000000);
 		unsigned nStartTicks = CTimer::Get ()->GetClockTicks ();
 
-		m_pCurrent->SetWakeTicks (nStartTicks + nTicks);
-		m_pCurrent->SetState (TaskStateBlockedWithTimeout);
+		pCurrent->SetWakeTicks (nStartTicks + nTicks);
+		pCurrent->SetState (TaskStateBlockedWithTimeout);
 	}
 	
 	m_SpinLock.Release ();
@@ -314,7 +641,7 @@ boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
 	CTask* p = *ppWaitListHead;
 	while (p)
 	{
-		if (p == m_pCurrent)
+		if (p == pCurrent)
 		{
 			if (pPrev)
 				pPrev->m_pWaitListNext = p->m_pWaitListNext;
@@ -324,12 +651,12 @@ boolean CScheduler::BlockTask (CTask **ppWaitListHead, unsigned nMicroSeconds)
 		pPrev = p;
 		p = p->m_pWaitListNext;
 	}
-	m_pCurrent->m_pWaitListNext = nullptr;
+	pCurrent->m_pWaitListNext = nullptr;
 
 	m_SpinLock.Release ();
 
 	// GetWakeTicks Will be zero if timeout expired, non-zero if event signalled
-	return m_pCurrent->GetWakeTicks() == 0;		
+	return pCurrent->GetWakeTicks() == 0;		
 }
 
 void CScheduler::WakeTasks (CTask **ppWaitListHead)
@@ -343,96 +670,278 @@ void CScheduler::WakeTasks (CTask **ppWaitListHead)
 
 	while (pTask)
 	{
-#ifdef NDEBUG
-		if (   pTask == 0
-		    ||    (pTask->GetState () != TaskStateBlocked
-		       && pTask->GetState () != TaskStateBlockedWithTimeout))
+		CTask* pNext = pTask->m_pWaitListNext;
+		pTask->m_pWaitListNext = 0;
+
+		TTaskState State = pTask->GetState ();
+
+		// a task, which has timed out, is ready, but may not have removed itself yet
+		if (State != TaskStateReady)
 		{
-			CLogger::Get ()->Write (FromScheduler, LogPanic, "Tried to wake non-blocked task");
-		}
+#ifdef NDEBUG
+			if (   State != TaskStateBlocked
+			    && State != TaskStateBlockedWithTimeout)
+			{
+				CLogger::Get ()->Write (FromScheduler, LogPanic, "Tried to wake non-blocked task");
+			}
 #else
-		assert (pTask != 0);
-		assert (   pTask->GetState () == TaskStateBlocked
-		        || pTask->GetState () == TaskStateBlockedWithTimeout);
+			assert (   State == TaskStateBlocked
+			        || State == TaskStateBlockedWithTimeout);
 #endif
 
-		pTask->SetState (TaskStateReady);
+			pTask->SetState (TaskStateReady);
+
+			// a running task is queued in Yield()
+			if (!IsRunning (pTask))
+			{
+				if (State == TaskStateBlockedWithTimeout)
+				{
+					DequeueSleeping (pTask);
+				}
+
+				if (!pTask->IsSuspended ())
+				{
+					EnqueueReady (pTask);
+				}
+			}
+		}
 
-		CTask* pNext = pTask->m_pWaitListNext;
-		pTask->m_pWaitListNext = 0;
 		pTask = pNext;
 	}
 
 	m_SpinLock.Release ();
 }
 
-unsigned CScheduler::GetNextTask (void)
+boolean CScheduler::IsRunning (CTask *pTask) const
 {
-	unsigned nTask = m_nCurrent < MAX_TASKS ? m_nCurrent : 0;
+	assert (pTask != 0);
+	assert (pTask->m_nCore < SCHED_CORES);
 
-	unsigned nTicks = CTimer::Get ()->GetClockTicks ();
+	return m_pCurrent[pTask->m_nCore] == pTask;
+}
 
-	for (unsigned i = 1; i <= m_nTasks; i++)
+CTask *CScheduler::GetNextTask (unsigned nCore)
+{
+	if (m_pSleepingQueue != 0)
 	{
-		if (++nTask >= m_nTasks)
-		{
-			nTask = 0;
-		}
+		WakeSleepingTasks ();
+	}
 
-		CTask *pTask = m_pTask[nTask];
-		if (pTask == 0)
-		{
-			continue;
-		}
+	CTask *pTask = FindReadyTask (nCore, nCore);
 
-		if (pTask->IsSuspended ())
-		{
-			continue;
-		}
+	// steal a migratable task from another core
+	for (unsigned i = 1; pTask == 0 && i < SCHED_CORES; i++)
+	{
+		pTask = FindReadyTask ((nCore + i) % SCHED_CORES, nCore);
+	}
 
-		switch (pTask->GetState ())
-		{
-		case TaskStateReady:
-			return nTask;
+	return pTask;
+}
 
-		case TaskStateBlocked:
-		case TaskStateNew:
-			continue;
+CTask *CScheduler::FindReadyTask (unsigned nQueueCore, unsigned nCore)
+{
+	assert (nQueueCore < SCHED_CORES);
+	assert (nCore < SCHED_CORES);
+
+	u32 nMask = m_nReadyMask[nQueueCore];
+	while (nMask != 0)
+	{
+		unsigned nPriority = 31 - __builtin_clz (nMask);
+		assert (nPriority < TASK_PRIORITIES);
 
-		case TaskStateBlockedWithTimeout:
-			if ((int) (pTask->GetWakeTicks () - nTicks) > 0)
+		for (CTask *pTask = m_ReadyQueue[nQueueCore][nPriority].pHead;
+		     pTask != 0; pTask = pTask->m_pQueueNext)
+		{
+			// the current task may continue here after changing its affinity
+			if (   nQueueCore != nCore
+			    && pTask->m_nAffinity != TASK_CORE_ANY
+			    && pTask != m_pCurrent[nCore])
 			{
 				continue;
 			}
-			pTask->SetState (TaskStateReady);
-			pTask->SetWakeTicks(0);		// Use as flag that timeout expired
-			return nTask;
 
-
-		case TaskStateSleeping:
-			if ((int) (pTask->GetWakeTicks () - nTicks) > 0)
+			// skip a task, which is still switched away from on another core
+			if (   pTask->m_bOnCore
+			    && pTask != m_pCurrent[nCore])
 			{
 				continue;
 			}
-			pTask->SetState (TaskStateReady);
-			return nTask;
 
-		case TaskStateTerminated:
-			if (m_pTaskTerminationHandler != 0)
-			{
-				(*m_pTaskTerminationHandler) (pTask);
-			}
-			RemoveTask (pTask);
-			delete pTask;
-			return MAX_TASKS;
+			DequeueReady (pTask);
 
-		default:
-			assert (0);
-			break;
+			return pTask;
 		}
+
+		nMask &= ~(1U << nPriority);
 	}
 
-	return MAX_TASKS;
+	return 0;
+}
+
+void CScheduler::EnqueueReady (CTask *pTask)
+{
+	assert (pTask != 0);
+	assert (pTask->GetState () == TaskStateReady);
+	assert (!pTask->IsSuspended ());
+
+	// a pinned task is queued on its core, a migratable task on its last core
+	if (pTask->m_nAffinity < SCHED_CORES)
+	{
+		pTask->m_nCore = pTask->m_nAffinity;
+	}
+	unsigned nCore = pTask->m_nCore;
+	assert (nCore < SCHED_CORES);
+
+	unsigned nPriority = pTask->GetPriority ();
+	assert (nPriority < TASK_PRIORITIES);
+	TTaskQueue *pQueue = &m_ReadyQueue[nCore][nPriority];
+
+	pTask->m_pQueueNext = 0;
+	pTask->m_pQueuePrev = pQueue->pTail;
+	if (pQueue->pTail != 0)
+	{
+		pQueue->pTail->m_pQueueNext = pTask;
+	}
+	else
+	{
+		pQueue->pHead = pTask;
+	}
+	pQueue->pTail = pTask;
+
+	m_nReadyMask[nCore] |= 1U << nPriority;
+}
+
+void CScheduler::DequeueReady (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	unsigned nCore = pTask->m_nCore;
+	assert (nCore < SCHED_CORES);
+
+	unsigned nPriority = pTask->GetPriority ();
+	assert (nPriority < TASK_PRIORITIES);
+	TTaskQueue *pQueue = &m_ReadyQueue[nCore][nPriority];
+
+	if (pTask->m_pQueuePrev != 0)
+	{
+		pTask->m_pQueuePrev->m_pQueueNext = pTask->m_pQueueNext;
+	}
+	else
+	{
+		assert (pQueue->pHead == pTask);
+		pQueue->pHead = pTask->m_pQueueNext;
+	}
+
+	if (pTask->m_pQueueNext != 0)
+	{
+		pTask->m_pQueueNext->m_pQueuePrev = pTask->m_pQueuePrev;
+	}
+	else
+	{
+		assert (pQueue->pTail == pTask);
+		pQueue->pTail = pTask->m_pQueuePrev;
+	}
+
+	pTask->m_pQueuePrev = 0;
+	pTask->m_pQueueNext = 0;
+
+	if (pQueue->pHead == 0)
+	{
+		m_nReadyMask[nCore] &= ~(1U << nPriority);
+	}
+}
+
+void CScheduler::EnqueueSleeping (CTask *pTask)
+{
+	assert (pTask != 0);
+	assert (   pTask->GetState () == TaskStateSleeping
+		|| pTask->GetState () == TaskStateBlockedWithTimeout);
+
+	unsigned nWakeTicks = pTask->GetWakeTicks ();
+
+	// insert behind all tasks with an earlier or the same wake time
+	CTask *pPrev = 0;
+	CTask *pNext = m_pSleepingQueue;
+	while (   pNext != 0
+	       && (int) (pNext->GetWakeTicks () - nWakeTicks) <= 0)
+	{
+		pPrev = pNext;
+		pNext = pNext->m_pQueueNext;
+	}
+
+	pTask->m_pQueuePrev = pPrev;
+	pTask->m_pQueueNext = pNext;
+
+	if (pPrev != 0)
+	{
+		pPrev->m_pQueueNext = pTask;
+	}
+	else
+	{
+		m_pSleepingQueue = pTask;
+		m_nNextWakeTicks = nWakeTicks;
+	}
+
+	if (pNext != 0)
+	{
+		pNext->m_pQueuePrev = pTask;
+	}
+}
+
+void CScheduler::DequeueSleeping (CTask *pTask)
+{
+	assert (pTask != 0);
+
+	if (pTask->m_pQueuePrev != 0)
+	{
+		pTask->m_pQueuePrev->m_pQueueNext = pTask->m_pQueueNext;
+	}
+	else
+	{
+		assert (m_pSleepingQueue == pTask);
+		m_pSleepingQueue = pTask->m_pQueueNext;
+
+		if (m_pSleepingQueue != 0)
+		{
+			m_nNextWakeTicks = m_pSleepingQueue->GetWakeTicks ();
+		}
+	}
+
+	if (pTask->m_pQueueNext != 0)
+	{
+		pTask->m_pQueueNext->m_pQueuePrev = pTask->m_pQueuePrev;
+	}
+
+	pTask->m_pQueuePrev = 0;
+	pTask->m_pQueueNext = 0;
+}
+
+void CScheduler::WakeSleepingTasks (void)
+{
+	unsigned nTicks = CTimer::Get ()->GetClockTicks ();
+
+	CTask *pTask;
+	while (   (pTask = m_pSleepingQueue) != 0
+	       && (int) (pTask->GetWakeTicks () - nTicks) <= 0)
+	{
+		DequeueSleeping (pTask);
+
+		if (pTask->GetState () == TaskStateBlockedWithTimeout)
+		{
+			pTask->SetWakeTicks (0);	// Use as flag that timeout expired
+		}
+		else
+		{
+			assert (pTask->GetState () == TaskStateSleeping);
+		}
+
+		pTask->SetState (TaskStateReady);
+
+		if (!pTask->IsSuspended ())
+		{
+			EnqueueReady (pTask);
+		}
+	}
 }
 
 CScheduler *CScheduler::Get (void)
@@ -40,46 +40,61 @@ unsigned CSemaphore::GetState (void) const
 
 void CSemaphore::Down (void)
 {
-	while (AtomicGet (&m_nCount) == 0)
+	m_SpinLock.Acquire ();
+
+	while (m_nCount == 0)
 	{
+		m_SpinLock.Release ();
+
 		m_Event.Wait ();
+
+		m_SpinLock.Acquire ();
 	}
 
-	if (AtomicDecrement (&m_nCount) == 0)
+	if (--m_nCount == 0)
 	{
 		assert (m_Event.GetState ());
 		m_Event.Clear ();
 	}
+
+	m_SpinLock.Release ();
 }
 
 void CSemaphore::Up (void)
 {
-	if (AtomicIncrement (&m_nCount) == 1)
+	m_SpinLock.Acquire ();
+
+	if (++m_nCount == 1)
 	{
 		assert (!m_Event.GetState ());
 		m_Event.Set ();
 	}
-#if NDEBUG
 	else
 	{
 		assert (m_Event.GetState ());
 	}
-#endif
 
+	m_SpinLock.Release ();
 }
 
 boolean CSemaphore::TryDown (void)
 {
-	if (AtomicGet (&m_nCount) == 0)
+	m_SpinLock.Acquire ();
+
+	if (m_nCount == 0)
 	{
+		m_SpinLock.Release ();
+
 		return FALSE;
 	}
 
-	if (AtomicDecrement (&m_nCount) == 0)
+	if (--m_nCount == 0)
 	{
 		assert (m_Event.GetState ());
 		m_Event.Clear ();
 	}
 
+	m_SpinLock.Release ();
+
 	return TRUE;
 }
@@ -81,7 +81,7 @@ void CSynchronizationEvent::Wait (void)
 {
 	if (!m_bState)
 	{
-		CScheduler::Get ()->BlockTask (&m_pWaitListHead, 0);
+		CScheduler::Get ()->BlockTask (&m_pWaitListHead, 0, &m_bState);
 	}
 }
 
@@ -93,6 +93,6 @@ boolean CSynchronizationEvent::WaitWithTimeout (unsigned nMicroSeconds)
 	}
 	else
 	{
-		return CScheduler::Get ()->BlockTask (&m_pWaitListHead, nMicroSeconds);
+		return CScheduler::Get ()->BlockTask (&m_pWaitListHead, nMicroSeconds, &m_bState);
 	}
 }
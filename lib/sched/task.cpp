@@ -27,7 +27,15 @@ CTask::CTask (unsigned nStackSize, boolean bCreateSuspended)
 	m_bSuspended (FALSE),
 	m_nStackSize (nStackSize),
 	m_pStack (0),
-	m_pWaitListNext (0)
+	m_pWaitListNext (0),
+	m_nPriority (TASK_PRIORITY_DEFAULT),
+	m_nAffinity (0),
+	m_nCore (0),
+	m_bOnCore (FALSE),
+	m_pQueuePrev (0),
+	m_pQueueNext (0),
+	m_pTaskPrev (0),
+	m_pTaskNext (0)
 {
 	for (unsigned i = 0; i < TASK_USER_DATA_SLOTS; i++)
 	{
@@ -64,22 +72,26 @@ CTask::~CTask (void)
 
 void CTask::Start (void)
 {
-	if (m_State == TaskStateNew)
-	{
-		m_State = TaskStateReady;
-	}
-	else
-	{
-		assert (m_bSuspended);
-		m_bSuspended = FALSE;
-	}
+	CScheduler::Get ()->StartTask (this);
 }
 
 void CTask::Suspend (void)
 {
-	assert (m_State != TaskStateNew);
-	assert (!m_bSuspended);
-	m_bSuspended = TRUE;
+	CScheduler::Get ()->SuspendTask (this);
+}
+
+void CTask::SetPriority (unsigned nPriority)
+{
+	assert (nPriority < TASK_PRIORITIES);
+
+	CScheduler::Get ()->SetTaskPriority (this, nPriority);
+}
+
+void CTask::SetCoreAffinity (unsigned nCore)
+{
+	assert (nCore < SCHED_CORES || nCore == TASK_CORE_ANY);
+
+	CScheduler::Get ()->SetTaskAffinity (this, nCore);
 }
 
 void CTask::Run (void)		// dummy method which is never called
@@ -173,6 +185,8 @@ void CTask::TaskEntry (void *pParam)
 	CTask *pThis = (CTask *) pParam;
 	assert (pThis != 0);
 
+	CScheduler::Get ()->FinishTaskSwitch ();
+
 	pThis->Run ();
 
 	pThis->m_State = TaskStateTerminated;
@@ -206,6 +206,7 @@ CUSBBulkOnlyMassStorageDevice::CUSBBulkOnlyMassStorageDevice (CUSBFunction *pFun
 	m_nCWBTag (0),
 	m_nBlockCount (0),
 	m_ullOffset (0),
+	m_RequestQueue (TransferHandler, this),
 	m_pPartitionManager (0),
 	m_nDeviceNumber (0)
 {
@@ -213,6 +214,9 @@ CUSBBulkOnlyMassStorageDevice::CUSBBulkOnlyMassStorageDevice (CUSBFunction *pFun
 
 CUSBBulkOnlyMassStorageDevice::~CUSBBulkOnlyMassStorageDevice (void)
 {
+	// the device has been removed
+	m_RequestQueue.Cancel ();
+
 	if (m_nDeviceNumber != 0)
 	{
 		CDeviceNameService::Get ()->RemoveDevice ("umsd", m_nDeviceNumber, TRUE);
@@ -424,72 +428,100 @@ boolean CUSBBulkOnlyMassStorageDevice::Configure (void)
 
 int CUSBBulkOnlyMassStorageDevice::Read (void *pBuffer, size_t nCount)
 {
-	unsigned nTries = MAX_TRIES;
+	m_RequestQueue.Flush ();
 
-	int nResult;
+	return Transfer (FALSE, pBuffer, nCount, m_ullOffset);
+}
 
-	do
-	{
-		nResult = TryRead (pBuffer, nCount);
+int CUSBBulkOnlyMassStorageDevice::Write (const void *pBuffer, size_t nCount)
+{
+	m_RequestQueue.Flush ();
 
-		if (nResult != (int) nCount)
-		{
-			int nStatus = Reset ();
-			if (nStatus != 0)
-			{
-				return nStatus;
-			}
-		}
+	return Transfer (TRUE, (void *) pBuffer, nCount, m_ullOffset);
+}
+
+u64 CUSBBulkOnlyMassStorageDevice::Seek (u64 ullOffset)
+{
+	m_ullOffset = ullOffset;
+
+	return m_ullOffset;
+}
+
+u64 CUSBBulkOnlyMassStorageDevice::GetSize (void) const
+{
+	assert (m_nBlockCount > 0);
+	assert (m_nBlockCount < (u32) -1);
+
+	return (u64) m_nBlockCount << UMSD_BLOCK_SHIFT;
+}
+
+unsigned CUSBBulkOnlyMassStorageDevice::GetCapacity (void) const
+{
+	return m_nBlockCount;
+}
+
+boolean CUSBBulkOnlyMassStorageDevice::SubmitRequest (CBlockRequest *pRequest)
+{
+	assert (pRequest != 0);
+	u64 ullOffset = pRequest->GetDeviceOffset ();
+	if (   (ullOffset & UMSD_BLOCK_MASK) != 0
+	    || (pRequest->GetCount () & UMSD_BLOCK_MASK) != 0
+	    || ullOffset + pRequest->GetCount () > GetSize ())
+	{
+		return FALSE;
 	}
-	while (   nResult != (int) nCount
-	       && --nTries > 0);
 
-	return nResult;
+	m_RequestQueue.Submit (pRequest);
+
+	return TRUE;
 }
 
-int CUSBBulkOnlyMassStorageDevice::Write (const void *pBuffer, size_t nCount)
+boolean CUSBBulkOnlyMassStorageDevice::FlushRequests (void)
+{
+	return m_RequestQueue.Flush ();
+}
+
+int CUSBBulkOnlyMassStorageDevice::Transfer (boolean bWrite, void *pBuffer, size_t nCount,
+					     u64 ullOffset)
 {
+	// TryRead() and TryWrite() use the current offset
+	u64 ullSavedOffset = m_ullOffset;
+	m_ullOffset = ullOffset;
+
 	unsigned nTries = MAX_TRIES;
 
 	int nResult;
 
 	do
 	{
-		nResult = TryWrite (pBuffer, nCount);
+		nResult = bWrite ? TryWrite (pBuffer, nCount) : TryRead (pBuffer, nCount);
 
 		if (nResult != (int) nCount)
 		{
 			int nStatus = Reset ();
 			if (nStatus != 0)
 			{
-				return nStatus;
+				nResult = nStatus;
+
+				break;
 			}
 		}
 	}
 	while (   nResult != (int) nCount
 	       && --nTries > 0);
 
+	m_ullOffset = ullSavedOffset;
+
 	return nResult;
 }
 
-u64 CUSBBulkOnlyMassStorageDevice::Seek (u64 ullOffset)
+int CUSBBulkOnlyMassStorageDevice::TransferHandler (boolean bWrite, void *pBuffer, size_t nCount,
+						    u64 ullOffset, void *pParam)
 {
-	m_ullOffset = ullOffset;
+	CUSBBulkOnlyMassStorageDevice *pThis = (CUSBBulkOnlyMassStorageDevice *) pParam;
+	assert (pThis != 0);
 
-	return m_ullOffset;
-}
-
-u64 CUSBBulkOnlyMassStorageDevice::GetSize (void) const
-{
-	assert (m_nBlockCount > 0);
-	assert (m_nBlockCount < (u32) -1);
-
-	return (u64) m_nBlockCount << UMSD_BLOCK_SHIFT;
-}
-
-unsigned CUSBBulkOnlyMassStorageDevice::GetCapacity (void) const
-{
-	return m_nBlockCount;
+	return pThis->Transfer (bWrite, pBuffer, nCount, ullOffset);
 }
 
 int CUSBBulkOnlyMassStorageDevice::TryRead (void *pBuffer, size_t nCount)
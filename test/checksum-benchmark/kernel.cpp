@@ -0,0 +1,259 @@
+//
+// kernel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "kernel.h"
+#include <circle/net/checksumcalculator.h>
+#include <circle/machineinfo.h>
+#include <circle/bcmpropertytags.h>
+#include <circle/util.h>
+#include <assert.h>
+
+#define BYTES_PER_RUN	(16 * 1024 * 1024)	// summed up per method and size
+#define MAX_SIZE	65536
+
+static const char FromKernel[] = "kernel";
+
+// typical sizes of TCP/UDP packets and of large (fragmented) UDP datagrams
+static const unsigned s_Size[] = {64, 256, 536, 1460, 8192, MAX_SIZE};
+#define SIZES		(sizeof s_Size / sizeof s_Size[0])
+
+static u8 s_Source[MAX_SIZE + 4] ALIGN (64);
+static u8 s_Dest[MAX_SIZE + 4] ALIGN (64);
+
+static volatile u32 s_nResult;			// keeps the compiler from optimizing away
+
+// independent of the alignment, 16-bit words in memory order, odd last byte is the low byte
+static u16 ReferenceChecksum (const u8 *pBuffer, unsigned nLength)
+{
+	u32 nSum = 0;
+	for (unsigned i = 0; i < nLength; i += 2)
+	{
+		nSum += pBuffer[i];
+		if (i+1 < nLength)
+		{
+			nSum += pBuffer[i+1] << 8;
+		}
+
+		nSum = (nSum & 0xFFFF) + (nSum >> 16);
+	}
+
+	return (u16) nSum;
+}
+
+CKernel::CKernel (void)
+:	m_Screen (m_Options.GetWidth (), m_Options.GetHeight ()),
+	m_Timer (&m_Interrupt),
+	m_Logger (m_Options.GetLogLevel (), &m_Timer),
+	m_nClockRate (0)
+{
+	m_ActLED.Blink (5);	// show we are alive
+}
+
+CKernel::~CKernel (void)
+{
+}
+
+boolean CKernel::Initialize (void)
+{
+	boolean bOK = TRUE;
+
+	if (bOK)
+	{
+		bOK = m_Screen.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Serial.Initialize (115200);
+	}
+
+	if (bOK)
+	{
+		CDevice *pTarget = m_DeviceNameService.GetDevice (m_Options.GetLogDevice (), FALSE);
+		if (pTarget == 0)
+		{
+			pTarget = &m_Screen;
+		}
+
+		bOK = m_Logger.Initialize (pTarget);
+	}
+
+	if (bOK)
+	{
+		bOK = m_Interrupt.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Timer.Initialize ();
+	}
+
+	return bOK;
+}
+
+TShutdownMode CKernel::Run (void)
+{
+	m_Logger.Write (FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
+
+	m_nClockRate = CMachineInfo::Get ()->GetClockRate (CLOCK_ID_ARM);
+
+	m_Logger.Write (FromKernel, LogNotice, "ARM clock %u MHz, NEON checksum %ssupported",
+			m_nClockRate / 1000000,
+			CChecksumCalculator::IsNEONSupported () ? "" : "not ");
+
+	u32 nRandom = 0x12345678;
+	for (unsigned i = 0; i < sizeof s_Source; i++)
+	{
+		nRandom = nRandom * 1103515245 + 12345;		// linear congruential generator
+
+		s_Source[i] = (u8) (nRandom >> 16);
+	}
+
+	boolean bOK = TRUE;
+	for (unsigned i = 0; i < SIZES && bOK; i++)
+	{
+		bOK = Measure (s_Size[i], 0);
+	}
+
+	// packet payloads often start at a 16-bit boundary only
+	if (bOK)
+	{
+		bOK = Measure (1460, 2);
+	}
+
+	// odd addresses and lengths use separate code paths
+	if (bOK)
+	{
+		bOK = Measure (1461, 1);
+	}
+
+	if (bOK)
+	{
+		bOK = Measure (129, 3);
+	}
+
+	m_Logger.Write (FromKernel, bOK ? LogNotice : LogError,
+			bOK ? "Benchmark finished" : "Benchmark failed");
+
+	return ShutdownHalt;
+}
+
+boolean CKernel::Measure (unsigned nSize, unsigned nOffset)
+{
+	assert (nSize <= MAX_SIZE);
+	assert (nOffset <= 4);
+	const u8 *pSource = s_Source + nOffset;
+	u8 *pDest = s_Dest + nOffset;
+
+	unsigned nIterations = BYTES_PER_RUN / nSize;
+
+	m_Logger.Write (FromKernel, LogNotice, "%u bytes at offset %u:", nSize, nOffset);
+
+	// the scalar code is the reference
+	u32 nSum = 0;
+	u64 nStartTicks = CTimer::GetClockTicks64 ();
+	for (unsigned i = 0; i < nIterations; i++)
+	{
+		nSum = CChecksumCalculator::CalculateChunkScalar (pSource, nSize, 0);
+	}
+	Report ("Scalar", nSize, nIterations, CTimer::GetClockTicks64 () - nStartTicks);
+
+	u16 nExpected = CChecksumCalculator::FoldResult (nSum);
+	s_nResult = nSum;
+
+	if (nExpected != ReferenceChecksum (pSource, nSize))
+	{
+		m_Logger.Write (FromKernel, LogError, "Scalar checksum differs (%04X, %04X)",
+				(unsigned) nExpected,
+				(unsigned) ReferenceChecksum (pSource, nSize));
+
+		return FALSE;
+	}
+
+	nStartTicks = CTimer::GetClockTicks64 ();
+	for (unsigned i = 0; i < nIterations; i++)
+	{
+		nSum = CChecksumCalculator::CalculateChunk (pSource, nSize, 0);
+	}
+	Report ("NEON", nSize, nIterations, CTimer::GetClockTicks64 () - nStartTicks);
+
+	if (CChecksumCalculator::FoldResult (nSum) != nExpected)
+	{
+		m_Logger.Write (FromKernel, LogError, "NEON checksum differs (%04X, %04X)",
+				(unsigned) CChecksumCalculator::FoldResult (nSum),
+				(unsigned) nExpected);
+
+		return FALSE;
+	}
+
+	// copy, as it was done before the data was summed up
+	nStartTicks = CTimer::GetClockTicks64 ();
+	for (unsigned i = 0; i < nIterations; i++)
+	{
+		memcpy (pDest, pSource, nSize);
+		nSum = CChecksumCalculator::CalculateChunkScalar (pDest, nSize, 0);
+	}
+	Report ("memcpy+scalar", nSize, nIterations, CTimer::GetClockTicks64 () - nStartTicks);
+
+	s_nResult = nSum;
+
+	memset (s_Dest, 0, sizeof s_Dest);
+
+	nStartTicks = CTimer::GetClockTicks64 ();
+	for (unsigned i = 0; i < nIterations; i++)
+	{
+		nSum = CChecksumCalculator::CopyAndCalculateChunk (pDest, pSource, nSize, 0);
+	}
+	Report ("Copy+sum", nSize, nIterations, CTimer::GetClockTicks64 () - nStartTicks);
+
+	if (   CChecksumCalculator::FoldResult (nSum) != nExpected
+	    || memcmp (pDest, pSource, nSize) != 0)
+	{
+		m_Logger.Write (FromKernel, LogError, "Copy+sum result differs");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void CKernel::Report (const char *pMethod, unsigned nSize, unsigned nIterations, u64 nTicks)
+{
+	if (nTicks == 0)
+	{
+		nTicks = 1;
+	}
+
+	u64 nBytes = (u64) nSize * nIterations;
+
+	// CLOCKHZ is 1 MHz, so that bytes per tick are MB/s
+	unsigned nMBytesPerSecond = (unsigned) (nBytes / nTicks);
+
+	if (m_nClockRate == 0)
+	{
+		m_Logger.Write (FromKernel, LogNotice, "%-14s %5u MB/s", pMethod, nMBytesPerSecond);
+
+		return;
+	}
+
+	double fBytesPerCycle = (double) nBytes / ((double) nTicks * m_nClockRate / CLOCKHZ);
+
+	m_Logger.Write (FromKernel, LogNotice, "%-14s %5u MB/s, %.2f bytes/cycle",
+			pMethod, nMBytesPerSecond, fBytesPerCycle);
+}
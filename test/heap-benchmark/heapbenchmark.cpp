@@ -0,0 +1,154 @@
+//
+// heapbenchmark.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "heapbenchmark.h"
+#include <circle/atomic.h>
+#include <circle/timer.h>
+#include <circle/logger.h>
+#include <assert.h>
+
+#define ITERATIONS	1000000
+#define SLOTS		64		// number of blocks, which are hold at once
+
+static const char FromBenchmark[] = "heapbench";
+
+// typical sizes of small objects (network, sound and USB buffers, strings)
+static const unsigned s_BlockSize[] = {16, 24, 40, 64, 100, 180, 256, 500, 1000, 1600, 2048, 4000};
+#define BLOCK_SIZES	(sizeof s_BlockSize / sizeof s_BlockSize[0])
+
+CHeapBenchmark::CHeapBenchmark (CMemorySystem *pMemorySystem)
+:
+#ifdef ARM_ALLOW_MULTI_CORE
+	CMultiCoreSupport (pMemorySystem),
+#endif
+	m_nStart (0),
+	m_nCoresDone (0)
+{
+}
+
+CHeapBenchmark::~CHeapBenchmark (void)
+{
+}
+
+void CHeapBenchmark::Run (unsigned nCore)
+{
+	if (nCore != 0)
+	{
+		// secondary cores take part in the second pass only
+		while (AtomicGet (&m_nStart) != 2)
+		{
+			// just wait
+		}
+
+		Hammer (nCore);
+
+		AtomicIncrement (&m_nCoresDone);
+
+		return;
+	}
+
+	CLogger::Get ()->Write (FromBenchmark, LogNotice,
+				"Running %u new/delete pairs per core", ITERATIONS);
+
+	// pass 1: core 0 only
+	AtomicSet (&m_nStart, 1);
+	u64 nOperations = Hammer (0);
+	Report ("Single core", 1, nOperations, m_nTicks[0]);
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	// pass 2: all cores concurrently
+	AtomicSet (&m_nStart, 2);
+	nOperations = Hammer (0);
+
+	while (AtomicGet (&m_nCoresDone) != BENCHMARK_CORES-1)
+	{
+		// just wait
+	}
+
+	u64 nMaxTicks = 0;
+	for (unsigned i = 0; i < BENCHMARK_CORES; i++)
+	{
+		if (i > 0)
+		{
+			nOperations += m_nOperations[i];
+		}
+
+		if (m_nTicks[i] > nMaxTicks)
+		{
+			nMaxTicks = m_nTicks[i];
+		}
+	}
+
+	Report ("All cores", BENCHMARK_CORES, nOperations, nMaxTicks);
+#endif
+
+	CLogger::Get ()->Write (FromBenchmark, LogNotice, "Benchmark finished");
+}
+
+u64 CHeapBenchmark::Hammer (unsigned nCore)
+{
+	assert (nCore < BENCHMARK_CORES);
+
+	u8 *pBlock[SLOTS];
+	for (unsigned i = 0; i < SLOTS; i++)
+	{
+		pBlock[i] = 0;
+	}
+
+	u32 nRandom = 0x12345678 + nCore;		// different sequence per core
+
+	u64 nStartTicks = CTimer::GetClockTicks64 ();
+
+	for (unsigned i = 0; i < ITERATIONS; i++)
+	{
+		nRandom = nRandom * 1103515245 + 12345;		// linear congruential generator
+
+		unsigned nSlot = (nRandom >> 8) % SLOTS;
+		unsigned nSize = s_BlockSize[(nRandom >> 16) % BLOCK_SIZES];
+
+		delete [] pBlock[nSlot];
+
+		pBlock[nSlot] = new u8[nSize];
+		assert (pBlock[nSlot] != 0);
+		pBlock[nSlot][0] = (u8) i;		// touch the block
+	}
+
+	for (unsigned i = 0; i < SLOTS; i++)
+	{
+		delete [] pBlock[i];
+	}
+
+	m_nTicks[nCore] = CTimer::GetClockTicks64 () - nStartTicks;
+	m_nOperations[nCore] = 2ULL * ITERATIONS;
+
+	return m_nOperations[nCore];
+}
+
+void CHeapBenchmark::Report (const char *pTitle, unsigned nCores, u64 nOperations, u64 nTicks)
+{
+	if (nTicks == 0)
+	{
+		nTicks = 1;
+	}
+
+	CLogger::Get ()->Write (FromBenchmark, LogNotice,
+				"%s (%u): %llu operations in %llu us, %llu ops/s",
+				pTitle, nCores, nOperations, nTicks * 1000000 / CLOCKHZ,
+				nOperations * CLOCKHZ / nTicks);
+}
@@ -0,0 +1,61 @@
+//
+// heapbenchmark.h
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _heapbenchmark_h
+#define _heapbenchmark_h
+
+#include <circle/multicore.h>
+#include <circle/memory.h>
+#include <circle/types.h>
+
+#ifdef ARM_ALLOW_MULTI_CORE
+	#define BENCHMARK_CORES		CORES
+#else
+	#define BENCHMARK_CORES		1
+#endif
+
+class CHeapBenchmark
+#ifdef ARM_ALLOW_MULTI_CORE
+	: public CMultiCoreSupport
+#endif
+{
+public:
+	CHeapBenchmark (CMemorySystem *pMemorySystem);
+	~CHeapBenchmark (void);
+
+#ifndef ARM_ALLOW_MULTI_CORE
+	boolean Initialize (void)	{ return TRUE; }
+#endif
+
+	void Run (unsigned nCore);
+
+private:
+	u64 Hammer (unsigned nCore);		// returns number of operations
+
+	void Report (const char *pTitle, unsigned nCores, u64 nOperations, u64 nTicks);
+
+private:
+	volatile int m_nStart;			// pass number, which is allowed to start
+	volatile int m_nCoresDone;
+
+	u64 m_nOperations[BENCHMARK_CORES];
+	u64 m_nTicks[BENCHMARK_CORES];
+};
+
+#endif
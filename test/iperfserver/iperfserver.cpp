@@ -2,7 +2,7 @@
 // iperfserver.cpp
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -89,6 +89,11 @@ void CIPerfServer::Listener (void)
 		return;
 	}
 
+	if (m_pSocket->SetOptionBufferSizes (RX_BUFFER_SIZE, 0) < 0)
+	{
+		CLogger::Get ()->Write (FromIPerf, LogWarning, "Cannot set receive buffer size");
+	}
+
 	while (1)
 	{
 		CIPAddress ForeignIP;
@@ -127,50 +132,79 @@ void CIPerfServer::Worker (void)
 	boolean bStarted = FALSE;
 	unsigned nStartTicks = 0;
 
-	u8 Buffer[FRAME_BUFFER_SIZE];
+	u64 ullIntervalBytes = 0;
+	unsigned nIntervalTicks = 0;
+
+	// receive all queued segments at once
+	u8 *pBuffer = new u8[READ_SIZE];
+	assert (pBuffer != 0);
+	TSocketIOVec IOVec = {pBuffer, READ_SIZE};
 	int nBytesReceived;
 
 	do
 	{
-		nBytesReceived = m_pSocket->Receive (Buffer, sizeof Buffer, 0);
+		nBytesReceived = m_pSocket->ReceiveMsg (&IOVec, 1, 0);
 		if (nBytesReceived > 0)
 		{
+			unsigned nTicks = CTimer::Get ()->GetClockTicks ();
+
 			if (!bStarted)
 			{
-				nStartTicks = CTimer::Get ()->GetClockTicks ();
+				nStartTicks = nTicks;
+				nIntervalTicks = nTicks;
 
 				bStarted = TRUE;
 			}
 
 			ullTotalBytesReceived += nBytesReceived;
+			ullIntervalBytes += nBytesReceived;
+
+			if (   REPORT_INTERVAL > 0
+			    && nTicks - nIntervalTicks >= REPORT_INTERVAL * CLOCKHZ)
+			{
+				Report ("Interval", ullIntervalBytes, nTicks - nIntervalTicks);
+
+				ullIntervalBytes = 0;
+				nIntervalTicks = nTicks;
+			}
 		}
 	}
 	while (nBytesReceived > 0);
 
+	delete [] pBuffer;
+
 	unsigned nEndTicks = CTimer::Get ()->GetClockTicks ();
 
 	delete m_pSocket;		// closes connection
 	m_pSocket = 0;
 
-	CString IPString;
-	m_ClientIP.Format (&IPString);
-
 	if (!bStarted)
 	{
+		CString IPString;
+		m_ClientIP.Format (&IPString);
+
 		CLogger::Get ()->Write (FromIPerf, LogNotice, "%s:%u: No data received",
 					(const char *) IPString, (unsigned) m_usClientPort);
 
 		return;
 	}
 
-	float fSeconds = (float) (nEndTicks - nStartTicks) / CLOCKHZ;
-	float fMBytes = (float) ullTotalBytesReceived / 1048576.0;
-	float fMBitsPerSec = fMBytes*8.0 / fSeconds;
+	Report ("Received", ullTotalBytesReceived, nEndTicks - nStartTicks);
+}
+
+void CIPerfServer::Report (const char *pWhat, u64 ullBytes, unsigned nTicks)
+{
+	CString IPString;
+	m_ClientIP.Format (&IPString);
+
+	float fSeconds = (float) nTicks / CLOCKHZ;
+	float fMBytes = (float) ullBytes / 1048576.0;
+	float fMBitsPerSec = fSeconds > 0.0 ? fMBytes*8.0 / fSeconds : 0.0;
 
 	fMBitsPerSec *= (1516.0 + 36.0) / 1480.0;	// consider protocol overhead
 
 	CLogger::Get ()->Write (FromIPerf, LogNotice,
-				"%s:%u: Received %.1f MBytes in %.1f sec (bandwidth %.1f MBits/sec)",
-				(const char *) IPString, (unsigned) m_usClientPort,
+				"%s:%u: %s %.1f MBytes in %.1f sec (bandwidth %.1f MBits/sec)",
+				(const char *) IPString, (unsigned) m_usClientPort, pWhat,
 				fMBytes+0.05, fSeconds+0.05, fMBitsPerSec+0.05);
 }
@@ -2,7 +2,7 @@
 // iperfserver.h
 //
 // Circle - A C++ bare metal environment for Raspberry Pi
-// Copyright (C) 2015-2018  R. Stange <rsta2@o2online.de>
+// Copyright (C) 2015-2025  R. Stange <rsta2@o2online.de>
 // 
 // This program is free software: you can redistribute it and/or modify
 // it under the terms of the GNU General Public License as published by
@@ -29,6 +29,12 @@
 
 #define MAX_CLIENTS	5
 
+#define RX_BUFFER_SIZE	0x40000		// determines the TCP receive window
+
+#define READ_SIZE	0x4000		// max. bytes returned per receive call
+
+#define REPORT_INTERVAL	1		// seconds, 0 to report the total rate only
+
 class CIPerfServer : public CTask		// for iperf2
 {
 public:
@@ -44,6 +50,8 @@ private:
 	void Listener (void);		// accepts incoming connections and creates worker task
 	void Worker (void);		// processes a connection
 
+	void Report (const char *pWhat, u64 ullBytes, unsigned nTicks);
+
 private:
 	CNetSubSystem *m_pNetSubSystem;
 	CSocket	      *m_pSocket;
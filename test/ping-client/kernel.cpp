@@ -26,6 +26,8 @@ static const u8 PingServer[]     = {192, 168, 0, 1};
 
 #define USE_DHCP
 
+#define STATISTICS_INTERVAL	10	// display RTT statistics after this number of replies
+
 #ifndef USE_DHCP
 static const u8 IPAddress[]      = {192, 168, 0, 250};
 static const u8 NetMask[]        = {255, 255, 255, 0};
@@ -108,6 +110,9 @@ TShutdownMode CKernel::Run (void)
 	unsigned nLastSend = 0;
 	unsigned nLastSendTicks = 0;
 	unsigned nSequenceNumber = 1;
+	unsigned nReplies = 0;
+	unsigned nMinRTT = (unsigned) -1, nMaxRTT = 0;
+	u64 nSumRTT = 0;
 	for (unsigned nCount = 0; 1; nCount++)
 	{
 		const u16 Identifier = 1;
@@ -133,6 +138,8 @@ TShutdownMode CKernel::Run (void)
 			if (   SenderIP == PingServer
 			    && usIdentifier == Identifier)
 			{
+				unsigned nRTT = CTimer::GetClockTicks () - nLastSendTicks;
+
 				CString Sender;
 				SenderIP.Format (&Sender);
 
@@ -140,7 +147,20 @@ TShutdownMode CKernel::Run (void)
 					 ulLength,
 					 (const char *) Sender,
 					 (unsigned) usSequenceNumber,
-					 (CTimer::GetClockTicks () - nLastSendTicks) * 1000.0 / CLOCKHZ);
+					 nRTT * 1000.0 / CLOCKHZ);
+
+				nMinRTT = nRTT < nMinRTT ? nRTT : nMinRTT;
+				nMaxRTT = nRTT > nMaxRTT ? nRTT : nMaxRTT;
+				nSumRTT += nRTT;
+
+				if (++nReplies % STATISTICS_INTERVAL == 0)
+				{
+					LOGNOTE ("%u replies, rtt min/avg/max = %.3f/%.3f/%.3f ms",
+						 nReplies,
+						 nMinRTT * 1000.0 / CLOCKHZ,
+						 nSumRTT * 1000.0 / nReplies / CLOCKHZ,
+						 nMaxRTT * 1000.0 / CLOCKHZ);
+				}
 			}
 		}
 
@@ -9,6 +9,9 @@
 
 //#define PLUG_AND_PLAY
 
+// use CFATFileSystem instead of the FatFs addon and show the buffer cache statistics
+//#define NATIVE_FAT
+
 #define LONESHA256_STATIC
 #include "lonesha256.h"
 
@@ -17,6 +20,16 @@
 #define FILENAME_READ	"/testfile.bin"
 #define FILENAME_WRITE	"/testfile2.bin"
 
+#ifdef NATIVE_FAT
+	#ifdef PLUG_AND_PLAY
+		#error NATIVE_FAT does not support PLUG_AND_PLAY
+	#endif
+
+	#define PARTITION	"emmc1-1"	// "umsd1-1"
+	#define TITLE_READ	"testfile.bin"
+	#define TITLE_WRITE	"test2.bin"	// must be a 8.3 name
+#endif
+
 static const char FromKernel[] = "kernel";
 
 CKernel::CKernel (void)
@@ -93,6 +106,33 @@ boolean CKernel::Initialize (void)
 
 bool CKernel::ReadTest()
 {
+#ifdef NATIVE_FAT
+	unsigned hFile = m_FATFileSystem.FileOpen (TITLE_READ);
+	if (hFile == 0)
+	{
+		m_Logger.Write (FromKernel, LogPanic, "Cannot open %s for reading", TITLE_READ);
+		return false;
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "Reading %s from " PARTITION "...", TITLE_READ);
+	unsigned int nStartTicks = CTimer::Get()->GetClockTicks();
+
+	unsigned nBytesRead = m_FATFileSystem.FileRead (hFile, m_pBuffer, 400 * MEGABYTE);
+	m_FATFileSystem.FileClose (hFile);
+	if (nBytesRead == FS_ERROR)
+	{
+		m_Logger.Write (FromKernel, LogPanic, "Failed to read %s into memory", TITLE_READ);
+		return false;
+	}
+
+	float nSeconds = (CTimer::Get()->GetClockTicks() - nStartTicks) / 1000000.0f;
+	m_Logger.Write (FromKernel, LogNotice, "%dMB read in %0.2f seconds", nBytesRead / 1024 / 1024, nSeconds);
+	ShowCacheStatistics();
+
+	m_nFileSize = nBytesRead;
+
+	return nBytesRead > 0;
+#else
 	FIL File;
 	FRESULT Result = f_open (&File, DRIVE FILENAME_READ, FA_READ);
 	if (Result != FR_OK)
@@ -119,6 +159,7 @@ bool CKernel::ReadTest()
 	m_Logger.Write (FromKernel, LogNotice, "File read in %0.2f seconds", nSeconds);
 
 	return m_nFileSize == nBytesRead;
+#endif
 }
 
 bool CKernel::HashTest()
@@ -148,6 +189,34 @@ bool CKernel::HashTest()
 
 bool CKernel::WriteTest()
 {
+#ifdef NATIVE_FAT
+	unsigned hFile = m_FATFileSystem.FileCreate (TITLE_WRITE);
+	if (hFile == 0)
+	{
+		m_Logger.Write (FromKernel, LogPanic, "Cannot open %s for writing", TITLE_WRITE);
+		return false;
+	}
+
+	m_Logger.Write (FromKernel, LogNotice, "Writing %dMB to " PARTITION "...", m_nFileSize / 1024 / 1024);
+
+	unsigned int nStartTicks = CTimer::Get()->GetClockTicks();
+
+	unsigned nBytesWritten = m_FATFileSystem.FileWrite (hFile, m_pBuffer, m_nFileSize);
+	if (   !m_FATFileSystem.FileClose (hFile)
+	    || nBytesWritten == FS_ERROR)
+	{
+		m_Logger.Write (FromKernel, LogPanic, "Failed to write %s", TITLE_WRITE);
+		return false;
+	}
+
+	m_FATFileSystem.Synchronize ();
+
+	float nSeconds = (CTimer::Get()->GetClockTicks() - nStartTicks) / 1000000.0f;
+	m_Logger.Write (FromKernel, LogNotice, "File written in %0.2f seconds", nSeconds);
+	ShowCacheStatistics();
+
+	return m_nFileSize == nBytesWritten;
+#else
 	FIL File;
 	FRESULT Result = f_open (&File, DRIVE FILENAME_WRITE, FA_WRITE | FA_CREATE_ALWAYS);
 	if (Result != FR_OK)
@@ -174,6 +243,26 @@ bool CKernel::WriteTest()
 	m_Logger.Write (FromKernel, LogNotice, "File written in %0.2f seconds", nSeconds);
 
 	return m_nFileSize == nBytesWritten;
+#endif
+}
+
+void CKernel::ShowCacheStatistics()
+{
+#ifdef NATIVE_FAT
+	TFATCacheStatistics Stats;
+	m_FATFileSystem.GetCacheStatistics (&Stats);
+
+	unsigned nRequests = Stats.nHits + Stats.nMisses;
+	m_Logger.Write (FromKernel, LogNotice, "Cache: %u hits, %u misses (%u%% hit ratio)",
+			Stats.nHits, Stats.nMisses, nRequests ? (unsigned) (Stats.nHits * 100ULL / nRequests) : 100);
+	m_Logger.Write (FromKernel, LogNotice, "Read-ahead: %u extents, %u used",
+			Stats.nReadAheadExtents, Stats.nReadAheadHits);
+	m_Logger.Write (FromKernel, LogNotice, "Disk: %u reads (%u sectors), %u writes (%u sectors)",
+			Stats.nReadRequests, Stats.nSectorsRead,
+			Stats.nWriteRequests, Stats.nSectorsWritten);
+	m_Logger.Write (FromKernel, LogNotice, "Direct: %u transfers (%u sectors)",
+			Stats.nDirectRequests, Stats.nDirectSectors);
+#endif
 }
 
 TShutdownMode CKernel::Run (void)
@@ -183,7 +272,15 @@ TShutdownMode CKernel::Run (void)
 	unsigned int nTestRuns = 0;
 	unsigned int nSuccessfulTestRuns = 0;
 
-#ifndef PLUG_AND_PLAY
+#if defined (NATIVE_FAT)
+	CDevice *pPartition = m_DeviceNameService.GetDevice (PARTITION, TRUE);
+	if (   pPartition == 0
+	    || !m_FATFileSystem.Mount (pPartition))
+	{
+		m_Logger.Write (FromKernel, LogError, "Cannot mount partition: %s", PARTITION);
+		return ShutdownHalt;
+	}
+#elif !defined (PLUG_AND_PLAY)
 	// Try to mount file system
 	FRESULT Result = f_mount (&m_FileSystem, DRIVE, 1);
 	if (Result != FR_OK)
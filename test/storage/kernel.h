@@ -15,6 +15,7 @@
 #include <circle/logger.h>
 #include <circle/types.h>
 #include <circle/usb/usbhcidevice.h>
+#include <circle/fs/fat/fatfs.h>
 #include <SDCard/emmc.h>
 #include <fatfs/ff.h>
 
@@ -41,6 +42,7 @@ private:
 	boolean ReadTest();
 	boolean HashTest();
 	boolean WriteTest();
+	void ShowCacheStatistics();
 
 	// do not change this order
 	CActLED			m_ActLED;
@@ -56,6 +58,7 @@ private:
 	CEMMCDevice 	m_EMMC;
 	CUSBHCIDevice		m_USBHCI;
 	FATFS 			m_FileSystem;
+	CFATFileSystem		m_FATFileSystem;	// used with NATIVE_FAT only
 
 	u8* m_pBuffer;
 	size_t m_nFileSize;
@@ -0,0 +1,260 @@
+//
+// kernel.cpp
+//
+// Circle - A C++ bare metal environment for Raspberry Pi
+// Copyright (C) 2025  R. Stange <rsta2@o2online.de>
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "kernel.h"
+#include <circle/sched/task.h>
+#include <assert.h>
+
+#define YIELD_ITERATIONS	100000
+#define WAKE_ITERATIONS		1000
+#define BACKGROUND_TASKS	8
+#define BACKGROUND_WORK_US	5	// busy time between two Yield() calls
+
+static const char FromKernel[] = "kernel";
+
+static volatile boolean s_bStop;
+
+CKernel::CKernel (void)
+:	m_Screen (m_Options.GetWidth (), m_Options.GetHeight ()),
+	m_Timer (&m_Interrupt),
+	m_Logger (m_Options.GetLogLevel (), &m_Timer)
+{
+	m_ActLED.Blink (5);	// show we are alive
+}
+
+CKernel::~CKernel (void)
+{
+}
+
+boolean CKernel::Initialize (void)
+{
+	boolean bOK = TRUE;
+
+	if (bOK)
+	{
+		bOK = m_Screen.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Serial.Initialize (115200);
+	}
+
+	if (bOK)
+	{
+		CDevice *pTarget = m_DeviceNameService.GetDevice (m_Options.GetLogDevice (), FALSE);
+		if (pTarget == 0)
+		{
+			pTarget = &m_Screen;
+		}
+
+		bOK = m_Logger.Initialize (pTarget);
+	}
+
+	if (bOK)
+	{
+		bOK = m_Interrupt.Initialize ();
+	}
+
+	if (bOK)
+	{
+		bOK = m_Timer.Initialize ();
+	}
+
+	return bOK;
+}
+
+// Calls Yield() in a loop, until s_bStop is set
+class CYieldTask : public CTask
+{
+public:
+	CYieldTask (unsigned nWorkMicros = 0)
+	:	m_nWorkMicros (nWorkMicros)
+	{
+	}
+
+	void Run (void)
+	{
+		while (!s_bStop)
+		{
+			if (m_nWorkMicros > 0)
+			{
+				CTimer::SimpleusDelay (m_nWorkMicros);
+			}
+
+			CScheduler::Get ()->Yield ();
+		}
+	}
+
+private:
+	unsigned m_nWorkMicros;
+};
+
+// Results are kept by the caller, because the task object is deleted on termination
+struct TLatencyResult
+{
+	unsigned nCount;
+	u64 nSumTicks;
+	unsigned nMaxTicks;
+};
+
+// Measures the time from setting the event until this task runs
+class CLatencyTask : public CTask
+{
+public:
+	CLatencyTask (CSynchronizationEvent *pEvent, volatile unsigned *pSetTicks,
+		      TLatencyResult *pResult)
+	:	m_pEvent (pEvent),
+		m_pSetTicks (pSetTicks),
+		m_pResult (pResult),
+		m_bDone (FALSE)
+	{
+		m_pResult->nCount = 0;
+		m_pResult->nSumTicks = 0;
+		m_pResult->nMaxTicks = 0;
+	}
+
+	void Run (void)
+	{
+		while (!s_bStop)
+		{
+			m_pEvent->Wait ();
+
+			unsigned nTicks = CTimer::GetClockTicks () - *m_pSetTicks;
+
+			m_pEvent->Clear ();
+
+			if (s_bStop)
+			{
+				break;
+			}
+
+			m_pResult->nCount++;
+			m_pResult->nSumTicks += nTicks;
+			if (nTicks > m_pResult->nMaxTicks)
+			{
+				m_pResult->nMaxTicks = nTicks;
+			}
+
+			m_bDone = TRUE;
+		}
+	}
+
+	boolean IsDone (void)
+	{
+		boolean bResult = m_bDone;
+		m_bDone = FALSE;
+
+		return bResult;
+	}
+
+private:
+	CSynchronizationEvent *m_pEvent;
+	volatile unsigned *m_pSetTicks;
+	TLatencyResult *m_pResult;
+
+	volatile boolean m_bDone;
+};
+
+TShutdownMode CKernel::Run (void)
+{
+	m_Logger.Write (FromKernel, LogNotice, "Compile time: " __DATE__ " " __TIME__);
+
+	MeasureYield ();
+
+	MeasureWakeLatency (TASK_PRIORITY_DEFAULT);
+	MeasureWakeLatency (TASK_PRIORITY_HIGHEST);
+
+	m_Logger.Write (FromKernel, LogNotice, "Finished!");
+
+	return ShutdownHalt;
+}
+
+void CKernel::MeasureYield (void)
+{
+	s_bStop = FALSE;
+	CTask *pTask = new CYieldTask;
+	assert (pTask != 0);
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	for (unsigned i = 0; i < YIELD_ITERATIONS; i++)
+	{
+		m_Scheduler.Yield ();
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks () - nStartTicks;
+
+	s_bStop = TRUE;
+	pTask->WaitForTermination ();
+
+	// each iteration switches to the other task and back
+	m_Logger.Write (FromKernel, LogNotice, "Yield: %u task switches in %u us, %u ns per switch",
+			2 * YIELD_ITERATIONS, nTicks,
+			(unsigned) ((u64) nTicks * 1000 / (2 * YIELD_ITERATIONS)));
+}
+
+void CKernel::MeasureWakeLatency (unsigned nPriority)
+{
+	s_bStop = FALSE;
+
+	CTask *pBackground[BACKGROUND_TASKS];
+	for (unsigned i = 0; i < BACKGROUND_TASKS; i++)
+	{
+		pBackground[i] = new CYieldTask (BACKGROUND_WORK_US);
+		assert (pBackground[i] != 0);
+	}
+
+	volatile unsigned nSetTicks = 0;
+	TLatencyResult Result;
+	CLatencyTask *pLatencyTask = new CLatencyTask (&m_Event, &nSetTicks, &Result);
+	assert (pLatencyTask != 0);
+	pLatencyTask->SetPriority (nPriority);
+
+	m_Scheduler.MsSleep (100);		// let the latency task block on the event
+
+	for (unsigned i = 0; i < WAKE_ITERATIONS; i++)
+	{
+		nSetTicks = CTimer::GetClockTicks ();
+		m_Event.Set ();
+
+		while (!pLatencyTask->IsDone ())
+		{
+			m_Scheduler.Yield ();
+		}
+	}
+
+	s_bStop = TRUE;
+	m_Event.Set ();
+
+	pLatencyTask->WaitForTermination ();
+	for (unsigned i = 0; i < BACKGROUND_TASKS; i++)
+	{
+		pBackground[i]->WaitForTermination ();
+	}
+
+	// pLatencyTask is not valid any more here
+	unsigned nCount = Result.nCount;
+	assert (nCount > 0);
+
+	m_Logger.Write (FromKernel, LogNotice,
+			"Wake latency (priority %u, %u busy tasks): avg %u us, max %u us",
+			nPriority, BACKGROUND_TASKS,
+			(unsigned) (Result.nSumTicks / nCount), Result.nMaxTicks);
+}